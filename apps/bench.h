@@ -0,0 +1,34 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * bench.h - Helpers shared by the *-bench apps
+ *
+ * Wall-clock timing in microseconds and the process' VmSize, read
+ * back from /proc/self/status.
+ */
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+static inline unsigned long now_us(void) {
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	return (unsigned long)t.tv_sec * 1000000 + t.tv_usec;
+}
+
+/* VmSize from /proc/self/status, in kB */
+static inline int vm_size(void) {
+	char buf[1024];
+	FILE * f = fopen("/proc/self/status", "r");
+	if (!f) return -1;
+	size_t r = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[r] = '\0';
+	char * line = strstr(buf, "VmSize:");
+	return line ? atoi(line + 7) : -1;
+}
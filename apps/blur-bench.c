@@ -0,0 +1,91 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * blur-bench - Box and Gaussian blur
+ *
+ * Blurs a screen-sized sprite of noise with blur_context_box() and
+ * blur_context_gaussian() at radii from 2 to 32 and reports the time
+ * per blur and the rate in megapixels per second.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <toaru/graphics.h>
+
+#include "bench.h"
+
+static void report(const char * what, int radius, unsigned long elapsed, int loops, int pixels) {
+	if (!elapsed) elapsed = 1;
+	printf("%-8s radius %2d: %8luus per blur, %7.2f Mpx/s\n", what, radius, elapsed / loops,
+		(double)pixels * loops / (double)elapsed);
+}
+
+static void noise(sprite_t * sprite) {
+	for (int i = 0; i < sprite->width * sprite->height; ++i) {
+		sprite->bitmap[i] = premultiply(rgba(rand() % 256, rand() % 256, rand() % 256, rand() % 256));
+	}
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-w width] [-h height] [-n loops]\n"
+			"\n"
+			" -w  sprite width (default 1920)\n"
+			" -h  sprite height (default 1080)\n"
+			" -n  blurs per radius (default 5)\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	int width = 1920;
+	int height = 1080;
+	int loops = 5;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "w:h:n:")) != -1) {
+		switch (opt) {
+			case 'w':
+				width = atoi(optarg);
+				break;
+			case 'h':
+				height = atoi(optarg);
+				break;
+			case 'n':
+				loops = atoi(optarg);
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (width < 1 || height < 1 || loops < 1) return usage(argv);
+
+	sprite_t * sprite = create_sprite(width, height, ALPHA_EMBEDDED);
+	gfx_context_t * ctx = init_graphics_sprite(sprite);
+
+	printf("%dx%d\n", width, height);
+
+	for (int radius = 2; radius <= 32; radius *= 2) {
+		noise(sprite);
+		unsigned long start = now_us();
+		for (int i = 0; i < loops; ++i) {
+			blur_context_box(ctx, radius);
+		}
+		report("box", radius, now_us() - start, loops, width * height);
+
+		noise(sprite);
+		start = now_us();
+		for (int i = 0; i < loops; ++i) {
+			blur_context_gaussian(ctx, radius / 2.0);
+		}
+		report("gaussian", radius, now_us() - start, loops, width * height);
+	}
+
+	free(ctx);
+	sprite_free(sprite);
+	return 0;
+}
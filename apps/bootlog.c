@@ -0,0 +1,160 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * bootlog - Show how long startup took and what it waited on
+ *
+ * Reads the log init writes as it runs /etc/startup.d and prints
+ * each script's start and end times, then walks back from the
+ * script that starts the desktop through whatever each one was
+ * waiting on, which is the critical path to the first frame.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#define BOOTLOG_PATH "/var/log/boot.log"
+#define MAX_UNITS 64
+
+struct unit {
+	char name[256];
+	char blocked_by[256];
+	int start;
+	int end;     /* -1 if it never exited */
+	int status;
+};
+
+static struct unit units[MAX_UNITS];
+static int unit_count = 0;
+static int frame = -1;
+
+static struct unit * find_unit(char * name) {
+	for (int i = 0; i < unit_count; ++i) {
+		if (!strcmp(units[i].name, name)) return &units[i];
+	}
+	return NULL;
+}
+
+static int read_log(char * path) {
+	FILE * f = fopen(path, "r");
+	if (!f) return 1;
+
+	char line[1024];
+	while (fgets(line, sizeof(line), f)) {
+		char * save;
+		char * fields[4] = {NULL};
+		int n = 0;
+		for (char * t = strtok_r(line, " \n", &save); t && n < 4; t = strtok_r(NULL, " \n", &save)) {
+			fields[n++] = t;
+		}
+		if (n < 3) continue;
+
+		if (!strcmp(fields[0], "start") && n == 4 && unit_count < MAX_UNITS &&
+				strlen(fields[2]) < 256 && strlen(fields[3]) < 256) {
+			struct unit * u = &units[unit_count++];
+			strcpy(u->name, fields[2]);
+			strcpy(u->blocked_by, fields[3]);
+			u->start = atoi(fields[1]);
+			u->end = -1;
+		} else if (!strcmp(fields[0], "exit") && n == 4) {
+			struct unit * u = find_unit(fields[2]);
+			if (u) {
+				u->end = atoi(fields[1]);
+				u->status = atoi(fields[3]);
+			}
+		} else if (!strcmp(fields[0], "frame")) {
+			if (frame < 0) frame = atoi(fields[1]);
+		}
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static void print_units(void) {
+	printf("%-24s %8s %8s %8s  %s\n", "SCRIPT", "START", "END", "TIME", "WAITED ON");
+	for (int i = 0; i < unit_count; ++i) {
+		struct unit * u = &units[i];
+		if (u->end >= 0) {
+			printf("%-24s %8d %8d %8d  %s\n", u->name, u->start, u->end, u->end - u->start, u->blocked_by);
+		} else {
+			printf("%-24s %8d %8s %8s  %s\n", u->name, u->start, "-", "-", u->blocked_by);
+		}
+	}
+	if (frame >= 0) {
+		printf("%-24s %8d\n", "(first frame)", frame);
+	}
+}
+
+static void print_critical_path(char * last) {
+	struct unit * path[MAX_UNITS];
+	int depth = 0;
+
+	struct unit * u = find_unit(last);
+	while (u && depth < MAX_UNITS) {
+		path[depth++] = u;
+		u = find_unit(u->blocked_by);
+	}
+
+	if (!depth) {
+		fprintf(stderr, "bootlog: %s was not started\n", last);
+		return;
+	}
+
+	printf("\ncritical path to %s:\n", frame >= 0 ? "first frame" : last);
+	int previous = 0;
+	for (int i = depth - 1; i >= 0; --i) {
+		u = path[i];
+		/* Gaps are time spent in init or the kernel rather than in a script */
+		printf("  %-24s +%-6d ", u->name, u->start - previous);
+		if (u->end >= 0) {
+			printf("%6d ms\n", u->end - u->start);
+			previous = u->end;
+		} else {
+			printf("%6s\n", "-");
+			previous = u->start;
+		}
+	}
+	if (frame >= 0) {
+		printf("  %-24s +%-6d\n", "(first frame)", frame - previous);
+		printf("total: %d ms\n", frame);
+	}
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-u SCRIPT] [LOG]\n"
+			"\n"
+			" -u  script to trace the critical path back from\n"
+			"     (default: 99_runstart.sh)\n"
+			" LOG defaults to " BOOTLOG_PATH "\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	char * last = "99_runstart.sh";
+	int opt;
+
+	while ((opt = getopt(argc, argv, "u:h")) != -1) {
+		switch (opt) {
+			case 'u':
+				last = optarg;
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	char * path = optind < argc ? argv[optind] : BOOTLOG_PATH;
+	if (read_log(path)) {
+		fprintf(stderr, "%s: %s: could not open\n", argv[0], path);
+		return 1;
+	}
+
+	print_units();
+	print_critical_path(last);
+	return 0;
+}
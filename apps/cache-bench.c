@@ -0,0 +1,95 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * cache-bench - Repeated reads of a file
+ *
+ * Reads a file start to finish several times and reports the
+ * throughput of each pass, so the first (cold) read can be compared
+ * with the ones served from the page cache, along with how much the
+ * cache grew and how often it hit, from /proc/meminfo.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#include "bench.h"
+
+/* A field from /proc/meminfo */
+static int meminfo(const char * field) {
+	char buf[1024];
+	FILE * f = fopen("/proc/meminfo", "r");
+	if (!f) return -1;
+	size_t r = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[r] = '\0';
+	char * line = strstr(buf, field);
+	return line ? atoi(line + strlen(field) + 1) : -1;
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-n passes] [-b size] file\n"
+			"\n"
+			" -n  number of times to read the file (default 4)\n"
+			" -b  size of each read() in kB (default 64)\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	int passes = 4;
+	size_t size = 64 * 1024;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:b:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				passes = atoi(optarg);
+				break;
+			case 'b':
+				size = atoi(optarg) * 1024;
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (optind >= argc || passes < 1 || !size) return usage(argv);
+
+	char * buf = malloc(size);
+	int cached = meminfo("Cached:");
+	int hits   = meminfo("CacheHits:");
+	int misses = meminfo("CacheMisses:");
+
+	for (int i = 0; i < passes; ++i) {
+		int fd = open(argv[optind], O_RDONLY);
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s: can't open\n", argv[0], argv[optind]);
+			return 1;
+		}
+		unsigned long total = 0;
+		unsigned long start = now_us();
+		ssize_t r;
+		while ((r = read(fd, buf, size)) > 0) {
+			total += r;
+		}
+		unsigned long elapsed = now_us() - start;
+		close(fd);
+
+		printf("pass %d: %lu bytes in %luus", i + 1, total, elapsed);
+		if (elapsed) {
+			printf(", %lu kB/s", (unsigned long)((unsigned long long)total * 1000000 / 1024 / elapsed));
+		}
+		printf("\n");
+	}
+
+	printf("Cached: %d kB before, %d kB after\n", cached, meminfo("Cached:"));
+	printf("Cache hits: %d, misses: %d\n", meminfo("CacheHits:") - hits, meminfo("CacheMisses:") - misses);
+
+	free(buf);
+	return 0;
+}
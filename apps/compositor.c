@@ -30,6 +30,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/fswait.h>
+#include <sys/pollset.h>
 #include <pthread.h>
 #include <dlfcn.h>
 /* auto-dep: export-dynamic */
@@ -892,6 +893,38 @@ static void yutani_screenshot(yutani_globals_t * yg) {
  *
  * This is the main redraw function.
  */
+/*
+ * Note the first frame that shows a client window in the boot log
+ * written by init, as the end of the boot critical path.
+ */
+static void log_first_frame(void) {
+	static int logged = 0;
+	if (logged) return;
+	logged = 1;
+
+	char uptime[32] = {0};
+	FILE * f = fopen("/proc/uptime", "r");
+	if (!f) return;
+	fgets(uptime, sizeof(uptime), f);
+	fclose(f);
+
+	unsigned long seconds = 0, millis = 0;
+	char * c = uptime;
+	while (*c == ' ') c++;
+	while (*c >= '0' && *c <= '9') seconds = seconds * 10 + (*c++ - '0');
+	if (*c == '.') {
+		c++;
+		for (int i = 0; i < 3; ++i, ++c) {
+			millis = millis * 10 + ((*c >= '0' && *c <= '9') ? *c - '0' : 0);
+		}
+	}
+
+	f = fopen("/var/log/boot.log", "a");
+	if (!f) return;
+	fprintf(f, "frame %lu compositor\n", seconds * 1000 + millis);
+	fclose(f);
+}
+
 static void redraw_windows(yutani_globals_t * yg) {
 	int has_updates = 0;
 
@@ -1045,6 +1078,10 @@ static void redraw_windows(yutani_globals_t * yg) {
 			} else {
 				flip(yg->backend_ctx);
 			}
+
+			if (yg->windows->length) {
+				log_first_frame();
+			}
 		}
 
 		if (!renderer_add_clip) gfx_clear_clip(yg->backend_ctx);
@@ -2143,6 +2180,7 @@ int main(int argc, char * argv[]) {
 	int mfd = -1;
 	int kfd = -1;
 	int amfd = -1;
+	int devices = -1;
 	int vmmouse = 0;
 	mouse_device_packet_t packet;
 	key_event_t event;
@@ -2166,6 +2204,13 @@ int main(int argc, char * argv[]) {
 		fds[1] = mfd;
 		fds[2] = kfd;
 		fds[3] = amfd;
+
+		/* Registered once; each wakeup handles every device that has input */
+		devices = pollset_create();
+		for (int i = 0; i < (amfd == -1 ? 3 : 4); ++i) {
+			struct pollset_event ev = { fds[i], POLLIN, 0, NULL };
+			pollset_ctl(devices, POLLSET_ADD, fds[i], &ev);
+		}
 	}
 
 	while (1) {
@@ -2228,39 +2273,47 @@ int main(int argc, char * argv[]) {
 				continue;
 			}
 		} else {
-			int index = fswait(amfd == -1 ? 3 : 4, fds);
-
-			if (index == 2) {
-				unsigned char buf[1];
-				int r = read(kfd, buf, 1);
-				if (r > 0) {
-					kbd_scancode(&state, buf[0], &event);
-					yutani_msg_buildx_key_event_alloc(m);
-					yutani_msg_buildx_key_event(m,0, &event, &state);
-					handle_key_event(yg, (struct yutani_msg_key_event *)m->data);
-				}
-				continue;
-			} else if (index == 1) {
-				int r = read(mfd, (char *)&packet, sizeof(mouse_device_packet_t));
-				if (r > 0) {
-					yg->last_mouse_buttons = packet.buttons;
-					yutani_msg_buildx_mouse_event_alloc(m);
-					yutani_msg_buildx_mouse_event(m,0, &packet, YUTANI_MOUSE_EVENT_TYPE_RELATIVE);
-					handle_mouse_event(yg, (struct yutani_msg_mouse_event *)m->data);
-				}
-				continue;
-			} else if (index == 3) {
-				int r = read(amfd, (char *)&packet, sizeof(mouse_device_packet_t));
-				if (r > 0) {
-					if (!vmmouse) {
-						packet.buttons = yg->last_mouse_buttons & 0xF;
-					} else {
+			struct pollset_event ready[4];
+			int count = pollset_wait(devices, ready, 4, -1);
+			int server_ready = 0;
+
+			for (int i = 0; i < count; ++i) {
+				int fd = ready[i].fd;
+				if (fd == kfd) {
+					unsigned char buf[32];
+					int r = read(kfd, buf, sizeof(buf));
+					for (int j = 0; j < r; ++j) {
+						kbd_scancode(&state, buf[j], &event);
+						yutani_msg_buildx_key_event_alloc(m);
+						yutani_msg_buildx_key_event(m,0, &event, &state);
+						handle_key_event(yg, (struct yutani_msg_key_event *)m->data);
+					}
+				} else if (fd == mfd) {
+					int r = read(mfd, (char *)&packet, sizeof(mouse_device_packet_t));
+					if (r > 0) {
 						yg->last_mouse_buttons = packet.buttons;
+						yutani_msg_buildx_mouse_event_alloc(m);
+						yutani_msg_buildx_mouse_event(m,0, &packet, YUTANI_MOUSE_EVENT_TYPE_RELATIVE);
+						handle_mouse_event(yg, (struct yutani_msg_mouse_event *)m->data);
 					}
-					yutani_msg_buildx_mouse_event_alloc(m);
-					yutani_msg_buildx_mouse_event(m,0, &packet, YUTANI_MOUSE_EVENT_TYPE_ABSOLUTE);
-					handle_mouse_event(yg, (struct yutani_msg_mouse_event *)m->data);
+				} else if (fd == amfd) {
+					int r = read(amfd, (char *)&packet, sizeof(mouse_device_packet_t));
+					if (r > 0) {
+						if (!vmmouse) {
+							packet.buttons = yg->last_mouse_buttons & 0xF;
+						} else {
+							yg->last_mouse_buttons = packet.buttons;
+						}
+						yutani_msg_buildx_mouse_event_alloc(m);
+						yutani_msg_buildx_mouse_event(m,0, &packet, YUTANI_MOUSE_EVENT_TYPE_ABSOLUTE);
+						handle_mouse_event(yg, (struct yutani_msg_mouse_event *)m->data);
+					}
+				} else {
+					server_ready = 1;
 				}
+			}
+
+			if (!server_ready) {
 				continue;
 			}
 		}
@@ -0,0 +1,125 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * dir-bench - Directory listing
+ *
+ * Lists a directory with the old one-entry-per-call readdir system
+ * call, with getdents() through readdir(), with an lstat() of every
+ * entry the way ls used to, and with lstat() only where d_type
+ * doesn't say what the entry is. Without a directory argument, a
+ * scratch directory full of empty files is made and removed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <syscall.h>
+#include <sys/stat.h>
+
+#include "bench.h"
+
+static void report(const char * what, unsigned long start, int count, int calls, const char * call) {
+	unsigned long elapsed = now_us() - start;
+	printf("%-16s %6d entries in %8luus, %d %s\n", what, count, elapsed, calls, call);
+}
+
+/* One system call per entry, as readdir() did before getdents */
+static void bench_readdir_syscall(const char * path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return;
+	struct dirent ent;
+	int count = 0;
+	unsigned long start = now_us();
+	while (syscall_readdir(fd, count, &ent) > 0) {
+		count++;
+	}
+	report("readdir syscall", start, count, count + 1, "readdir calls");
+	close(fd);
+}
+
+static void bench_listing(const char * path, const char * what, int do_stat) {
+	DIR * dirp = opendir(path);
+	if (!dirp) return;
+	int count = 0, stats = 0, unknown = 0;
+	unsigned long start = now_us();
+	struct dirent * ent;
+	while ((ent = readdir(dirp))) {
+		count++;
+		if (ent->d_type == DT_UNKNOWN) unknown++;
+		if (do_stat == 2 || (do_stat == 1 && ent->d_type == DT_UNKNOWN)) {
+			char tmp[strlen(path) + strlen(ent->d_name) + 2];
+			struct stat st;
+			sprintf(tmp, "%s/%s", path, ent->d_name);
+			lstat(tmp, &st);
+			stats++;
+		}
+	}
+	report(what, start, count, stats, "lstat calls");
+	closedir(dirp);
+	if (do_stat == 1 && unknown) {
+		printf("%d of %d entries had no d_type\n", unknown, count);
+	}
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-n count] [directory]\n"
+			"\n"
+			" -n  files to create when no directory is given (default 1000)\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	int count = 1000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = atoi(optarg);
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (count < 1) return usage(argv);
+
+	const char * path = "/tmp/dir-bench";
+	int scratch = optind >= argc;
+
+	if (scratch) {
+		if (mkdir(path, 0755) < 0) {
+			fprintf(stderr, "%s: %s: can't create\n", argv[0], path);
+			return 1;
+		}
+		for (int i = 0; i < count; ++i) {
+			char name[64];
+			sprintf(name, "%s/file-%05d", path, i);
+			close(open(name, O_WRONLY | O_CREAT, 0644));
+		}
+	} else {
+		path = argv[optind];
+	}
+
+	bench_readdir_syscall(path);
+	bench_listing(path, "getdents", 0);
+	bench_listing(path, "lstat each", 2);
+	bench_listing(path, "lstat if needed", 1);
+
+	if (scratch) {
+		for (int i = 0; i < count; ++i) {
+			char name[64];
+			sprintf(name, "%s/file-%05d", path, i);
+			unlink(name);
+		}
+		rmdir(path);
+	}
+
+	return 0;
+}
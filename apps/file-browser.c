@@ -152,9 +152,14 @@ static void load_directory(const char * path) {
 			//struct stat statbufl;
 			//char * link;
 
-			char tmp[strlen(path)+strlen(ent->d_name)+2];
-			sprintf(tmp, "%s/%s", path, ent->d_name);
-			lstat(tmp, &statbuf);
+			if (ent->d_type != DT_UNKNOWN) {
+				/* The type is all we look at */
+				statbuf.st_mode = (ent->d_type == DT_DIR) ? S_IFDIR : 0;
+			} else {
+				char tmp[strlen(path)+strlen(ent->d_name)+2];
+				sprintf(tmp, "%s/%s", path, ent->d_name);
+				lstat(tmp, &statbuf);
+			}
 #if 0
 			if (S_ISLNK(statbuf.st_mode)) {
 				stat(tmp, &statbufl);
@@ -308,10 +308,8 @@ redo_everything:
 			draw_sprite_scaled(bg, wallpaper, 0, (height - nh) / 2, width, nh);
 		}
 
-		/* Three box blurs = good enough approximation of a guassian, but faster*/
-		blur_context_box(bg, 20);
-		blur_context_box(bg, 20);
-		blur_context_box(bg, 20);
+		/* Three 21-pixel box blurs, as a good enough approximation of a gaussian */
+		blur_context_gaussian(bg, 10.5);
 
 		free(bg);
 		free(wallpaper);
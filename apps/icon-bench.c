@@ -0,0 +1,77 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * icon-bench - Icon loading
+ *
+ * Loads every 16px and 48px icon through the icon cache, which takes
+ * them from the shared icon atlas when it's there, and then again by
+ * decoding each bitmap with load_sprite(), and reports the time and
+ * how much private memory (VmSize) each way added to the process.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#include <toaru/graphics.h>
+#include <toaru/icon_cache.h>
+
+#include "bench.h"
+
+static void report(const char * what, unsigned long start, int count, int before) {
+	unsigned long elapsed = now_us() - start;
+	printf("%-12s %4d icons in %8luus, VmSize +%d kB\n", what, count, elapsed, vm_size() - before);
+}
+
+/* Names of the bitmaps in a directory, without .bmp */
+static int list_icons(const char * dir, char names[][64], int max) {
+	DIR * dirp = opendir(dir);
+	if (!dirp) return 0;
+	int count = 0;
+	struct dirent * ent;
+	while (count < max && (ent = readdir(dirp))) {
+		size_t len = strlen(ent->d_name);
+		if (len > 4 && len < 64 && !strcmp(ent->d_name + len - 4, ".bmp")) {
+			memcpy(names[count], ent->d_name, len - 4);
+			names[count][len - 4] = '\0';
+			count++;
+		}
+	}
+	closedir(dirp);
+	return count;
+}
+
+int main(int argc, char * argv[]) {
+	static char names_16[128][64];
+	static char names_48[128][64];
+	int count_16 = list_icons("/usr/share/icons/16", names_16, 128);
+	int count_48 = list_icons("/usr/share/icons/48", names_48, 128);
+
+	printf("icon atlas: %s\n", access(ICON_ATLAS_PATH, R_OK) ? "missing" : ICON_ATLAS_PATH);
+
+	int before = vm_size();
+	unsigned long start = now_us();
+	for (int i = 0; i < count_16; ++i) icon_get_16(names_16[i]);
+	for (int i = 0; i < count_48; ++i) icon_get_48(names_48[i]);
+	report("icon cache", start, count_16 + count_48, before);
+
+	before = vm_size();
+	start = now_us();
+	for (int i = 0; i < count_16 + count_48; ++i) {
+		char path[128];
+		if (i < count_16) {
+			sprintf(path, "/usr/share/icons/16/%s.bmp", names_16[i]);
+		} else {
+			sprintf(path, "/usr/share/icons/48/%s.bmp", names_48[i - count_16]);
+		}
+		sprite_t * sprite = malloc(sizeof(sprite_t));
+		load_sprite(sprite, path);
+	}
+	report("load_sprite", start, count_16 + count_48, before);
+
+	return 0;
+}
@@ -0,0 +1,124 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * idle-bench - CPU used by processes while the desktop sits idle
+ *
+ * Takes a process snapshot, sleeps, takes another, and reports how
+ * much CPU time, how many system calls and how many context switches
+ * each named process used in between. By default it watches the panel
+ * and the compositor, which does the work for every region the panel
+ * flips. Leave the mouse and keyboard alone while it runs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#include <kernel/procsnap.h>
+
+#include "bench.h"
+
+struct usage {
+	uint32_t ticks;
+	uint32_t syscalls;
+	uint32_t switches;
+	int found;
+};
+
+static const char * basename_of(const char * name) {
+	const char * slash = strrchr(name, '/');
+	return slash ? slash + 1 : name;
+}
+
+/* Totals for every thread of every process with this name */
+static int sample(const char * name, struct usage * out) {
+	static char buf[sizeof(procsnap_header_t) + 256 * sizeof(procsnap_record_t)];
+	memset(out, 0, sizeof(struct usage));
+
+	int fd = open("/proc/snapshot", O_RDONLY);
+	if (fd < 0) return 1;
+	int r = read(fd, buf, sizeof(buf));
+	close(fd);
+
+	procsnap_header_t * header = (procsnap_header_t *)buf;
+	if (r < (int)sizeof(procsnap_header_t) || header->magic != PROCSNAP_MAGIC ||
+			header->record_size != sizeof(procsnap_record_t)) return 1;
+
+	procsnap_record_t * records = (procsnap_record_t *)(buf + header->header_size);
+	for (uint32_t i = 0; i < header->count; ++i) {
+		procsnap_record_t * rec = &records[i];
+		char rec_name[sizeof(rec->name) + 1];
+		memcpy(rec_name, rec->name, sizeof(rec->name));
+		rec_name[sizeof(rec->name)] = '\0';
+		if (strcmp(basename_of(rec_name), name)) continue;
+		out->ticks    += rec->utime + rec->stime;
+		out->syscalls += rec->syscalls;
+		out->switches += rec->nvcsw + rec->nivcsw;
+		out->found = 1;
+	}
+	return 0;
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-t seconds] [process...]\n"
+			"\n"
+			" -t  how long to watch (default 30)\n"
+			"\n"
+			"Watches panel and compositor if no processes are named.\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	int seconds = 30;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:h")) != -1) {
+		switch (opt) {
+			case 't':
+				seconds = atoi(optarg);
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (seconds < 1) return usage(argv);
+
+	char * defaults[] = {"panel", "compositor"};
+	char ** names = optind < argc ? &argv[optind] : defaults;
+	int count = optind < argc ? argc - optind : 2;
+
+	struct usage * before = calloc(count, sizeof(struct usage));
+	for (int i = 0; i < count; ++i) {
+		if (sample(names[i], &before[i])) {
+			fprintf(stderr, "%s: /proc/snapshot is not available\n", argv[0]);
+			return 1;
+		}
+	}
+
+	unsigned long start = now_us();
+	sleep(seconds);
+	double elapsed = (double)(now_us() - start) / 1000000.0;
+
+	printf("%-16s %10s %8s %12s %12s\n", "process", "cpu ms", "cpu %", "syscalls/s", "switches/s");
+	for (int i = 0; i < count; ++i) {
+		struct usage after;
+		sample(names[i], &after);
+		if (!before[i].found || !after.found) {
+			printf("%-16s not running\n", names[i]);
+			continue;
+		}
+		uint32_t ticks = after.ticks - before[i].ticks;
+		printf("%-16s %10lu %7.2f%% %12.1f %12.1f\n", names[i], ticks,
+			(double)ticks / (elapsed * 10.0),
+			(after.syscalls - before[i].syscalls) / elapsed,
+			(after.switches - before[i].switches) / elapsed);
+	}
+
+	return 0;
+}
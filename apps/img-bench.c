@@ -0,0 +1,83 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * img-bench - Image decoding
+ *
+ * Decodes each image given with load_sprite() a number of times and
+ * reports how fast it went, both in megabytes of file read and in
+ * megapixels produced per second.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include <toaru/graphics.h>
+
+#include "bench.h"
+
+static void report(const char * path, unsigned long elapsed, int loops, size_t file_size, size_t pixels) {
+	if (!elapsed) elapsed = 1;
+	double seconds = (double)elapsed / 1000000.0;
+	printf("%-32s %3d loads in %8luus, %7.2f MB/s read, %7.2f Mpx/s\n", path, loops, elapsed,
+		(double)file_size * loops / (1024.0 * 1024.0) / seconds,
+		(double)pixels * loops / 1000000.0 / seconds);
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-n loops] image...\n"
+			"\n"
+			" -n  times to decode each image (default 10)\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	int loops = 10;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				loops = atoi(optarg);
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (loops < 1 || optind >= argc) return usage(argv);
+
+	int ret = 0;
+	for (int i = optind; i < argc; ++i) {
+		struct stat st;
+		if (stat(argv[i], &st) < 0) {
+			fprintf(stderr, "%s: %s: not found\n", argv[0], argv[i]);
+			ret = 1;
+			continue;
+		}
+
+		sprite_t sprite;
+		size_t pixels = 0;
+		unsigned long start = now_us();
+		for (int j = 0; j < loops; ++j) {
+			if (load_sprite(&sprite, argv[i])) {
+				fprintf(stderr, "%s: %s: failed to decode\n", argv[0], argv[i]);
+				free(sprite.bitmap);
+				ret = 1;
+				pixels = 0;
+				break;
+			}
+			pixels = sprite.width * sprite.height;
+			free(sprite.bitmap);
+		}
+		if (pixels) {
+			report(argv[i], now_us() - start, loops, st.st_size, pixels);
+		}
+	}
+
+	return ret;
+}
@@ -9,7 +9,12 @@
  * this application... This uses the libtoaru_graphics sprite
  * functionality to load images, so it will support whatever
  * that ends up supporting - which at the time of writing is
- * just bitmaps of various types.
+ * bitmaps and PNGs.
+ *
+ * The window opens as soon as the image size is known and fills
+ * in while the rest of the file decodes. Only the part of the
+ * image that's in view is drawn, over a checkerboard built from
+ * two cached rows, so zooming and panning large images is cheap.
  *
  */
 
@@ -20,6 +25,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <sys/time.h>
 
 #include <toaru/yutani.h>
 #include <toaru/graphics.h>
@@ -45,6 +51,22 @@ int height = 300;
 
 sprite_t img = {0};
 
+/* Image pixels per screen pixel is 2^-zoom; pan moves the image from the center */
+#define ZOOM_MIN -4
+#define ZOOM_MAX  5
+#define PAN_STEP 32
+static int zoom = 0;
+static int pan_x = 0;
+static int pan_y = 0;
+
+/* Redraw at most this often while the image is still loading */
+#define PROGRESS_INTERVAL 50000
+
+/* The two rows of the checkerboard background, for the current width */
+#define CHECKER_SIZE 10
+static uint32_t * checker[2] = {NULL, NULL};
+static int checker_width = 0;
+
 #define APPLICATION_TITLE "Image Viewer"
 
 void usage(char * argv[]) {
@@ -53,7 +75,9 @@ void usage(char * argv[]) {
 			"\n"
 			"usage: %s \033[3mimage\033[0m\n"
 			"\n"
-			" -? --help      \033[3mShow this help message.\033[0m\n",
+			" -? --help      \033[3mShow this help message.\033[0m\n"
+			"\n"
+			"Keys: + and - zoom, arrows pan, 0 resets the view, q quits.\n",
 			argv[0]);
 }
 
@@ -61,19 +85,104 @@ static void decors() {
 	render_decorations(window, ctx, APPLICATION_TITLE);
 }
 
+static void build_checker(void) {
+	if (checker_width == width) return;
+	checker_width = width;
+	for (int i = 0; i < 2; ++i) {
+		free(checker[i]);
+		checker[i] = malloc(sizeof(uint32_t) * (width ? width : 1));
+		for (int x = 0; x < width; ++x) {
+			checker[i][x] = ((x / CHECKER_SIZE) % 2 == i) ? rgb(107,107,107) : rgb(147,147,147);
+		}
+	}
+}
+
+static int zoomed(int size) {
+	int out = zoom >= 0 ? size << zoom : size >> -zoom;
+	return out ? out : 1;
+}
+
+static int unzoomed(int offset) {
+	return zoom >= 0 ? offset >> zoom : offset << -zoom;
+}
+
 void redraw() {
-	static double r = 0.0;
+	build_checker();
+
+	int shown_w = zoomed(img.width);
+	int shown_h = zoomed(img.height);
+	int img_x = width / 2 - shown_w / 2 + pan_x;
+	int img_y = height / 2 - shown_h / 2 + pan_y;
+
+	/* Screen columns the image covers */
+	int x0 = img_x < 0 ? 0 : img_x;
+	int x1 = img_x + shown_w > width ? width : img_x + shown_w;
 
 	for (int y = 0; y < height; ++y) {
-		for (int x = 0; x < width; ++x) {
-			GFX(ctx,x+decor_left_width,y+decor_top_height) = (((y / 10) % 2 == 0) ^ ((x / 10) % 2 == 0)) ? rgb(107,107,107) : rgb(147,147,147);
+		uint32_t * row = &GFX(ctx, decor_left_width, y + decor_top_height);
+		memcpy(row, checker[(y / CHECKER_SIZE) % 2], sizeof(uint32_t) * width);
+
+		if (!img.bitmap || y < img_y || y >= img_y + shown_h) continue;
+		int iy = unzoomed(y - img_y);
+		if (iy >= img.height) continue;
+		uint32_t * src = &img.bitmap[iy * img.width];
+
+		if (zoom == 0) {
+			for (int x = x0; x < x1; ++x) {
+				row[x] = alpha_blend_rgba(row[x], src[x - img_x]);
+			}
+		} else {
+			for (int x = x0; x < x1; ++x) {
+				int ix = unzoomed(x - img_x);
+				if (ix >= img.width) break;
+				row[x] = alpha_blend_rgba(row[x], src[ix]);
+			}
 		}
 	}
 
-	draw_sprite(ctx, &img, decor_left_width + width/2 - img.width/2, decor_top_height + height/2 - img.height/2);
 	decors();
 	flip(ctx);
-	r += 0.02;
+}
+
+static void set_zoom(int new_zoom) {
+	if (new_zoom < ZOOM_MIN || new_zoom > ZOOM_MAX) return;
+	/* Keep the same part of the image in the center */
+	if (new_zoom > zoom) {
+		pan_x <<= new_zoom - zoom;
+		pan_y <<= new_zoom - zoom;
+	} else {
+		pan_x >>= zoom - new_zoom;
+		pan_y >>= zoom - new_zoom;
+	}
+	zoom = new_zoom;
+}
+
+static unsigned long now_us(void) {
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	return (unsigned long)t.tv_sec * 1000000 + t.tv_usec;
+}
+
+static void show_progress(sprite_t * sprite, int y, int rows, void * data) {
+	static unsigned long last = 0;
+
+	if (!rows) {
+		/* Size is known; open the window now and fill it in as rows arrive */
+		img.alpha = ALPHA_EMBEDDED;
+		width = img.width;
+		height = img.height;
+
+		window = yutani_window_create(yctx, width + decor_width, height + decor_height);
+		yutani_window_move(yctx, window, left, top);
+		yutani_window_advertise_icon(yctx, window, APPLICATION_TITLE, "imgviewer");
+		ctx = init_graphics_yutani_double_buffer(window);
+	} else if (now_us() - last < PROGRESS_INTERVAL) {
+		return;
+	}
+
+	redraw();
+	yutani_flip(yctx, window);
+	last = now_us();
 }
 
 void resize_finish(int w, int h) {
@@ -144,22 +253,14 @@ int main(int argc, char * argv[]) {
 	decor_width = bounds.width;
 	decor_height = bounds.height;
 
-	load_sprite(&img, argv[optind]);
-	if (!img.width) {
-		fprintf(stderr, "%s: failed to open image %s\n", argv[0], argv[optind]);
-		return 1;
+	if (load_sprite_progressive(&img, argv[optind], show_progress, NULL)) {
+		if (!window) {
+			fprintf(stderr, "%s: failed to open image %s\n", argv[0], argv[optind]);
+			return 1;
+		}
+		/* Cut short or corrupt; show what we got */
+		fprintf(stderr, "%s: %s: image is incomplete\n", argv[0], argv[optind]);
 	}
-	img.alpha = ALPHA_EMBEDDED;
-
-	width = img.width;
-	height = img.height;
-
-	window = yutani_window_create(yctx, width + decor_width, height + decor_height);
-	yutani_window_move(yctx, window, left, top);
-
-	yutani_window_advertise_icon(yctx, window, APPLICATION_TITLE, "imgviewer");
-
-	ctx = init_graphics_yutani_double_buffer(window);
 
 	redraw();
 	yutani_flip(yctx, window);
@@ -177,8 +278,44 @@ int main(int argc, char * argv[]) {
 				case YUTANI_MSG_KEY_EVENT:
 					{
 						struct yutani_msg_key_event * ke = (void*)m->data;
-						if (ke->event.action == KEY_ACTION_DOWN && ke->event.keycode == 'q') {
-							playing = 0;
+						if (ke->event.action != KEY_ACTION_DOWN) break;
+						int changed = 1;
+						switch (ke->event.keycode) {
+							case 'q':
+								playing = 0;
+								changed = 0;
+								break;
+							case '+':
+							case '=':
+								set_zoom(zoom + 1);
+								break;
+							case '-':
+								set_zoom(zoom - 1);
+								break;
+							case '0':
+								zoom = 0;
+								pan_x = 0;
+								pan_y = 0;
+								break;
+							case KEY_ARROW_LEFT:
+								pan_x += PAN_STEP;
+								break;
+							case KEY_ARROW_RIGHT:
+								pan_x -= PAN_STEP;
+								break;
+							case KEY_ARROW_UP:
+								pan_y += PAN_STEP;
+								break;
+							case KEY_ARROW_DOWN:
+								pan_y -= PAN_STEP;
+								break;
+							default:
+								changed = 0;
+								break;
+						}
+						if (changed) {
+							redraw();
+							yutani_flip(yctx, window);
 						}
 					}
 					break;
@@ -22,16 +22,28 @@
  * Startup scripts can be any executable binary. Shell scripts are
  * generally used to allow easy editing, but you could also use
  * a binary (even a dynamically linked one) as a startup script.
- * `init` will wait for each startup script (that is, it will wait for
- * the original process it started to exit) before running the next one.
- * So if you wish to run daemons, be sure to fork them off and then
- * exit so that the rest of the startup process can continue.
+ *
+ * A script that has a line of the form
+ *
+ *     # after: 00_migrate.sh 01_hostname.sh
+ *
+ * near its top only waits for the named scripts (an empty list means
+ * it can start immediately) and runs alongside anything else that is
+ * ready. A script without one waits for every script sorted before
+ * it, which is the traditional one-at-a-time behaviour. `init` waits
+ * for the original process it started to exit, so if you wish to run
+ * daemons, be sure to fork them off and then exit.
+ *
+ * Start and exit times of each script, and the script it was last
+ * waiting on, are logged to /var/log/boot.log; see `bootlog`.
  *
  * When the last startup script finishes, `init` will reboot the system.
  */
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -41,6 +53,28 @@
 #include <sys/wait.h>
 
 #define INITD_PATH "/etc/startup.d"
+#define BOOTLOG_DIR "/var/log"
+#define BOOTLOG_PATH "/var/log/boot.log"
+
+#define MAX_AFTER 16
+
+enum {
+	UNIT_WAITING,
+	UNIT_RUNNING,
+	UNIT_DONE,
+};
+
+struct unit {
+	char path[256];
+	char * name;
+	int annotated;           /* has an "# after:" line */
+	int after_count;
+	int after[MAX_AFTER];    /* indices of units this one waits for */
+	int state;
+	int pid;
+	unsigned long start;
+	unsigned long end;
+};
 
 /* Initialize fd 0, 1, 2 */
 void set_console(void) {
@@ -61,15 +95,10 @@ void set_console(void) {
 /* Run a startup script and wait for it to finish */
 int start_options(char * args[]) {
 
-	/* Fork child to run script */
-	int cpid = syscall_fork();
-
-	/* Child process... */
-	if (!cpid) {
-		/* Pass environment from init to child */
-		syscall_execve(args[0], args, environ);
-		/* exec failed, exit this subprocess */
-		syscall_exit(0);
+	/* Start the script, passing our environment along */
+	pid_t cpid;
+	if (posix_spawn(&cpid, args[0], NULL, NULL, args, environ)) {
+		return -1;
 	}
 
 	/* Wait for the child process to finish */
@@ -97,6 +126,196 @@ int start_options(char * args[]) {
 	return cpid;
 }
 
+/*
+ * Log lines are kept until /var/log is writable, which for a read-only
+ * root is only once the overlay has been mounted by 00_migrate.sh.
+ */
+static char log_buffer[4096];
+static int log_length = 0;
+
+static void log_flush(void) {
+	if (!log_length) return;
+	syscall_mkdir(BOOTLOG_DIR, 0755);
+	int fd = syscall_open(BOOTLOG_PATH, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0) return;
+	syscall_write(fd, log_buffer, log_length);
+	syscall_close(fd);
+	log_length = 0;
+}
+
+static void log_line(char * line) {
+	int len = strlen(line);
+	if (log_length + len > (int)sizeof(log_buffer)) return;
+	memcpy(log_buffer + log_length, line, len);
+	log_length += len;
+}
+
+/* Milliseconds since boot, from /proc/uptime ("seconds.millis") */
+static unsigned long uptime_ms(void) {
+	char buf[32] = {0};
+	int fd = syscall_open("/proc/uptime", 0, 0);
+	if (fd < 0) return 0;
+	syscall_read(fd, buf, sizeof(buf) - 1);
+	syscall_close(fd);
+
+	unsigned long seconds = 0, millis = 0;
+	char * c = buf;
+	while (*c == ' ') c++;
+	while (*c >= '0' && *c <= '9') seconds = seconds * 10 + (*c++ - '0');
+	if (*c == '.') {
+		c++;
+		for (int i = 0; i < 3; ++i, ++c) {
+			millis = millis * 10 + ((*c >= '0' && *c <= '9') ? *c - '0' : 0);
+		}
+	}
+	return seconds * 1000 + millis;
+}
+
+static int find_unit(struct unit * units, int count, char * name) {
+	for (int i = 0; i < count; ++i) {
+		if (!strcmp(units[i].name, name)) return i;
+	}
+	return -1;
+}
+
+/* Look for an "# after:" line in the first few hundred bytes of a script */
+static void read_annotation(struct unit * units, int count, int index) {
+	struct unit * u = &units[index];
+	char buf[512];
+
+	int fd = syscall_open(u->path, 0, 0);
+	if (fd < 0) return;
+	int len = syscall_read(fd, buf, sizeof(buf) - 1);
+	syscall_close(fd);
+	if (len <= 0) return;
+	buf[len] = '\0';
+
+	char * line = buf;
+	while (line && *line) {
+		char * next = strchr(line, '\n');
+		if (next) *next++ = '\0';
+
+		if (!strncmp(line, "# after:", 8)) {
+			u->annotated = 1;
+			char * save;
+			for (char * dep = strtok_r(line + 8, " \t", &save); dep; dep = strtok_r(NULL, " \t", &save)) {
+				/* Dependencies on scripts that don't exist are ignored */
+				int other = find_unit(units, count, dep);
+				if (other >= 0 && other != index && u->after_count < MAX_AFTER) {
+					u->after[u->after_count++] = other;
+				}
+			}
+			return;
+		}
+		line = next;
+	}
+}
+
+/*
+ * A unit is ready once everything it waits for is done; returns the
+ * one that finished last (what it was blocked by), -1 if none, or -2
+ * if it isn't ready.
+ */
+static int unit_ready(struct unit * units, int index) {
+	struct unit * u = &units[index];
+	int blocked_by = -1;
+
+	if (u->annotated) {
+		for (int i = 0; i < u->after_count; ++i) {
+			struct unit * dep = &units[u->after[i]];
+			if (dep->state != UNIT_DONE) return -2;
+			if (blocked_by < 0 || dep->end > units[blocked_by].end) blocked_by = u->after[i];
+		}
+	} else {
+		for (int i = 0; i < index; ++i) {
+			if (units[i].state != UNIT_DONE) return -2;
+			if (blocked_by < 0 || units[i].end > units[blocked_by].end) blocked_by = i;
+		}
+	}
+
+	return blocked_by;
+}
+
+static void finish_unit(struct unit * u, int status) {
+	char line[512];
+	u->state = UNIT_DONE;
+	u->end = uptime_ms();
+	sprintf(line, "exit %lu %s %d\n", u->end, u->name, status);
+	log_line(line);
+	log_flush();
+}
+
+/* Returns 1 if the script is now running, 0 if it couldn't be started */
+static int start_unit(struct unit * units, int index, int blocked_by) {
+	struct unit * u = &units[index];
+	char line[512];
+
+	u->start = uptime_ms();
+	u->state = UNIT_RUNNING;
+	sprintf(line, "start %lu %s %s\n", u->start, u->name, blocked_by >= 0 ? units[blocked_by].name : "-");
+	log_line(line);
+
+	if (posix_spawn(&u->pid, u->path, NULL, NULL, (char *[]){u->path, NULL}, environ)) {
+		/* Couldn't run it at all; there's nothing to wait for */
+		u->pid = -1;
+		finish_unit(u, 127);
+		return 0;
+	}
+	return 1;
+}
+
+/* Run every script as soon as what it waits for has finished */
+static void run_units(struct unit * units, int count) {
+	int running = 0, done = 0;
+
+	while (done < count) {
+		for (int i = 0; i < count; ++i) {
+			if (units[i].state != UNIT_WAITING) continue;
+			int blocked_by = unit_ready(units, i);
+			if (blocked_by == -2) continue;
+			if (start_unit(units, i, blocked_by)) running++;
+			else done++;
+		}
+
+		if (!running) {
+			/* Circular dependencies: run the first waiting script anyway */
+			for (int i = 0; i < count; ++i) {
+				if (units[i].state == UNIT_WAITING) {
+					if (start_unit(units, i, -1)) running++;
+					else done++;
+					break;
+				}
+			}
+		}
+
+		/* Wait, ignoring kernel threads (which also end up as children to init) */
+		int status = 0;
+		int pid = waitpid(-1, &status, WNOKERN);
+		if (pid == -1) {
+			if (errno == EINTR) continue;
+			/* No children left; nothing we started can still be running */
+			for (int i = 0; i < count; ++i) {
+				if (units[i].state == UNIT_RUNNING) {
+					units[i].state = UNIT_DONE;
+					units[i].end = uptime_ms();
+					running--;
+					done++;
+				}
+			}
+			continue;
+		}
+
+		for (int i = 0; i < count; ++i) {
+			if (units[i].state == UNIT_RUNNING && units[i].pid == pid) {
+				finish_unit(&units[i], WEXITSTATUS(status));
+				running--;
+				done++;
+				break;
+			}
+		}
+	}
+}
+
 int main(int argc, char * argv[]) {
 	/* Initialize stdin/out/err */
 	set_console();
@@ -131,13 +350,20 @@ int main(int argc, char * argv[]) {
 		qsort(entries, count, sizeof(struct dirent), comparator);
 
 		/* Run scripts */
+		struct unit * units = calloc(count, sizeof(struct unit));
+		int unit_count = 0;
 		for (int i = 0; i < count; ++i) {
 			if (entries[i].d_name[0] != '.') {
-				char path[256];
-				sprintf(path, "/etc/startup.d/%s", entries[i].d_name);
-				start_options((char *[]){path, NULL});
+				struct unit * u = &units[unit_count++];
+				sprintf(u->path, INITD_PATH "/%s", entries[i].d_name);
+				u->name = u->path + strlen(INITD_PATH "/");
 			}
 		}
+		for (int i = 0; i < unit_count; ++i) {
+			read_annotation(units, unit_count, i);
+		}
+
+		run_units(units, unit_count);
 	}
 
 	/* Self-explanatory */
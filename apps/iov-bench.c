@@ -0,0 +1,132 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * iov-bench - Vectored and positioned I/O
+ *
+ * Writes small header-plus-payload records the three ways a program
+ * can (two writes, copying into one buffer, writev), then reads
+ * records back from scattered offsets with lseek+read and with
+ * pread, and reports the time and number of system calls for each.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/uio.h>
+
+#include "bench.h"
+
+struct header {
+	unsigned int type;
+	unsigned int size;
+};
+
+static void report(const char * what, unsigned long start, int count, int calls) {
+	unsigned long elapsed = now_us() - start;
+	printf("%-16s %6d in %8luus, %.2fus each, %d syscalls\n", what, count, elapsed,
+		count ? (double)elapsed / count : 0.0, calls);
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-n count] [-s size] [-f file]\n"
+			"\n"
+			" -n  number of records (default 1000)\n"
+			" -s  payload size in bytes (default 200)\n"
+			" -f  scratch file (default /tmp/iov-bench)\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	int count = 1000;
+	size_t size = 200;
+	char * file = "/tmp/iov-bench";
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:s:f:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = atoi(optarg);
+				break;
+			case 's':
+				size = atoi(optarg);
+				break;
+			case 'f':
+				file = optarg;
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (count < 1 || !size) return usage(argv);
+
+	char * payload = malloc(size);
+	memset(payload, 'x', size);
+	struct header header = { 1, size };
+	size_t record = sizeof(header) + size;
+
+	int fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s: can't open\n", argv[0], file);
+		return 1;
+	}
+
+	unsigned long start = now_us();
+	for (int i = 0; i < count; ++i) {
+		write(fd, &header, sizeof(header));
+		write(fd, payload, size);
+	}
+	report("write+write", start, count, count * 2);
+
+	start = now_us();
+	for (int i = 0; i < count; ++i) {
+		char * buf = malloc(record);
+		memcpy(buf, &header, sizeof(header));
+		memcpy(buf + sizeof(header), payload, size);
+		write(fd, buf, record);
+		free(buf);
+	}
+	report("copy+write", start, count, count);
+
+	start = now_us();
+	for (int i = 0; i < count; ++i) {
+		struct iovec iov[2] = {
+			{ &header, sizeof(header) },
+			{ payload, size },
+		};
+		writev(fd, iov, 2);
+	}
+	report("writev", start, count, count);
+
+	/* Read records back in a scattered order */
+	int records = count * 3;
+	char * buf = malloc(record);
+	unsigned int seed = 1;
+
+	start = now_us();
+	for (int i = 0; i < count; ++i) {
+		seed = seed * 1103515245 + 12345;
+		lseek(fd, (seed >> 8) % records * record, SEEK_SET);
+		read(fd, buf, record);
+	}
+	report("lseek+read", start, count, count * 2);
+
+	seed = 1;
+	start = now_us();
+	for (int i = 0; i < count; ++i) {
+		seed = seed * 1103515245 + 12345;
+		pread(fd, buf, record, (seed >> 8) % records * record);
+	}
+	report("pread", start, count, count);
+
+	close(fd);
+	unlink(file);
+	free(buf);
+	free(payload);
+	return 0;
+}
@@ -7,6 +7,10 @@
  *
  * This is the updated windowed version of the
  * julia fractal generator demo.
+ *
+ * Rows can be split between several threads (-j), and -b renders
+ * off-screen with 1 to N threads and reports the speedup, as a
+ * quick check that CPU-bound work scales across processors.
  */
 
 #include <stdio.h>
@@ -16,6 +20,9 @@
 #include <time.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
 
 #include <toaru/yutani.h>
 #include <toaru/graphics.h>
@@ -48,10 +55,11 @@ float initer = 1000; /* Iteration levels */
 float pixcorx;       /* Internal values */
 float pixcory;
 
-int newcolor;        /* Color we're placing */
-int lastcolor;       /* Last color we placed */
 int no_repeat = 0;   /* Repeat colors? */
 
+#define MAX_THREADS 32
+int threads = 1;     /* Threads rendering rows */
+
 /*
  * Color table
  * These are orange/red shades from the Ubuntu platte.
@@ -76,7 +84,7 @@ int top    = 40;
 int width  = 300;
 int height = 300;
 
-void julia(int xpt, int ypt) {
+static uint32_t julia(int xpt, int ypt) {
 	long double x = xpt * pixcorx + Minx;
 	long double y = Maxy - ypt * pixcory;
 	long double xnew = 0;
@@ -102,11 +110,111 @@ void julia(int xpt, int ypt) {
 		}
 	}
 	if (k >= initer) {
-		GFX_(xpt,ypt) = rgb(0,0,0);
+		return rgb(0,0,0);
 	} else {
-		GFX_(xpt,ypt) = colors[color];
+		return colors[color];
+	}
+}
+
+/* Render every `step`th row starting at `first`; stride is in pixels */
+static void render_rows(uint32_t * pixels, int stride, int first, int step) {
+	for (int j = first; j < height; j += step) {
+		uint32_t * row = pixels + stride * j;
+		for (int i = 0; i < width; ++i) {
+			row[i] = julia(i,j);
+		}
+	}
+}
+
+struct render_job {
+	uint32_t * pixels;
+	int stride;
+	int first;
+	int step;
+	volatile int * finished;
+};
+
+static void * render_thread(void * arg) {
+	struct render_job * job = arg;
+	render_rows(job->pixels, job->stride, job->first, job->step);
+	__sync_fetch_and_add(job->finished, 1);
+	return NULL;
+}
+
+/*
+ * Rows are interleaved rather than split into bands, so each thread
+ * gets a similar mix of cheap and expensive ones.
+ */
+static void render_parallel(uint32_t * pixels, int stride, int count) {
+	static struct render_job jobs[MAX_THREADS];
+	volatile int finished = 0;
+
+	for (int t = 1; t < count; ++t) {
+		jobs[t].pixels   = pixels;
+		jobs[t].stride   = stride;
+		jobs[t].first    = t;
+		jobs[t].step     = count;
+		jobs[t].finished = &finished;
+		pthread_t thread;
+		pthread_create(&thread, NULL, render_thread, &jobs[t]);
 	}
-	newcolor = color;
+
+	/* The calling thread takes a share too */
+	render_rows(pixels, stride, 0, count);
+
+	while (finished < count - 1) {
+		sched_yield();
+	}
+}
+
+static void set_scale(void) {
+	float _x = Maxx - Minx;
+	float _y = _x / width * height;
+	Miny = 0 - _y / 2;
+	Maxy = _y / 2;
+	pixcorx = (Maxx - Minx) / width;
+	pixcory = (Maxy - Miny) / height;
+}
+
+static int processor_count(void) {
+	FILE * f = fopen("/proc/cpuinfo", "r");
+	if (!f) return 1;
+	char line[256];
+	int count = 1;
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "Processors: ", 12)) {
+			count = atoi(line + 12);
+		}
+	}
+	fclose(f);
+	return count < 1 ? 1 : count;
+}
+
+static unsigned long elapsed_ms(struct timeval * start) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_usec - start->tv_usec) / 1000;
+}
+
+/* Render off-screen with 1..max threads and report the speedup */
+static int benchmark(int max) {
+	uint32_t * pixels = malloc(width * height * sizeof(uint32_t));
+	unsigned long single = 0;
+
+	set_scale();
+	printf("%dx%d, %d iterations, %d processor%s\n", width, height, (int)initer, processor_count(), processor_count() == 1 ? "" : "s");
+
+	for (int count = 1; count <= max; ++count) {
+		struct timeval start;
+		gettimeofday(&start, NULL);
+		render_parallel(pixels, width, count);
+		unsigned long ms = elapsed_ms(&start);
+		if (count == 1) single = ms;
+		printf("%2d thread%s: %5lu ms  %.2fx\n", count, count == 1 ? " " : "s", ms, ms ? (double)single / ms : 0.0);
+	}
+
+	free(pixels);
+	return 0;
 }
 
 void usage(char * argv[]) {
@@ -115,7 +223,7 @@ void usage(char * argv[]) {
 			"\n"
 			"usage: %s [-n] [-i \033[3miniter\033[0m] [-x \033[3mminx\033[0m] \n"
 			"          [-X \033[3mmaxx\033[0m] [-c \033[3mconx\033[0m] [-C \033[3mcony\033[0m]\n"
-			"          [-W \033[3mwidth\033[0m] [-H \033[3mheight\033[0m] [-h]\n"
+			"          [-W \033[3mwidth\033[0m] [-H \033[3mheight\033[0m] [-j \033[3mthreads\033[0m] [-b] [-h]\n"
 			"\n"
 			" -n --no-repeat \033[3mDo not repeat colors\033[0m\n"
 			" -i --initer    \033[3mInitializer value\033[0m\n"
@@ -125,6 +233,8 @@ void usage(char * argv[]) {
 			" -C --cony      \033[3mcon y\033[0m\n"
 			" -W --width     \033[3mWindow width\033[0m\n"
 			" -H --height    \033[3mWindow height\033[0m\n"
+			" -j --threads   \033[3mRender with this many threads\033[0m\n"
+			" -b --benchmark \033[3mTime off-screen renders with 1..N threads\033[0m\n"
 			" -h --help      \033[3mShow this help message.\033[0m\n",
 			argv[0]);
 }
@@ -136,33 +246,26 @@ static void decors() {
 void redraw() {
 	printf("initer: %f\n", initer);
 	printf("X: %f %f\n", Minx, Maxx);
-	float _x = Maxx - Minx;
-	float _y = _x / width * height;
-	Miny = 0 - _y / 2;
-	Maxy = _y / 2;
+	set_scale();
 	printf("Y: %f %f\n", Miny, Maxy);
 	printf("conx: %f cony: %f\n", conx, cony);
 
 	decors();
 
-	newcolor  = 0;
-	lastcolor = 0;
+	uint32_t * pixels = &GFX_(0,0);
+	int stride = GFX_S(ctx) / GFX_B(ctx);
 
-	pixcorx = (Maxx - Minx) / width;
-	pixcory = (Maxy - Miny) / height;
-	int j = 0;
-	do {
-		int i = 1;
-		do {
-			julia(i,j);
-			if (lastcolor != newcolor) julia(i-1,j);
-			else if (i > 0) GFX_(i-1,j) = colors[lastcolor];
-			newcolor = lastcolor;
-			i+= 2;
-		} while ( i < width );
+	if (threads > 1) {
+		render_parallel(pixels, stride, threads);
+		yutani_flip(yctx, window);
+		return;
+	}
+
+	/* One thread: show progress a row at a time */
+	for (int j = 0; j < height; ++j) {
+		render_rows(pixels + stride * j, stride, 0, height);
 		yutani_flip(yctx, window);
-		++j;
-	} while ( j < height );
+	}
 }
 
 void resize_finish(int w, int h) {
@@ -193,6 +296,7 @@ void resize_finish(int w, int h) {
 
 
 int main(int argc, char * argv[]) {
+	int bench = 0;
 
 	static struct option long_opts[] = {
 		{"no-repeat", no_argument,    0, 'n'},
@@ -203,6 +307,8 @@ int main(int argc, char * argv[]) {
 		{"cony",   required_argument, 0, 'C'},
 		{"width",  required_argument, 0, 'W'},
 		{"height", required_argument, 0, 'H'},
+		{"threads", required_argument, 0, 'j'},
+		{"benchmark", no_argument,    0, 'b'},
 		{"help",   no_argument,       0, 'h'},
 		{0,0,0,0}
 	};
@@ -210,7 +316,7 @@ int main(int argc, char * argv[]) {
 	if (argc > 1) {
 		/* Read some arguments */
 		int index, c;
-		while ((c = getopt_long(argc, argv, "ni:x:X:c:C:W:H:h", long_opts, &index)) != -1) {
+		while ((c = getopt_long(argc, argv, "ni:x:X:c:C:W:H:j:bh", long_opts, &index)) != -1) {
 			if (!c) {
 				if (long_opts[index].flag == 0) {
 					c = long_opts[index].val;
@@ -241,6 +347,14 @@ int main(int argc, char * argv[]) {
 				case 'H':
 					height = atoi(optarg);
 					break;
+				case 'j':
+					threads = atoi(optarg);
+					if (threads < 1) threads = 1;
+					if (threads > MAX_THREADS) threads = MAX_THREADS;
+					break;
+				case 'b':
+					bench = 1;
+					break;
 				case 'h':
 					usage(argv);
 					exit(0);
@@ -251,6 +365,10 @@ int main(int argc, char * argv[]) {
 		}
 	}
 
+	if (bench) {
+		return benchmark(threads > 1 ? threads : processor_count());
+	}
+
 	yctx = yutani_init();
 	if (!yctx) {
 		fprintf(stderr, "%s: failed to connect to compositor\n", argv[0]);
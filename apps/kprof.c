@@ -0,0 +1,373 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * kprof - Kernel profiler
+ *
+ * Enables the kernel trace buffer for a while (or for the life
+ * of a command), then reads back /proc/trace and summarizes it:
+ * hot kernel functions from timer samples, and latency histograms
+ * for system calls, interrupts and block I/O.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <syscall.h>
+#include <sys/wait.h>
+
+#include <kernel/trace.h>
+
+#define HISTOGRAM_BUCKETS 24
+#define HISTOGRAM_WIDTH 40
+#define MAX_SYSCALLS 128
+#define MAX_PIDS 1024
+
+struct symbol {
+	uint32_t addr;
+	char * name;
+	uint32_t hits;
+};
+
+struct latency {
+	uint32_t count;
+	uint64_t total;
+	uint32_t max;
+	uint32_t buckets[HISTOGRAM_BUCKETS];
+};
+
+static struct symbol * symbols = NULL;
+static size_t symbol_count = 0;
+static uint32_t tsc_per_us = 0;
+
+static void usage(char * argv[]) {
+	fprintf(stderr,
+			"kprof - kernel profiler\n"
+			"\n"
+			"usage: %s [-e events] [-n count] [-t seconds] [command...]\n"
+			"\n"
+			" -e: \033[3mEvents to trace, any of: s (samples), c (syscalls),\033[0m\n"
+			"     \033[3mw (context switches), f (page faults), i (irqs), b (block I/O)\033[0m\n"
+			" -n: \033[3mNumber of entries to show in each table\033[0m\n"
+			" -t: \033[3mSeconds to trace for when no command is given\033[0m\n"
+			"\n", argv[0]);
+}
+
+static int trace_set(uint32_t mask, int reset) {
+	char * args[] = {(char *)mask, (char *)reset, NULL};
+	return syscall_system_function(TRACE_SYSFUNC, args);
+}
+
+/* Read a whole procfs file; these don't report a length. */
+static char * read_all(char * path, size_t * out_size) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	size_t size = 0;
+	size_t avail = 0x10000;
+	char * buf = malloc(avail);
+	int r;
+	while ((r = read(fd, buf + size, avail - size)) > 0) {
+		size += r;
+		if (size == avail) {
+			avail *= 2;
+			buf = realloc(buf, avail);
+		}
+	}
+	close(fd);
+	*out_size = size;
+	return buf;
+}
+
+static uint32_t parse_hex(char * c) {
+	uint32_t out = 0;
+	for (; *c; ++c) {
+		if (*c >= '0' && *c <= '9') out = (out << 4) | (*c - '0');
+		else if (*c >= 'a' && *c <= 'f') out = (out << 4) | (*c - 'a' + 10);
+		else break;
+	}
+	return out;
+}
+
+static void load_symbols(void) {
+	size_t size;
+	char * buf = read_all("/proc/ksyms", &size);
+	if (!buf) return;
+
+	size_t avail = 1024;
+	symbols = malloc(sizeof(struct symbol) * avail);
+
+	char * line = buf;
+	char * end = buf + size;
+	while (line < end) {
+		char * nl = memchr(line, '\n', end - line);
+		if (!nl) break;
+		*nl = '\0';
+		char * space = strchr(line, ' ');
+		if (space) {
+			if (symbol_count == avail) {
+				avail *= 2;
+				symbols = realloc(symbols, sizeof(struct symbol) * avail);
+			}
+			symbols[symbol_count].addr = parse_hex(line);
+			symbols[symbol_count].name = space + 1;
+			symbols[symbol_count].hits = 0;
+			symbol_count++;
+		}
+		line = nl + 1;
+	}
+}
+
+/* /proc/ksyms is sorted by address */
+static struct symbol * find_symbol(uint32_t addr) {
+	if (!symbol_count || addr < symbols[0].addr) return NULL;
+	size_t lo = 0, hi = symbol_count;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (symbols[mid].addr <= addr) lo = mid;
+		else hi = mid;
+	}
+	return &symbols[lo];
+}
+
+static void latency_add(struct latency * l, uint32_t cycles) {
+	l->count++;
+	l->total += cycles;
+	if (cycles > l->max) l->max = cycles;
+	uint32_t us = tsc_per_us ? cycles / tsc_per_us : cycles;
+	int bucket = 0;
+	while (us > 1 && bucket < HISTOGRAM_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+	l->buckets[bucket]++;
+}
+
+static uint32_t to_us(uint64_t cycles) {
+	return tsc_per_us ? (uint32_t)(cycles / tsc_per_us) : (uint32_t)cycles;
+}
+
+static void print_histogram(char * title, struct latency * l) {
+	if (!l->count) return;
+
+	printf("\n%s: %lu events, avg %lu, max %lu %s\n", title, l->count,
+			to_us(l->total / l->count), to_us(l->max), tsc_per_us ? "us" : "cycles");
+
+	uint32_t peak = 0;
+	int last = 0;
+	for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+		if (l->buckets[i] > peak) peak = l->buckets[i];
+		if (l->buckets[i]) last = i;
+	}
+
+	for (int i = 0; i <= last; ++i) {
+		char bar[HISTOGRAM_WIDTH + 1];
+		int width = l->buckets[i] * HISTOGRAM_WIDTH / peak;
+		memset(bar, '#', width);
+		bar[width] = '\0';
+		printf("  %8u - %-8u %7lu |%s\n", i ? 1 << i : 0, (1 << (i + 1)) - 1, l->buckets[i], bar);
+	}
+}
+
+static void print_share(uint32_t hits, uint32_t samples, char * what, int pid) {
+	uint32_t permille = (uint64_t)hits * 1000 / samples;
+	printf("  %3lu.%lu %8lu  ", permille / 10, permille % 10, hits);
+	if (pid >= 0) printf("[user pid %d]\n", pid);
+	else printf("%s\n", what);
+}
+
+static int by_hits(const void * a, const void * b) {
+	const struct symbol * x = *(const struct symbol **)a;
+	const struct symbol * y = *(const struct symbol **)b;
+	return (int)y->hits - (int)x->hits;
+}
+
+static struct latency * by_total_base;
+static int by_total(const void * a, const void * b) {
+	struct latency * x = &by_total_base[*(const int *)a];
+	struct latency * y = &by_total_base[*(const int *)b];
+	if (x->total == y->total) return 0;
+	return x->total < y->total ? 1 : -1;
+}
+
+int main(int argc, char * argv[]) {
+	uint32_t mask = TRACE_MASK_ALL;
+	int top = 20;
+	int seconds = 5;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "e:n:t:?")) != -1) {
+		switch (opt) {
+			case 'e':
+				mask = 0;
+				for (char * c = optarg; *c; ++c) {
+					switch (*c) {
+						case 's': mask |= TRACE_MASK(TRACE_SAMPLE); break;
+						case 'c': mask |= TRACE_MASK(TRACE_SYSCALL); break;
+						case 'w': mask |= TRACE_MASK(TRACE_SWITCH); break;
+						case 'f': mask |= TRACE_MASK(TRACE_PAGE_FAULT); break;
+						case 'i': mask |= TRACE_MASK(TRACE_IRQ); break;
+						case 'b': mask |= TRACE_MASK(TRACE_BLOCK); break;
+						default:
+							usage(argv);
+							return 1;
+					}
+				}
+				break;
+			case 'n':
+				top = atoi(optarg);
+				break;
+			case 't':
+				seconds = atoi(optarg);
+				break;
+			case '?':
+				usage(argv);
+				return 1;
+		}
+	}
+
+	/* Load symbols first so reading them doesn't show up in the trace */
+	load_symbols();
+
+	if (trace_set(mask, 1) < 0) {
+		fprintf(stderr, "%s: could not enable tracing (are you root?)\n", argv[0]);
+		return 1;
+	}
+
+	if (optind < argc) {
+		pid_t child = fork();
+		if (!child) {
+			execvp(argv[optind], &argv[optind]);
+			fprintf(stderr, "%s: %s: command not found\n", argv[0], argv[optind]);
+			exit(127);
+		}
+		waitpid(child, NULL, 0);
+	} else {
+		sleep(seconds);
+	}
+
+	trace_set(0, 0);
+
+	size_t size;
+	char * data = read_all("/proc/trace", &size);
+	trace_header_t * header = (trace_header_t *)data;
+	if (!data || size < sizeof(trace_header_t) || header->magic != TRACE_MAGIC ||
+			header->record_size != sizeof(trace_record_t)) {
+		fprintf(stderr, "%s: /proc/trace is missing or in an unexpected format\n", argv[0]);
+		return 1;
+	}
+
+	tsc_per_us = header->tsc_per_ms / 1000;
+	trace_record_t * records = (trace_record_t *)(data + sizeof(trace_header_t));
+	uint32_t count = (size - sizeof(trace_header_t)) / sizeof(trace_record_t);
+	if (count > header->count) count = header->count;
+
+	uint32_t samples = 0, user_samples = 0, unknown_samples = 0;
+	uint32_t switches = 0, faults = 0;
+	uint32_t irqs[16] = {0};
+	uint32_t block_read = 0, block_written = 0;
+	static uint32_t user_by_pid[MAX_PIDS];
+	static struct latency syscalls[MAX_SYSCALLS];
+	struct latency syscall_all = {0}, irq_all = {0}, block_all = {0};
+
+	for (uint32_t i = 0; i < count; ++i) {
+		trace_record_t * r = &records[i];
+		switch (r->type) {
+			case TRACE_SAMPLE:
+				samples++;
+				if (r->arg2) {
+					user_samples++;
+					if (r->pid < MAX_PIDS) user_by_pid[r->pid]++;
+				} else {
+					struct symbol * s = find_symbol(r->arg);
+					if (s) s->hits++;
+					else unknown_samples++;
+				}
+				break;
+			case TRACE_SYSCALL:
+				latency_add(&syscall_all, r->duration);
+				if (r->arg < MAX_SYSCALLS) latency_add(&syscalls[r->arg], r->duration);
+				break;
+			case TRACE_SWITCH:
+				switches++;
+				break;
+			case TRACE_PAGE_FAULT:
+				faults++;
+				break;
+			case TRACE_IRQ:
+				if (r->arg < 16) irqs[r->arg]++;
+				if (r->duration) latency_add(&irq_all, r->duration);
+				break;
+			case TRACE_BLOCK:
+				if (r->arg2 & TRACE_BLOCK_WRITE) block_written += r->arg2 & ~TRACE_BLOCK_WRITE;
+				else block_read += r->arg2;
+				latency_add(&block_all, r->duration);
+				break;
+		}
+	}
+
+	printf("%lu records", count);
+	if (header->dropped) printf(" (%lu older records were overwritten)", header->dropped);
+	printf(", %lu context switches, %lu page faults\n", switches, faults);
+
+	if (samples) {
+		printf("\n%lu samples, %lu in userspace\n", samples, user_samples);
+
+		struct symbol ** hot = malloc(sizeof(struct symbol *) * (symbol_count + 1));
+		size_t hot_count = 0;
+		for (size_t i = 0; i < symbol_count; ++i) {
+			if (symbols[i].hits) hot[hot_count++] = &symbols[i];
+		}
+		qsort(hot, hot_count, sizeof(struct symbol *), by_hits);
+
+		printf("\n      %%   samples  function\n");
+		for (size_t i = 0; i < hot_count && (int)i < top; ++i) {
+			print_share(hot[i]->hits, samples, hot[i]->name, -1);
+		}
+		if (unknown_samples) {
+			print_share(unknown_samples, samples, "[unknown]", -1);
+		}
+		for (int pid = 0; pid < MAX_PIDS; ++pid) {
+			if (user_by_pid[pid]) {
+				print_share(user_by_pid[pid], samples, NULL, pid);
+			}
+		}
+	}
+
+	if (syscall_all.count) {
+		print_histogram("System calls", &syscall_all);
+
+		int order[MAX_SYSCALLS];
+		int used = 0;
+		for (int i = 0; i < MAX_SYSCALLS; ++i) {
+			if (syscalls[i].count) order[used++] = i;
+		}
+		by_total_base = syscalls;
+		qsort(order, used, sizeof(int), by_total);
+
+		printf("\n  syscall    count      total        avg        max\n");
+		for (int i = 0; i < used && i < top; ++i) {
+			struct latency * l = &syscalls[order[i]];
+			printf("  %7d %8lu %10lu %10lu %10lu\n", order[i], l->count,
+					to_us(l->total), to_us(l->total / l->count), to_us(l->max));
+		}
+	}
+
+	if (irq_all.count) {
+		print_histogram("Interrupts (excluding those that switched tasks)", &irq_all);
+		printf("\n");
+		for (int i = 0; i < 16; ++i) {
+			if (irqs[i]) printf("  irq %2d: %lu\n", i, irqs[i]);
+		}
+	}
+
+	if (block_all.count) {
+		print_histogram("Block requests", &block_all);
+		printf("\n  read %lu bytes, wrote %lu bytes\n", block_read, block_written);
+	}
+
+	return 0;
+}
@@ -88,6 +88,30 @@ static const char * color_str(struct stat * sb) {
 	}
 }
 
+/* File type bits for a d_type, for entries that don't need a stat() */
+static int dtype_mode(unsigned char type) {
+	switch (type) {
+		case DT_DIR:  return S_IFDIR;
+		case DT_LNK:  return S_IFLNK;
+		case DT_REG:  return S_IFREG;
+		case DT_CHR:  return S_IFCHR;
+		case DT_BLK:  return S_IFBLK;
+		case DT_FIFO: return S_IFIFO;
+		case DT_SOCK: return S_IFSOCK;
+		default:      return 0;
+	}
+}
+
+/*
+ * Short listings only need each entry's type, except that colored
+ * output looks at the permission bits of files and devices.
+ */
+static int needs_stat(struct dirent * ent) {
+	if (long_mode || ent->d_type == DT_UNKNOWN) return 1;
+	if (ent->d_type == DT_DIR || ent->d_type == DT_LNK) return 0;
+	return stdout_is_tty;
+}
+
 static int filecmp(const void * c1, const void * c2) {
 	const struct tfile * d1 = *(const struct tfile **)c1;
 	const struct tfile * d2 = *(const struct tfile **)c2;
@@ -321,13 +345,19 @@ static int display_dir(char * p) {
 
 			f->name = strdup(ent->d_name);
 
-			char tmp[strlen(p)+strlen(ent->d_name)+2];
-			sprintf(tmp, "%s/%s", p, ent->d_name);
-			lstat(tmp, &f->statbuf);
-			if (S_ISLNK(f->statbuf.st_mode)) {
-				stat(tmp, &f->statbufl);
-				f->link = malloc(4096);
-				readlink(tmp, f->link, 4096);
+			if (!needs_stat(ent)) {
+				memset(&f->statbuf, 0, sizeof(struct stat));
+				f->statbuf.st_mode = dtype_mode(ent->d_type);
+				f->link = NULL;
+			} else {
+				char tmp[strlen(p)+strlen(ent->d_name)+2];
+				sprintf(tmp, "%s/%s", p, ent->d_name);
+				lstat(tmp, &f->statbuf);
+				if (S_ISLNK(f->statbuf.st_mode)) {
+					stat(tmp, &f->statbufl);
+					f->link = malloc(4096);
+					readlink(tmp, f->link, 4096);
+				}
 			}
 
 			list_insert(ents_list, (void *)f);
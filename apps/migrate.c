@@ -5,10 +5,11 @@
  *
  * migrate - Relocate root filesystem to tmpfs
  *
- * Run as part of system startup to move the ext2 root ramdisk
- * into a flexible in-memory temporary filesystem, which allows
- * file creation and editing and is much faster than the using
- * the ext2 driver against the static in-memory ramdisk.
+ * Run as part of system startup to make the root filesystem
+ * writable. A compressed (rofs) root gets a tmpfs overlay, which
+ * copies nothing up front; an ext2 root is copied into a tmpfs,
+ * which allows file creation and editing and is much faster than
+ * using the ext2 driver against the static in-memory ramdisk.
  *
  * Based on the original Python implementation.
  */
@@ -212,6 +213,12 @@ int main(int argc, char * argv[]) {
 		root_type = "ext2";
 	}
 
+	if (!strcmp(root_type, "rofs")) {
+		TRACE_("Overlaying tmpfs on root");
+		system("mount overlay / /");
+		return 0;
+	}
+
 	char tmp[1024];
 
 	TRACE_("Remounting root to /dev/base");
@@ -0,0 +1,140 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * mmap-bench - Large allocations and file mappings
+ *
+ * Times malloc() and free() of large blocks, shows how much memory
+ * the process holds while they are allocated and after they are
+ * freed, and optionally compares reading a file with read() against
+ * touching it through mmap().
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "bench.h"
+
+static void report(const char * what, unsigned long start, int count) {
+	unsigned long elapsed = now_us() - start;
+	printf("%-24s %6d in %8luus, %.1fus each\n", what, count, elapsed,
+		count ? (double)elapsed / count : 0.0);
+}
+
+static void touch(char * p, size_t size) {
+	for (size_t i = 0; i < size; i += 0x1000) {
+		p[i] = 1;
+	}
+}
+
+static void bench_file(const char * path) {
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "can't open %s\n", path);
+		return;
+	}
+
+	unsigned long sum = 0;
+	char * buf = malloc(0x10000);
+	unsigned long start = now_us();
+	ssize_t r;
+	while ((r = read(fd, buf, 0x10000)) > 0) {
+		for (ssize_t i = 0; i < r; i += 0x1000) sum += buf[i];
+	}
+	report("read() file", start, 1);
+	free(buf);
+
+	start = now_us();
+	unsigned char * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "mmap of %s failed\n", path);
+		close(fd);
+		return;
+	}
+	unsigned long msum = 0;
+	for (size_t i = 0; i < (size_t)st.st_size; i += 0x1000) msum += (char)map[i];
+	munmap(map, st.st_size);
+	report("mmap() file", start, 1);
+
+	if (sum != msum) {
+		fprintf(stderr, "contents differ between read() and mmap()\n");
+	}
+	close(fd);
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-n count] [-s size] [-f file]\n"
+			"\n"
+			" -n  number of blocks (default 64)\n"
+			" -s  size of each block in kB (default 256)\n"
+			" -f  also compare read() and mmap() of this file\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	int count = 64;
+	size_t size = 256 * 1024;
+	char * file = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:s:f:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = atoi(optarg);
+				break;
+			case 's':
+				size = atoi(optarg) * 1024;
+				break;
+			case 'f':
+				file = optarg;
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (count < 1 || !size) return usage(argv);
+
+	char ** blocks = malloc(sizeof(char *) * count);
+	int before = vm_size();
+
+	unsigned long start = now_us();
+	for (int i = 0; i < count; ++i) {
+		blocks[i] = malloc(size);
+		touch(blocks[i], size);
+	}
+	report("malloc+touch", start, count);
+	int peak = vm_size();
+
+	start = now_us();
+	for (int i = 0; i < count; ++i) {
+		free(blocks[i]);
+	}
+	report("free", start, count);
+	int after = vm_size();
+
+	start = now_us();
+	for (int i = 0; i < count; ++i) {
+		char * p = malloc(size);
+		touch(p, size);
+		free(p);
+	}
+	report("malloc+touch+free", start, count);
+
+	printf("VmSize: %d kB before, %d kB with %d blocks of %zu kB, %d kB after freeing\n",
+		before, peak, count, size / 1024, after);
+
+	if (file) {
+		bench_file(file);
+	}
+
+	return 0;
+}
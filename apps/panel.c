@@ -32,7 +32,9 @@
 #include <toaru/sdf.h>
 #include <toaru/icon_cache.h>
 #include <toaru/menu.h>
+#include <toaru/widget.h>
 #include <kernel/mod/sound.h>
+#include <kernel/procsnap.h>
 
 #define PANEL_HEIGHT 28
 #define FONT_SIZE 14
@@ -94,6 +96,7 @@ static int height;
 static int widgets_width = 0;
 static int widgets_volume_enabled = 0;
 static int widgets_network_enabled = 0;
+static int widgets_cpu_enabled = 0;
 
 static int network_status = 0;
 
@@ -295,6 +298,31 @@ static char * netstat_dns = NULL;
 static struct MenuEntry_Normal * netstat_mac_entry;
 static char * netstat_mac = NULL;
 
+#define CPU_HISTORY 20
+static int cpu_history[CPU_HISTORY] = {0}; /* permille busy, oldest first */
+static procsnap_header_t cpu_last;
+
+/*
+ * Only the snapshot header is read; with no room for records the
+ * kernel skips walking the process list entirely.
+ */
+static void update_cpu_usage(void) {
+	procsnap_header_t header;
+	int fd = open("/proc/snapshot", O_RDONLY);
+	if (fd < 0) return;
+	int r = read(fd, &header, sizeof(header));
+	close(fd);
+	if (r < (int)sizeof(header) || header.magic != PROCSNAP_MAGIC) return;
+
+	if (cpu_last.magic) {
+		uint32_t busy = (header.cpu_user - cpu_last.cpu_user) + (header.cpu_system - cpu_last.cpu_system);
+		uint32_t total = busy + (header.cpu_idle - cpu_last.cpu_idle);
+		memmove(cpu_history, cpu_history + 1, sizeof(int) * (CPU_HISTORY - 1));
+		cpu_history[CPU_HISTORY - 1] = total ? busy * 1000 / total : 0;
+	}
+	cpu_last = header;
+}
+
 static void update_network_status(void) {
 	FILE * net = fopen("/proc/netif","r");
 
@@ -456,6 +484,12 @@ static void panel_check_click(struct yutani_msg_window_mouse_event * evt) {
 				}
 				widget++;
 			}
+			if (widgets_cpu_enabled) {
+				if (evt->new_x > WIDGET_POSITION(widget) && evt->new_x < WIDGET_POSITION(widget-1)) {
+					launch_application("exec terminal top");
+				}
+				widget++;
+			}
 		} else if (evt->buttons & YUTANI_MOUSE_BUTTON_RIGHT) {
 			if (evt->new_x >= APP_OFFSET && evt->new_x < LEFT_BOUND) {
 				for (int i = 0; i < MAX_WINDOW_COUNT; ++i) {
@@ -775,185 +809,321 @@ static void handle_key_event(struct yutani_msg_key_event * ke) {
 
 }
 
-static void redraw(void) {
-	spin_lock(&drawlock);
+/*
+ * Panel widgets
+ *
+ * Each part of the panel is a widget that remembers what it last
+ * showed. redraw() works out what each one should show now, and only
+ * the ones that changed are repainted and flipped, so the clock
+ * ticking doesn't redraw the window list.
+ */
 
-	struct timeval now;
-	struct tm * timeinfo;
-	char   buffer[80];
+static widget_tree_t * panel_widgets = NULL;
 
-	uint32_t txt_color = TEXT_COLOR;
-	int t = 0;
+static widget_t * widget_appmenu = NULL;
+static widget_t * widget_network = NULL;
+static widget_t * widget_volume = NULL;
+static widget_t * widget_cpu = NULL;
+static widget_t * widget_clock = NULL;
+static widget_t * widget_logout = NULL;
 
-	/* Redraw the background */
-	memcpy(ctx->backbuffer, bg_blob, bg_size);
+static int appmenu_shown = -1;
+static int network_shown = -1;
+static int volume_shown = -1;
+static int logout_shown = -1;
+static int cpu_shown[CPU_HISTORY];
 
-	/* Get the current time for the clock */
-	gettimeofday(&now, NULL);
-	timeinfo = localtime((time_t *)&now.tv_sec);
+static char clock_time[16];
+static char clock_day[32];
+static char clock_date[32];
+
+struct window_cell {
+	widget_t * widget;
+	char * name;     /* Full title */
+	char * icon;
+	char title[50];  /* Title as shown, shortened to fit */
+	int title_width; /* What it was shortened for */
+	int focused;
+	int hilighted;
+};
+
+static struct window_cell cells[MAX_WINDOW_COUNT];
+static int cell_count = 0;
 
+static void set_state(widget_t * widget, int * shown, int state) {
+	if (*shown != state) {
+		*shown = state;
+		widget_invalidate(widget);
+	}
+}
+
+static void set_string(widget_t * widget, char * shown, size_t size, const char * string) {
+	/* Only what fits is kept, so only that is compared */
+	if (strncmp(shown, string, size - 1)) {
+		size_t len = strlen(string);
+		if (len > size - 1) len = size - 1;
+		memcpy(shown, string, len);
+		shown[len] = '\0';
+		widget_invalidate(widget);
+	}
+}
+
+static void draw_background(widget_tree_t * tree, gfx_context_t * ctx, widget_rect_t * rect) {
+	for (int y = rect->y; y < rect->y + rect->height; ++y) {
+		memcpy(&GFX(ctx, rect->x, y), &bg_blob[y * GFX_S(ctx) + rect->x * GFX_B(ctx)], rect->width * GFX_B(ctx));
+	}
+}
+
+static void draw_appmenu(widget_t * self, gfx_context_t * ctx) {
+	draw_sdf_string(ctx, 8, 3, "Applications", 20, appmenu_shown ? HILIGHT_COLOR : TEXT_COLOR, SDF_FONT_THIN);
+}
+
+static void draw_network(widget_t * self, gfx_context_t * ctx) {
+	uint32_t color = (network_shown & 2) ? HILIGHT_COLOR : ICON_COLOR;
+	draw_sprite_alpha_paint(ctx, (network_shown & 1) ? sprite_net_active : sprite_net_disabled, 0, 0, 1.0, color);
+}
+
+static void draw_volume(widget_t * self, gfx_context_t * ctx) {
+	sprite_t * sprites[] = {sprite_volume_mute, sprite_volume_low, sprite_volume_med, sprite_volume_high};
+	draw_sprite_alpha_paint(ctx, sprites[volume_shown], 0, 0, 1.0, ICON_COLOR);
+}
+
+static void draw_cpu(widget_t * self, gfx_context_t * ctx) {
+	/* One column per second of history, scaled to the panel */
+	int graph_height = PANEL_HEIGHT - 8;
+	int left = (WIDGET_WIDTH - CPU_HISTORY) / 2;
+	for (int i = 0; i < CPU_HISTORY; ++i) {
+		int h = cpu_shown[i] * graph_height / 1000;
+		if (h) draw_rectangle(ctx, left + i, 4 + graph_height - h, 1, h, ICON_COLOR);
+	}
+	draw_line(ctx, left, left + CPU_HISTORY - 1, 4 + graph_height, 4 + graph_height, ICON_COLOR);
+}
+
+static void draw_clock(widget_t * self, gfx_context_t * ctx) {
 	/* Hours : Minutes : Seconds */
-	strftime(buffer, 80, "%H:%M:%S", timeinfo);
-	draw_sdf_string(ctx, width - TIME_LEFT, 3, buffer, 20, txt_color, SDF_FONT_THIN);
+	draw_sdf_string(ctx, DATE_WIDTH, 3, clock_time, 20, TEXT_COLOR, SDF_FONT_THIN);
 
 	/* Day-of-week */
-	strftime(buffer, 80, "%A", timeinfo);
-	t = draw_sdf_string_width(buffer, 12, SDF_FONT_THIN);
+	int t = draw_sdf_string_width(clock_day, 12, SDF_FONT_THIN);
 	t = (DATE_WIDTH - t) / 2;
-	draw_sdf_string(ctx, width - TIME_LEFT - DATE_WIDTH + t, 2, buffer, 12, txt_color, SDF_FONT_THIN);
+	draw_sdf_string(ctx, t, 2, clock_day, 12, TEXT_COLOR, SDF_FONT_THIN);
 
 	/* Month Day */
-	strftime(buffer, 80, "%h %e", timeinfo);
-	t = draw_sdf_string_width(buffer, 12, SDF_FONT_BOLD);
+	t = draw_sdf_string_width(clock_date, 12, SDF_FONT_BOLD);
 	t = (DATE_WIDTH - t) / 2;
-	draw_sdf_string(ctx, width - TIME_LEFT - DATE_WIDTH + t, 12, buffer, 12, txt_color, SDF_FONT_BOLD);
+	draw_sdf_string(ctx, t, 12, clock_date, 12, TEXT_COLOR, SDF_FONT_BOLD);
+}
 
-	/* Applications menu */
-	draw_sdf_string(ctx, 8, 3, "Applications", 20, appmenu->window ? HILIGHT_COLOR : txt_color, SDF_FONT_THIN);
+static void draw_logout(widget_t * self, gfx_context_t * ctx) {
+	/* XXX This should probably have some sort of focus hilight */
+	draw_sprite_alpha_paint(ctx, sprite_logout, 1, 1, 1.0, logout_shown ? HILIGHT_COLOR : ICON_COLOR);
+}
 
-	/* Draw each widget */
-	/* - Volume */
-	int widget = 0;
-	if (widgets_network_enabled) {
-		uint32_t color = (netstat && netstat->window) ? HILIGHT_COLOR : ICON_COLOR;
-		if (network_status == 1) {
-			draw_sprite_alpha_paint(ctx, sprite_net_active, WIDGET_POSITION(widget), 0, 1.0, color);
-		} else {
-			draw_sprite_alpha_paint(ctx, sprite_net_disabled, WIDGET_POSITION(widget), 0, 1.0, color);
+static void draw_window_cell(widget_t * self, gfx_context_t * ctx) {
+	struct window_cell * cell = self->data;
+	int w = self->bounds.width;
+
+	/* Hilight the focused window */
+	if (cell->focused) {
+		for (int y = 0; y < GRADIENT_HEIGHT; ++y) {
+			for (int x = 0; x < w; ++x) {
+				GFX(ctx, x, y) = alpha_blend_rgba(GFX(ctx, x, y), GRADIENT_AT(y));
+			}
 		}
-		widget++;
 	}
-	if (widgets_volume_enabled) {
-		if (volume_level < 10) {
-			draw_sprite_alpha_paint(ctx, sprite_volume_mute, WIDGET_POSITION(widget), 0, 1.0, ICON_COLOR);
-		} else if (volume_level < 0x547ae147) {
-			draw_sprite_alpha_paint(ctx, sprite_volume_low, WIDGET_POSITION(widget), 0, 1.0, ICON_COLOR);
-		} else if (volume_level < 0xa8f5c28e) {
-			draw_sprite_alpha_paint(ctx, sprite_volume_med, WIDGET_POSITION(widget), 0, 1.0, ICON_COLOR);
+
+	/* Get the icon for this window */
+	sprite_t * icon = icon_get_48(cell->icon);
+
+	{
+		sprite_t * _tmp_s = create_sprite(48, PANEL_HEIGHT-2, ALPHA_EMBEDDED);
+		gfx_context_t * _tmp = init_graphics_sprite(_tmp_s);
+
+		draw_fill(_tmp, rgba(0,0,0,0));
+		/* Draw it, scaled if necessary */
+		if (icon->width == 48) {
+			draw_sprite(_tmp, icon, 0, 0);
 		} else {
-			draw_sprite_alpha_paint(ctx, sprite_volume_high, WIDGET_POSITION(widget), 0, 1.0, ICON_COLOR);
+			draw_sprite_scaled(_tmp, icon, 0, 0, 48, 48);
 		}
-		widget++;
+
+		free(_tmp);
+		draw_sprite_alpha(ctx, _tmp_s, w - 48 - 2, 0, 0.7);
+		sprite_free(_tmp_s);
 	}
 
-	/* Now draw the window list */
+	{
+		sprite_t * _tmp_s = create_sprite(w, PANEL_HEIGHT, ALPHA_EMBEDDED);
+		gfx_context_t * _tmp = init_graphics_sprite(_tmp_s);
+
+		draw_fill(_tmp, rgba(0,0,0,0));
+		draw_sdf_string(_tmp, 0, 0, cell->title, 16, rgb(0,0,0), SDF_FONT_THIN);
+		blur_context_box(_tmp, 4);
+
+		free(_tmp);
+		draw_sprite(ctx, _tmp_s, 2, TEXT_Y_OFFSET + 2);
+		sprite_free(_tmp_s);
+	}
+
+	/* Then draw the window title, with appropriate color */
+	uint32_t color = TEXT_COLOR;
+	if (cell->hilighted) {
+		/* Current hilighted - title should be a light blue */
+		color = HILIGHT_COLOR;
+	} else if (cell->focused) {
+		/* Top window should be white */
+		color = FOCUS_COLOR;
+	}
+	draw_sdf_string(ctx, 2, TEXT_Y_OFFSET + 2, cell->title, 16, color, SDF_FONT_THIN);
+}
+
+/* Shorten a title with an ellipsis until it fits in a window list cell */
+static void fit_title(char * out, const char * name, int w) {
+	memset(out, 0x0, 50);
+	if (w <= MIN_TEXT_WIDTH) return;
+
+	int t_l = strlen(name);
+	if (t_l > 45) {
+		t_l = 45;
+	}
+	for (int i = 0; i < t_l;  ++i) {
+		out[i] = name[i];
+		if (!name[i]) break;
+	}
+
+	while (t_l > 0 && draw_sdf_string_width(out, 16, SDF_FONT_THIN) > w - ICON_PADDING) {
+		t_l--;
+		out[t_l] = '.';
+		out[t_l+1] = '.';
+		out[t_l+2] = '.';
+		out[t_l+3] = '\0';
+	}
+}
+
+static void update_window_cells(void) {
 	int i = 0, j = 0;
+	int w = title_width > MIN_TEXT_WIDTH ? title_width : 0;
+
 	spin_lock(&lock);
-	if (window_list) {
+	if (window_list && w) {
 		foreach(node, window_list) {
 			struct window_ad * ad = node->value;
-			char * s = "";
-			char tmp_title[50];
-			int w = 0;
 
-			if (APP_OFFSET + i + w > LEFT_BOUND) {
+			if (APP_OFFSET + i + w > LEFT_BOUND || j >= MAX_WINDOW_COUNT) {
 				break;
 			}
 
-			if (title_width > MIN_TEXT_WIDTH) {
-
-				memset(tmp_title, 0x0, 50);
-				int t_l = strlen(ad->name);
-				if (t_l > 45) {
-					t_l = 45;
-				}
-				for (int i = 0; i < t_l;  ++i) {
-					tmp_title[i] = ad->name[i];
-					if (!ad->name[i]) break;
-				}
-
-				while (draw_sdf_string_width(tmp_title, 16, SDF_FONT_THIN) > title_width - ICON_PADDING) {
-					t_l--;
-					tmp_title[t_l] = '.';
-					tmp_title[t_l+1] = '.';
-					tmp_title[t_l+2] = '.';
-					tmp_title[t_l+3] = '\0';
-				}
-				w += title_width;
-
-				s = tmp_title;
+			struct window_cell * cell = &cells[j];
+			if (!cell->widget) {
+				cell->widget = widget_create(panel_widgets->root, APP_OFFSET + i, 0, w, PANEL_HEIGHT, draw_window_cell, cell);
 			}
-
-			/* Hilight the focused window */
-			if (ad->flags & 1) {
-				/* This is the focused window */
-				for (int y = 0; y < GRADIENT_HEIGHT; ++y) {
-					for (int x = APP_OFFSET + i; x < APP_OFFSET + i + w; ++x) {
-						GFX(ctx, x, y) = alpha_blend_rgba(GFX(ctx, x, y), GRADIENT_AT(y));
-					}
-				}
+			widget_move(cell->widget, APP_OFFSET + i, 0, w, PANEL_HEIGHT);
+
+			if (!cell->name || strcmp(cell->name, ad->name) || cell->title_width != w) {
+				free(cell->name);
+				cell->name = strdup(ad->name);
+				cell->title_width = w;
+				fit_title(cell->title, ad->name, w);
+				widget_invalidate(cell->widget);
 			}
+			if (!cell->icon || strcmp(cell->icon, ad->icon)) {
+				free(cell->icon);
+				cell->icon = strdup(ad->icon);
+				widget_invalidate(cell->widget);
+			}
+			set_state(cell->widget, &cell->focused, ad->flags & 1);
+			set_state(cell->widget, &cell->hilighted, j == focused_app);
 
-			/* Get the icon for this window */
-			sprite_t * icon = icon_get_48(ad->icon);
+			/* XXX This keeps track of how far left each window list item is
+			 * so we can map clicks up in the mouse callback. */
+			if (ads_by_l[j]) {
+				ads_by_l[j]->left = APP_OFFSET + i;
+			}
+			j++;
+			i += w;
+		}
+	}
+	spin_unlock(&lock);
 
-			{
-				sprite_t * _tmp_s = create_sprite(48, PANEL_HEIGHT-2, ALPHA_EMBEDDED);
-				gfx_context_t * _tmp = init_graphics_sprite(_tmp_s);
+	/* Windows that went away */
+	for (int k = j; k < cell_count; ++k) {
+		widget_free(cells[k].widget);
+		free(cells[k].name);
+		free(cells[k].icon);
+		memset(&cells[k], 0, sizeof(struct window_cell));
+	}
+	cell_count = j;
+}
 
-				draw_fill(_tmp, rgba(0,0,0,0));
-				/* Draw it, scaled if necessary */
-				if (icon->width == 48) {
-					draw_sprite(_tmp, icon, 0, 0);
-				} else {
-					draw_sprite_scaled(_tmp, icon, 0, 0, 48, 48);
-				}
+static void create_widgets(void) {
+	panel_widgets = widget_tree_create(yctx, panel, ctx, draw_background, NULL);
+	widget_t * root = panel_widgets->root;
 
-				free(_tmp);
-				draw_sprite_alpha(ctx, _tmp_s, APP_OFFSET + i + w - 48 - 2, 0, 0.7);
-				sprite_free(_tmp_s);
-			}
+	widget_appmenu = widget_create(root, 0, 0, APP_OFFSET, PANEL_HEIGHT, draw_appmenu, NULL);
+	if (widgets_network_enabled) widget_network = widget_create(root, 0, 0, WIDGET_WIDTH, PANEL_HEIGHT, draw_network, NULL);
+	if (widgets_volume_enabled)  widget_volume  = widget_create(root, 0, 0, WIDGET_WIDTH, PANEL_HEIGHT, draw_volume, NULL);
+	if (widgets_cpu_enabled)     widget_cpu     = widget_create(root, 0, 0, WIDGET_WIDTH, PANEL_HEIGHT, draw_cpu, NULL);
+	widget_clock  = widget_create(root, 0, 0, TIME_LEFT + DATE_WIDTH - 24, PANEL_HEIGHT, draw_clock, NULL);
+	widget_logout = widget_create(root, 0, 0, 24, PANEL_HEIGHT, draw_logout, NULL);
+}
 
+/* Place the widgets that are positioned from the right edge */
+static void layout_widgets(void) {
+	int widget = 0;
+	if (widget_network) widget_move(widget_network, WIDGET_POSITION(widget++), 0, WIDGET_WIDTH, PANEL_HEIGHT);
+	if (widget_volume)  widget_move(widget_volume,  WIDGET_POSITION(widget++), 0, WIDGET_WIDTH, PANEL_HEIGHT);
+	if (widget_cpu)     widget_move(widget_cpu,     WIDGET_POSITION(widget++), 0, WIDGET_WIDTH, PANEL_HEIGHT);
+	widget_move(widget_clock, width - TIME_LEFT - DATE_WIDTH, 0, TIME_LEFT + DATE_WIDTH - 24, PANEL_HEIGHT);
+	widget_move(widget_logout, width - 24, 0, 24, PANEL_HEIGHT);
+}
 
-			{
-				sprite_t * _tmp_s = create_sprite(w, PANEL_HEIGHT, ALPHA_EMBEDDED);
-				gfx_context_t * _tmp = init_graphics_sprite(_tmp_s);
+static void redraw(void) {
+	spin_lock(&drawlock);
 
-				draw_fill(_tmp, rgba(0,0,0,0));
-				draw_sdf_string(_tmp, 0, 0, s, 16, rgb(0,0,0), SDF_FONT_THIN);
-				blur_context_box(_tmp, 4);
+	struct timeval now;
+	struct tm * timeinfo;
+	char   buffer[80];
 
-				free(_tmp);
-				draw_sprite(ctx, _tmp_s, APP_OFFSET + i + 2, TEXT_Y_OFFSET + 2);
-				sprite_free(_tmp_s);
+	layout_widgets();
 
-			}
+	/* Get the current time for the clock */
+	gettimeofday(&now, NULL);
+	timeinfo = localtime((time_t *)&now.tv_sec);
+	strftime(buffer, 80, "%H:%M:%S", timeinfo);
+	set_string(widget_clock, clock_time, sizeof(clock_time), buffer);
+	strftime(buffer, 80, "%A", timeinfo);
+	set_string(widget_clock, clock_day, sizeof(clock_day), buffer);
+	strftime(buffer, 80, "%h %e", timeinfo);
+	set_string(widget_clock, clock_date, sizeof(clock_date), buffer);
 
-			if (title_width > MIN_TEXT_WIDTH) {
-				/* Then draw the window title, with appropriate color */
-				if (j == focused_app) {
-					/* Current hilighted - title should be a light blue */
-					draw_sdf_string(ctx, APP_OFFSET + i + 2, TEXT_Y_OFFSET + 2, s, 16, HILIGHT_COLOR, SDF_FONT_THIN);
-				} else {
-					if (ad->flags & 1) {
-						/* Top window should be white */
-						draw_sdf_string(ctx, APP_OFFSET + i + 2, TEXT_Y_OFFSET + 2, s, 16, FOCUS_COLOR, SDF_FONT_THIN);
-					} else {
-						/* Otherwise, off white */
-						draw_sdf_string(ctx, APP_OFFSET + i + 2, TEXT_Y_OFFSET + 2, s, 16, txt_color, SDF_FONT_THIN);
-					}
-				}
-			}
+	set_state(widget_appmenu, &appmenu_shown, !!appmenu->window);
+	set_state(widget_logout, &logout_shown, !!logout_menu->window);
 
-			/* XXX This keeps track of how far left each window list item is
-			 * so we can map clicks up in the mouse callback. */
-			if (j < MAX_WINDOW_COUNT) {
-				if (ads_by_l[j]) {
-					ads_by_l[j]->left = APP_OFFSET + i;
-				}
-			}
-			j++;
-			i += w;
+	if (widget_network) {
+		set_state(widget_network, &network_shown, (network_status == 1) | ((netstat && netstat->window) ? 2 : 0));
+	}
+	if (widget_volume) {
+		int level;
+		if (volume_level < 10) {
+			level = 0;
+		} else if (volume_level < 0x547ae147) {
+			level = 1;
+		} else if (volume_level < 0xa8f5c28e) {
+			level = 2;
+		} else {
+			level = 3;
 		}
+		set_state(widget_volume, &volume_shown, level);
+	}
+	if (widget_cpu && memcmp(cpu_shown, cpu_history, sizeof(cpu_history))) {
+		memcpy(cpu_shown, cpu_history, sizeof(cpu_history));
+		widget_invalidate(widget_cpu);
 	}
-	spin_unlock(&lock);
 
-	/* Draw the logout button; XXX This should probably have some sort of focus hilight */
-	draw_sprite_alpha_paint(ctx, sprite_logout, width - 23, 1, 1.0, (logout_menu->window ? HILIGHT_COLOR : ICON_COLOR)); /* Logout button */
+	update_window_cells();
 
-	/* Flip */
-	flip(ctx);
-	yutani_flip(yctx, panel);
+	/* Repaint and flip whatever changed */
+	widget_render(panel_widgets);
 
 	spin_unlock(&drawlock);
 }
@@ -1080,6 +1250,9 @@ static void resize_finish(int xwidth, int xheight) {
 	bg_blob = realloc(bg_blob, bg_size);
 	memcpy(bg_blob, ctx->backbuffer, bg_size);
 
+	/* Everything moves and gets redrawn */
+	widget_tree_resize(panel_widgets);
+
 	update_window_list();
 	redraw();
 }
@@ -1185,6 +1358,12 @@ int main (int argc, char ** argv) {
 		sprite_net_disabled->alpha = ALPHA_FORCE_SLOW_EMBEDDED;
 	}
 
+	if (!stat("/proc/snapshot",&stat_tmp)) {
+		widgets_cpu_enabled = 1;
+		widgets_width += WIDGET_WIDTH;
+		update_cpu_usage();
+	}
+
 	/* Draw the background */
 	for (int i = 0; i < width; i += sprite_panel->width) {
 		draw_sprite(ctx, sprite_panel, i, 0);
@@ -1195,6 +1374,8 @@ int main (int argc, char ** argv) {
 	bg_blob = malloc(bg_size);
 	memcpy(bg_blob, ctx->backbuffer, bg_size);
 
+	create_widgets();
+
 	/* Catch SIGINT */
 	signal(SIGINT, sig_int);
 	signal(SIGUSR2, sig_usr2);
@@ -1272,6 +1453,7 @@ int main (int argc, char ** argv) {
 				waitpid(-1, NULL, WNOHANG);
 				update_volume_level();
 				update_network_status();
+				if (widgets_cpu_enabled) update_cpu_usage();
 				redraw();
 			}
 		}
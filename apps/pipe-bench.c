@@ -0,0 +1,91 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * pipe-bench - Pipe throughput
+ *
+ * Pushes a block of data through a pipe() to a forked child that
+ * reads it back, once for each of a range of write sizes, and
+ * reports the time and throughput of each. Pipes are backed by the
+ * kernel's ring buffers, so small writes show the per-call cost and
+ * large ones, which wrap around the ring, the cost of the copies.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+static void run(char * data, size_t total, size_t chunk) {
+	int fds[2];
+	if (pipe(fds) < 0) {
+		fprintf(stderr, "pipe-bench: can't create a pipe\n");
+		exit(1);
+	}
+
+	unsigned long start = now_us();
+	pid_t child = fork();
+	if (!child) {
+		char buf[4096];
+		size_t got = 0;
+		close(fds[1]);
+		while (got < total) {
+			int r = read(fds[0], buf, sizeof(buf));
+			if (r <= 0) break;
+			got += r;
+		}
+		_exit(0);
+	}
+
+	close(fds[0]);
+	for (size_t written = 0; written < total; written += chunk) {
+		write(fds[1], data + written, total - written < chunk ? total - written : chunk);
+	}
+	waitpid(child, NULL, 0);
+	unsigned long elapsed = now_us() - start;
+	if (!elapsed) elapsed = 1;
+	close(fds[1]);
+
+	printf("%6lu byte writes: %8lu bytes in %8luus, %lu kB/s\n", (unsigned long)chunk,
+		(unsigned long)total, elapsed, (unsigned long)((unsigned long long)total * 1000000 / 1024 / elapsed));
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-s kB]\n"
+			"\n"
+			" -s  how much to send for each write size, in kB (default 4096)\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	size_t kb = 4096;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:h")) != -1) {
+		switch (opt) {
+			case 's':
+				kb = atoi(optarg);
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (!kb) return usage(argv);
+
+	size_t total = kb * 1024;
+	char * data = malloc(total);
+	memset(data, 'x', total);
+
+	static const size_t chunks[] = { 16, 256, 1000, 4096, 65536 };
+	for (size_t i = 0; i < sizeof(chunks) / sizeof(*chunks); ++i) {
+		run(data, total, chunks[i]);
+	}
+
+	return 0;
+}
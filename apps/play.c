@@ -6,23 +6,78 @@
  * play - Play back PCM samples
  *
  * This needs very specifically-formatted PCM data to function
- * properly - 16-bit, signed, stereo, little endian, and 48KHz.
+ * properly - 16-bit, signed, stereo, little endian. The sample
+ * rate defaults to 48KHz and can be changed with -r.
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <getopt.h>
 
 #include <sys/ioctl.h>
+#include <sys/fswait.h>
+
+#include <kernel/mod/sound.h>
+
+static void usage(char * argv[]) {
+	fprintf(stderr,
+			"play - Play back PCM samples\n"
+			"\n"
+			"usage: %s [-r rate] [-v volume] [-l frames] [-m] [-s] file\n"
+			"\n"
+			" -r: \033[3mSample rate of the input, in Hz\033[0m\n"
+			" -v: \033[3mStream volume, from 0.0 to 1.0\033[0m\n"
+			" -l: \033[3mStream buffer size, in frames\033[0m\n"
+			" -m: \033[3mWrite directly into a mapped ring instead of write()\033[0m\n"
+			" -s: \033[3mPrint mixer statistics when done\033[0m\n"
+			"\n", argv[0]);
+}
 
 int main(int argc, char * argv[]) {
+	uint32_t rate = 0;
+	uint32_t latency = 0;
+	double volume = -1.0;
+	int show_stats = 0;
+	int use_mmap = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:v:l:ms?")) != -1) {
+		switch (opt) {
+			case 'r':
+				rate = atoi(optarg);
+				break;
+			case 'v':
+				volume = atof(optarg);
+				break;
+			case 'l':
+				latency = atoi(optarg);
+				break;
+			case 'm':
+				use_mmap = 1;
+				break;
+			case 's':
+				show_stats = 1;
+				break;
+			case '?':
+				usage(argv);
+				return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv);
+		return 1;
+	}
+
 	int spkr = open("/dev/dsp", O_WRONLY);
 	int song;
-	if (!strcmp(argv[1], "-")) {
+	if (!strcmp(argv[optind], "-")) {
 		song = STDIN_FILENO;
 	} else {
-		song = open(argv[1], O_RDONLY);
+		song = open(argv[optind], O_RDONLY);
 	}
 
 	if (spkr == -1) {
@@ -35,10 +90,76 @@ int main(int argc, char * argv[]) {
 		return 2;
 	}
 
-	char buf[0x1000];
-	int r;
-	while ((r = read(song, buf, sizeof(buf)))) {
-		write(spkr, buf, r);
+	if (rate && ioctl(spkr, SND_DSP_SET_RATE, &rate) < 0) {
+		fprintf(stderr, "unsupported sample rate: %lu\n", rate);
+		return 1;
 	}
+
+	if (volume >= 0.0) {
+		uint32_t val = volume >= 1.0 ? SND_KNOB_MAX_VALUE : (uint32_t)(volume * SND_KNOB_MAX_VALUE);
+		ioctl(spkr, SND_DSP_SET_VOLUME, &val);
+	}
+
+	if (use_mmap) {
+		snd_dsp_mmap_request_t req = {
+			.frames = latency ? latency : 4096,
+			.period = (latency ? latency : 4096) / 4,
+		};
+		if (ioctl(spkr, SND_DSP_MMAP, &req) < 0) {
+			fprintf(stderr, "could not map dsp ring (frames must be a power of two)\n");
+			return 1;
+		}
+		snd_dsp_mmap_t * map = req.map;
+		uint32_t * ring = (uint32_t *)((char *)map + map->data_offset);
+		uint32_t mask = map->frames - 1;
+		int done = 0;
+		/* Bytes of a frame a short read left in the slot at write_ptr */
+		uint32_t partial = 0;
+		while (!done) {
+			/* Wait until a period's worth of the ring is free, then fill what we can */
+			fswait(1, &spkr);
+			uint32_t space = map->frames - (map->write_ptr - map->read_ptr);
+			while (space) {
+				uint32_t start = map->write_ptr & mask;
+				uint32_t count = space < map->frames - start ? space : map->frames - start;
+				int r = read(song, (char *)&ring[start] + partial, count * 4 - partial);
+				if (r <= 0) {
+					done = 1;
+					break;
+				}
+				/* Only publish whole frames; the rest stays put for the next read */
+				uint32_t frames = (partial + r) / 4;
+				partial = (partial + r) % 4;
+				map->write_ptr += frames;
+				space -= frames;
+			}
+		}
+		/* Let the mixer drain what's left */
+		while (map->read_ptr != map->write_ptr) {
+			fswait2(1, &spkr, 100);
+		}
+	} else {
+		if (latency && ioctl(spkr, SND_DSP_SET_LATENCY, &latency) < 0) {
+			fprintf(stderr, "unsupported buffer size: %lu\n", latency);
+			return 1;
+		}
+
+		char buf[0x1000];
+		int r;
+		while ((r = read(song, buf, sizeof(buf)))) {
+			write(spkr, buf, r);
+		}
+	}
+
+	if (show_stats) {
+		snd_dsp_stats_t stats;
+		if (ioctl(spkr, SND_DSP_GET_STATS, &stats) == 0) {
+			fprintf(stderr, "rate: %lu Hz, buffer: %lu frames\n", stats.rate, stats.latency);
+			fprintf(stderr, "frames played: %lu, underruns: %lu\n", stats.samples, stats.underruns);
+			fprintf(stderr, "periods: %lu, late: %lu, mix time: %lu cycles (max %lu)\n",
+					stats.periods, stats.late, stats.mix_time, stats.mix_time_max);
+		}
+	}
+
 	return 0;
 }
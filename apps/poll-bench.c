@@ -0,0 +1,155 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * poll-bench - Measure readiness wakeups over many pipes
+ *
+ * Opens a number of pipes and has a second thread write a newline
+ * into a few of them at a time, while the main thread waits on all of
+ * them with a pollset, poll() or fswait() and reads whatever is ready.
+ * Reports wakeups (returns from the wait) and descriptors handled
+ * per second.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/fswait.h>
+#include <sys/pollset.h>
+
+#include "bench.h"
+
+#define BURST 8
+
+enum { MODE_POLLSET, MODE_POLL, MODE_FSWAIT };
+
+static int pipe_count = 1000;
+static int (*pipes)[2];
+static volatile int running = 1;
+
+/* Writes land on a few pipes at once, so batching waits have something to batch */
+static void * writer(void * arg) {
+	unsigned int next = 0;
+	while (running) {
+		for (int i = 0; i < BURST; ++i) {
+			next = (next + 7919) % pipe_count;
+			write(pipes[next][1], "\n", 1);
+		}
+		sched_yield();
+	}
+	return NULL;
+}
+
+static void drain(int fd) {
+	char buf[64];
+	read(fd, buf, sizeof(buf));
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-n pipes] [-t seconds] [-m pollset|poll|fswait]\n"
+			"\n"
+			" -n  number of pipes (default 1000)\n"
+			" -t  how long to run (default 5)\n"
+			" -m  how to wait (default pollset)\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	int seconds = 5;
+	int mode = MODE_POLLSET;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:t:m:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				pipe_count = atoi(optarg);
+				break;
+			case 't':
+				seconds = atoi(optarg);
+				break;
+			case 'm':
+				if (!strcmp(optarg, "pollset")) mode = MODE_POLLSET;
+				else if (!strcmp(optarg, "poll")) mode = MODE_POLL;
+				else if (!strcmp(optarg, "fswait")) mode = MODE_FSWAIT;
+				else return usage(argv);
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (pipe_count < 1 || seconds < 1) return usage(argv);
+
+	pipes = malloc(sizeof(*pipes) * pipe_count);
+	int * read_fds = malloc(sizeof(int) * pipe_count);
+	struct pollfd * poll_fds = malloc(sizeof(struct pollfd) * pipe_count);
+	struct pollset_event * ready = malloc(sizeof(struct pollset_event) * pipe_count);
+
+	int set = pollset_create();
+	for (int i = 0; i < pipe_count; ++i) {
+		if (pipe(pipes[i]) < 0) {
+			fprintf(stderr, "%s: could only open %d pipes\n", argv[0], i);
+			return 1;
+		}
+		read_fds[i] = pipes[i][0];
+		poll_fds[i].fd = pipes[i][0];
+		poll_fds[i].events = POLLIN;
+		struct pollset_event ev = { pipes[i][0], POLLIN, 0, NULL };
+		pollset_ctl(set, POLLSET_ADD, pipes[i][0], &ev);
+	}
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, writer, NULL);
+
+	unsigned long wakeups = 0;
+	unsigned long handled = 0;
+	unsigned long start = now_us();
+	unsigned long end = start + seconds * 1000000UL;
+
+	while (now_us() < end) {
+		if (mode == MODE_POLLSET) {
+			int count = pollset_wait(set, ready, pipe_count, 100);
+			for (int i = 0; i < count; ++i) {
+				drain(ready[i].fd);
+			}
+			handled += count > 0 ? count : 0;
+		} else if (mode == MODE_POLL) {
+			int count = poll(poll_fds, pipe_count, 100);
+			for (int i = 0; i < pipe_count && count > 0; ++i) {
+				if (poll_fds[i].revents & POLLIN) {
+					drain(poll_fds[i].fd);
+					handled++;
+				}
+			}
+		} else {
+			int index = fswait2(pipe_count, read_fds, 100);
+			if (index >= 0 && index < pipe_count) {
+				drain(read_fds[index]);
+				handled++;
+			}
+		}
+		wakeups++;
+	}
+
+	double elapsed = (now_us() - start) / 1000000.0;
+
+	/* The writer may be blocked on a full pipe, so don't wait for it */
+	running = 0;
+	pthread_kill(thread, SIGKILL);
+
+	printf("%d pipes, %s: %.0f wakeups/s, %.0f descriptors/s (%.2f per wakeup)\n",
+		pipe_count,
+		mode == MODE_POLLSET ? "pollset" : mode == MODE_POLL ? "poll" : "fswait",
+		wakeups / elapsed,
+		handled / elapsed,
+		wakeups ? (double)handled / wakeups : 0.0);
+
+	return 0;
+}
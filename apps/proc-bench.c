@@ -0,0 +1,104 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * proc-bench - Process lookups with many processes around
+ *
+ * Starts a number of idle children, then times reading each one's
+ * /proc/<pid>/status, forking and reaping short-lived children while
+ * the idle ones are still there, and finally killing and reaping the
+ * idle ones.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+static void report(const char * what, unsigned long start, int count) {
+	unsigned long elapsed = now_us() - start;
+	printf("%-24s %6d in %8luus, %.1fus each\n", what, count, elapsed,
+		count ? (double)elapsed / count : 0.0);
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-n processes] [-f forks]\n"
+			"\n"
+			" -n  number of idle children (default 1000)\n"
+			" -f  number of fork/exit/wait rounds (default 1000)\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	int count = 1000;
+	int forks = 1000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:f:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = atoi(optarg);
+				break;
+			case 'f':
+				forks = atoi(optarg);
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (count < 0 || forks < 0) return usage(argv);
+
+	pid_t * children = malloc(sizeof(pid_t) * (count ? count : 1));
+	int started = 0;
+
+	unsigned long start = now_us();
+	for (; started < count; ++started) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "%s: could only start %d children\n", argv[0], started);
+			break;
+		}
+		if (!pid) {
+			while (1) sleep(100);
+		}
+		children[started] = pid;
+	}
+	report("fork (idle)", start, started);
+
+	char path[64];
+	char buf[512];
+	start = now_us();
+	for (int i = 0; i < started; ++i) {
+		sprintf(path, "/proc/%d/status", children[i]);
+		FILE * f = fopen(path, "r");
+		if (!f) continue;
+		fread(buf, 1, sizeof(buf), f);
+		fclose(f);
+	}
+	report("/proc/<pid>/status", start, started);
+
+	start = now_us();
+	for (int i = 0; i < forks; ++i) {
+		pid_t pid = fork();
+		if (!pid) _exit(0);
+		if (pid > 0) waitpid(pid, NULL, 0);
+	}
+	report("fork+exit+waitpid", start, forks);
+
+	start = now_us();
+	for (int i = 0; i < started; ++i) {
+		kill(children[i], SIGKILL);
+	}
+	for (int i = 0; i < started; ++i) {
+		waitpid(children[i], NULL, 0);
+	}
+	report("kill+waitpid", start, started);
+
+	return 0;
+}
@@ -29,7 +29,7 @@ static int show_username = 0;
 static int show_mem = 0;
 static int collect_commandline = 0;
 
-static int widths[] = {3,3,4,3,3,4};
+static int widths[] = {3,3,4,3,3,4,4};
 
 struct process {
 	int uid;
@@ -38,6 +38,7 @@ struct process {
 	int mem;
 	int vsz;
 	int shm;
+	int time;
 	char * process;
 	char * command_line;
 };
@@ -54,15 +55,30 @@ void print_username(int uid) {
 	endpwent();
 }
 
+static int mem_total = 0;
+
+static void read_mem_total(void) {
+	FILE * f = fopen("/proc/meminfo", "r");
+	if (!f) return;
+	char line[LINE_LEN];
+	while (fgets(line, LINE_LEN, f) != NULL) {
+		if (strstr(line, "MemTotal:") == line) {
+			mem_total = atoi(line + strlen("MemTotal:"));
+		}
+	}
+	fclose(f);
+}
+
 struct process * process_entry(struct dirent *dent) {
 	char tmp[256];
 	FILE * f;
 	char line[LINE_LEN];
 
-	int pid = 0, uid = 0, tgid = 0, mem = 0, shm = 0, vsz = 0;
+	int pid = 0, uid = 0, tgid = 0, mem = 0, shm = 0, vsz = 0, cpu_time = 0;
 	char name[100];
 
-	sprintf(tmp, "/proc/%s/status", dent->d_name);
+	/* /proc/PID/stat: pid (name) state ppid tgid uid utime stime ... vsz shm start */
+	sprintf(tmp, "/proc/%s/stat", dent->d_name);
 	f = fopen(tmp, "r");
 
 	if (!f) {
@@ -70,33 +86,36 @@ struct process * process_entry(struct dirent *dent) {
 	}
 
 	line[0] = 0;
+	fgets(line, LINE_LEN, f);
+	fclose(f);
 
-	while (fgets(line, LINE_LEN, f) != NULL) {
-		char * n = strstr(line,"\n");
-		if (n) { *n = '\0'; }
-		char * tab = strstr(line,"\t");
-		if (tab) {
-			*tab = '\0';
-			tab++;
-		}
-		if (strstr(line, "Pid:") == line) {
-			pid = atoi(tab);
-		} else if (strstr(line, "Uid:") == line) {
-			uid = atoi(tab);
-		} else if (strstr(line, "Tgid:") == line) {
-			tgid = atoi(tab);
-		} else if (strstr(line, "Name:") == line) {
-			strcpy(name, tab);
-		} else if (strstr(line, "VmSize:") == line) {
-			vsz = atoi(tab);
-		} else if (strstr(line, "RssShmem:") == line) {
-			shm = atoi(tab);
-		} else if (strstr(line, "MemPermille:") == line) {
-			mem = atoi(tab);
+	char * open_paren = strchr(line, '(');
+	char * close_paren = strrchr(line, ')');
+	if (!open_paren || !close_paren || close_paren < open_paren) {
+		return NULL;
+	}
+
+	pid = atoi(line);
+	*close_paren = '\0';
+	strncpy(name, open_paren + 1, sizeof(name) - 1);
+	name[sizeof(name)-1] = '\0';
+
+	char * save;
+	int field = 3;
+	for (char * tok = strtok_r(close_paren + 1, " \n", &save); tok; tok = strtok_r(NULL, " \n", &save), field++) {
+		switch (field) {
+			case 5:  tgid = atoi(tok); break;
+			case 6:  uid  = atoi(tok); break;
+			case 7:  cpu_time = atoi(tok); break;
+			case 8:  cpu_time += atoi(tok); break;
+			case 15: vsz  = atoi(tok); break;
+			case 16: shm  = atoi(tok); break;
 		}
 	}
 
-	fclose(f);
+	if (mem_total) {
+		mem = 1000 * (vsz + shm) / mem_total;
+	}
 
 	if (!show_all) {
 		/* Filter not ours */
@@ -114,6 +133,7 @@ struct process * process_entry(struct dirent *dent) {
 	out->mem = mem;
 	out->shm = shm;
 	out->vsz = vsz;
+	out->time = cpu_time;
 	out->process = strdup(name);
 	out->command_line = NULL;
 
@@ -125,6 +145,7 @@ struct process * process_entry(struct dirent *dent) {
 	if ((len = sprintf(garbage, "%d", out->vsz)) > widths[3]) widths[3] = len;
 	if ((len = sprintf(garbage, "%d", out->shm)) > widths[4]) widths[4] = len;
 	if ((len = sprintf(garbage, "%d.%01d", out->mem / 10, out->mem % 10)) > widths[5]) widths[5] = len;
+	if ((len = sprintf(garbage, "%d:%02d", out->time / 60000, (out->time / 1000) % 60)) > widths[6]) widths[6] = len;
 
 	struct passwd * p = getpwuid(out->uid);
 	if (p) {
@@ -169,6 +190,7 @@ void print_header(void) {
 		printf("%*s ", widths[5], "MEM%");
 		printf("%*s ", widths[3], "VSZ");
 		printf("%*s ", widths[4], "SHM");
+		printf("%*s ", widths[6], "TIME");
 	}
 	printf("CMD\n");
 }
@@ -193,6 +215,9 @@ void print_entry(struct process * out) {
 		printf("%*s ", widths[5], tmp);
 		printf("%*d ", widths[3], out->vsz);
 		printf("%*d ", widths[4], out->shm);
+		char t[20];
+		sprintf(t, "%d:%02d", out->time / 60000, (out->time / 1000) % 60);
+		printf("%*s ", widths[6], t);
 	}
 	if (out->command_line) {
 		printf("%s\n", out->command_line);
@@ -254,6 +279,8 @@ int main (int argc, char * argv[]) {
 		}
 	}
 
+	read_mem_total();
+
 	/* Open the directory */
 	DIR * dirp = opendir("/proc");
 
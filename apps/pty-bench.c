@@ -0,0 +1,132 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * pty-bench - Pseudo-terminal throughput
+ *
+ * Opens a pty pair and pushes a block of 80-column lines through it
+ * in both directions while a child drains the other end: program
+ * output written to the slave, with output processing (OPOST, ONLCR)
+ * on and off, and typed input written to the master, in canonical
+ * and raw mode. Echo is off for input so nothing else has to drain
+ * the master. Reports the time and throughput of each.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pty.h>
+#include <termios.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+#define LINE_LEN 80
+#define CHUNK    4096
+
+static void drain(int fd, size_t expected) {
+	char buf[CHUNK];
+	size_t got = 0;
+	while (got < expected) {
+		int r = read(fd, buf, sizeof(buf));
+		if (r <= 0) break;
+		got += r;
+	}
+}
+
+static void run(const char * what, int input, int cooked, char * data, size_t total) {
+	int master, slave;
+	if (openpty(&master, &slave, NULL, NULL, NULL) < 0) {
+		fprintf(stderr, "pty-bench: can't open a pty\n");
+		exit(1);
+	}
+
+	struct termios tios;
+	tcgetattr(slave, &tios);
+	if (input) {
+		tios.c_lflag &= ~(ECHO | ECHONL);
+		if (cooked) {
+			tios.c_lflag |= ICANON;
+		} else {
+			tios.c_lflag &= ~ICANON;
+			tios.c_cc[VMIN] = 255;
+		}
+	} else {
+		if (cooked) {
+			tios.c_oflag |= OPOST | ONLCR;
+		} else {
+			tios.c_oflag &= ~OPOST;
+		}
+	}
+	tcsetattr(slave, TCSANOW, &tios);
+
+	/* ONLCR turns every newline into two bytes */
+	size_t expected = total + ((!input && cooked) ? total / LINE_LEN : 0);
+	int from = input ? master : slave;
+	int to   = input ? slave : master;
+
+	unsigned long start = now_us();
+	pid_t child = fork();
+	if (!child) {
+		drain(to, expected);
+		_exit(0);
+	}
+
+	for (size_t written = 0; written < total; written += CHUNK) {
+		write(from, data + written, CHUNK);
+	}
+	waitpid(child, NULL, 0);
+	unsigned long elapsed = now_us() - start;
+	if (!elapsed) elapsed = 1;
+
+	printf("%-14s %8lu bytes in %8luus, %lu kB/s\n", what, (unsigned long)total, elapsed,
+		(unsigned long)((unsigned long long)total * 1000000 / 1024 / elapsed));
+
+	close(master);
+	close(slave);
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-s kB]\n"
+			"\n"
+			" -s  how much to send each way, in kB (default 1024)\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	size_t kb = 1024;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:h")) != -1) {
+		switch (opt) {
+			case 's':
+				kb = atoi(optarg);
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (!kb) return usage(argv);
+
+	/* Whole chunks of whole lines, so canonical reads line up */
+	size_t block = CHUNK * LINE_LEN / 16;
+	size_t total = kb * 1024;
+	total -= total % block;
+	if (!total) total = block;
+
+	char * data = malloc(total);
+	for (size_t i = 0; i < total; ++i) {
+		data[i] = (i % LINE_LEN == LINE_LEN - 1) ? '\n' : 'a' + (i % 26);
+	}
+
+	run("output raw", 0, 0, data, total);
+	run("output cooked", 0, 1, data, total);
+	run("input raw", 1, 0, data, total);
+	run("input cooked", 1, 1, data, total);
+
+	return 0;
+}
@@ -0,0 +1,121 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * readahead - Warm caches for files that will be needed soon
+ *
+ * Takes a list of files, one per line, and brings each into memory
+ * so that whoever opens it next doesn't wait on decompression or
+ * a device. Filesystems that support IOCTL_PRELOAD (the tmpfs
+ * overlay over a compressed root) keep a decompressed copy; for
+ * anything else the file is simply read through once.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+
+#define CHUNK_SIZE 65536
+
+static int verbose = 0;
+
+static unsigned long now_us(void) {
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	return (unsigned long)t.tv_sec * 1000000 + t.tv_usec;
+}
+
+static void preload(char * path) {
+	static char buf[CHUNK_SIZE];
+	unsigned long before = now_us();
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		if (verbose) fprintf(stderr, "readahead: %s: not found\n", path);
+		return;
+	}
+
+	size_t total = 0;
+	const char * how = "ioctl";
+	if (ioctl(fd, IOCTL_PRELOAD, NULL) < 0) {
+		how = "read";
+		ssize_t r;
+		while ((r = read(fd, buf, CHUNK_SIZE)) > 0) {
+			total += r;
+		}
+	}
+	close(fd);
+
+	if (verbose) {
+		fprintf(stderr, "readahead: %s: %s", path, how);
+		if (total) fprintf(stderr, " %zu bytes", total);
+		fprintf(stderr, " in %lu us\n", now_us() - before);
+	}
+}
+
+static void preload_list(char * list) {
+	FILE * f = fopen(list, "r");
+	if (!f) {
+		fprintf(stderr, "readahead: %s: could not open\n", list);
+		return;
+	}
+
+	char line[1024];
+	while (fgets(line, sizeof(line), f)) {
+		char * nl = strchr(line, '\n');
+		if (nl) *nl = '\0';
+		if (!*line || *line == '#') continue;
+		preload(line);
+	}
+
+	fclose(f);
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-v] [-f] LIST...\n"
+			"\n"
+			" -v  print what was loaded and how long it took\n"
+			" -f  arguments are files to load, not lists of files\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	int files = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "vfh")) != -1) {
+		switch (opt) {
+			case 'v':
+				verbose = 1;
+				break;
+			case 'f':
+				files = 1;
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (optind >= argc) return usage(argv);
+
+	unsigned long before = now_us();
+	for (int i = optind; i < argc; ++i) {
+		if (files) {
+			preload(argv[i]);
+		} else {
+			preload_list(argv[i]);
+		}
+	}
+
+	if (verbose) {
+		fprintf(stderr, "readahead: done in %lu us\n", now_us() - before);
+	}
+
+	return 0;
+}
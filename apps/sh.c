@@ -28,6 +28,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <spawn.h>
 
 #include <sys/time.h>
 #include <sys/wait.h>
@@ -44,7 +45,7 @@ extern char **environ;
 #endif
 
 #ifndef toaru
-#define tcsetpgrp(a,b)
+#define tcsetpgrp(a,b) ((void)(a), (void)(b))
 #endif
 
 #define PIPE_TOKEN "\xFF\xFFPIPE\xFF\xFF"
@@ -457,8 +458,11 @@ void tab_complete_func(rline_context_t * c) {
 			if (ent->d_name[0] != '.' || compare[0] == '.') {
 				if (!word || strstr(ent->d_name, compare) == ent->d_name) {
 					struct stat statbuf;
-					/* stat it */
-					if (last_slash) {
+					if (ent->d_type != DT_UNKNOWN) {
+						/* Only need to know if it's a directory */
+						statbuf.st_mode = (ent->d_type == DT_DIR) ? S_IFDIR : 0;
+					} else if (last_slash) {
+						/* stat it */
 						char * x = malloc(strlen(tmp) + 1 + strlen(ent->d_name) + 1);
 						sprintf(x,"%s/%s",tmp,ent->d_name);
 						lstat(x, &statbuf);
@@ -699,6 +703,47 @@ void run_cmd(char ** args) {
 	exit(i);
 }
 
+/*
+ * Start args in a child with `in` and `out` (unless -1) as its stdin
+ * and stdout, and `close_a` and `close_b` closed. Programs are started
+ * with posix_spawnp(), which doesn't copy the shell to do it; builtins
+ * and commands that can't be found still need a forked shell to run in.
+ */
+static pid_t start_cmd(char ** args, int in, int out, int close_a, int close_b) {
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	if (out >= 0) posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+	if (in >= 0) posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+	if (close_a >= 0) posix_spawn_file_actions_addclose(&actions, close_a);
+	if (close_b >= 0) posix_spawn_file_actions_addclose(&actions, close_b);
+
+	pid_t pid;
+	int error = posix_spawnp(&pid, *args, &actions, NULL, args, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if (!error) return pid;
+
+	pid = fork();
+	if (!pid) {
+		if (out >= 0) dup2(out, STDOUT_FILENO);
+		if (in >= 0) dup2(in, STDIN_FILENO);
+		if (close_a >= 0) close(close_a);
+		if (close_b >= 0) close(close_b);
+		run_cmd(args);
+	}
+	return pid;
+}
+
+/* Open the target of a redirection: -1 if there isn't one, -2 if it can't be opened */
+static int open_output(char * file, int flags) {
+	if (!file) return -1;
+	int fd = open(file, flags, 0666);
+	if (fd < 0) {
+		fprintf(stderr, "sh: %s: %s\n", file, strerror(errno));
+		return -2;
+	}
+	return fd;
+}
+
 int is_number(const char * c) {
 	while (*c) {
 		if (!isdigit(*c)) return 0;
@@ -1157,44 +1202,21 @@ _nope:
 	if (cmdi > 0) {
 		int last_output[2];
 		pipe(last_output);
-		child_pid = fork();
-		if (!child_pid) {
-			dup2(last_output[1], STDOUT_FILENO);
-			close(last_output[0]);
-			run_cmd(arg_starts[0]);
-		}
+		child_pid = start_cmd(arg_starts[0], -1, last_output[1], last_output[0], -1);
 
 		for (int j = 1; j < cmdi; ++j) {
 			int tmp_out[2];
 			pipe(tmp_out);
-			if (!fork()) {
-				dup2(tmp_out[1], STDOUT_FILENO);
-				dup2(last_output[0], STDIN_FILENO);
-				close(tmp_out[0]);
-				close(last_output[1]);
-				run_cmd(arg_starts[j]);
-			}
+			start_cmd(arg_starts[j], last_output[0], tmp_out[1], tmp_out[0], last_output[1]);
 			close(last_output[0]);
 			close(last_output[1]);
 			last_output[0] = tmp_out[0];
 			last_output[1] = tmp_out[1];
 		}
 
-		last_child = fork();
-		if (!last_child) {
-			if (output_files[cmdi]) {
-				int fd = open(output_files[cmdi], file_args[cmdi], 0666);
-				if (fd < 0) {
-					fprintf(stderr, "sh: %s: %s\n", output_files[cmdi], strerror(errno));
-					return -1;
-				} else {
-					dup2(fd, STDOUT_FILENO);
-				}
-			}
-			dup2(last_output[0], STDIN_FILENO);
-			close(last_output[1]);
-			run_cmd(arg_starts[cmdi]);
-		}
+		int out_fd = open_output(output_files[cmdi], file_args[cmdi]);
+		last_child = (out_fd == -2) ? -1 : start_cmd(arg_starts[cmdi], last_output[0], out_fd, last_output[1], -1);
+		if (out_fd >= 0) close(out_fd);
 		close(last_output[0]);
 		close(last_output[1]);
 
@@ -1204,19 +1226,10 @@ _nope:
 		if (func) {
 			return func(argcs[0], arg_starts[0]);
 		} else {
-			child_pid = fork();
-			if (!child_pid) {
-				if (output_files[cmdi]) {
-					int fd = open(output_files[cmdi], file_args[cmdi], 0666);
-					if (fd < 0) {
-						fprintf(stderr, "sh: %s: %s\n", output_files[cmdi], strerror(errno));
-						return -1;
-					} else {
-						dup2(fd, STDOUT_FILENO);
-					}
-				}
-				run_cmd(arg_starts[0]);
-			}
+			int out_fd = open_output(output_files[cmdi], file_args[cmdi]);
+			if (out_fd == -2) return 1;
+			child_pid = start_cmd(arg_starts[0], -1, out_fd, -1, -1);
+			if (out_fd >= 0) close(out_fd);
 			last_child = child_pid;
 		}
 	}
@@ -1554,10 +1567,7 @@ uint32_t shell_cmd_if(int argc, char * argv[]) {
 		return 1;
 	}
 
-	pid_t child_pid = fork();
-	if (!child_pid) {
-		run_cmd(if_args);
-	}
+	pid_t child_pid = start_cmd(if_args, -1, -1, -1, -1);
 	tcsetpgrp(STDIN_FILENO, child_pid);
 
 	child = child_pid;
@@ -1580,10 +1590,7 @@ uint32_t shell_cmd_if(int argc, char * argv[]) {
 			}
 			return func(argc, then_args);
 		} else {
-			child_pid = fork();
-			if (!child_pid) {
-				run_cmd(then_args);
-			}
+			child_pid = start_cmd(then_args, -1, -1, -1, -1);
 			tcsetpgrp(STDIN_FILENO, child_pid);
 			child = child_pid;
 			do {
@@ -1603,10 +1610,7 @@ uint32_t shell_cmd_if(int argc, char * argv[]) {
 			}
 			return func(argc, else_args);
 		} else {
-			child_pid = fork();
-			if (!child_pid) {
-				run_cmd(else_args);
-			}
+			child_pid = start_cmd(else_args, -1, -1, -1, -1);
 			tcsetpgrp(STDIN_FILENO, child_pid);
 			child = child_pid;
 			do {
@@ -1642,10 +1646,7 @@ uint32_t shell_cmd_while(int argc, char * argv[]) {
 	tcsetpgrp(STDIN_FILENO, getpid());
 
 	do {
-		pid_t child_pid = fork();
-		if (!child_pid) {
-			run_cmd(while_args);
-		}
+		pid_t child_pid = start_cmd(while_args, -1, -1, -1, -1);
 		child = child_pid;
 
 		int pid, ret_code = 0;
@@ -1656,10 +1657,7 @@ uint32_t shell_cmd_while(int argc, char * argv[]) {
 
 		handle_status(ret_code);
 		if (WEXITSTATUS(ret_code) == 0) {
-			child_pid = fork();
-			if (!child_pid) {
-				run_cmd(do_args);
-			}
+			child_pid = start_cmd(do_args, -1, -1, -1, -1);
 			child = child_pid;
 			do {
 				pid = waitpid(-1, &ret_code, 0);
@@ -1682,12 +1680,7 @@ uint32_t shell_cmd_export_cmd(int argc, char * argv[]) {
 
 	int pipe_fds[2];
 	pipe(pipe_fds);
-	pid_t child_pid = fork();
-	if (!child_pid) {
-		dup2(pipe_fds[1], STDOUT_FILENO);
-		close(pipe_fds[0]);
-		run_cmd(&argv[2]);
-	}
+	pid_t child_pid = start_cmd(&argv[2], -1, pipe_fds[1], pipe_fds[0], -1);
 
 	close(pipe_fds[1]);
 
@@ -1764,10 +1757,7 @@ uint32_t shell_cmd_not(int argc, char * argv[]) {
 		return 1;
 	}
 	int ret_code = 0;
-	pid_t child_pid = fork();
-	if (!child_pid) {
-		run_cmd(&argv[1]);
-	}
+	pid_t child_pid = start_cmd(&argv[1], -1, -1, -1, -1);
 	tcsetpgrp(STDIN_FILENO, child_pid);
 	child = child_pid;
 	do {
@@ -0,0 +1,108 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * signal-bench - Signal delivery rate
+ *
+ * Counts how many signals per second reach a handler: sent by the
+ * process to itself with raise(), and sent by a second process to
+ * one sitting in a blocking read() on a pipe, which has to wake,
+ * run the handler and go back to reading. Also checks that signals
+ * sent while blocked with sigprocmask() arrive once unblocked.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+static volatile int received = 0;
+
+static void handler(int sig) {
+	received++;
+}
+
+static void report(const char * what, unsigned long start, int count) {
+	unsigned long elapsed = now_us() - start;
+	printf("%-16s %8d in %8luus, %.2fus each, %lu/s\n", what, count, elapsed,
+		count ? (double)elapsed / count : 0.0,
+		elapsed ? (unsigned long)((unsigned long long)count * 1000000 / elapsed) : 0);
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-n count]\n"
+			"\n"
+			" -n  number of signals of each kind (default 10000)\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	int count = 10000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = atoi(optarg);
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (count < 1) return usage(argv);
+
+	signal(SIGUSR1, handler);
+
+	/* To ourselves */
+	unsigned long start = now_us();
+	for (int i = 0; i < count; ++i) {
+		raise(SIGUSR1);
+	}
+	report("raise", start, received);
+
+	/* Held while blocked, then delivered once */
+	sigset_t set, old;
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	sigprocmask(SIG_BLOCK, &set, &old);
+	received = 0;
+	for (int i = 0; i < 10; ++i) {
+		raise(SIGUSR1);
+	}
+	int while_blocked = received;
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	printf("sigprocmask: %d delivered while blocked, %d after unblocking\n", while_blocked, received);
+
+	/* From another process, to a reader blocked on a pipe */
+	int fds[2];
+	if (pipe(fds) < 0) {
+		fprintf(stderr, "%s: can't create pipe\n", argv[0]);
+		return 1;
+	}
+	received = 0;
+	pid_t parent = getpid();
+	pid_t child = fork();
+	if (!child) {
+		for (int i = 0; i < count; ++i) {
+			kill(parent, SIGUSR1);
+			/* Don't let them pile up into one pending signal */
+			usleep(0);
+		}
+		write(fds[1], "x", 1);
+		exit(0);
+	}
+
+	char c;
+	start = now_us();
+	while (read(fds[0], &c, 1) != 1);
+	report("kill+read", start, received);
+	waitpid(child, NULL, 0);
+
+	return 0;
+}
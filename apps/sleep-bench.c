@@ -0,0 +1,117 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * sleep-bench - Many processes in short timed sleeps
+ *
+ * Forks a number of sleepers that each usleep() for a random few
+ * milliseconds over and over, and reports how late they woke up.
+ * Run it under `kprof -e i` to see how long the timer interrupt
+ * takes with that many timers armed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+struct result {
+	unsigned long wakeups;
+	unsigned long late_total; /* microseconds */
+	unsigned long late_max;
+};
+
+static void sleeper(int fd, int seconds, int max_ms) {
+	struct result r = {0, 0, 0};
+	unsigned long end = now_us() + seconds * 1000000UL;
+
+	srand(getpid());
+	while (1) {
+		unsigned long start = now_us();
+		if (start >= end) break;
+		unsigned long want = (1 + rand() % max_ms) * 1000UL;
+		usleep(want);
+		unsigned long took = now_us() - start;
+		unsigned long late = took > want ? took - want : 0;
+		r.wakeups++;
+		r.late_total += late;
+		if (late > r.late_max) r.late_max = late;
+	}
+
+	write(fd, &r, sizeof(r));
+	exit(0);
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-n sleepers] [-t seconds] [-m ms]\n"
+			"\n"
+			" -n  number of sleeping processes (default 500)\n"
+			" -t  how long to run (default 5)\n"
+			" -m  longest single sleep (default 20)\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	int count = 500;
+	int seconds = 5;
+	int max_ms = 20;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:t:m:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = atoi(optarg);
+				break;
+			case 't':
+				seconds = atoi(optarg);
+				break;
+			case 'm':
+				max_ms = atoi(optarg);
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (count < 1 || seconds < 1 || max_ms < 1) return usage(argv);
+
+	int fds[2];
+	pipe(fds);
+
+	int started = 0;
+	for (; started < count; ++started) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "%s: could only start %d sleepers\n", argv[0], started);
+			break;
+		}
+		if (!pid) {
+			close(fds[0]);
+			sleeper(fds[1], seconds, max_ms);
+		}
+	}
+	close(fds[1]);
+
+	struct result total = {0, 0, 0};
+	for (int i = 0; i < started; ++i) {
+		struct result r;
+		if (read(fds[0], &r, sizeof(r)) != sizeof(r)) break;
+		total.wakeups    += r.wakeups;
+		total.late_total += r.late_total;
+		if (r.late_max > total.late_max) total.late_max = r.late_max;
+	}
+
+	while (wait(NULL) > 0);
+
+	printf("%d sleepers: %.0f wakeups/s, late by %.0fus on average, %luus at most\n",
+		started,
+		(double)total.wakeups / seconds,
+		total.wakeups ? (double)total.late_total / total.wakeups : 0.0,
+		total.late_max);
+
+	return 0;
+}
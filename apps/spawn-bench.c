@@ -0,0 +1,80 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * spawn-bench - Time starting a program and waiting for it
+ *
+ * Runs a command (/bin/true by default) over and over, either with
+ * fork() and exec or with posix_spawn(), and reports how long each
+ * start, exec and exit took on average.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-n count] [-m fork|spawn] [command...]\n"
+			"\n"
+			" -n  how many times to run it (default 200)\n"
+			" -m  how to start it (default spawn)\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	int count = 200;
+	int use_fork = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:m:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = atoi(optarg);
+				break;
+			case 'm':
+				if (!strcmp(optarg, "fork")) use_fork = 1;
+				else if (!strcmp(optarg, "spawn")) use_fork = 0;
+				else return usage(argv);
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (count < 1) return usage(argv);
+
+	char * default_args[] = {"/bin/true", NULL};
+	char ** args = (optind < argc) ? &argv[optind] : default_args;
+
+	unsigned long start = now_us();
+	for (int i = 0; i < count; ++i) {
+		pid_t pid;
+		if (use_fork) {
+			pid = fork();
+			if (!pid) {
+				execvp(args[0], args);
+				_exit(127);
+			}
+		} else {
+			if (posix_spawnp(&pid, args[0], NULL, NULL, args, environ)) {
+				fprintf(stderr, "%s: can't run %s\n", argv[0], args[0]);
+				return 1;
+			}
+		}
+		waitpid(pid, NULL, 0);
+	}
+	unsigned long elapsed = now_us() - start;
+
+	printf("%s %s: %d runs in %luus, %.1fus each\n",
+		use_fork ? "fork+exec" : "posix_spawn", args[0], count, elapsed,
+		(double)elapsed / count);
+
+	return 0;
+}
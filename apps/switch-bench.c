@@ -0,0 +1,105 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * switch-bench - Context switch cost
+ *
+ * Passes a byte back and forth between two processes over a pair
+ * of pipes, so every round trip is two context switches, and
+ * reports the time per switch along with how many FPU saves and
+ * restores the kernel did or avoided, from /proc/cpuinfo. With -f
+ * one side does some floating point work each round, to compare
+ * switches with and without FPU state to carry.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+/* A field from /proc/cpuinfo */
+static long cpuinfo(const char * field) {
+	char buf[1024];
+	FILE * f = fopen("/proc/cpuinfo", "r");
+	if (!f) return -1;
+	size_t r = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[r] = '\0';
+	char * line = strstr(buf, field);
+	return line ? atol(line + strlen(field) + 1) : -1;
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-n rounds] [-f]\n"
+			"\n"
+			" -n  number of round trips (default 10000)\n"
+			" -f  do floating point work in the child each round\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	int rounds = 10000;
+	int use_fpu = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:fh")) != -1) {
+		switch (opt) {
+			case 'n':
+				rounds = atoi(optarg);
+				break;
+			case 'f':
+				use_fpu = 1;
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (rounds < 1) return usage(argv);
+
+	int ping[2], pong[2];
+	if (pipe(ping) < 0 || pipe(pong) < 0) {
+		fprintf(stderr, "%s: can't create pipes\n", argv[0]);
+		return 1;
+	}
+
+	long saves = cpuinfo("FPUSaves:");
+	long saves_avoided = cpuinfo("FPUSavesAvoided:");
+	long restores = cpuinfo("FPURestores:");
+	long restores_avoided = cpuinfo("FPURestoresAvoided:");
+
+	pid_t child = fork();
+	if (!child) {
+		volatile double x = 1.0;
+		char c;
+		for (int i = 0; i < rounds; ++i) {
+			read(ping[0], &c, 1);
+			if (use_fpu) x = x * 1.000001 + 0.5;
+			write(pong[1], &c, 1);
+		}
+		exit(0);
+	}
+
+	char c = 'x';
+	unsigned long start = now_us();
+	for (int i = 0; i < rounds; ++i) {
+		write(ping[1], &c, 1);
+		read(pong[0], &c, 1);
+	}
+	unsigned long elapsed = now_us() - start;
+	waitpid(child, NULL, 0);
+
+	printf("%d round trips in %luus, %.2fus per switch%s\n", rounds, elapsed,
+		(double)elapsed / (rounds * 2), use_fpu ? " (child uses the FPU)" : "");
+	printf("FPU saves: %ld, avoided: %ld\n",
+		cpuinfo("FPUSaves:") - saves, cpuinfo("FPUSavesAvoided:") - saves_avoided);
+	printf("FPU restores: %ld, avoided: %ld\n",
+		cpuinfo("FPURestores:") - restores, cpuinfo("FPURestoresAvoided:") - restores_avoided);
+
+	return 0;
+}
@@ -0,0 +1,90 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * syscall-bench - System call latency
+ *
+ * Times a cheap system call (getpid) made through the vDSO entry
+ * point, which uses SYSENTER where the processor has it, against
+ * the same call made with int $0x7F, and gettimeofday() read from
+ * the vDSO against asking the kernel for it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <syscall.h>
+#include <syscall_nums.h>
+#include <sys/time.h>
+#include <sys/vdso.h>
+
+#include "bench.h"
+
+static void report(const char * what, unsigned long start, int count) {
+	unsigned long elapsed = now_us() - start;
+	printf("%-24s %8d in %8luus, %.3fus each\n", what, count, elapsed,
+		count ? (double)elapsed / count : 0.0);
+}
+
+/* getpid the old way, straight through the interrupt gate */
+static int getpid_int(void) {
+	int a;
+	__asm__ __volatile__("int $0x7F" : "=a" (a) : "0" (SYS_GETPID));
+	return a;
+}
+
+static int usage(char * argv[]) {
+	fprintf(stderr,
+			"usage: %s [-n count]\n"
+			"\n"
+			" -n  number of calls of each kind (default 100000)\n", argv[0]);
+	return 1;
+}
+
+int main(int argc, char * argv[]) {
+	int count = 100000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = atoi(optarg);
+				break;
+			default:
+				return usage(argv);
+		}
+	}
+
+	if (count < 1) return usage(argv);
+
+	printf("system call entry: %s\n",
+		(VDSO_DATA->features & VDSO_SYSENTER) ? "sysenter" : "int 0x7F");
+
+	unsigned long start = now_us();
+	for (int i = 0; i < count; ++i) {
+		syscall_getpid();
+	}
+	report("getpid (vdso)", start, count);
+
+	start = now_us();
+	for (int i = 0; i < count; ++i) {
+		getpid_int();
+	}
+	report("getpid (int 0x7F)", start, count);
+
+	struct timeval t;
+	start = now_us();
+	for (int i = 0; i < count; ++i) {
+		gettimeofday(&t, NULL);
+	}
+	report("gettimeofday (vdso)", start, count);
+
+	start = now_us();
+	for (int i = 0; i < count; ++i) {
+		syscall_gettimeofday(&t, NULL);
+	}
+	report("gettimeofday (syscall)", start, count);
+
+	return 0;
+}
@@ -0,0 +1,545 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * top - Show processes by resource usage
+ *
+ * Reads /proc/snapshot and shows per-process CPU usage and rates
+ * of system calls, faults, context switches and I/O since the
+ * previous refresh. Threads are folded into their process.
+ * Falls back to walking /proc/PID/stat on kernels without the
+ * snapshot interface.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <termios.h>
+#include <pwd.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <sys/fswait.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+#include <kernel/procsnap.h>
+
+#include <toaru/hashmap.h>
+#include <toaru/list.h>
+
+struct process {
+	int pid;
+	int uid;
+	int threads;
+	char name[64];
+
+	unsigned long ticks;
+	unsigned long syscalls;
+	unsigned long faults;
+	unsigned long switches;
+	uint64_t read_bytes;
+	uint64_t write_bytes;
+	int vsz;
+	int shm;
+
+	/* Rates since the last refresh */
+	int cpu_permille;
+	unsigned long syscall_rate;
+	unsigned long fault_rate;
+	unsigned long switch_rate;
+	uint64_t read_rate;
+	uint64_t write_rate;
+};
+
+/* System-wide counters; only available from the snapshot */
+struct system {
+	int valid;
+	uint32_t cpu_user;
+	uint32_t cpu_system;
+	uint32_t cpu_idle;
+	uint32_t mem_total;
+	uint32_t mem_used;
+	uint32_t switches;
+	uint32_t irqs[PROCSNAP_IRQS];
+};
+
+static struct termios old;
+static int interactive = 0;
+
+static procsnap_header_t * snapshot = NULL;
+static size_t snapshot_size = 0;
+
+static void set_unbuffered(void) {
+	tcgetattr(fileno(stdin), &old);
+	struct termios new = old;
+	new.c_lflag &= (~ICANON & ~ECHO);
+	tcsetattr(fileno(stdin), TCSAFLUSH, &new);
+}
+
+static void set_buffered(void) {
+	tcsetattr(fileno(stdin), TCSAFLUSH, &old);
+}
+
+static uint64_t parse_u64(char * c) {
+	uint64_t out = 0;
+	while (*c >= '0' && *c <= '9') {
+		out = out * 10 + (*c - '0');
+		c++;
+	}
+	return out;
+}
+
+/*
+ * /proc/PID/stat: pid (name) state ppid tgid uid utime stime nvcsw nivcsw
+ *                 syscalls faults rbytes wbytes vsz shm start
+ */
+static int read_stat(char * pid, struct process * out, int * tgid) {
+	char path[sizeof("/proc//stat") + 256]; /* pid is a d_name */
+	char line[1024];
+
+	sprintf(path, "/proc/%s/stat", pid);
+	FILE * f = fopen(path, "r");
+	if (!f) return 1;
+	line[0] = '\0';
+	fgets(line, sizeof(line), f);
+	fclose(f);
+
+	char * open_paren = strchr(line, '(');
+	char * close_paren = strrchr(line, ')');
+	if (!open_paren || !close_paren || close_paren < open_paren) return 1;
+
+	memset(out, 0, sizeof(struct process));
+	out->pid = atoi(line);
+	*close_paren = '\0';
+	strncpy(out->name, open_paren + 1, sizeof(out->name) - 1);
+
+	char * save;
+	int field = 3;
+	for (char * tok = strtok_r(close_paren + 1, " \n", &save); tok; tok = strtok_r(NULL, " \n", &save), field++) {
+		switch (field) {
+			case 5:  *tgid = atoi(tok); break;
+			case 6:  out->uid = atoi(tok); break;
+			case 7:  out->ticks = atoi(tok); break;
+			case 8:  out->ticks += atoi(tok); break;
+			case 9:  out->switches = atoi(tok); break;
+			case 10: out->switches += atoi(tok); break;
+			case 11: out->syscalls = atoi(tok); break;
+			case 12: out->faults = atoi(tok); break;
+			case 13: out->read_bytes = parse_u64(tok); break;
+			case 14: out->write_bytes = parse_u64(tok); break;
+			case 15: out->vsz = atoi(tok); break;
+			case 16: out->shm = atoi(tok); break;
+		}
+	}
+	out->threads = 1;
+	return 0;
+}
+
+static struct process * group_for(hashmap_t * procs, int tgid) {
+	struct process * existing = hashmap_get(procs, (void *)(uintptr_t)tgid);
+	if (!existing) {
+		existing = calloc(1, sizeof(struct process));
+		existing->pid = tgid;
+		hashmap_set(procs, (void *)(uintptr_t)tgid, existing);
+	}
+	return existing;
+}
+
+static void accumulate(struct process * existing, struct process * p) {
+	if (p->pid == existing->pid) {
+		/* Identity and memory belong to the thread group leader */
+		existing->uid = p->uid;
+		memcpy(existing->name, p->name, sizeof(p->name));
+		existing->vsz = p->vsz;
+		existing->shm = p->shm;
+	}
+	existing->threads     += 1;
+	existing->ticks       += p->ticks;
+	existing->syscalls    += p->syscalls;
+	existing->faults      += p->faults;
+	existing->switches    += p->switches;
+	existing->read_bytes  += p->read_bytes;
+	existing->write_bytes += p->write_bytes;
+}
+
+static hashmap_t * collect_stat(void) {
+	hashmap_t * procs = hashmap_create_int(64);
+
+	DIR * dirp = opendir("/proc");
+	if (!dirp) return procs;
+
+	struct dirent * ent;
+	while ((ent = readdir(dirp)) != NULL) {
+		if (ent->d_name[0] < '0' || ent->d_name[0] > '9') continue;
+
+		struct process p;
+		int tgid = 0;
+		if (read_stat(ent->d_name, &p, &tgid)) continue;
+		if (!tgid) tgid = p.pid;
+
+		accumulate(group_for(procs, tgid), &p);
+	}
+	closedir(dirp);
+
+	return procs;
+}
+
+/*
+ * One read() of /proc/snapshot. The buffer grows until every
+ * process fits; returns 1 if the snapshot is not available.
+ */
+static int read_snapshot(void) {
+	int fd = open("/proc/snapshot", O_RDONLY);
+	if (fd < 0) return 1;
+
+	if (!snapshot) {
+		snapshot_size = sizeof(procsnap_header_t) + 64 * sizeof(procsnap_record_t);
+		snapshot = malloc(snapshot_size);
+	}
+
+	while (1) {
+		lseek(fd, 0, SEEK_SET);
+		int r = read(fd, snapshot, snapshot_size);
+		if (r < (int)sizeof(procsnap_header_t) || snapshot->magic != PROCSNAP_MAGIC ||
+				snapshot->record_size != sizeof(procsnap_record_t)) {
+			close(fd);
+			return 1;
+		}
+		if (snapshot->count >= snapshot->total) break;
+		/* Leave some room for processes started before the next read */
+		snapshot_size = snapshot->header_size + (snapshot->total + 16) * snapshot->record_size;
+		snapshot = realloc(snapshot, snapshot_size);
+	}
+
+	close(fd);
+	return 0;
+}
+
+static hashmap_t * collect_snapshot(struct system * sys) {
+	if (read_snapshot()) return NULL;
+
+	sys->valid     = 1;
+	sys->cpu_user  = snapshot->cpu_user;
+	sys->cpu_system = snapshot->cpu_system;
+	sys->cpu_idle  = snapshot->cpu_idle;
+	sys->mem_total = snapshot->mem_total;
+	sys->mem_used  = snapshot->mem_used;
+	sys->switches  = snapshot->context_switches;
+	memcpy(sys->irqs, snapshot->irqs, sizeof(sys->irqs));
+
+	hashmap_t * procs = hashmap_create_int(64);
+	procsnap_record_t * records = (procsnap_record_t *)((char *)snapshot + snapshot->header_size);
+
+	for (uint32_t i = 0; i < snapshot->count; ++i) {
+		procsnap_record_t * r = &records[i];
+		struct process p = {0};
+
+		p.pid         = r->pid;
+		p.uid         = r->uid;
+		memcpy(p.name, r->name, sizeof(r->name));
+		p.ticks       = r->utime + r->stime;
+		p.syscalls    = r->syscalls;
+		p.faults      = r->page_faults;
+		p.switches    = r->nvcsw + r->nivcsw;
+		p.read_bytes  = r->read_bytes;
+		p.write_bytes = r->write_bytes;
+		p.vsz         = r->vsz;
+		p.shm         = r->shm;
+
+		accumulate(group_for(procs, r->tgid), &p);
+	}
+
+	return procs;
+}
+
+static hashmap_t * collect(struct system * sys) {
+	memset(sys, 0, sizeof(struct system));
+	hashmap_t * procs = collect_snapshot(sys);
+	if (procs) return procs;
+	return collect_stat();
+}
+
+static void free_procs(hashmap_t * procs) {
+	list_t * values = hashmap_values(procs);
+	foreach(node, values) {
+		free(node->value);
+	}
+	list_free(values);
+	free(values);
+	hashmap_free(procs);
+	free(procs);
+}
+
+static int by_cpu(const void * a, const void * b) {
+	const struct process * x = *(const struct process **)a;
+	const struct process * y = *(const struct process **)b;
+	if (x->cpu_permille != y->cpu_permille) return y->cpu_permille - x->cpu_permille;
+	return x->pid - y->pid;
+}
+
+static void format_size(char * out, uint64_t bytes) {
+	if (bytes >= 10 * 1024 * 1024) {
+		sprintf(out, "%dM", (int)(bytes / (1024 * 1024)));
+	} else if (bytes >= 10 * 1024) {
+		sprintf(out, "%dK", (int)(bytes / 1024));
+	} else {
+		sprintf(out, "%d", (int)bytes);
+	}
+}
+
+static void read_meminfo(int * total, int * free) {
+	char line[256];
+	FILE * f = fopen("/proc/meminfo", "r");
+	*total = *free = 0;
+	if (!f) return;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (strstr(line, "MemTotal:") == line) *total = atoi(line + strlen("MemTotal:"));
+		if (strstr(line, "MemFree:") == line) *free = atoi(line + strlen("MemFree:"));
+	}
+	fclose(f);
+}
+
+static void render_system(struct system * sys, struct system * last, unsigned long elapsed_ms) {
+	uint32_t user = sys->cpu_user - last->cpu_user;
+	uint32_t system = sys->cpu_system - last->cpu_system;
+	uint32_t idle = sys->cpu_idle - last->cpu_idle;
+	uint32_t total = user + system + idle;
+	if (!total) total = 1;
+
+	printf("cpu: %lu.%lu%% user, %lu.%lu%% system, %lu.%lu%% idle; %d switches/s\n",
+			user * 1000 / total / 10, user * 1000 / total % 10,
+			system * 1000 / total / 10, system * 1000 / total % 10,
+			idle * 1000 / total / 10, idle * 1000 / total % 10,
+			(int)((sys->switches - last->switches) * 1000 / elapsed_ms));
+
+	printf("irq/s:");
+	for (int i = 0; i < PROCSNAP_IRQS; ++i) {
+		uint32_t count = sys->irqs[i] - last->irqs[i];
+		if (count) printf(" %d:%d", i, (int)(count * 1000 / elapsed_ms));
+	}
+	printf("\n");
+}
+
+static void render(hashmap_t * procs, hashmap_t * previous, struct system * sys, struct system * last, unsigned long elapsed_ms) {
+	list_t * values = hashmap_values(procs);
+	struct process ** sorted = malloc(sizeof(struct process *) * (values->length + 1));
+	int count = 0;
+	unsigned long total_permille = 0;
+
+	foreach(node, values) {
+		struct process * p = node->value;
+		struct process * last = previous ? hashmap_get(previous, (void *)(uintptr_t)p->pid) : NULL;
+		if (last && elapsed_ms) {
+			/* Ticks are milliseconds, so this is CPU time over wall time */
+			p->cpu_permille = (p->ticks - last->ticks) * 1000 / elapsed_ms;
+			p->syscall_rate = (p->syscalls - last->syscalls) * 1000 / elapsed_ms;
+			p->fault_rate   = (p->faults - last->faults) * 1000 / elapsed_ms;
+			p->switch_rate  = (p->switches - last->switches) * 1000 / elapsed_ms;
+			p->read_rate    = (p->read_bytes - last->read_bytes) * 1000 / elapsed_ms;
+			p->write_rate   = (p->write_bytes - last->write_bytes) * 1000 / elapsed_ms;
+		}
+		total_permille += p->cpu_permille;
+		sorted[count++] = p;
+	}
+	list_free(values);
+	free(values);
+
+	qsort(sorted, count, sizeof(struct process *), by_cpu);
+
+	struct winsize w = {0};
+	ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+	int rows = w.ws_row ? w.ws_row : 24;
+
+	int mem_total, mem_used;
+	if (sys->valid) {
+		mem_total = sys->mem_total;
+		mem_used = sys->mem_used;
+	} else {
+		int mem_free;
+		read_meminfo(&mem_total, &mem_free);
+		mem_used = mem_total - mem_free;
+	}
+
+	if (interactive) printf("\033[H\033[2J");
+	printf("%d processes, cpu %lu.%lu%%, memory %d kB used of %d kB\n",
+			count, total_permille / 10, total_permille % 10, mem_used, mem_total);
+	int header_rows = 4;
+	if (sys->valid && last->valid && elapsed_ms) {
+		render_system(sys, last, elapsed_ms);
+		header_rows += 2;
+	}
+	printf("\n");
+	printf("\033[7m%5s %-8s %5s %8s %7s %6s %6s %6s %6s %6s %6s  %s\033[0m\n",
+			"PID", "USER", "%CPU", "TIME", "VSZ", "SHM", "SYSC/s", "FLT/s", "CSW/s", "READ/s", "WRIT/s", "CMD");
+
+	for (int i = 0; i < count && (!interactive || i < rows - header_rows); ++i) {
+		struct process * p = sorted[i];
+		char user[10], cpu[16], rd[16], wr[16];
+
+		struct passwd * pw = getpwuid(p->uid);
+		if (pw) {
+			sprintf(user, "%.8s", pw->pw_name);
+		} else {
+			sprintf(user, "%d", p->uid);
+		}
+		endpwent();
+
+		sprintf(cpu, "%d:%02d.%02d", (int)(p->ticks / 60000), (int)(p->ticks / 1000) % 60, (int)(p->ticks / 10) % 100);
+		format_size(rd, p->read_rate);
+		format_size(wr, p->write_rate);
+
+		printf("%5d %-8s %3d.%d %8s %7d %6d %6d %6d %6d %6s %6s  %s",
+				p->pid, user, p->cpu_permille / 10, p->cpu_permille % 10, cpu,
+				p->vsz, p->shm, (int)p->syscall_rate, (int)p->fault_rate, (int)p->switch_rate,
+				rd, wr, p->name);
+		if (p->threads > 1) printf(" [%d]", p->threads);
+		printf("\n");
+	}
+	fflush(stdout);
+	free(sorted);
+}
+
+static unsigned long elapsed_us(struct timeval * start) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_usec - start->tv_usec);
+}
+
+/*
+ * Start `children` idle processes and compare the cost of one
+ * refresh through /proc/snapshot with walking /proc/PID/stat.
+ */
+static void benchmark(int children, int rounds) {
+	pid_t * pids = malloc(sizeof(pid_t) * children);
+	for (int i = 0; i < children; ++i) {
+		pids[i] = fork();
+		if (!pids[i]) {
+			while (1) sleep(1000);
+		}
+	}
+	usleep(100000);
+
+	struct system sys;
+	struct timeval start;
+	int processes = 0;
+
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < rounds; ++i) {
+		memset(&sys, 0, sizeof(sys));
+		hashmap_t * procs = collect_snapshot(&sys);
+		if (!procs) {
+			fprintf(stderr, "top: /proc/snapshot is not available\n");
+			break;
+		}
+		processes = snapshot->count;
+		free_procs(procs);
+	}
+	unsigned long snapshot_us = elapsed_us(&start);
+
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < rounds; ++i) {
+		free_procs(collect_stat());
+	}
+	unsigned long stat_us = elapsed_us(&start);
+
+	for (int i = 0; i < children; ++i) {
+		kill(pids[i], SIGKILL);
+		waitpid(pids[i], NULL, 0);
+	}
+	free(pids);
+
+	printf("%d processes, %d refreshes\n", processes, rounds);
+	printf("/proc/snapshot:  %6d us per refresh\n", (int)(snapshot_us / rounds));
+	printf("/proc/PID/stat:  %6d us per refresh\n", (int)(stat_us / rounds));
+}
+
+static void usage(char * argv[]) {
+	fprintf(stderr,
+			"top - show processes by resource usage\n"
+			"\n"
+			"usage: %s [-d seconds] [-n iterations]\n"
+			"       %s -b processes [-n iterations]\n"
+			"\n"
+			" -d: \033[3mDelay between refreshes (default 2)\033[0m\n"
+			" -n: \033[3mExit after this many refreshes\033[0m\n"
+			" -b: \033[3mStart this many idle processes and time refreshes\033[0m\n"
+			"\n"
+			"Press q to quit.\n", argv[0], argv[0]);
+}
+
+int main(int argc, char * argv[]) {
+	int delay = 2;
+	int iterations = -1;
+	int bench = -1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:n:b:?")) != -1) {
+		switch (opt) {
+			case 'd':
+				delay = atoi(optarg);
+				if (delay < 1) delay = 1;
+				break;
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			case 'b':
+				bench = atoi(optarg);
+				break;
+			case '?':
+				usage(argv);
+				return 1;
+		}
+	}
+
+	if (bench >= 0) {
+		benchmark(bench, iterations > 0 ? iterations : 20);
+		return 0;
+	}
+
+	interactive = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+	if (interactive) set_unbuffered();
+
+	hashmap_t * previous = NULL;
+	struct system sys, last_sys;
+	struct timeval last;
+	gettimeofday(&last, NULL);
+
+	/* First sample only establishes a baseline */
+	previous = collect(&last_sys);
+	unsigned long wait_ms = 500;
+
+	while (iterations != 0) {
+		int fds[] = {STDIN_FILENO};
+		if (interactive) {
+			int index = fswait2(1, fds, wait_ms);
+			if (index == 0) {
+				char c;
+				if (read(STDIN_FILENO, &c, 1) == 1 && (c == 'q' || c == 'Q')) break;
+			}
+		} else {
+			usleep(wait_ms * 1000);
+		}
+
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		unsigned long elapsed_ms = (now.tv_sec - last.tv_sec) * 1000 + (now.tv_usec - last.tv_usec) / 1000;
+
+		hashmap_t * procs = collect(&sys);
+		render(procs, previous, &sys, &last_sys, elapsed_ms);
+
+		free_procs(previous);
+		previous = procs;
+		last_sys = sys;
+		last = now;
+		wait_ms = delay * 1000;
+		if (iterations > 0) iterations--;
+	}
+
+	free_procs(previous);
+	if (interactive) set_buffered();
+	return 0;
+}
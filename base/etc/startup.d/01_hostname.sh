@@ -1,4 +1,5 @@
 #!/bin/sh
+# after:
 
 export-cmd HOSTNAME cat /etc/hostname
 
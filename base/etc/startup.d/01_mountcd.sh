@@ -1,3 +1,4 @@
 #!/bin/sh
+# after: 00_migrate.sh
 
 if stat -Lq /dev/cdrom0 then mount iso /dev/cdrom0 /cdrom
@@ -0,0 +1,5 @@
+#!/bin/sh
+# after: 00_migrate.sh
+
+# Warm the caches for what the desktop loads first; see /etc/readahead.list
+if stat -Lq /etc/readahead.list then readahead /etc/readahead.list
@@ -1,3 +1,4 @@
 #!/bin/sh
+# after: 00_migrate.sh
 
 if qemu-fwcfg -q opt/org.toaruos.displayharness then /bin/qemu-display-hack
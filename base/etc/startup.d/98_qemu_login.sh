@@ -1,4 +1,5 @@
 #!/bin/sh
+# after: 00_migrate.sh 01_hostname.sh 91_font_server.sh
 
 if not qemu-fwcfg -q opt/org.toaruos.forceuser then exit 0
 
@@ -1,4 +1,5 @@
 #!/bin/sh
+# after: 00_migrate.sh 01_hostname.sh 90_qemu_hack.sh 91_font_server.sh 97_qemu_bench.sh 98_qemu_login.sh
 
 export-cmd START kcmdline -g start
 
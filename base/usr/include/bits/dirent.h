@@ -1,18 +1,24 @@
 #pragma once
 
 #include <stdint.h>
+#include <sys/getdents.h>
 
 typedef struct dirent {
 	uint32_t d_ino;
 	char d_name[256];
+	unsigned char d_type; /* DT_*; DT_UNKNOWN if the filesystem didn't say */
 } dirent;
 
 typedef struct DIR {
 	int fd;
 	int cur_entry;
+	/* Records from the last getdents() */
+	int buf_pos;
+	int buf_len;
+	char buf[4096];
 } DIR;
 
 DIR * opendir (const char * dirname);
 int closedir (DIR * dir);
 struct dirent * readdir (DIR * dirp);
-
+void rewinddir (DIR * dirp);
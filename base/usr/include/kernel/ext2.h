@@ -111,6 +111,17 @@ typedef struct ext2_bgdescriptor ext2_bgdescriptor_t;
 #define EXT2_S_IFCHR	0x2000
 #define EXT2_S_IFIFO	0x1000
 
+/* Directory entry file types, when the filesystem records them */
+#define EXT2_FEATURE_INCOMPAT_FILETYPE	0x0002
+#define EXT2_FT_UNKNOWN	0
+#define EXT2_FT_REG_FILE	1
+#define EXT2_FT_DIR	2
+#define EXT2_FT_CHRDEV	3
+#define EXT2_FT_BLKDEV	4
+#define EXT2_FT_FIFO	5
+#define EXT2_FT_SOCK	6
+#define EXT2_FT_SYMLINK	7
+
 /* setuid, etc. */
 #define EXT2_S_ISUID	0x0800
 #define EXT2_S_ISGID	0x0400
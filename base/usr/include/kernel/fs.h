@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <toaru/list.h>
+
 #define PATH_SEPARATOR '/'
 #define PATH_SEPARATOR_STRING "/"
 #define PATH_UP  ".."
@@ -36,6 +38,24 @@
 #define     _IFIFO  0010000 /* fifo */
 
 struct fs_node;
+struct pollset_event;
+struct iovec;
+
+/*
+ * A registration for readiness alerts on a node. selectwait() queues
+ * it on the node's list of waiters with fs_wait_add(), and the node
+ * calls fs_wait_alert() when it may have become readable, writable or
+ * hung up; each waiter interested in the change is taken off the list
+ * and its alert() hook is called. Registrations are one-shot, so the
+ * owner re-arms with another selectwait() once it has looked at the node.
+ */
+typedef struct fs_waiter {
+	node_t link;        /* Queued on a node while link.owner is set */
+	int events;         /* POLLIN, POLLOUT; hang-ups always alert */
+	void (*alert)(struct fs_waiter * waiter, int events);
+	void * owner;
+	int index;
+} fs_waiter_t;
 
 typedef uint32_t (*read_type_t) (struct fs_node *, uint32_t, uint32_t, uint8_t *);
 typedef uint32_t (*write_type_t) (struct fs_node *, uint32_t, uint32_t, uint8_t *);
@@ -52,8 +72,13 @@ typedef int (*chmod_type_t) (struct fs_node *, int mode);
 typedef int (*symlink_type_t) (struct fs_node *, char * name, char * value);
 typedef int (*readlink_type_t) (struct fs_node *, char * buf, size_t size);
 typedef int (*selectcheck_type_t) (struct fs_node *);
-typedef int (*selectwait_type_t) (struct fs_node *, void * process);
+typedef int (*selectwait_type_t) (struct fs_node *, fs_waiter_t * waiter);
+typedef int (*pollcheck_type_t) (struct fs_node *);
 typedef int (*chown_type_t) (struct fs_node *, int, int);
+typedef uint32_t (*readpage_type_t) (struct fs_node *, uint32_t index, uint8_t * page);
+typedef uint32_t (*writepage_type_t) (struct fs_node *, uint32_t index, uint32_t size, uint8_t * page);
+typedef int (*getdents_fill_t) (void * context, uint32_t ino, uint8_t type, char * name);
+typedef int (*getdents_type_t) (struct fs_node *, uint32_t * position, getdents_fill_t fill, void * context);
 
 typedef struct fs_node {
 	char name[256];         /* The filename. */
@@ -95,8 +120,27 @@ typedef struct fs_node {
 
 	selectcheck_type_t selectcheck;
 	selectwait_type_t selectwait;
+	pollcheck_type_t pollcheck;   /* POLL* bits that hold now; see pollcheck_fs */
 
 	chown_type_t chown;
+
+	/*
+	 * Page cache hooks for regular files (see kernel/fs/pagecache.c).
+	 * readpage() fills a whole page from `index * 4096` and returns how
+	 * much of it is in the file; writepage() writes `size` bytes back.
+	 * Without a readpage(), reads go straight to read().
+	 */
+	readpage_type_t readpage;
+	writepage_type_t writepage;
+
+	/*
+	 * Batched directory listing (see getdents_fs). Calls fill() for each
+	 * entry from *position on, advancing *position past each one that
+	 * was taken, until fill() returns non-zero (returns 1) or the
+	 * directory ends (returns 0). What a position means is up to the
+	 * filesystem; 0 is always the start.
+	 */
+	getdents_type_t getdents;
 } fs_node_t;
 
 struct dirent {
@@ -136,9 +180,12 @@ extern int pty_create(void *size, fs_node_t ** fs_master, fs_node_t ** fs_slave)
 int has_permission(fs_node_t *node, int permission_bit);
 uint32_t read_fs(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer);
 uint32_t write_fs(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer);
+uint32_t readv_fs(fs_node_t *node, uint32_t offset, struct iovec * iov, int count);
+uint32_t writev_fs(fs_node_t *node, uint32_t offset, struct iovec * iov, int count);
 void open_fs(fs_node_t *node, unsigned int flags);
 void close_fs(fs_node_t *node);
 struct dirent *readdir_fs(fs_node_t *node, uint32_t index);
+int getdents_fs(fs_node_t *node, uint32_t *position, getdents_fill_t fill, void * context);
 fs_node_t *finddir_fs(fs_node_t *node, char *name);
 int mkdir_fs(char *name, uint16_t permission);
 int create_file_fs(char *name, uint16_t permission);
@@ -152,7 +199,15 @@ int unlink_fs(char * name);
 int symlink_fs(char * value, char * name);
 int readlink_fs(fs_node_t * node, char * buf, size_t size);
 int selectcheck_fs(fs_node_t * node);
-int selectwait_fs(fs_node_t * node, void * process);
+int selectwait_fs(fs_node_t * node, fs_waiter_t * waiter);
+int pollcheck_fs(fs_node_t * node);
+
+void fs_wait_add(list_t ** waiters, fs_waiter_t * waiter);
+void fs_wait_remove(fs_waiter_t * waiter);
+void fs_wait_alert(list_t * waiters, int events);
+fs_node_t * make_pollset(void);
+int pollset_ctl_fs(fs_node_t * set, int op, int fd, fs_node_t * node, int events, void * data);
+int pollset_wait_fs(fs_node_t * set, struct pollset_event * out, int max, int timeout);
 
 void vfs_install(void);
 void * vfs_mount(char * path, fs_node_t * local_root);
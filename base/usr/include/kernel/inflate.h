@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Decompress a raw DEFLATE (RFC 1951) stream into a buffer of
+ * known size. Returns 0 on success and stores the number of bytes
+ * produced in *written; returns a negative value if the input is
+ * corrupt, truncated, or would overflow the output.
+ */
+extern int inflate_raw(const uint8_t * in, size_t in_len, uint8_t * out, size_t out_len, size_t * written);
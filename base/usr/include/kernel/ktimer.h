@@ -0,0 +1,34 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Kernel timers
+ *
+ * A ktimer_t is embedded in whatever it wakes (process_t has one for
+ * sleep_until() and fswait timeouts), so arming one never allocates.
+ * Timers live in a hierarchical timing wheel: arming and cancelling
+ * are O(1), and the timer interrupt only looks at the slot for the
+ * current millisecond. See sys/ktimer.c.
+ */
+#pragma once
+
+#include <toaru/list.h>
+
+typedef struct ktimer {
+	node_t link;                        /* In a wheel slot while link.owner is set */
+	unsigned long expires;              /* timer_now_ms() at which to fire */
+	void (*fire)(struct ktimer * timer);
+	void * data;
+} ktimer_t;
+
+/* Fill in fire and data, then arm with ktimer_add() */
+extern void ktimer_add(ktimer_t * timer, unsigned long expires);
+/* Returns 1 if the timer was armed and now isn't, 0 if it had already fired */
+extern int ktimer_cancel(ktimer_t * timer);
+/* Timer interrupt: fire everything up to `now` */
+extern void ktimer_run(unsigned long now);
+
+static inline int ktimer_pending(ktimer_t * timer) {
+	return timer->link.owner != NULL;
+}
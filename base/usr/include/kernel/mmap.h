@@ -0,0 +1,38 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ */
+#pragma once
+
+#include <kernel/system.h>
+#include <kernel/fs.h>
+#include <toaru/hashmap.h>
+
+/*
+ * Pages shared by every MAP_SHARED mapping of one file (or of one
+ * anonymous MAP_SHARED region, which fork() hands to the child).
+ * The object owns the frames, or holds the file's pages in the page
+ * cache pinned; page tables mapping them mark the entries shared so
+ * that releasing a directory leaves them alone.
+ */
+typedef struct vm_object {
+	int refcount;
+	fs_node_t * file;   /* NULL for anonymous memory */
+	hashmap_t * pages;  /* page index in the file -> frame number */
+	hashmap_t * cached; /* page index in the file -> cached_page_t, if the file is cached */
+} vm_object_t;
+
+typedef struct vm_area {
+	uintptr_t start;
+	uintptr_t end;       /* Exclusive; both page-aligned */
+	int prot;
+	int flags;
+	fs_node_t * file;    /* Held open while mapped */
+	uint32_t offset;     /* File offset of start */
+	vm_object_t * object; /* MAP_SHARED only */
+} vm_area_t;
+
+extern uintptr_t mmap_map(uintptr_t addr, size_t length, int prot, int flags, fs_node_t * file, uint32_t offset);
+extern int mmap_unmap(uintptr_t addr, size_t length);
+extern int mmap_protect(uintptr_t addr, size_t length, int prot);
+extern int mmap_fault(uintptr_t address, uint32_t err_code);
+extern void mmap_clone(page_directory_t * dst, page_directory_t * src);
+extern void mmap_release(page_directory_t * dir);
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Compressed read-only filesystem image, built by util/mkrofs.py.
+ *
+ * The superblock is followed by file data, split into blocks that
+ * are compressed (raw DEFLATE) independently, and then by the
+ * metadata tables, which the driver keeps in memory:
+ *
+ *   inodes   rofs_inode_t[inode_count], root is inode 0
+ *   dirents  rofs_dirent_t[dirent_count]; each directory owns a
+ *            contiguous run sorted by name, so lookups bisect
+ *   names    NUL-terminated entry names and symlink targets
+ *   blocks   rofs_block_t[block_count]; each file owns a
+ *            contiguous run, one entry per block_size bytes
+ *
+ * All values are little-endian.
+ */
+
+#define ROFS_MAGIC   0x53464F52 /* ROFS */
+#define ROFS_VERSION 1
+
+/* Set in rofs_block_t.size when a block did not compress */
+#define ROFS_BLOCK_STORED 0x80000000
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t block_size;
+	uint32_t image_size;
+
+	uint32_t inode_count;
+	uint32_t inode_offset;
+	uint32_t dirent_count;
+	uint32_t dirent_offset;
+	uint32_t names_size;
+	uint32_t names_offset;
+	uint32_t block_count;
+	uint32_t block_offset;
+} rofs_super_t;
+
+typedef struct {
+	uint16_t mode;   /* type and permission bits, as in st_mode */
+	uint16_t uid;
+	uint16_t gid;
+	uint16_t nlink;
+	uint32_t size;   /* bytes; entries for a directory */
+	uint32_t mtime;
+	uint32_t start;  /* first block, first dirent, or symlink target name */
+} rofs_inode_t;
+
+typedef struct {
+	uint32_t inode;
+	uint32_t name;   /* offset into the name table */
+} rofs_dirent_t;
+
+typedef struct {
+	uint32_t offset; /* from the start of the image */
+	uint32_t size;   /* compressed length, | ROFS_BLOCK_STORED */
+} rofs_block_t;
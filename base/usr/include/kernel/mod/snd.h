@@ -49,4 +49,12 @@ int snd_unregister(snd_device_t * device);
  */
 int snd_request_buf(snd_device_t * device, uint32_t size, uint8_t *buffer);
 
+/*
+ * Ask the mixer tasklet to fill a buffer. Unlike snd_request_buf, this is safe
+ * to call from an interrupt handler: the mixing itself happens later, outside
+ * of interrupt context, so the device should request buffers ahead of where it
+ * is currently playing.
+ */
+int snd_schedule_buf(snd_device_t * device, uint32_t size, uint8_t *buffer);
+
 #endif  /* KERNEL_MOD_SND_H */
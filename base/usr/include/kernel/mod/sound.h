@@ -34,3 +34,43 @@ typedef struct snd_knob_value {
 #define SND_MIXER_READ_KNOB 2
 #define SND_MIXER_WRITE_KNOB 3
 
+/* /dev/dsp IOCTLs */
+#define SND_DSP_SET_REALTIME 4 /* Don't block on full buffers */
+#define SND_DSP_GET_SAMPLES  5 /* Returns frames consumed by the mixer */
+#define SND_DSP_SET_RATE     6 /* uint32_t *: stream sample rate in Hz */
+#define SND_DSP_SET_VOLUME   7 /* uint32_t *: stream gain, 0 to SND_KNOB_MAX_VALUE */
+#define SND_DSP_SET_LATENCY  8 /* uint32_t *: buffered frames; only while the buffer is empty */
+#define SND_DSP_GET_STATS    9 /* snd_dsp_stats_t * */
+#define SND_DSP_MMAP        10 /* snd_dsp_mmap_request_t *: switch the stream to a shared ring */
+
+typedef struct snd_dsp_stats {
+	uint32_t rate;         /* Stream sample rate */
+	uint32_t latency;      /* Stream buffer size, in frames */
+	uint32_t samples;      /* Frames consumed by the mixer */
+	uint32_t underruns;    /* Periods in which this stream ran dry */
+	uint32_t periods;      /* Periods mixed by the device */
+	uint32_t late;         /* Periods the mixer fell behind the device */
+	uint32_t mix_time;     /* TSC cycles spent mixing the last period */
+	uint32_t mix_time_max; /* Worst case of the above */
+} snd_dsp_stats_t;
+
+/*
+ * Header of a mapped stream. The ring of frames follows at data_offset.
+ * Positions are free-running frame counters; the client writes frames
+ * at write_ptr and then advances it, the mixer consumes from read_ptr.
+ * The stream is reported ready by fswait once `period` frames are free.
+ */
+typedef struct snd_dsp_mmap {
+	volatile uint32_t read_ptr;  /* Advanced by the mixer */
+	volatile uint32_t write_ptr; /* Advanced by the client */
+	uint32_t frames;             /* Ring size in frames, a power of two */
+	uint32_t period;             /* Frames to be free before the stream is ready */
+	uint32_t data_offset;        /* Offset of the ring from this header, in bytes */
+	volatile uint32_t underruns; /* Periods in which the ring ran dry */
+} snd_dsp_mmap_t;
+
+typedef struct snd_dsp_mmap_request {
+	uint32_t frames;       /* IN */
+	uint32_t period;       /* IN */
+	snd_dsp_mmap_t * map;  /* OUT */
+} snd_dsp_mmap_request_t;
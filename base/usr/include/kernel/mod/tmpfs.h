@@ -18,6 +18,8 @@ struct tmpfs_file {
 	size_t pointers;
 	char ** blocks;
 	char * target;
+	fs_node_t * lower; /* overlay: file in the lower filesystem */
+	int copied;        /* overlay: contents now live here, not in lower */
 };
 
 struct tmpfs_dir;
@@ -33,6 +35,7 @@ struct tmpfs_dir {
 	unsigned int ctime;
 	list_t * files;
 	struct tmpfs_dir * parent;
+	fs_node_t * lower; /* overlay: entries not yet populated */
 };
 
 #endif /* _TMPFS_H__ */
@@ -19,7 +19,14 @@ typedef struct {
     char * deps;
 } module_data_t;
 
+typedef struct {
+    uintptr_t addr;
+    char * name;
+} symbol_entry_t;
+
 void (* symbol_find(const char * name))(void);
+extern char * symbol_lookup(uintptr_t addr, uintptr_t * base);
+extern symbol_entry_t * symbols_sorted(size_t * count);
 
 extern int module_quickcheck(void * blob);
 extern void * module_load_direct(void * blob, size_t size);
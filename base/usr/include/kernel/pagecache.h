@@ -0,0 +1,46 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ */
+#pragma once
+
+#include <kernel/system.h>
+#include <kernel/fs.h>
+#include <toaru/list.h>
+
+/*
+ * One page of a file, filled by the filesystem's readpage(). Each page
+ * lives at its own address in the page cache window, which is mapped
+ * in every directory, so it can be copied from directly. Pinned pages
+ * are in use (mapped into a process, or being copied) and can't be
+ * reclaimed; the rest sit on the LRU list.
+ */
+typedef struct cached_page {
+	node_t lru;                  /* On the LRU list while unpinned */
+	struct cached_file * file;   /* NULL once dropped from its file */
+	uint32_t index;              /* Page index in the file */
+	uint32_t valid;              /* Bytes that came from the file; the rest is zero */
+	uintptr_t address;           /* Where it sits in the window */
+	int pinned;
+	int dirty;                   /* Written through a mapping, not yet written back */
+} cached_page_t;
+
+struct pagecache_stats {
+	uint32_t pages;
+	uint32_t pinned;
+	uint32_t dirty;
+	uint32_t limit;
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t reclaimed;
+	uint32_t written;
+};
+
+extern cached_page_t * pagecache_get(fs_node_t * node, uint32_t index);
+extern void pagecache_put(cached_page_t * page);
+extern uintptr_t pagecache_frame(cached_page_t * page);
+extern void pagecache_set_dirty(cached_page_t * page);
+extern int pagecache_writeback(fs_node_t * node, cached_page_t * page);
+extern uint32_t pagecache_read(fs_node_t * node, uint32_t offset, uint32_t size, uint8_t * buffer);
+extern void pagecache_update(fs_node_t * node, uint32_t offset, uint32_t size, uint8_t * buffer);
+extern void pagecache_invalidate(fs_node_t * node);
+extern void pagecache_pressure(void);
+extern void pagecache_get_stats(struct pagecache_stats * stats);
@@ -5,6 +5,8 @@
 
 #include <kernel/signal.h>
 #include <kernel/task.h>
+#include <kernel/smp.h>
+#include <kernel/ktimer.h>
 
 #include <toaru/tree.h>
 
@@ -30,7 +32,8 @@ typedef struct thread {
 	uintptr_t  eip; /* Instruction Pointer */
 
 	uint8_t    fpu_enabled;
-	uint8_t    fp_regs[512];
+	uint8_t    fp_regs[512 + 16]; /* FXSAVE area, from the first 16-byte boundary */
+	int        fpu_cpu;           /* Processor that last loaded this state, or -1 */
 
 	uint8_t    padding[32]; /* I don't know */
 
@@ -66,6 +69,18 @@ typedef struct signal_table {
 	uintptr_t functions[NUMSIGNALS+1];
 } sig_table_t;
 
+/* Resource accounting, kept up to date as things happen */
+typedef struct process_stats {
+	unsigned long utime;       /* Timer ticks spent in user mode */
+	unsigned long stime;       /* Timer ticks spent in the kernel */
+	unsigned long nvcsw;       /* Voluntary context switches (blocking) */
+	unsigned long nivcsw;      /* Involuntary context switches (preemption) */
+	unsigned long syscalls;    /* System calls made */
+	unsigned long page_faults; /* Page faults taken */
+	uint64_t      read_bytes;  /* Bytes returned by read() */
+	uint64_t      write_bytes; /* Bytes accepted by write() */
+} process_stats_t;
+
 /* Portable process struct */
 typedef struct process {
 	pid_t         id;                /* Process ID (pid) */
@@ -82,6 +97,9 @@ typedef struct process {
 
 	thread_t      thread;            /* Associated task information */
 	tree_node_t * tree_entry;        /* Process Tree Entry */
+	node_t *      list_entry;        /* Entry in process_list */
+	list_t        zombies;           /* Finished children not yet waited for */
+	node_t        zombie_node;       /* On the parent's zombies once finished */
 	image_t       image;             /* Binary image information */
 	fs_node_t *   wd_node;           /* Working directory VFS node */
 	char *        wd_name;           /* Working directory path name */
@@ -91,30 +109,26 @@ typedef struct process {
 	uint8_t       finished;          /* Status indicator */
 	uint8_t       started;
 	uint8_t       running;
+	int           cpu;               /* Processor it last ran on */
 	struct regs * syscall_registers; /* Registers at interrupt */
 	list_t *      wait_queue;
 	list_t *      shm_mappings;      /* Shared memory chunk mappings */
-	list_t *      signal_queue;      /* Queued signals */
-	thread_t      signal_state;
-	char *        signal_kstack;
+	uint64_t      signals_pending;   /* Sent, not yet delivered; bit n is signal n */
+	uint64_t      signals_blocked;   /* Held pending by sigprocmask() */
+	uint8_t       syscall_restart;   /* Interrupted by a signal; run the call again after it */
 	node_t        sched_node;
 	node_t        sleep_node;
-	node_t *      timed_sleep_node;
+	ktimer_t      sleep_timer;       /* sleep_until() deadline, or fswait timeout */
 	uint8_t       is_tasklet;
 	volatile uint8_t sleep_interrupted;
-	list_t *      node_waits;
+	fs_waiter_t * node_waits;   /* Registrations during process_wait_nodes() */
 	int           awoken_index;
-	node_t *      timeout_node;
+	struct process * vfork_parent;   /* Borrowing its memory until exec or exit */
+	struct process * vfork_child;    /* Waiting in vfork() for this child */
 	struct timeval start;
+	process_stats_t stats;             /* Resource usage */
 } process_t;
 
-typedef struct {
-	unsigned long end_tick;
-	unsigned long end_subtick;
-	process_t * process;
-	int is_fswait;
-} sleeper_t;
-
 extern void initialize_process_tree(void);
 extern process_t * spawn_process(volatile process_t * parent, int reuse_fds);
 extern void debug_print_process_tree(void);
@@ -128,18 +142,16 @@ extern uint32_t process_append_fd(process_t * proc, fs_node_t * node);
 extern process_t * process_from_pid(pid_t pid);
 extern void delete_process(process_t * proc);
 process_t * process_get_parent(process_t * process);
+process_t * process_make_zombie(process_t * process);
+extern void vfork_release(process_t * proc);
 extern uint32_t process_move_fd(process_t * proc, int src, int dest);
 extern int process_is_ready(process_t * proc);
 
-extern void wakeup_sleepers(unsigned long seconds, unsigned long subseconds);
 extern void sleep_until(process_t * process, unsigned long seconds, unsigned long subseconds);
 
-extern volatile process_t * current_process;
-extern process_t * kernel_idle_task;
 extern list_t * process_list;
 
 extern int process_wait_nodes(process_t * process,fs_node_t * nodes[], int timeout);
-extern int process_alert_node(process_t * process, void * value);
 extern int process_awaken_from_fswait(process_t * process, int index);
 
 typedef void (*tasklet_t) (void *, char *);
@@ -0,0 +1,67 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Binary process snapshot
+ *
+ * A single read() of /proc/snapshot at offset 0 returns a header
+ * with system-wide counters followed by as many per-process records
+ * as fit in the buffer. Everything is captured at one instant, so
+ * monitors don't need to walk /proc or parse text.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define PROCSNAP_MAGIC 0x50534E50 /* PNSP */
+#define PROCSNAP_IRQS  16
+
+typedef struct {
+	uint32_t magic;
+	uint32_t header_size;      /* Records start here */
+	uint32_t record_size;
+	uint32_t count;            /* Records that were returned */
+	uint32_t total;            /* Processes that exist; > count if the buffer was too small */
+
+	/* Time since boot, in timer ticks (milliseconds) */
+	uint32_t uptime;
+	uint32_t cpu_user;
+	uint32_t cpu_system;
+	uint32_t cpu_idle;
+
+	uint32_t mem_total;        /* kB */
+	uint32_t mem_used;         /* kB */
+	uint32_t kheap_used;       /* kB */
+
+	uint32_t context_switches;
+	uint32_t irqs[PROCSNAP_IRQS];
+} procsnap_header_t;
+
+#define PROCSNAP_FLAG_TASKLET 0x01
+#define PROCSNAP_FLAG_THREAD  0x02
+
+typedef struct {
+	int32_t  pid;
+	int32_t  tgid;
+	int32_t  ppid;
+	uint32_t uid;
+	char     state;            /* R, S or Z */
+	uint8_t  flags;
+	uint16_t reserved;
+	char     name[32];
+
+	/* See process_stats_t */
+	uint32_t utime;
+	uint32_t stime;
+	uint32_t nvcsw;
+	uint32_t nivcsw;
+	uint32_t syscalls;
+	uint32_t page_faults;
+	uint64_t read_bytes;
+	uint64_t write_bytes;
+
+	uint32_t vsz;              /* kB, shared by a thread group */
+	uint32_t shm;              /* kB, shared by a thread group */
+	uint32_t start;            /* seconds since the epoch */
+} procsnap_record_t;
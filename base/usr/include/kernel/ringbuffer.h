@@ -11,17 +11,20 @@ typedef struct {
 	int internal_stop;
 	list_t * alert_waiters;
 	int discard;
+	int lockless; /* Exactly one reader and one writer; skip the lock */
 } ring_buffer_t;
 
 size_t ring_buffer_unread(ring_buffer_t * ring_buffer);
 size_t ring_buffer_size(fs_node_t * node);
 size_t ring_buffer_available(ring_buffer_t * ring_buffer);
 size_t ring_buffer_read(ring_buffer_t * ring_buffer, size_t size, uint8_t * buffer);
+size_t ring_buffer_read_line(ring_buffer_t * ring_buffer, size_t size, uint8_t * buffer);
 size_t ring_buffer_write(ring_buffer_t * ring_buffer, size_t size, uint8_t * buffer);
 
 ring_buffer_t * ring_buffer_create(size_t size);
 void ring_buffer_destroy(ring_buffer_t * ring_buffer);
 void ring_buffer_interrupt(ring_buffer_t * ring_buffer);
-void ring_buffer_alert_waiters(ring_buffer_t * ring_buffer);
-void ring_buffer_select_wait(ring_buffer_t * ring_buffer, void * process);
+void ring_buffer_alert_waiters(ring_buffer_t * ring_buffer, int events);
+void ring_buffer_select_wait(ring_buffer_t * ring_buffer, fs_waiter_t * waiter);
+void ring_buffer_selftest(void);
 
@@ -40,3 +40,9 @@ extern int    shm_release(char * path);
 extern void shm_install(void);
 extern void shm_release_all(process_t * proc);
 
+/* Kernel-owned chunks, for drivers sharing their buffers with userspace */
+extern shm_chunk_t * shm_chunk_from_kernel(void * address, size_t size);
+extern void * shm_map_chunk(shm_chunk_t * chunk, process_t * proc);
+extern int    shm_unmap_chunk(shm_chunk_t * chunk, process_t * proc);
+extern void   shm_release_chunk(shm_chunk_t * chunk);
+
@@ -4,8 +4,13 @@
 #pragma once
 
 #include <kernel/types.h>
-void return_from_signal_handler(void);
-void fix_signal_stacks(void);
+
+struct regs;
+void deliver_signals(struct regs * r);
+int return_from_signal_handler(struct regs * r);
 
 #include <sys/signal_defs.h>
 
+#define SIGNAL_BIT(signum) (1ULL << (signum))
+/* Signals sigprocmask() can't block */
+#define SIGNAL_UNBLOCKABLE (SIGNAL_BIT(SIGKILL) | SIGNAL_BIT(SIGSTOP))
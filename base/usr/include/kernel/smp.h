@@ -0,0 +1,80 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Per-processor state
+ *
+ * Each processor has a GDT entry (selector 0x30) whose base is its
+ * cpu_t, and the kernel keeps %gs loaded with it, so the scheduler
+ * globals below resolve to the running processor's copy.
+ *
+ * The kernel proper is serialized by a single lock: a processor
+ * takes it on entry from user mode or the idle loop and gives it up
+ * on the way back out, so code that ran on one processor before
+ * still only ever runs on one processor at a time. See sys/smp.c.
+ */
+#pragma once
+
+#include <kernel/types.h>
+#include <kernel/task.h>
+#include <toaru/list.h>
+
+#define MAX_CPUS 32
+
+#define CPU_SELECTOR 0x30
+
+/* Local APIC vectors */
+#define LAPIC_TIMER_VECTOR  0x7B
+#define IPI_RESCHEDULE      0x7C
+#define IPI_TLB_SHOOTDOWN   0x7D
+#define LAPIC_SPURIOUS      0xFF
+
+struct process;
+struct regs;
+
+typedef struct cpu {
+	struct cpu * self;                         /* Read through %gs:0; must be first */
+	int id;                                    /* Index in cpus[] */
+	int lapic_id;
+	volatile int online;
+
+	volatile struct process * process;         /* current_process */
+	struct process * idle_task;
+	page_directory_t * directory;              /* current_directory */
+	list_t * ready_queue;
+
+	int kernel_lock_held;
+	uint32_t kernel_lock_flags;
+	volatile int tlb_flush;                    /* Set by a shootdown, cleared once flushed */
+	int sync_depth;                            /* IRQ_OFF nesting, see cpu/irq.c */
+	struct process * fpu_owner;                /* Whose FPU state the registers hold */
+	int fpu_live;                              /* FPU enabled for the current task */
+} cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+extern int cpu_count;
+
+static inline cpu_t * this_cpu(void) {
+	cpu_t * cpu;
+	/* Volatile: a task switch can move the caller to another processor */
+	__asm__ __volatile__ ("movl %%gs:0, %0" : "=r"(cpu));
+	return cpu;
+}
+
+#define current_process   (this_cpu()->process)
+#define current_directory (this_cpu()->directory)
+#define kernel_idle_task  (this_cpu()->idle_task)
+
+extern void smp_install(void);
+extern void gdt_install_cpu(int id);
+
+/* The kernel lock */
+extern int kernel_lock_enter(void);
+extern void kernel_lock_leave(int took);
+extern void kernel_lock_release(void);
+
+extern void smp_relax(void);
+extern void smp_reschedule(cpu_t * cpu);
+extern void tlb_shootdown(page_directory_t * dir);
+extern void lapic_handler(struct regs * r);
@@ -32,7 +32,6 @@ void int_enable(void);
 #define STOP while (1) { PAUSE; }
 
 #define SYSCALL_VECTOR 0x7F
-#define SIGNAL_RETURN 0xFFFFDEAF
 #define THREAD_RETURN 0xFFFFB00F
 
 extern void * code;
@@ -48,6 +47,8 @@ typedef volatile int spin_lock_t[2];
 extern void spin_init(spin_lock_t lock);
 extern void spin_lock(spin_lock_t lock);
 extern void spin_unlock(spin_lock_t lock);
+extern void spin_lock_irqsave(spin_lock_t lock, uint32_t * flags);
+extern void spin_unlock_irqrestore(spin_lock_t lock, uint32_t flags);
 
 extern void return_to_userspace(void);
 
@@ -75,10 +76,16 @@ extern uint8_t startswith(const char * str, const char * accept);
 extern void gdt_install(void);
 extern void gdt_set_gate(uint8_t num, uint64_t base, uint64_t limit, uint8_t access, uint8_t gran);
 extern void set_kernel_stack(uintptr_t stack);
+extern int sysenter_available;
+
+/* vDSO */
+extern void vdso_install(void);
+extern void vdso_update(void);
 
 /* IDT */
 extern void idt_install(void);
 extern void idt_set_gate(uint8_t num, void (*base)(void), uint16_t sel, uint8_t flags);
+extern void idt_load_cpu(void);
 
 /* Registers
  *
@@ -118,10 +125,15 @@ extern void irq_ack(size_t);
 
 /* Timer */
 extern void timer_install(void);
+extern void timer_account(struct regs *r);
 extern unsigned long timer_ticks;
 extern unsigned long timer_subticks;
+extern unsigned long timer_user_ticks;
+extern unsigned long timer_system_ticks;
+extern unsigned long timer_idle_ticks;
 extern signed long timer_drift;
 extern void relative_time(unsigned long seconds, unsigned long subseconds, unsigned long * out_seconds, unsigned long * out_subseconds);
+extern unsigned long timer_now_ms(void);
 
 /* Memory Management */
 extern uintptr_t placement_pointer;
@@ -135,7 +147,6 @@ extern uintptr_t kvmalloc_p(size_t size, uintptr_t * phys);
 // Page types moved to task.h
 
 extern page_directory_t *kernel_directory;
-extern page_directory_t *current_directory;
 
 extern void paging_install(uint32_t memsize);
 extern void paging_prestart(void);
@@ -154,6 +165,7 @@ int debug_shell_start(void);
 void heap_install(void);
 
 void alloc_frame(page_t *page, int is_kernel, int is_writeable);
+void alloc_user_frame(uintptr_t address, page_directory_t * dir);
 void free_frame(page_t *page);
 uintptr_t memory_use(void);
 uintptr_t memory_total(void);
@@ -180,6 +192,8 @@ extern void switch_task(uint8_t reschedule);
 extern void switch_next(void);
 extern uint32_t fork(void);
 extern uint32_t clone(uintptr_t new_stack, uintptr_t thread_func, uintptr_t arg);
+extern uint32_t vfork(uintptr_t new_stack, uintptr_t thread_func, uintptr_t arg);
+extern void vfork_exec(void);
 extern uint32_t getpid(void);
 extern void enter_user_jmp(uintptr_t location, int argc, char ** argv, uintptr_t stack);
 
@@ -202,6 +216,14 @@ extern uint32_t now(void);
 extern void switch_fpu(void);
 extern void unswitch_fpu(void);
 extern void fpu_install(void);
+extern void fpu_install_ap(void);
+extern void fpu_fork(process_t * child, process_t * parent);
+extern int fpu_get_state(process_t * proc, uint8_t * out);
+extern void fpu_set_state(process_t * proc, uint8_t * in);
+extern unsigned long fpu_saves;
+extern unsigned long fpu_saves_avoided;
+extern unsigned long fpu_restores;
+extern unsigned long fpu_restores_avoided;
 
 /* ELF */
 extern int exec( char *, int, char **, char **);
@@ -214,21 +236,26 @@ extern void syscalls_install(void);
 extern int wakeup_queue(list_t * queue);
 extern int wakeup_queue_interrupted(list_t * queue);
 extern int sleep_on(list_t * queue);
-
-typedef struct {
-	uint32_t  signum;
-	uintptr_t handler;
-	regs_t registers_before;
-} signal_t;
-
-extern void handle_signal(process_t *, signal_t *);
+extern int sleep_on_unlocking(list_t * queue, spin_lock_t release, uint32_t flags);
 
 extern int send_signal(pid_t process, uint32_t signal, int force);
+extern int signal_pending(process_t * proc);
+extern void signal_default_actions(process_t * proc);
+
+/* Kernel addresses for the page cache, at the top of the kernel heap (see fs/pagecache.c) */
+#define PAGE_CACHE_START  0x1C000000
+#define PAGE_CACHE_END    0x20000000
 
 #define USER_STACK_BOTTOM 0xAFF00000
 #define USER_STACK_TOP    0xB0000000
 #define SHM_START         0xB0000000
 
+/* mmap() places mappings here, working down from the top */
+#define MMAP_BOTTOM       0x80000000
+#define MMAP_TOP          0xA0000000
+/* ...and MAP_FIXED may ask for anything from here to the stack */
+#define USER_MAP_START    0x20000000
+
 extern void validate(void * ptr);
 extern int validate_safe(void * ptr);
 
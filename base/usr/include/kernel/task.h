@@ -1,6 +1,7 @@
 #pragma once
 
 #include <kernel/types.h>
+#include <toaru/list.h>
 
 typedef struct page {
 	unsigned int present:1;
@@ -12,7 +13,8 @@ typedef struct page {
 	unsigned int dirty:1;
 	unsigned int pat:1;
 	unsigned int global:1;
-	unsigned int unused:3;
+	unsigned int shared:1;  /* Frame belongs to a mapping object, not to this directory */
+	unsigned int unused:2;
 	unsigned int frame:20;
 } __attribute__((packed)) page_t;
 
@@ -25,5 +27,8 @@ typedef struct page_directory {
 	page_table_t *tables[1024];	/* 1024 pointers to page tables... */
 	uintptr_t physical_address;	/* The physical address of physical_tables */
 	int32_t ref_count;
+	uint32_t user_pages;	/* Frames owned below SHM_START */
+	uint32_t shm_pages;	/* Shared memory pages mapped in */
+	list_t * mappings;	/* mmap() regions, sorted by address (see kernel/mem/mmap.c) */
 } page_directory_t;
 
@@ -0,0 +1,76 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Kernel trace buffer
+ *
+ * Shared between the kernel, which records events, and
+ * userspace tools (kprof) which read /proc/trace.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/* Event types; each is also a bit in the enable mask */
+#define TRACE_SAMPLE       0  /* arg: eip, arg2: 1 if user mode */
+#define TRACE_SYSCALL      1  /* arg: syscall number, arg2: return value */
+#define TRACE_SWITCH       2  /* arg: previous pid */
+#define TRACE_PAGE_FAULT   3  /* arg: faulting address, arg2: eip */
+#define TRACE_IRQ          4  /* arg: irq line */
+#define TRACE_BLOCK        5  /* arg: first sector, arg2: bytes (top bit set for writes) */
+#define TRACE_TYPES        6
+
+#define TRACE_MASK(type)   (1 << (type))
+#define TRACE_MASK_ALL     ((1 << TRACE_TYPES) - 1)
+#define TRACE_BLOCK_WRITE  0x80000000
+
+/* syscall_system_function(TRACE_SYSFUNC, {mask, reset}) */
+#define TRACE_SYSFUNC      14
+
+#define TRACE_MAGIC        0x43525454 /* TTRC */
+
+typedef struct {
+	uint64_t tsc;
+	uint16_t type;
+	uint16_t pid;
+	uint32_t arg;
+	uint32_t arg2;
+	uint32_t duration; /* cycles, or 0 when not known */
+} trace_record_t;
+
+/* /proc/trace starts with this, followed by `count` records, oldest first */
+typedef struct {
+	uint32_t magic;
+	uint32_t record_size;
+	uint32_t count;
+	uint32_t dropped;    /* records overwritten since the last reset */
+	uint32_t mask;
+	uint32_t tsc_per_ms; /* estimated from the PIT */
+} trace_header_t;
+
+#ifdef _KERNEL_
+
+extern volatile uint32_t trace_mask;
+extern volatile uint32_t trace_switches;
+
+extern void trace_record(uint16_t type, uint32_t arg, uint32_t arg2, uint32_t duration);
+extern uint32_t trace_control(uint32_t mask, int reset);
+extern uint32_t trace_snapshot(uint32_t offset, uint32_t size, uint8_t * buffer);
+
+static inline uint64_t trace_tsc(void) {
+	uint64_t x;
+	asm volatile ("rdtsc" : "=A"(x));
+	return x;
+}
+
+/*
+ * Static tracepoints: a single load and branch when disabled.
+ */
+#define trace_enabled(type) (trace_mask & TRACE_MASK(type))
+
+#define trace_event(type, arg, arg2, duration) do { \
+	if (trace_enabled(type)) trace_record((type), (arg), (arg2), (duration)); \
+} while (0)
+
+#endif
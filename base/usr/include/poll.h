@@ -10,6 +10,9 @@
 
 typedef unsigned int nfds_t;
 
+/* Most entries one poll() call can take */
+#define POLL_MAX 4096
+
 struct pollfd {
 	int fd;
 	short events;
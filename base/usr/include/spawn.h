@@ -0,0 +1,45 @@
+#pragma once
+
+#include <sys/types.h>
+
+/*
+ * posix_spawn() starts the child with vfork semantics: it runs in our
+ * memory, on a stack of its own, until its exec, and we wait for that
+ * rather than copying the address space the way fork() does.
+ */
+
+typedef struct {
+	int flags;
+} posix_spawnattr_t;
+
+struct __spawn_action {
+	int type;
+	int fd;
+	int newfd;
+	char * path;
+	int oflag;
+	mode_t mode;
+};
+
+typedef struct {
+	int count;
+	int capacity;
+	struct __spawn_action * actions;
+} posix_spawn_file_actions_t;
+
+extern int posix_spawn(pid_t * pid, const char * path, const posix_spawn_file_actions_t * file_actions,
+		const posix_spawnattr_t * attrp, char * const argv[], char * const envp[]);
+extern int posix_spawnp(pid_t * pid, const char * file, const posix_spawn_file_actions_t * file_actions,
+		const posix_spawnattr_t * attrp, char * const argv[], char * const envp[]);
+
+extern int posix_spawn_file_actions_init(posix_spawn_file_actions_t * file_actions);
+extern int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t * file_actions);
+extern int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t * file_actions, int fd, const char * path, int oflag, mode_t mode);
+extern int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t * file_actions, int fd);
+extern int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t * file_actions, int fd, int newfd);
+
+/* No attributes are supported yet; flags must be 0 */
+extern int posix_spawnattr_init(posix_spawnattr_t * attr);
+extern int posix_spawnattr_destroy(posix_spawnattr_t * attr);
+extern int posix_spawnattr_getflags(const posix_spawnattr_t * attr, short * flags);
+extern int posix_spawnattr_setflags(posix_spawnattr_t * attr, short flags);
@@ -0,0 +1,38 @@
+#pragma once
+
+/*
+ * Batched directory reads
+ *
+ * getdents() fills a buffer with as many directory entries as fit and
+ * returns the number of bytes used, or 0 at the end of the directory.
+ * Each record is d_reclen bytes long (a multiple of 4) and carries the
+ * entry's type when the filesystem knows it, so listing a directory
+ * doesn't need a stat() per entry. DT_UNKNOWN means it didn't; stat()
+ * the entry instead. The position is kept in the descriptor's offset,
+ * is opaque, and starts over after an lseek() to 0.
+ */
+
+#include <stdint.h>
+
+#define DT_UNKNOWN  0
+#define DT_FIFO     1
+#define DT_CHR      2
+#define DT_DIR      4
+#define DT_BLK      6
+#define DT_REG      8
+#define DT_LNK     10
+#define DT_SOCK    12
+
+struct dirent_record {
+	uint32_t d_ino;
+	uint16_t d_reclen;
+	uint8_t  d_type;
+	char     d_name[];
+};
+
+/* Space a record for a name of `len` bytes takes, including the terminator */
+#define DIRENT_RECLEN(len) ((sizeof(struct dirent_record) + (len) + 1 + 3) & ~3)
+
+#ifndef _KERNEL_
+extern int getdents(int fd, void * buf, unsigned int size);
+#endif
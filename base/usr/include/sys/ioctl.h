@@ -8,5 +8,8 @@
 #define IOCTL_DTYPE_FILE     1
 #define IOCTL_DTYPE_TTY      2
 
+/* Bring a file's contents into memory ahead of use, if supported */
+#define IOCTL_PRELOAD 0x4F01
+
 #define IOCTL_PACKETFS_QUEUED 0x5050
 
@@ -1,3 +1,43 @@
 #pragma once
 
-/* Nothing here, we don't have an mmap implementation yet? */
+/*
+ * Memory mappings
+ *
+ * Mappings live between the heap and the user stack. Anonymous
+ * mappings are filled with zeros as they are touched. File mappings
+ * read pages in from the file as they are touched; MAP_SHARED pages
+ * are shared with everyone else mapping the same file and written
+ * back when the mapping goes away, MAP_PRIVATE pages are copies.
+ */
+
+#define PROT_NONE  0x0
+#define PROT_READ  0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC  0x4 /* Not enforced; anything readable can be run */
+
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+#define MAP_FIXED     0x10
+#define MAP_ANONYMOUS 0x20
+#define MAP_ANON      MAP_ANONYMOUS
+
+#define MAP_FAILED ((void *)-1)
+
+/* mmap() takes more arguments than a system call has registers */
+struct mmap_args {
+	void * addr;
+	unsigned long length;
+	int prot;
+	int flags;
+	int fd;
+	long offset;
+};
+
+#ifndef _KERNEL_
+#include <stddef.h>
+#include <sys/types.h>
+
+extern void * mmap(void * addr, size_t length, int prot, int flags, int fd, off_t offset);
+extern int munmap(void * addr, size_t length);
+extern int mprotect(void * addr, size_t length, int prot);
+#endif
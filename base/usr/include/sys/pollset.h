@@ -0,0 +1,35 @@
+#pragma once
+
+/*
+ * Persistent readiness sets
+ *
+ * A pollset is a file descriptor holding a list of other descriptors
+ * and the events wanted from each. Registrations stay in place between
+ * calls, so pollset_wait() only looks at descriptors that have reported
+ * a change and returns all of the ready ones at once. A pollset is
+ * itself readable when it has something to report, so it can be
+ * waited on with fswait() or nested in another set.
+ *
+ * Entries are level-triggered unless POLLET is given: a level entry is
+ * reported by every wait while the condition holds, an edge entry once
+ * per change.
+ */
+
+#include <poll.h>
+
+#define POLLSET_ADD 1
+#define POLLSET_MOD 2
+#define POLLSET_DEL 3
+
+#define POLLET 0x4000
+
+struct pollset_event {
+	int fd;
+	short events;  /* POLL* bits wanted, and POLLET; ignored by POLLSET_DEL */
+	short revents; /* Filled in by pollset_wait */
+	void * data;   /* Returned as given */
+};
+
+extern int pollset_create(void);
+extern int pollset_ctl(int set, int op, int fd, struct pollset_event * event);
+extern int pollset_wait(int set, struct pollset_event * events, int max, int timeout);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#define NFDBITS (8 * sizeof(fd_mask))
+
+#define FD_ZERO(set)     do { (set)->fds_bits[0] = 0; (set)->fds_bits[1] = 0; } while (0)
+#define FD_SET(fd, set)  ((set)->fds_bits[(fd) / NFDBITS] |=  (1UL << ((fd) % NFDBITS)))
+#define FD_CLR(fd, set)  ((set)->fds_bits[(fd) / NFDBITS] &= ~(1UL << ((fd) % NFDBITS)))
+#define FD_ISSET(fd, set) (!!((set)->fds_bits[(fd) / NFDBITS] & (1UL << ((fd) % NFDBITS))))
+
+extern int select(int nfds, fd_set * readfds, fd_set * writefds, fd_set * exceptfds, struct timeval * timeout);
@@ -1,6 +1,10 @@
 #pragma once
 
+#ifndef _KERNEL_
 #include <sys/types.h>
+#else
+#include <kernel/types.h>
+#endif
 
 #define SIGEV_NONE   1
 #define SIGEV_SIGNAL 2
@@ -15,11 +19,10 @@
 #define SA_NOCLDSTOP 1
 #define SA_SIGINFO   2
 
-#if 0
+/* sigprocmask() */
 #define SIG_SETMASK 0
 #define SIG_BLOCK 1
 #define SIG_UNBLOCK 2
-#endif
 
 #define sa_handler   _signal_handlers._handler
 #define sa_sigaction _signal_handlers._sigaction
@@ -41,7 +44,8 @@ typedef struct {
 	union sigval si_value;
 } siginfo_t;
 
-typedef unsigned long sigset_t;
+/* Bit n is signal n */
+typedef unsigned long long sigset_t;
 typedef void (*_sig_func_ptr)();
 
 struct sigaction {
@@ -54,4 +58,13 @@ struct sigaction {
 };
 
 
+#ifndef _KERNEL_
 extern int kill(pid_t, int);
+extern int sigprocmask(int how, const sigset_t * set, sigset_t * oldset);
+extern int sigpending(sigset_t * set);
+extern int sigemptyset(sigset_t * set);
+extern int sigfillset(sigset_t * set);
+extern int sigaddset(sigset_t * set, int signum);
+extern int sigdelset(sigset_t * set, int signum);
+extern int sigismember(const sigset_t * set, int signum);
+#endif
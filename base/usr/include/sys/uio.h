@@ -0,0 +1,26 @@
+#pragma once
+
+/*
+ * Scatter/gather I/O
+ *
+ * readv() and writev() move data between one descriptor and several
+ * buffers in a single call. On regular files each buffer is read or
+ * written in turn at the file offset; anything else (pipes, terminals,
+ * packet sockets) sees the buffers as one read or write, so a writev()
+ * is still a single message.
+ */
+
+#define IOV_MAX 1024
+
+struct iovec {
+	void * iov_base;
+	unsigned long iov_len;
+};
+
+#ifndef _KERNEL_
+#include <stddef.h>
+#include <sys/types.h>
+
+extern ssize_t readv(int fd, const struct iovec * iov, int iovcnt);
+extern ssize_t writev(int fd, const struct iovec * iov, int iovcnt);
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+/*
+ * The vDSO
+ *
+ * Two read-only pages the kernel maps at the same address in every
+ * process. The first holds data the kernel keeps up to date, so that
+ * the time can be read without a system call; the second holds the
+ * code userspace calls to make a system call, which uses SYSENTER on
+ * processors that have it and int 0x7F on those that don't.
+ *
+ * The time is published under a sequence count: it is odd while the
+ * kernel is writing, and readers retry if it changed under them.
+ */
+
+#include <stdint.h>
+
+#define VDSO_ADDRESS 0x1BFFE000
+#define VDSO_SIZE    0x2000
+
+/* Where the system call entry point is stored; see DEFN_SYSCALL in syscall.h */
+#define VDSO_SYSCALL_ENTRY 0x1BFFE004
+
+/* Signal handlers return here, to call sigreturn */
+#define VDSO_SIGRETURN 0x1BFFF100
+
+#define VDSO_SYSENTER 0x01 /* The entry point uses SYSENTER */
+
+struct vdso_data {
+	volatile uint32_t sequence;
+	uintptr_t syscall;           /* At VDSO_SYSCALL_ENTRY */
+	uint32_t features;
+	volatile uint32_t seconds;   /* Time of day, as gettimeofday() would give it */
+	volatile uint32_t useconds;
+};
+
+#define VDSO_DATA ((struct vdso_data *)VDSO_ADDRESS)
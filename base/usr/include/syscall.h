@@ -2,6 +2,12 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/vdso.h>
+
+/* System calls go through the vDSO, which picks the fastest way in */
+#define __SYSCALL_STR(x) #x
+#define __SYSCALL_XSTR(x) __SYSCALL_STR(x)
+#define __SYSCALL_CALL "call *" __SYSCALL_XSTR(VDSO_SYSCALL_ENTRY)
 
 #define DECL_SYSCALL0(fn)                int syscall_##fn()
 #define DECL_SYSCALL1(fn,p1)             int syscall_##fn(p1)
@@ -12,13 +18,13 @@
 
 #define DEFN_SYSCALL0(fn, num) \
 	int syscall_##fn() { \
-		int a; __asm__ __volatile__("int $0x7F" : "=a" (a) : "0" (num)); \
+		int a; __asm__ __volatile__(__SYSCALL_CALL : "=a" (a) : "0" (num)); \
 		return a; \
 	}
 
 #define DEFN_SYSCALL1(fn, num, P1) \
 	int syscall_##fn(P1 p1) { \
-		int __res; __asm__ __volatile__("push %%ebx; movl %2,%%ebx; int $0x7F; pop %%ebx" \
+		int __res; __asm__ __volatile__("push %%ebx; movl %2,%%ebx; " __SYSCALL_CALL "; pop %%ebx" \
 				: "=a" (__res) \
 				: "0" (num), "r" ((int)(p1))); \
 		return __res; \
@@ -26,7 +32,7 @@
 
 #define DEFN_SYSCALL2(fn, num, P1, P2) \
 	int syscall_##fn(P1 p1, P2 p2) { \
-		int __res; __asm__ __volatile__("push %%ebx; movl %2,%%ebx; int $0x7F; pop %%ebx" \
+		int __res; __asm__ __volatile__("push %%ebx; movl %2,%%ebx; " __SYSCALL_CALL "; pop %%ebx" \
 				: "=a" (__res) \
 				: "0" (num), "r" ((int)(p1)), "c"((int)(p2))); \
 		return __res; \
@@ -34,7 +40,7 @@
 
 #define DEFN_SYSCALL3(fn, num, P1, P2, P3) \
 	int syscall_##fn(P1 p1, P2 p2, P3 p3) { \
-		int __res; __asm__ __volatile__("push %%ebx; movl %2,%%ebx; int $0x7F; pop %%ebx" \
+		int __res; __asm__ __volatile__("push %%ebx; movl %2,%%ebx; " __SYSCALL_CALL "; pop %%ebx" \
 				: "=a" (__res) \
 				: "0" (num), "r" ((int)(p1)), "c"((int)(p2)), "d"((int)(p3))); \
 		return __res; \
@@ -42,7 +48,7 @@
 
 #define DEFN_SYSCALL4(fn, num, P1, P2, P3, P4) \
 	int syscall_##fn(P1 p1, P2 p2, P3 p3, P4 p4) { \
-		int __res; __asm__ __volatile__("push %%ebx; movl %2,%%ebx; int $0x7F; pop %%ebx" \
+		int __res; __asm__ __volatile__("push %%ebx; movl %2,%%ebx; " __SYSCALL_CALL "; pop %%ebx" \
 				: "=a" (__res) \
 				: "0" (num), "r" ((int)(p1)), "c"((int)(p2)), "d"((int)(p3)), "S"((int)(p4))); \
 		return __res; \
@@ -50,7 +56,7 @@
 
 #define DEFN_SYSCALL5(fn, num, P1, P2, P3, P4, P5) \
 	int syscall_##fn(P1 p1, P2 p2, P3 p3, P4 p4, P5 p5) { \
-		int __res; __asm__ __volatile__("push %%ebx; movl %2,%%ebx; int $0x7F; pop %%ebx" \
+		int __res; __asm__ __volatile__("push %%ebx; movl %2,%%ebx; " __SYSCALL_CALL "; pop %%ebx" \
 				: "=a" (__res) \
 				: "0" (num), "r" ((int)(p1)), "c"((int)(p2)), "d"((int)(p3)), "S"((int)(p4)), "D"((int)(p5))); \
 		return __res; \
@@ -96,6 +102,8 @@ DECL_SYSCALL2(shm_obtain, char *, size_t *);
 DECL_SYSCALL1(shm_release, char *);
 DECL_SYSCALL2(send_signal, uint32_t, uint32_t);
 DECL_SYSCALL2(signal, uint32_t, void *);
+DECL_SYSCALL3(sigprocmask, int, const void *, void *);
+DECL_SYSCALL1(sigpending, void *);
 DECL_SYSCALL2(share_fd, int, int);
 DECL_SYSCALL1(get_fd, int);
 DECL_SYSCALL0(gettid);
@@ -109,6 +117,18 @@ DECL_SYSCALL2(access, char *, int);
 DECL_SYSCALL2(stat, char *, void *);
 DECL_SYSCALL2(fswait,int,int*);
 DECL_SYSCALL3(fswait2,int,int*,int);
+DECL_SYSCALL0(pollset_create);
+DECL_SYSCALL4(pollset_ctl,int,int,int,void*);
+DECL_SYSCALL4(pollset_wait,int,void*,int,int);
+DECL_SYSCALL3(poll,void*,unsigned int,int);
+DECL_SYSCALL3(vfork,uintptr_t,uintptr_t,void*);
+DECL_SYSCALL1(mmap,void*);
+DECL_SYSCALL2(munmap,void*,size_t);
+DECL_SYSCALL3(mprotect,void*,size_t,int);
+DECL_SYSCALL3(readv,int,void*,int);
+DECL_SYSCALL3(writev,int,void*,int);
+DECL_SYSCALL4(pread,int,void*,size_t,long);
+DECL_SYSCALL4(pwrite,int,void*,size_t,long);
 DECL_SYSCALL3(chown,char*,int,int);
 DECL_SYSCALL3(waitpid, int, int *, int);
 DECL_SYSCALL5(mount, char *, char *, char *, unsigned long, void *);
@@ -48,3 +48,19 @@
 #define SYS_FSWAIT 59
 #define SYS_FSWAIT2 60
 #define SYS_CHOWN 61
+#define SYS_POLLSET_CREATE 62
+#define SYS_POLLSET_CTL 63
+#define SYS_POLLSET_WAIT 64
+#define SYS_POLL 65
+#define SYS_VFORK 66
+#define SYS_MMAP 67
+#define SYS_MUNMAP 68
+#define SYS_MPROTECT 69
+#define SYS_READV 70
+#define SYS_WRITEV 71
+#define SYS_PREAD 72
+#define SYS_PWRITE 73
+#define SYS_SIGRETURN 74
+#define SYS_SIGPROCMASK 75
+#define SYS_SIGPENDING 76
+#define SYS_GETDENTS 77
@@ -69,9 +69,21 @@ extern sprite_t * create_sprite(size_t width, size_t height, int alpha);
 extern void blur_context(gfx_context_t * _dst, gfx_context_t * _src, double amount);
 extern void blur_context_no_vignette(gfx_context_t * _dst, gfx_context_t * _src, double amount);
 extern void blur_context_box(gfx_context_t * _src, int radius);
+extern void blur_context_gaussian(gfx_context_t * _src, double sigma);
 extern void sprite_free(sprite_t * sprite);
 
-extern void load_sprite(sprite_t * sprite, char * filename);
+/*
+ * Load a BMP or PNG. Returns 0 on success; on failure the sprite is
+ * left empty, or partly filled if the file was cut short.
+ */
+extern int load_sprite(sprite_t * sprite, char * filename);
+
+/*
+ * Called while an image loads: once with no rows as soon as the
+ * sprite is allocated (and cleared), then for each decoded row.
+ */
+typedef void (*sprite_progress_t)(sprite_t * sprite, int y, int rows, void * data);
+extern int load_sprite_progressive(sprite_t * sprite, char * filename, sprite_progress_t progress, void * data);
 //extern int load_sprite_png(sprite_t * sprite, char * file);
 extern void draw_sprite(gfx_context_t * ctx, sprite_t * sprite, int32_t x, int32_t y);
 extern void draw_line(gfx_context_t * ctx, int32_t x0, int32_t x1, int32_t y0, int32_t y1, uint32_t color);
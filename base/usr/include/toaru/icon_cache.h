@@ -1,7 +1,37 @@
 #pragma once
 
+#include <stdint.h>
 #include <toaru/graphics.h>
 
 extern sprite_t * icon_get_16(const char * name);
 extern sprite_t * icon_get_48(const char * name);
 
+/*
+ * Icon atlas
+ *
+ * util/mkiconatlas.py packs the icons under /usr/share/icons into one
+ * file at build time, already converted to premultiplied ARGB. The
+ * icon cache maps it shared and read-only, so icons cost every GUI
+ * process nothing to decode and only one copy sits in memory; icons
+ * that aren't in it are still loaded from their bitmaps.
+ *
+ * The file is a header, an index of `count` entries sorted by name,
+ * then the pixels of each icon (rows top to bottom) at its offset.
+ */
+#define ICON_ATLAS_PATH    "/usr/share/icons/icons.atlas"
+#define ICON_ATLAS_MAGIC   0x534E4349 /* ICNS */
+#define ICON_ATLAS_VERSION 1
+
+struct icon_atlas_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t size;      /* Of the whole file */
+};
+
+struct icon_atlas_entry {
+	char name[56];      /* Path under /usr/share/icons without .bmp, eg. "48/folder" */
+	uint16_t width;
+	uint16_t height;
+	uint32_t offset;    /* From the start of the file */
+};
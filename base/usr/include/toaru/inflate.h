@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Streaming DEFLATE (RFC 1951) decompressor.
+ *
+ * Compressed input is pulled through read() a buffer at a time and
+ * output is pushed through write() in order, so neither side has to
+ * be held in memory whole; the decoder itself keeps a 64KiB window.
+ * read() returns the number of bytes it stored, 0 at the end of the
+ * input; write() returns non-zero to stop decoding early.
+ */
+typedef struct inflate_stream {
+	size_t (*read)(struct inflate_stream * stream, uint8_t * buf, size_t size);
+	int (*write)(struct inflate_stream * stream, const uint8_t * buf, size_t size);
+	void * data;
+} inflate_stream_t;
+
+/*
+ * Decompress a raw DEFLATE stream. Returns 0 once the final block has
+ * been decoded, 1 if write() stopped it, and a negative value if the
+ * input is corrupt or ends early.
+ */
+extern int inflate(inflate_stream_t * stream);
+
+/* The same, for a stream with a zlib (RFC 1950) header; the checksum is not verified */
+extern int inflate_zlib(inflate_stream_t * stream);
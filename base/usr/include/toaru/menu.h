@@ -3,6 +3,7 @@
 #include <toaru/graphics.h>
 #include <toaru/hashmap.h>
 #include <toaru/list.h>
+#include <toaru/widget.h>
 
 enum MenuEntry_Type {
 	MenuEntry_Unknown,
@@ -28,6 +29,9 @@ struct MenuEntry {
 	void (*activate)(struct MenuEntry *, int);
 
 	void (*callback)(struct MenuEntry *);
+
+	widget_t * _widget; /* While the menu is shown */
+	int _drawn; /* What the widget last showed */
 };
 
 struct MenuEntry_Normal {
@@ -58,6 +62,7 @@ struct MenuList {
 	struct MenuList * parent;
 	struct menu_bar * _bar;
 	int closed;
+	widget_tree_t * widgets;
 };
 
 struct MenuSet {
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <toaru/graphics.h>
+#include <toaru/yutani.h>
+#include <toaru/list.h>
+
+/*
+ * Retained widgets
+ *
+ * A window's contents are described as a tree of rectangles, each of
+ * which knows how to draw itself. When something changes, the widget
+ * showing it is invalidated; widget_render() then repaints only the
+ * damaged rectangles (background first, then every widget inside
+ * them) and flips just those regions to the compositor.
+ *
+ * Bounds are in window coordinates. Each widget draws into a context
+ * that starts at its own top left corner and is clipped to its
+ * bounds. Siblings should not overlap; children are drawn after their
+ * parent. Widgets without a draw function only group their children.
+ */
+
+#define WIDGET_MAX_DAMAGE 8
+
+typedef struct {
+	int x, y;
+	int width, height;
+} widget_rect_t;
+
+struct widget_tree;
+
+typedef struct widget {
+	widget_rect_t bounds;
+	int dirty;
+	int hidden;
+
+	void (*draw)(struct widget * self, gfx_context_t * ctx);
+	void * data;
+
+	struct widget * parent;
+	struct widget_tree * tree;
+	list_t * children;
+} widget_t;
+
+typedef struct widget_tree {
+	widget_t * root;
+
+	yutani_t * yctx;
+	yutani_window_t * window;
+	gfx_context_t * ctx;
+
+	/* Repaints what lies under the widgets in part of the window */
+	void (*background)(struct widget_tree * tree, gfx_context_t * ctx, widget_rect_t * rect);
+	void * data;
+
+	int damage_count;
+	widget_rect_t damage[WIDGET_MAX_DAMAGE];
+} widget_tree_t;
+
+extern widget_tree_t * widget_tree_create(yutani_t * yctx, yutani_window_t * window, gfx_context_t * ctx,
+		void (*background)(widget_tree_t *, gfx_context_t *, widget_rect_t *), void * data);
+extern void widget_tree_free(widget_tree_t * tree);
+/* The window was resized (or its context replaced); everything gets redrawn */
+extern void widget_tree_resize(widget_tree_t * tree);
+
+extern widget_t * widget_create(widget_t * parent, int x, int y, int width, int height,
+		void (*draw)(widget_t *, gfx_context_t *), void * data);
+extern void widget_free(widget_t * widget);
+
+extern void widget_move(widget_t * widget, int x, int y, int width, int height);
+extern void widget_set_hidden(widget_t * widget, int hidden);
+extern void widget_invalidate(widget_t * widget);
+extern void widget_damage(widget_tree_t * tree, int x, int y, int width, int height);
+
+/* Redraw and flip everything that changed; returns the number of regions flipped */
+extern int widget_render(widget_tree_t * tree);
@@ -37,6 +37,8 @@ extern int tcsetpgrp(int fd, pid_t pgrp);
 
 extern ssize_t write(int fd, const void * buf, size_t count);
 extern ssize_t read(int fd, void * buf, size_t count);
+extern ssize_t pread(int fd, void * buf, size_t count, off_t offset);
+extern ssize_t pwrite(int fd, const void * buf, size_t count, off_t offset);
 
 extern int symlink(const char *target, const char *linkpath);
 extern ssize_t readlink(const char *pathname, char *buf, size_t bufsiz);
@@ -34,7 +34,7 @@ EFI_HANDLE ImageHandleIn;
 #define LINK_TEXT "https://toaruos.org - https://gitlab.com/toaruos"
 
 /* Boot command line strings */
-#define DEFAULT_ROOT_CMDLINE "root=/dev/ram0,nocache "
+#define DEFAULT_ROOT_CMDLINE "root=/dev/ram0 root_type=rofs "
 #define DEFAULT_GRAPHICAL_CMDLINE "start=live-session "
 #define DEFAULT_SINGLE_CMDLINE "start=terminal\037-F "
 #define DEFAULT_TEXT_CMDLINE "start=--vga "
@@ -83,6 +83,7 @@ static char * modules[] = {
 	"E1000.KO",    // 21
 	"PCSPKR.KO",   // 22
 	"PORTIO.KO",   // 23
+	"ROFS.KO",     // 24
 	0
 };
 
@@ -160,8 +161,8 @@ int kmain() {
 			"network interface drivers.");
 
 	BOOT_OPTION(_migrate,     1, "Writable root",
-			"Migrates the ramdisk from ext2 to an in-memory",
-			"temporary filesystem at boot.");
+			"Overlays an in-memory temporary filesystem on",
+			"the compressed ramdisk at boot.");
 
 	BOOT_OPTION(_serialshell, 0, "Debug on serial",
 			"Start a kernel debug shell on the first",
@@ -245,6 +246,11 @@ int kmain() {
 		strcat(cmdline, "novmwareresset ");
 	}
 
+	if (fw_cfg_cmdline[0]) {
+		strcat(cmdline, fw_cfg_cmdline);
+		strcat(cmdline, " ");
+	}
+
 	/* Configure modules */
 	if (!_normal_ata) {
 		modules[6] = "NONE";
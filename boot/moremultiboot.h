@@ -527,6 +527,9 @@ struct fw_cfg_file {
 
 static int boot_mode = 0;
 
+/* Extra kernel arguments from fw_cfg, appended to the command line */
+static char fw_cfg_cmdline[257] = {0};
+
 void swap_bytes(void * in, int count) {
 	char * bytes = in;
 	if (count == 4) {
@@ -562,6 +565,8 @@ void show_menu(void) {
 
 		unsigned int bootmode_size = 0;
 		int bootmode_index = -1;
+		unsigned int cmdline_size = 0;
+		int cmdline_index = -1;
 		for (unsigned int i = 0; i < count; ++i) {
 			struct fw_cfg_file file;
 			uint8_t * tmp = (uint8_t *)&file;
@@ -574,12 +579,25 @@ void show_menu(void) {
 				bootmode_size = file.size;
 				bootmode_index = file.select;
 			}
+			if (!strcmp(file.name,"opt/org.toaruos.cmdline")) {
+				swap_bytes(&file.size, 4);
+				swap_bytes(&file.select, 2);
+				cmdline_size = file.size;
+				cmdline_index = file.select;
+			}
 #if 0
 			print_("selector "); print_hex_(file.select); print_(" is "); print_hex_(file.size); print_(" bytes\n");
 			print_("and its name is: "); print_(file.name); print_("\n");
 #endif
 		}
 
+		if (cmdline_index != -1) {
+			outports(0x510, cmdline_index);
+			for (int i = 0; i < sizeof(fw_cfg_cmdline) - 1 && i < cmdline_size; ++i) {
+				fw_cfg_cmdline[i] = inportb(0x511);
+			}
+		}
+
 		if (bootmode_index != -1) {
 			outports(0x510, bootmode_index);
 			char tmp[33] = {0};
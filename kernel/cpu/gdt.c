@@ -28,58 +28,111 @@ typedef struct {
 	uintptr_t base;
 } __attribute__((packed)) gdt_pointer_t;
 
-/* In the future we may need to put a lock on the access of this */
-static struct {
-    gdt_entry_t entries[6];
-    gdt_pointer_t pointer;
-    tss_entry_t tss;
-} gdt __attribute__((used));
+/* One table and TSS per processor; entry 6 points at that processor's cpu_t */
+typedef struct {
+	gdt_entry_t entries[7];
+	gdt_pointer_t pointer;
+	tss_entry_t tss;
+} gdt_t;
+
+static gdt_t gdt[MAX_CPUS] __attribute__((used));
 
 extern void gdt_flush(uintptr_t);
+extern void sysenter_entry(void);
 
-#define ENTRY(X) (gdt.entries[(X)])
+/* Set once the bootstrap processor has found SYSENTER; see vdso_install */
+int sysenter_available = 0;
 
-void gdt_set_gate(uint8_t num, uint64_t base, uint64_t limit, uint8_t access, uint8_t gran) {
+static void set_gate(gdt_t * table, uint8_t num, uint64_t base, uint64_t limit, uint8_t access, uint8_t gran) {
+	gdt_entry_t * entry = &table->entries[num];
 	/* Base Address */
-	ENTRY(num).base_low = (base & 0xFFFF);
-	ENTRY(num).base_middle = (base >> 16) & 0xFF;
-	ENTRY(num).base_high = (base >> 24) & 0xFF;
+	entry->base_low = (base & 0xFFFF);
+	entry->base_middle = (base >> 16) & 0xFF;
+	entry->base_high = (base >> 24) & 0xFF;
 	/* Limits */
-	ENTRY(num).limit_low = (limit & 0xFFFF);
-	ENTRY(num).granularity = (limit >> 16) & 0X0F;
+	entry->limit_low = (limit & 0xFFFF);
+	entry->granularity = (limit >> 16) & 0X0F;
 	/* Granularity */
-	ENTRY(num).granularity |= (gran & 0xF0);
+	entry->granularity |= (gran & 0xF0);
 	/* Access flags */
-	ENTRY(num).access = access;
+	entry->access = access;
 }
 
-static void write_tss(int32_t num, uint16_t ss0, uint32_t esp0);
+void gdt_set_gate(uint8_t num, uint64_t base, uint64_t limit, uint8_t access, uint8_t gran) {
+	for (int i = 0; i < MAX_CPUS; ++i) {
+		set_gate(&gdt[i], num, base, limit, access, gran);
+	}
+}
 
-void gdt_install(void) {
-	gdt_pointer_t *gdtp = &gdt.pointer;
-	gdtp->limit = sizeof gdt.entries - 1;
-	gdtp->base = (uintptr_t)&ENTRY(0);
+static void write_tss(gdt_t * table, int32_t num, uint16_t ss0, uint32_t esp0);
+
+/*
+ * Point SYSENTER at sysenter_entry. It loads %esp from an MSR, which
+ * can't follow task switches, so it is given the address of this
+ * processor's tss.esp0 and the entry code loads the stack from there.
+ */
+static void sysenter_install(gdt_t * table) {
+	uint32_t eax, edx;
+	asm volatile ("cpuid" : "=a"(eax), "=d"(edx) : "a"(1) : "ebx", "ecx");
+	if (!(edx & (1 << 11))) return;
+
+	/* The Pentium Pro reports SEP but doesn't have it */
+	uint32_t family = (eax >> 8) & 0xF;
+	uint32_t model = (eax >> 4) & 0xF;
+	uint32_t stepping = eax & 0xF;
+	if (family == 6 && model < 3 && stepping < 3) return;
+
+	asm volatile ("wrmsr" : : "c"(0x174), "a"(0x08), "d"(0));
+	asm volatile ("wrmsr" : : "c"(0x175), "a"((uintptr_t)&table->tss.esp0), "d"(0));
+	asm volatile ("wrmsr" : : "c"(0x176), "a"((uintptr_t)&sysenter_entry), "d"(0));
+
+	if (table == &gdt[0]) {
+		sysenter_available = 1;
+	}
+}
 
-	gdt_set_gate(0, 0, 0, 0, 0);                /* NULL segment */
-	gdt_set_gate(1, 0, 0xFFFFFFFF, 0x9A, 0xCF); /* Code segment */
-	gdt_set_gate(2, 0, 0xFFFFFFFF, 0x92, 0xCF); /* Data segment */
-	gdt_set_gate(3, 0, 0xFFFFFFFF, 0xFA, 0xCF); /* User code */
-	gdt_set_gate(4, 0, 0xFFFFFFFF, 0xF2, 0xCF); /* User data */
+/*
+ * Build and load the tables for a processor. The bootstrap
+ * processor does this first thing, application processors as
+ * soon as they reach protected mode.
+ */
+void gdt_install_cpu(int id) {
+	gdt_t * table = &gdt[id];
+	gdt_pointer_t *gdtp = &table->pointer;
+	gdtp->limit = sizeof table->entries - 1;
+	gdtp->base = (uintptr_t)&table->entries[0];
+
+	cpus[id].self = &cpus[id];
+	cpus[id].id = id;
+
+	set_gate(table, 0, 0, 0, 0, 0);                /* NULL segment */
+	set_gate(table, 1, 0, 0xFFFFFFFF, 0x9A, 0xCF); /* Code segment */
+	set_gate(table, 2, 0, 0xFFFFFFFF, 0x92, 0xCF); /* Data segment */
+	set_gate(table, 3, 0, 0xFFFFFFFF, 0xFA, 0xCF); /* User code */
+	set_gate(table, 4, 0, 0xFFFFFFFF, 0xF2, 0xCF); /* User data */
 
-	write_tss(5, 0x10, 0x0);
+	write_tss(table, 5, 0x10, 0x0);
+
+	set_gate(table, 6, (uintptr_t)&cpus[id], sizeof(cpu_t) - 1, 0x92, 0x40); /* Per-CPU data */
 
 	/* Go go go */
 	gdt_flush((uintptr_t)gdtp);
 	tss_flush();
+
+	sysenter_install(table);
 }
 
-static void write_tss(int32_t num, uint16_t ss0, uint32_t esp0) {
-	tss_entry_t * tss = &gdt.tss;
+void gdt_install(void) {
+	gdt_install_cpu(0);
+}
+
+static void write_tss(gdt_t * table, int32_t num, uint16_t ss0, uint32_t esp0) {
+	tss_entry_t * tss = &table->tss;
 	uintptr_t base = (uintptr_t)tss;
 	uintptr_t limit = base + sizeof *tss;
 
 	/* Add the TSS descriptor to the GDT */
-	gdt_set_gate(num, base, limit, 0xE9, 0x00);
+	set_gate(table, num, base, limit, 0xE9, 0x00);
 
 	memset(tss, 0x0, sizeof *tss);
 
@@ -96,7 +149,6 @@ static void write_tss(int32_t num, uint16_t ss0, uint32_t esp0) {
 }
 
 void set_kernel_stack(uintptr_t stack) {
-	/* Set the kernel stack */
-	gdt.tss.esp0 = stack;
+	/* Set the kernel stack for this processor */
+	gdt[this_cpu()->id].tss.esp0 = stack;
 }
-
@@ -51,3 +51,8 @@ void idt_install(void) {
 
 	idt_load((uintptr_t)idtp);
 }
+
+/* Application processors share the table */
+void idt_load_cpu(void) {
+	idt_load((uintptr_t)&idt.pointer);
+}
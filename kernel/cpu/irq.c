@@ -11,6 +11,7 @@
 #include <kernel/logging.h>
 #include <kernel/module.h>
 #include <kernel/printf.h>
+#include <kernel/trace.h>
 
 /* Programmable interrupt controller */
 #define PIC1           0x20
@@ -37,8 +38,8 @@
 		             "2:"); \
 	} while (0)
 
-/* Interrupts */
-static volatile int sync_depth = 0;
+/* Interrupts; the nesting depth is per-processor */
+#define sync_depth (this_cpu()->sync_depth)
 
 #define SYNC_CLI() asm volatile("cli")
 #define SYNC_STI() asm volatile("sti")
@@ -85,6 +86,7 @@ void int_enable(void) {
 
 static void (*irqs[IRQ_CHAIN_SIZE])(void);
 static irq_handler_chain_t irq_routines[IRQ_CHAIN_SIZE * IRQ_CHAIN_DEPTH] = { NULL };
+unsigned long irq_counts[IRQ_CHAIN_SIZE] = { 0 };
 static char * _irq_handler_descriptions[IRQ_CHAIN_SIZE * IRQ_CHAIN_DEPTH] = { NULL };
 
 char * get_irq_handler(int irq, int chain) {
@@ -158,7 +160,17 @@ void irq_ack(size_t irq_no) {
 void irq_handler(struct regs *r) {
 	/* Disable interrupts when handling */
 	int_disable();
+	if (r->int_no >= LAPIC_TIMER_VECTOR) {
+		/* Takes the kernel lock itself, if it needs it */
+		lapic_handler(r);
+		int_resume();
+		return;
+	}
+	int took = kernel_lock_enter();
 	if (r->int_no <= 47 && r->int_no >= 32) {
+		irq_counts[r->int_no - 32]++;
+		uint64_t start = trace_enabled(TRACE_IRQ) ? trace_tsc() : 0;
+		uint32_t switches = trace_switches;
 		for (size_t i = 0; i < IRQ_CHAIN_DEPTH; i++) {
 			irq_handler_chain_t handler = irq_routines[i * IRQ_CHAIN_SIZE + (r->int_no - 32)];
 			if (!handler) break;
@@ -167,7 +179,13 @@ void irq_handler(struct regs *r) {
 			}
 		}
 		irq_ack(r->int_no - 32);
-	}
 done:
+		/* Handlers that switched tasks have no meaningful duration */
+		if (start && trace_enabled(TRACE_IRQ)) {
+			trace_record(TRACE_IRQ, r->int_no - 32, 0, switches == trace_switches ? (uint32_t)(trace_tsc() - start) : 0);
+		}
+	}
+	deliver_signals(r);
+	kernel_lock_leave(took);
 	int_resume();
 }
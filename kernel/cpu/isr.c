@@ -83,6 +83,7 @@ static const char *exception_messages[32] = {
 };
 
 void fault_handler(struct regs * r) {
+	int took = kernel_lock_enter();
 	irq_handler_t handler = isr_routines[r->int_no];
 	if (handler) {
 		handler(r);
@@ -91,4 +92,6 @@ void fault_handler(struct regs * r) {
 		HALT_AND_CATCH_FIRE("Process caused an unhandled exception", r);
 		STOP;
 	}
+	deliver_signals(r);
+	kernel_lock_leave(took);
 }
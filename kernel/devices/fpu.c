@@ -5,12 +5,16 @@
  *
  * FPU and SSE context handling.
  *
- * FPU context is kept through context switches,
- * but the FPU is disabled. When an FPU instruction
- * is executed, it will trap here and the context
- * will be saved to its original owner and the context
- * for the current process will be loaded or the FPU
- * will be reset for the new process.
+ * Tasks are switched in with the FPU disabled (CR0.TS), so the
+ * first FPU or SSE instruction a task runs traps here and only
+ * then is its state loaded. A task that used the FPU during its
+ * time slice is saved when it is switched out, since it may next
+ * run on another processor; one that didn't costs nothing.
+ *
+ * Each processor remembers whose state its registers hold, and
+ * each task which processor last loaded it, so a task that comes
+ * back to the same processor with nobody else having used the
+ * FPU there in between doesn't need a restore either.
  *
  * FPU states are per kernel thread.
  *
@@ -18,9 +22,17 @@
 #include <kernel/system.h>
 #include <kernel/logging.h>
 
-#define NO_LAZY_FPU
+/* Context switches that saved FPU state, and ones that didn't need to */
+unsigned long fpu_saves = 0;
+unsigned long fpu_saves_avoided = 0;
+/* FPU traps that loaded a saved state, and ones that found it still loaded */
+unsigned long fpu_restores = 0;
+unsigned long fpu_restores_avoided = 0;
 
-process_t * fpu_thread = NULL;
+/* FXSAVE needs 16-byte alignment; fp_regs has room to find it */
+static inline uint8_t * fpu_area(process_t * proc) {
+	return (uint8_t *)(((uintptr_t)proc->thread.fp_regs + 15) & ~15);
+}
 
 /**
  * Set the FPU control word
@@ -59,23 +71,18 @@ void disable_fpu(void) {
 	asm volatile ("mov %0, %%cr0" :: "r"(t));
 }
 
-/* Temporary aligned buffer for copying around FPU contexts */
-uint8_t saves[512] __attribute__((aligned(16)));
-
 /**
  * Restore the FPU for a process
  */
 void restore_fpu(process_t * proc) {
-	memcpy(&saves,(uint8_t *)&proc->thread.fp_regs,512);
-	asm volatile ("fxrstor (%0)" :: "r"(saves));
+	asm volatile ("fxrstor (%0)" :: "r"(fpu_area(proc)));
 }
 
 /**
  * Save the FPU for a process
  */
 void save_fpu(process_t * proc) {
-	asm volatile ("fxsave (%0)" :: "r"(saves));
-	memcpy((uint8_t *)&proc->thread.fp_regs,&saves,512);
+	asm volatile ("fxsave (%0)" :: "r"(fpu_area(proc)) : "memory");
 }
 
 /**
@@ -89,54 +96,107 @@ void init_fpu(void) {
  * Kernel trap for FPU usage when FPU is disabled
  */
 void invalid_op(struct regs * r) {
-	/* First, turn the FPU on */
-	enable_fpu();
-	if (fpu_thread == current_process) {
-		/* If this is the thread that last used the FPU, do nothing */
+	cpu_t * cpu = this_cpu();
+	process_t * proc = (process_t *)current_process;
+
+	/* First, turn the FPU on; it stays on until this task is switched out */
+	asm volatile ("clts");
+	cpu->fpu_live = 1;
+
+	if (cpu->fpu_owner == proc && proc->thread.fpu_cpu == cpu->id) {
+		/* Nobody has used the FPU here since this thread was saved */
+		fpu_restores_avoided++;
 		return;
 	}
-	if (fpu_thread) {
-		/* If there is a thread that was using the FPU, save its state */
-		save_fpu(fpu_thread);
-	}
-	fpu_thread = (process_t *)current_process;
-	if (!fpu_thread->thread.fpu_enabled) {
+
+	cpu->fpu_owner = proc;
+	proc->thread.fpu_cpu = cpu->id;
+
+	if (!proc->thread.fpu_enabled) {
 		/*
 		 * If the FPU has not been used in this thread previously,
 		 * we need to initialize it.
 		 */
 		init_fpu();
-		fpu_thread->thread.fpu_enabled = 1;
+		proc->thread.fpu_enabled = 1;
 		return;
 	}
 	/* Otherwise we restore the context for this thread. */
-	restore_fpu(fpu_thread);
+	restore_fpu(proc);
+	fpu_restores++;
 }
 
-/* Called during a context switch; disable the FPU */
+/* Called when switching away from a thread; save its state if it used the FPU */
 void switch_fpu(void) {
-#ifdef NO_LAZY_FPU
-	save_fpu((process_t *)current_process);
-#else
-	disable_fpu();
-#endif
+	cpu_t * cpu = this_cpu();
+	if (cpu->fpu_live) {
+		save_fpu((process_t *)current_process);
+		disable_fpu();
+		cpu->fpu_live = 0;
+		fpu_saves++;
+	} else {
+		fpu_saves_avoided++;
+	}
 }
 
+/*
+ * Called when switching to a thread. If the last one left without
+ * being saved (it exited, or returned from a signal handler), what
+ * is in the registers no longer matches anyone's saved state.
+ */
 void unswitch_fpu(void) {
-#ifdef NO_LAZY_FPU
-	restore_fpu((process_t *)current_process);
-#endif
+	cpu_t * cpu = this_cpu();
+	if (cpu->fpu_live) {
+		disable_fpu();
+		cpu->fpu_live = 0;
+		cpu->fpu_owner = NULL;
+	}
+}
+
+/* Give a new thread a copy of its parent's FPU state */
+void fpu_fork(process_t * child, process_t * parent) {
+	if (parent == current_process && this_cpu()->fpu_live) {
+		/* The parent's latest state is still in the registers */
+		save_fpu(parent);
+	}
+	child->thread.fpu_enabled = parent->thread.fpu_enabled;
+	child->thread.fpu_cpu = -1;
+	memcpy(fpu_area(child), fpu_area(parent), 512);
+}
+
+/* Copy a thread's FPU state out, for a signal frame; 0 if it has none */
+int fpu_get_state(process_t * proc, uint8_t * out) {
+	if (!proc->thread.fpu_enabled) return 0;
+	if (proc == current_process && this_cpu()->fpu_live) {
+		save_fpu(proc);
+	}
+	memcpy(out, fpu_area(proc), 512);
+	return 1;
+}
+
+/* Put back state from fpu_get_state() */
+void fpu_set_state(process_t * proc, uint8_t * in) {
+	memcpy(fpu_area(proc), in, 512);
+	/* Reserved MXCSR bits would make FXRSTOR fault */
+	*(uint32_t *)(fpu_area(proc) + 24) &= 0xFFBF;
+	proc->thread.fpu_enabled = 1;
+	if (proc == current_process && this_cpu()->fpu_live) {
+		restore_fpu(proc);
+	} else {
+		/* Whatever a processor has loaded for it is stale now */
+		proc->thread.fpu_cpu = -1;
+	}
 }
 
 /* Enable the FPU context handling */
 void fpu_install(void) {
-#ifdef NO_LAZY_FPU
-	enable_fpu();
-	init_fpu();
-	save_fpu((void*)current_process);
-#else
 	enable_fpu();
 	disable_fpu();
 	isrs_install_handler(7, &invalid_op);
-#endif
+}
+
+/* Enable the FPU on an application processor */
+void fpu_install_ap(void) {
+	enable_fpu();
+	disable_fpu();
 }
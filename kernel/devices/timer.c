@@ -8,6 +8,8 @@
 #include <kernel/system.h>
 #include <kernel/logging.h>
 #include <kernel/process.h>
+#include <kernel/ktimer.h>
+#include <kernel/trace.h>
 
 #define PIT_A 0x40
 #define PIT_B 0x41
@@ -42,15 +44,45 @@ timer_phase(
  */
 unsigned long timer_ticks = 0;
 unsigned long timer_subticks = 0;
+
+/* System-wide CPU time, in subticks summed over all processors */
+unsigned long timer_user_ticks = 0;
+unsigned long timer_system_ticks = 0;
+unsigned long timer_idle_ticks = 0;
 signed long timer_drift = 0;
 signed long _timer_drift = 0;
 
 static int behind = 0;
 
+/*
+ * Charge a tick to whoever was interrupted. Every processor does
+ * this from its own timer, so the totals count processor time.
+ */
+void timer_account(struct regs *r) {
+	/* Sampling profiler: one sample of the interrupted EIP per tick */
+	trace_event(TRACE_SAMPLE, r->eip, (r->cs & 3) == 3, 0);
+
+	if (current_process) {
+		if ((r->cs & 3) == 3) {
+			current_process->stats.utime++;
+			timer_user_ticks++;
+		} else {
+			current_process->stats.stime++;
+			if (current_process == kernel_idle_task) {
+				timer_idle_ticks++;
+			} else {
+				timer_system_ticks++;
+			}
+		}
+	}
+}
+
 /*
  * IRQ handler for when the timer fires
  */
 int timer_handler(struct regs *r) {
+	timer_account(r);
+
 	if (++timer_subticks == SUBTICKS_PER_TICK || (behind && ++timer_subticks == SUBTICKS_PER_TICK)) {
 		timer_ticks++;
 		timer_subticks = 0;
@@ -61,21 +93,27 @@ int timer_handler(struct regs *r) {
 			else behind = 0;
 		}
 	}
+	vdso_update();
 	irq_ack(TIMER_IRQ);
 
-	wakeup_sleepers(timer_ticks, timer_subticks);
+	ktimer_run(timer_now_ms());
 	switch_task(1);
 	return 1;
 }
 
 void relative_time(unsigned long seconds, unsigned long subseconds, unsigned long * out_seconds, unsigned long * out_subseconds) {
-	if (subseconds + timer_subticks > SUBTICKS_PER_TICK) {
-		*out_seconds    = timer_ticks + seconds + 1;
-		*out_subseconds = (subseconds + timer_subticks) - SUBTICKS_PER_TICK;
-	} else {
-		*out_seconds    = timer_ticks + seconds;
-		*out_subseconds = timer_subticks + subseconds;
-	}
+	/* subseconds may be more than a second's worth (fswait timeouts, usleep) */
+	unsigned long total = timer_subticks + subseconds;
+	*out_seconds    = timer_ticks + seconds + total / SUBTICKS_PER_TICK;
+	*out_subseconds = total % SUBTICKS_PER_TICK;
+}
+
+/*
+ * Milliseconds since boot, for the timing wheel. Wraps after 49 days,
+ * so compare with a signed difference.
+ */
+unsigned long timer_now_ms(void) {
+	return timer_ticks * SUBTICKS_PER_TICK + timer_subticks;
 }
 
 /*
@@ -0,0 +1,463 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Page Cache
+ *
+ * Pages of regular files, kept by (device, inode) so that every open
+ * of a file, exec() and mmap() all find the same copy. Filesystems
+ * opt in by giving their file nodes a readpage() (and optionally a
+ * writepage()); read_fs() then copies out of the cache instead of
+ * calling read(). Writes go to the filesystem first and are copied
+ * into any cached pages after, so the cache never holds data the
+ * disk doesn't; the only dirty pages are ones written through
+ * MAP_SHARED mappings, which the mapping writes back when it goes.
+ *
+ * Cached pages live in a window of kernel address space above the
+ * heap (PAGE_CACHE_START to PAGE_CACHE_END) whose page tables are
+ * shared by every directory. Pages nobody is using are kept on an
+ * LRU list and reclaimed, oldest first, when the cache grows past its
+ * limit or free memory runs low.
+ */
+#include <kernel/system.h>
+#include <kernel/fs.h>
+#include <kernel/printf.h>
+#include <kernel/logging.h>
+#include <kernel/mem.h>
+#include <kernel/pagecache.h>
+
+#include <toaru/list.h>
+#include <toaru/hashmap.h>
+
+#define PAGE_SIZE     0x1000
+#define CACHE_SLOTS   ((PAGE_CACHE_END - PAGE_CACHE_START) / PAGE_SIZE)
+#define RECLAIM_BATCH 32
+
+typedef struct cached_file {
+	char key[24];
+	hashmap_t * pages;    /* index -> cached_page_t */
+	list_t * partial;     /* Pages with less than a full page of data */
+} cached_file_t;
+
+/* Protects everything below; never held over a filesystem call or a copy to user memory */
+static spin_lock_t cache_lock = { 0 };
+
+static hashmap_t * files = NULL;  /* "device:inode" -> cached_file_t */
+static list_t * lru = NULL;       /* Unpinned pages, least recently used first */
+static uint16_t * free_slots = NULL;
+static uint32_t free_count = 0;
+static struct pagecache_stats stats = {0};
+
+static void cache_init(void) {
+	files = hashmap_create(64);
+	lru = list_create();
+	free_slots = malloc(sizeof(uint16_t) * CACHE_SLOTS);
+	for (uint32_t i = 0; i < CACHE_SLOTS; ++i) {
+		free_slots[i] = CACHE_SLOTS - 1 - i;
+	}
+	free_count = CACHE_SLOTS;
+
+	/* At most a quarter of memory */
+	uint32_t limit = memory_total() / 4 / (PAGE_SIZE / 1024);
+	stats.limit = limit < CACHE_SLOTS ? limit : CACHE_SLOTS;
+}
+
+static int low_memory(void) {
+	return memory_total() - memory_use() < memory_total() / 16;
+}
+
+static cached_file_t * file_find(fs_node_t * node, int create) {
+	char key[24];
+	sprintf(key, "%x:%x", (uintptr_t)node->device, node->inode);
+	cached_file_t * file = hashmap_get(files, key);
+	if (!file && create) {
+		file = malloc(sizeof(cached_file_t));
+		memcpy(file->key, key, sizeof(key));
+		file->pages = hashmap_create_int(16);
+		file->partial = list_create();
+		hashmap_set(files, key, file);
+	}
+	return file;
+}
+
+static void file_track_partial(cached_file_t * file, cached_page_t * page) {
+	node_t * node = list_find(file->partial, page);
+	if (page->valid < PAGE_SIZE && !node) {
+		list_insert(file->partial, page);
+	} else if (page->valid == PAGE_SIZE && node) {
+		list_delete(file->partial, node);
+		free(node);
+	}
+}
+
+/* Take a page out of its file, and the file out of the cache if that was its last page */
+static void file_remove_page(cached_page_t * page) {
+	cached_file_t * file = page->file;
+	if (!file) return;
+
+	hashmap_remove(file->pages, (void *)page->index);
+	node_t * node = list_find(file->partial, page);
+	if (node) {
+		list_delete(file->partial, node);
+		free(node);
+	}
+	page->file = NULL;
+	if (page->dirty) {
+		/* There's nowhere to write it any more */
+		page->dirty = 0;
+		stats.dirty--;
+	}
+
+	if (hashmap_is_empty(file->pages)) {
+		hashmap_remove(files, file->key);
+		hashmap_free(file->pages);
+		free(file->pages);
+		list_free(file->partial);
+		free(file->partial);
+		free(file);
+	}
+}
+
+static cached_page_t * page_alloc(void) {
+	if (!free_count) return NULL;
+	cached_page_t * page = malloc(sizeof(cached_page_t));
+	memset(page, 0, sizeof(cached_page_t));
+	page->lru.value = page;
+	page->address = PAGE_CACHE_START + free_slots[--free_count] * PAGE_SIZE;
+	alloc_frame(get_page(page->address, 0, kernel_directory), 1, 1);
+	stats.pages++;
+	return page;
+}
+
+/* Unmap a page here; other processors must be flushed before page_free() */
+static void page_unmap(cached_page_t * page) {
+	page_t * entry = get_page(page->address, 0, kernel_directory);
+	free_frame(entry);
+	memset(entry, 0, sizeof(page_t));
+	invalidate_tables_at(page->address);
+}
+
+static void page_free(cached_page_t * page) {
+	free_slots[free_count++] = (page->address - PAGE_CACHE_START) / PAGE_SIZE;
+	stats.pages--;
+	free(page);
+}
+
+static int reclaim(int count) {
+	cached_page_t * victims[RECLAIM_BATCH];
+	int found = 0;
+
+	if (count > RECLAIM_BATCH) count = RECLAIM_BATCH;
+	node_t * node = lru->head;
+	while (node && found < count) {
+		node_t * next = node->next;
+		cached_page_t * page = node->value;
+		if (!page->dirty) {
+			list_delete(lru, node);
+			file_remove_page(page);
+			page_unmap(page);
+			victims[found++] = page;
+		}
+		node = next;
+	}
+
+	if (!found) return 0;
+
+	tlb_shootdown(NULL);
+	for (int i = 0; i < found; ++i) {
+		page_free(victims[i]);
+	}
+	stats.reclaimed += found;
+	return found;
+}
+
+static void pin(cached_page_t * page) {
+	if (!page->pinned++) {
+		list_delete(lru, &page->lru);
+		stats.pinned++;
+	}
+}
+
+/**
+ * pagecache_get: Find a page of a file, reading it in if it isn't cached.
+ *
+ * The page comes back pinned, and stays put until pagecache_put().
+ * Returns NULL if the node doesn't use the cache, the filesystem
+ * failed, or there's no room.
+ */
+cached_page_t * pagecache_get(fs_node_t * node, uint32_t index) {
+	if (!node->readpage) return NULL;
+
+	spin_lock(cache_lock);
+	if (!files) {
+		cache_init();
+	}
+
+	cached_file_t * file = file_find(node, 0);
+	cached_page_t * page = file ? hashmap_get(file->pages, (void *)index) : NULL;
+	if (page) {
+		pin(page);
+		stats.hits++;
+		spin_unlock(cache_lock);
+		return page;
+	}
+
+	stats.misses++;
+	if (stats.pages >= stats.limit || low_memory()) {
+		reclaim(RECLAIM_BATCH);
+	}
+	page = page_alloc();
+	spin_unlock(cache_lock);
+
+	if (!page) return NULL;
+
+	/* Nobody else can see the page yet, so it's filled without the lock */
+	uint32_t valid = node->readpage(node, index, (uint8_t *)page->address);
+
+	spin_lock(cache_lock);
+	if (valid > PAGE_SIZE) {
+		page_unmap(page);
+		page_free(page);
+		spin_unlock(cache_lock);
+		return NULL;
+	}
+	memset((void *)(page->address + valid), 0, PAGE_SIZE - valid);
+
+	file = file_find(node, 1);
+	cached_page_t * other = hashmap_get(file->pages, (void *)index);
+	if (other) {
+		/* Somebody else read it in while we were reading */
+		page_unmap(page);
+		page_free(page);
+		pin(other);
+		spin_unlock(cache_lock);
+		return other;
+	}
+
+	page->file   = file;
+	page->index  = index;
+	page->valid  = valid;
+	page->pinned = 1;
+	stats.pinned++;
+	hashmap_set(file->pages, (void *)index, page);
+	file_track_partial(file, page);
+	spin_unlock(cache_lock);
+	return page;
+}
+
+/**
+ * pagecache_put: Done with a page from pagecache_get().
+ *
+ * Dirty pages should have been written back first; a page that was
+ * dropped from its file while pinned is freed here.
+ */
+void pagecache_put(cached_page_t * page) {
+	spin_lock(cache_lock);
+	if (--page->pinned == 0) {
+		stats.pinned--;
+		if (page->file) {
+			list_append(lru, &page->lru);
+		} else {
+			page_unmap(page);
+			tlb_shootdown(NULL);
+			page_free(page);
+		}
+	}
+	spin_unlock(cache_lock);
+}
+
+/* Physical frame holding a (pinned) page, for mapping it into a process */
+uintptr_t pagecache_frame(cached_page_t * page) {
+	return get_page(page->address, 0, kernel_directory)->frame;
+}
+
+void pagecache_set_dirty(cached_page_t * page) {
+	spin_lock(cache_lock);
+	if (page->file && !page->dirty) {
+		page->dirty = 1;
+		stats.dirty++;
+	}
+	spin_unlock(cache_lock);
+}
+
+/**
+ * pagecache_writeback: Write a dirty (pinned) page back to its file.
+ *
+ * Only the part of the page that is in the file is written; pages
+ * don't make files longer.
+ */
+int pagecache_writeback(fs_node_t * node, cached_page_t * page) {
+	spin_lock(cache_lock);
+	if (!page->dirty) {
+		spin_unlock(cache_lock);
+		return 0;
+	}
+	page->dirty = 0;
+	stats.dirty--;
+	stats.written++;
+	uint32_t size = page->valid;
+	spin_unlock(cache_lock);
+
+	if (!size) return 0;
+	if (node->writepage) {
+		return node->writepage(node, page->index, size, (uint8_t *)page->address);
+	} else if (node->write) {
+		return node->write(node, page->index * PAGE_SIZE, size, (uint8_t *)page->address);
+	}
+	return -EINVAL;
+}
+
+/**
+ * pagecache_read: read_fs() for nodes with a readpage().
+ *
+ * The end of the file is where a page has less than a page of data.
+ */
+uint32_t pagecache_read(fs_node_t * node, uint32_t offset, uint32_t size, uint8_t * buffer) {
+	uint32_t done = 0;
+	while (done < size) {
+		uint32_t at = offset + done;
+		cached_page_t * page = pagecache_get(node, at / PAGE_SIZE);
+		if (!page) {
+			/* Out of room; read the rest the old way */
+			uint32_t ret = node->read(node, at, size - done, buffer + done);
+			if ((int32_t)ret < 0) return done ? done : ret;
+			return done + ret;
+		}
+
+		uint32_t in_page = at % PAGE_SIZE;
+		uint32_t valid = page->valid;
+		if (in_page >= valid) {
+			pagecache_put(page);
+			break;
+		}
+		uint32_t count = valid - in_page;
+		if (count > size - done) count = size - done;
+		memcpy(buffer + done, (void *)(page->address + in_page), count);
+		pagecache_put(page);
+
+		done += count;
+		if (valid < PAGE_SIZE) break;
+	}
+	return done;
+}
+
+/**
+ * pagecache_update: Copy newly written data into the cached pages it covers.
+ *
+ * Called after the filesystem has taken the write. Pages before the
+ * write that ended early are now followed by more of the file, so
+ * they become full pages.
+ */
+void pagecache_update(fs_node_t * node, uint32_t offset, uint32_t size, uint8_t * buffer) {
+	if (!files || !size) return;
+
+	uint32_t first = offset / PAGE_SIZE;
+	uint32_t last  = (offset + size - 1) / PAGE_SIZE;
+
+	spin_lock(cache_lock);
+	cached_file_t * file = file_find(node, 0);
+	if (!file) {
+		spin_unlock(cache_lock);
+		return;
+	}
+	node_t * partial = file->partial->head;
+	while (partial) {
+		node_t * next = partial->next;
+		cached_page_t * page = partial->value;
+		if (page->index < first) {
+			page->valid = PAGE_SIZE;
+			list_delete(file->partial, partial);
+			free(partial);
+		}
+		partial = next;
+	}
+	spin_unlock(cache_lock);
+
+	for (uint32_t index = first; index <= last; ++index) {
+		spin_lock(cache_lock);
+		file = file_find(node, 0);
+		if (!file) {
+			spin_unlock(cache_lock);
+			return;
+		}
+		cached_page_t * page = hashmap_get(file->pages, (void *)index);
+		if (page) pin(page);
+		spin_unlock(cache_lock);
+		if (!page) continue;
+
+		uint32_t start = index == first ? offset % PAGE_SIZE : 0;
+		uint32_t end   = index == last ? (offset + size - 1) % PAGE_SIZE + 1 : PAGE_SIZE;
+		memcpy((void *)(page->address + start), buffer + (index * PAGE_SIZE + start - offset), end - start);
+
+		spin_lock(cache_lock);
+		if (page->file && end > page->valid) {
+			page->valid = end;
+			file_track_partial(page->file, page);
+		}
+		spin_unlock(cache_lock);
+		pagecache_put(page);
+	}
+}
+
+/**
+ * pagecache_invalidate: Forget every cached page of a file.
+ *
+ * For truncation and unlinking. Pages that are still mapped stay with
+ * their mappings, but are no longer part of the file.
+ */
+void pagecache_invalidate(fs_node_t * node) {
+	if (!files) return;
+
+	spin_lock(cache_lock);
+	cached_file_t * file = file_find(node, 0);
+	if (!file) {
+		spin_unlock(cache_lock);
+		return;
+	}
+
+	list_t * pages = hashmap_values(file->pages);
+	list_t * victims = list_create();
+	foreach(item, pages) {
+		cached_page_t * page = item->value;
+		file_remove_page(page);
+		if (!page->pinned) {
+			list_delete(lru, &page->lru);
+			page_unmap(page);
+			list_insert(victims, page);
+		}
+	}
+	list_free(pages);
+	free(pages);
+
+	if (victims->length) {
+		tlb_shootdown(NULL);
+		foreach(item, victims) {
+			page_free(item->value);
+		}
+	}
+	list_free(victims);
+	free(victims);
+	spin_unlock(cache_lock);
+}
+
+/**
+ * pagecache_pressure: Give back some memory if free memory is low.
+ *
+ * Called before memory is handed to a process.
+ */
+void pagecache_pressure(void) {
+	if (!files || !lru->length || !low_memory()) return;
+	spin_lock(cache_lock);
+	reclaim(RECLAIM_BATCH);
+	spin_unlock(cache_lock);
+}
+
+void pagecache_get_stats(struct pagecache_stats * out) {
+	spin_lock(cache_lock);
+	if (!files) {
+		cache_init();
+	}
+	memcpy(out, &stats, sizeof(struct pagecache_stats));
+	spin_unlock(cache_lock);
+}
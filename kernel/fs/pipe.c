@@ -13,6 +13,8 @@
 #include <kernel/pipe.h>
 #include <kernel/logging.h>
 
+#include <poll.h>
+
 #define DEBUG_PIPES 0
 
 uint32_t read_pipe(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer);
@@ -71,15 +73,12 @@ static inline void pipe_increment_write_by(pipe_device_t * pipe, size_t amount)
 	pipe->write_ptr = (pipe->write_ptr + amount) % pipe->size;
 }
 
-static void pipe_alert_waiters(pipe_device_t * pipe) {
-	if (pipe->alert_waiters) {
-		while (pipe->alert_waiters->head) {
-			node_t * node = list_dequeue(pipe->alert_waiters);
-			process_t * p = node->value;
-			process_alert_node(p, pipe);
-			free(node);
-		}
-	}
+static inline void pipe_increment_read_by(pipe_device_t * pipe, size_t amount) {
+	pipe->read_ptr = (pipe->read_ptr + amount) % pipe->size;
+}
+
+static void pipe_alert_waiters(pipe_device_t * pipe, int events) {
+	fs_wait_alert(pipe->alert_waiters, events);
 }
 
 uint32_t read_pipe(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer) {
@@ -109,16 +108,24 @@ uint32_t read_pipe(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buf
 	size_t collected = 0;
 	while (collected == 0) {
 		spin_lock(pipe->lock_read);
-		while (pipe_unread(pipe) > 0 && collected < size) {
-			buffer[collected] = pipe->buffer[pipe->read_ptr];
-			pipe_increment_read(pipe);
-			collected++;
-		}
+		/* At most two contiguous segments: up to the end of the buffer, then from the start */
+		collected = MIN(pipe_unread(pipe), size);
+		size_t first = MIN(collected, pipe->size - pipe->read_ptr);
+		memcpy(buffer, &pipe->buffer[pipe->read_ptr], first);
+		memcpy(buffer + first, pipe->buffer, collected - first);
+		pipe_increment_read_by(pipe, collected);
 		spin_unlock(pipe->lock_read);
 		wakeup_queue(pipe->wait_queue_writers);
+		if (collected) {
+			pipe_alert_waiters(pipe, POLLOUT);
+		}
 		/* Deschedule and switch */
 		if (collected == 0) {
-			sleep_on(pipe->wait_queue_readers);
+			if (sleep_on(pipe->wait_queue_readers) && signal_pending((process_t *)current_process)) {
+				/* Nothing read yet: run the handler, then read again */
+				current_process->syscall_restart = 1;
+				return 0;
+			}
 		}
 	}
 
@@ -154,30 +161,16 @@ uint32_t write_pipe(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *bu
 	while (written < size) {
 		spin_lock(pipe->lock_write);
 
-#if 0
-		size_t available = 0;
-		if (pipe->read_ptr <= pipe->write_ptr) {
-			available = pipe->size - pipe->write_ptr;
-		} else {
-			available = pipe->read_ptr - pipe->write_ptr - 1;
-		}
-		if (available) {
-			available = min(available, size - written);
-			memcpy(&pipe->buffer[pipe->write_ptr], buffer, available);
-			pipe_increment_write_by(pipe, available);
-			written += available;
-		}
-#else
-		while (pipe_available(pipe) > 0 && written < size) {
-			pipe->buffer[pipe->write_ptr] = buffer[written];
-			pipe_increment_write(pipe);
-			written++;
-		}
-#endif
+		size_t available = MIN(pipe_available(pipe), size - written);
+		size_t first = MIN(available, pipe->size - pipe->write_ptr);
+		memcpy(&pipe->buffer[pipe->write_ptr], buffer + written, first);
+		memcpy(pipe->buffer, buffer + written + first, available - first);
+		pipe_increment_write_by(pipe, available);
+		written += available;
 
 		spin_unlock(pipe->lock_write);
 		wakeup_queue(pipe->wait_queue_readers);
-		pipe_alert_waiters(pipe);
+		pipe_alert_waiters(pipe, POLLIN);
 		if (written < size) {
 			sleep_on(pipe->wait_queue_writers);
 		}
@@ -233,21 +226,28 @@ static int pipe_check(fs_node_t * node) {
 	return 1;
 }
 
-static int pipe_wait(fs_node_t * node, void * process) {
+static int pipe_wait(fs_node_t * node, fs_waiter_t * waiter) {
 	pipe_device_t * pipe = (pipe_device_t *)node->device;
+	fs_wait_add(&pipe->alert_waiters, waiter);
+	return 0;
+}
 
-	if (!pipe->alert_waiters) {
-		pipe->alert_waiters = list_create();
-	}
+static int pipe_poll(fs_node_t * node) {
+	pipe_device_t * pipe = (pipe_device_t *)node->device;
 
-	if (!list_find(pipe->alert_waiters, process)) {
-		list_insert(pipe->alert_waiters, process);
+	if (pipe->dead) {
+		return POLLHUP;
 	}
-	list_insert(((process_t *)process)->node_waits, pipe);
 
-	return 0;
+	return (pipe_unread(pipe) ? POLLIN : 0) | (pipe_available(pipe) ? POLLOUT : 0);
 }
 
+/*
+ * These back /dev/kbd, /dev/mouse and the serial ports. They keep their
+ * reader and writer locks rather than going lockless like the /dev/dsp
+ * rings: the devices can be opened by more than one reader, and the mouse
+ * interrupt handler reads from its own pipe to drop stale packets.
+ */
 fs_node_t * make_pipe(size_t size) {
 	fs_node_t * fnode = malloc(sizeof(fs_node_t));
 	pipe_device_t * pipe = malloc(sizeof(pipe_device_t));
@@ -272,6 +272,7 @@ fs_node_t * make_pipe(size_t size) {
 
 	fnode->selectcheck = pipe_check;
 	fnode->selectwait  = pipe_wait;
+	fnode->pollcheck   = pipe_poll;
 
 	fnode->atime = now();
 	fnode->mtime = fnode->atime;
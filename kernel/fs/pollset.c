@@ -0,0 +1,291 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Readiness notification
+ *
+ * Nodes that can block keep a list of fs_waiter_t registrations and
+ * call fs_wait_alert() when their state changes. fswait() registers
+ * a waiter per node for the length of one call (process_wait_nodes);
+ * a pollset keeps one per entry for as long as the entry exists and
+ * gathers the entries that alerted on a ready list, so a wait only
+ * looks at those instead of every registered descriptor.
+ */
+#include <kernel/system.h>
+#include <kernel/fs.h>
+#include <kernel/process.h>
+#include <kernel/printf.h>
+#include <kernel/logging.h>
+
+#include <toaru/hashmap.h>
+#include <sys/pollset.h>
+
+/*
+ * Protects every node's waiter list and every pollset's ready list.
+ * Alerts can come from interrupt handlers, so it's taken with
+ * interrupts off, and alert() hooks run with it held.
+ */
+static spin_lock_t poll_lock = { 0 };
+
+static void wait_alert_locked(list_t * waiters, int events) {
+	node_t * node = waiters->head;
+	while (node) {
+		node_t * next = node->next;
+		fs_waiter_t * waiter = node->value;
+		if ((waiter->events | POLLHUP | POLLERR) & events) {
+			list_delete(waiters, node);
+			waiter->alert(waiter, events);
+		}
+		node = next;
+	}
+}
+
+void fs_wait_add(list_t ** waiters, fs_waiter_t * waiter) {
+	uint32_t flags;
+	spin_lock_irqsave(poll_lock, &flags);
+	if (!*waiters) {
+		*waiters = list_create();
+	}
+	if (!waiter->link.owner) {
+		waiter->link.value = waiter;
+		list_append(*waiters, &waiter->link);
+	}
+	spin_unlock_irqrestore(poll_lock, flags);
+}
+
+void fs_wait_remove(fs_waiter_t * waiter) {
+	uint32_t flags;
+	spin_lock_irqsave(poll_lock, &flags);
+	if (waiter->link.owner) {
+		list_delete(waiter->link.owner, &waiter->link);
+	}
+	spin_unlock_irqrestore(poll_lock, flags);
+}
+
+void fs_wait_alert(list_t * waiters, int events) {
+	if (!waiters || !waiters->head) return;
+
+	uint32_t flags;
+	spin_lock_irqsave(poll_lock, &flags);
+	wait_alert_locked(waiters, events);
+	spin_unlock_irqrestore(poll_lock, flags);
+}
+
+struct pollset_entry {
+	fs_waiter_t waiter;
+	node_t ready;           /* On the set's ready list while ready.owner is set */
+	struct pollset * set;
+	fs_node_t * node;       /* Referenced for as long as the entry exists */
+	int fd;
+	int events;
+	void * data;
+};
+
+struct pollset {
+	hashmap_t * entries;    /* fd -> entry */
+	list_t * ready;         /* Entries to look at on the next wait */
+	list_t * waiters;       /* Waiting on the set itself */
+};
+
+/* Called with poll_lock held */
+static void pollset_make_ready(struct pollset_entry * entry) {
+	struct pollset * set = entry->set;
+	if (!entry->ready.owner) {
+		list_append(set->ready, &entry->ready);
+	}
+	if (set->waiters) {
+		wait_alert_locked(set->waiters, POLLIN);
+	}
+}
+
+static void pollset_entry_alert(fs_waiter_t * waiter, int events) {
+	pollset_make_ready(waiter->owner);
+}
+
+static void pollset_entry_free(struct pollset * set, struct pollset_entry * entry) {
+	fs_wait_remove(&entry->waiter);
+
+	uint32_t flags;
+	spin_lock_irqsave(poll_lock, &flags);
+	if (entry->ready.owner) {
+		list_delete(set->ready, &entry->ready);
+	}
+	spin_unlock_irqrestore(poll_lock, flags);
+
+	close_fs(entry->node);
+	free(entry);
+}
+
+static int pollset_check(fs_node_t * node) {
+	struct pollset * set = node->device;
+	return set->ready->length ? 0 : 1;
+}
+
+static int pollset_select_wait(fs_node_t * node, fs_waiter_t * waiter) {
+	struct pollset * set = node->device;
+	fs_wait_add(&set->waiters, waiter);
+	return 0;
+}
+
+static void pollset_close(fs_node_t * node) {
+	struct pollset * set = node->device;
+
+	list_t * entries = hashmap_values(set->entries);
+	foreach(n, entries) {
+		pollset_entry_free(set, n->value);
+	}
+	list_free(entries);
+	free(entries);
+
+	hashmap_free(set->entries);
+	free(set->entries);
+	free(set->ready);
+	if (set->waiters) {
+		free(set->waiters);
+	}
+	free(set);
+}
+
+fs_node_t * make_pollset(void) {
+	fs_node_t * fnode = malloc(sizeof(fs_node_t));
+	memset(fnode, 0x00, sizeof(fs_node_t));
+
+	struct pollset * set = malloc(sizeof(struct pollset));
+	set->entries = hashmap_create_int(64);
+	set->ready   = list_create();
+	set->waiters = NULL;
+
+	sprintf(fnode->name, "[pollset]");
+	fnode->mask   = 0600;
+	fnode->flags  = FS_CHARDEVICE;
+	fnode->device = set;
+	fnode->close  = pollset_close;
+	fnode->selectcheck = pollset_check;
+	fnode->selectwait  = pollset_select_wait;
+	fnode->atime = now();
+	fnode->mtime = fnode->atime;
+	fnode->ctime = fnode->atime;
+
+	return fnode;
+}
+
+int pollset_ctl_fs(fs_node_t * set_node, int op, int fd, fs_node_t * node, int events, void * data) {
+	if (set_node->close != pollset_close) return -EINVAL;
+
+	struct pollset * set = set_node->device;
+	struct pollset_entry * entry = hashmap_get(set->entries, (void *)fd);
+	uint32_t flags;
+
+	switch (op) {
+		case POLLSET_ADD:
+			if (entry) return -EEXIST;
+			if (node == set_node) return -EINVAL;
+			entry = malloc(sizeof(struct pollset_entry));
+			memset(entry, 0x00, sizeof(struct pollset_entry));
+			entry->waiter.alert = pollset_entry_alert;
+			entry->waiter.owner = entry;
+			entry->ready.value  = entry;
+			entry->set  = set;
+			entry->node = clone_fs(node);
+			entry->fd   = fd;
+			hashmap_set(set->entries, (void *)fd, entry);
+			break;
+		case POLLSET_MOD:
+			if (!entry) return -ENOENT;
+			break;
+		case POLLSET_DEL:
+			if (!entry) return -ENOENT;
+			hashmap_remove(set->entries, (void *)fd);
+			pollset_entry_free(set, entry);
+			return 0;
+		default:
+			return -EINVAL;
+	}
+
+	entry->events = events;
+	entry->data   = data;
+	entry->waiter.events = events & (POLLIN | POLLOUT);
+
+	/* Look at it on the next wait, whatever its state */
+	spin_lock_irqsave(poll_lock, &flags);
+	pollset_make_ready(entry);
+	spin_unlock_irqrestore(poll_lock, flags);
+
+	return 0;
+}
+
+/*
+ * Take each entry off the ready list once, re-arm it and report it if
+ * it has anything to say. Arming before checking means a change that
+ * lands after the check puts the entry straight back on the list.
+ * Level-triggered entries that reported go back on the list, to be
+ * checked again next time.
+ */
+static int pollset_collect(struct pollset * set, struct pollset_event * out, int max) {
+	uint32_t flags;
+	int count = 0;
+
+	spin_lock_irqsave(poll_lock, &flags);
+	size_t pending = set->ready->length;
+	spin_unlock_irqrestore(poll_lock, flags);
+
+	while (pending-- && count < max) {
+		spin_lock_irqsave(poll_lock, &flags);
+		node_t * node = list_dequeue(set->ready);
+		spin_unlock_irqrestore(poll_lock, flags);
+		if (!node) break;
+
+		struct pollset_entry * entry = node->value;
+		selectwait_fs(entry->node, &entry->waiter);
+
+		int revents = pollcheck_fs(entry->node) & (entry->events | POLLHUP | POLLERR | POLLNVAL);
+		if (!revents) continue;
+
+		out[count].fd      = entry->fd;
+		out[count].events  = entry->events;
+		out[count].revents = revents;
+		out[count].data    = entry->data;
+		count++;
+
+		if (!(entry->events & POLLET)) {
+			spin_lock_irqsave(poll_lock, &flags);
+			if (!entry->ready.owner) {
+				list_append(set->ready, &entry->ready);
+			}
+			spin_unlock_irqrestore(poll_lock, flags);
+		}
+	}
+
+	return count;
+}
+
+/*
+ * Fill `out` with up to `max` ready entries. Returns how many, 0 if
+ * the timeout (in milliseconds; -1 waits forever) passed first, or
+ * -EINTR for a signal.
+ */
+int pollset_wait_fs(fs_node_t * set_node, struct pollset_event * out, int max, int timeout) {
+	if (set_node->close != pollset_close) return -EINVAL;
+
+	struct pollset * set = set_node->device;
+	fs_node_t * nodes[] = { set_node, NULL };
+
+	unsigned long deadline = timer_now_ms() + (timeout > 0 ? timeout : 0);
+
+	while (1) {
+		int count = pollset_collect(set, out, max);
+		if (count) return count;
+
+		int remaining = timeout;
+		if (timeout > 0) {
+			unsigned long current = timer_now_ms();
+			if ((long)(deadline - current) <= 0) return 0;
+			remaining = deadline - current;
+		}
+
+		int index = process_wait_nodes((process_t *)current_process, nodes, remaining);
+		if (index == -1) return -EINTR;
+		if (index != 0) return 0;
+	}
+}
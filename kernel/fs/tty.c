@@ -16,6 +16,9 @@
 #define TTY_BUFFER_SIZE 4096
 //4096
 
+/* Output is translated in chunks of this size before being handed to the ring buffer */
+#define TTY_STAGE_SIZE 256
+
 typedef struct pty {
 	/* the PTY number */
 	int            name;
@@ -63,6 +66,11 @@ static void clear_input_buffer(pty_t * pty) {
 }
 
 static void output_process_slave(pty_t * pty, uint8_t c) {
+	if (!(pty->tios.c_oflag & OPOST)) {
+		OUT(c);
+		return;
+	}
+
 	if (c == '\n' && (pty->tios.c_oflag & ONLCR)) {
 		c = '\n';
 		OUT(c);
@@ -89,6 +97,51 @@ static void output_process(pty_t * pty, uint8_t c) {
 	output_process_slave(pty, c);
 }
 
+static void output_flush(pty_t * pty, uint8_t * buffer, size_t size, int echo) {
+	if (echo) {
+		/* Echoes must never block the master, which is the one that has to drain them */
+		size = MIN(size, ring_buffer_available(pty->out));
+	}
+	if (size) {
+		ring_buffer_write(pty->out, size, buffer);
+	}
+}
+
+/*
+ * Bulk version of output_process_slave: translate a whole buffer and pass it to
+ * the ring buffer in large pieces, so waiters are woken per chunk instead of per
+ * byte. Without output processing the buffer is passed through untouched.
+ */
+static void output_process_buffer(pty_t * pty, uint8_t * buffer, size_t size, int echo) {
+	if (!(pty->tios.c_oflag & OPOST) || !(pty->tios.c_oflag & (ONLCR | ONLRET | OLCUC))) {
+		output_flush(pty, buffer, size, echo);
+		return;
+	}
+
+	uint8_t stage[TTY_STAGE_SIZE];
+	size_t n = 0;
+	for (size_t i = 0; i < size; ++i) {
+		uint8_t c = buffer[i];
+		if (n > TTY_STAGE_SIZE - 2) {
+			output_flush(pty, stage, n, echo);
+			n = 0;
+		}
+		if (c == '\n' && (pty->tios.c_oflag & ONLCR)) {
+			stage[n++] = '\n';
+			stage[n++] = '\r';
+			continue;
+		}
+		if (c == '\r' && (pty->tios.c_oflag & ONLRET)) {
+			continue;
+		}
+		if (c >= 'a' && c <= 'z' && (pty->tios.c_oflag & OLCUC)) {
+			c = c + 'a' - 'A';
+		}
+		stage[n++] = c;
+	}
+	output_flush(pty, stage, n, echo);
+}
+
 static void input_process(pty_t * pty, uint8_t c) {
 	if (pty->tios.c_lflag & ISIG) {
 		if (c == pty->tios.c_cc[VINTR]) {
@@ -261,12 +314,43 @@ uint32_t  read_pty_master(fs_node_t * node, uint32_t offset, uint32_t size, uint
 uint32_t write_pty_master(fs_node_t * node, uint32_t offset, uint32_t size, uint8_t *buffer) {
 	pty_t * pty = (pty_t *)node->device;
 
+	if (pty->tios.c_lflag & ICANON) {
+		/* Line editing needs to see every character */
+		size_t l = 0;
+		for (uint8_t * c = buffer; l < size; ++c, ++l) {
+			input_process(pty, *c);
+		}
+		return size;
+	}
+
+	/*
+	 * Outside of canonical mode, only the signal characters need individual
+	 * attention; everything between them is echoed and queued as a block.
+	 */
 	size_t l = 0;
-	for (uint8_t * c = buffer; l < size; ++c, ++l) {
-		input_process(pty, *c);
+	while (l < size) {
+		size_t run = l;
+		if (pty->tios.c_lflag & ISIG) {
+			while (run < size && buffer[run] != pty->tios.c_cc[VINTR] && buffer[run] != pty->tios.c_cc[VQUIT]) {
+				run++;
+			}
+		} else {
+			run = size;
+		}
+		if (run > l) {
+			if (pty->tios.c_lflag & ECHO) {
+				output_process_buffer(pty, &buffer[l], run - l, 1);
+			}
+			ring_buffer_write(pty->in, run - l, &buffer[l]);
+		}
+		if (run < size) {
+			input_process(pty, buffer[run]);
+			run++;
+		}
+		l = run;
 	}
 
-	return l;
+	return size;
 }
 void      open_pty_master(fs_node_t * node, unsigned int flags) {
 	return;
@@ -292,12 +376,9 @@ uint32_t  read_pty_slave(fs_node_t * node, uint32_t offset, uint32_t size, uint8
 uint32_t write_pty_slave(fs_node_t * node, uint32_t offset, uint32_t size, uint8_t *buffer) {
 	pty_t * pty = (pty_t *)node->device;
 
-	size_t l = 0;
-	for (uint8_t * c = buffer; l < size; ++c, ++l) {
-		output_process_slave(pty, *c);
-	}
+	output_process_buffer(pty, buffer, size, 0);
 
-	return l;
+	return size;
 }
 void      open_pty_slave(fs_node_t * node, unsigned int flags) {
 	return;
@@ -346,15 +427,15 @@ static int check_pty_slave(fs_node_t * node) {
 	return 1;
 }
 
-static int wait_pty_master(fs_node_t * node, void * process) {
+static int wait_pty_master(fs_node_t * node, fs_waiter_t * waiter) {
 	pty_t * pty = (pty_t *)node->device;
-	ring_buffer_select_wait(pty->out, process);
+	ring_buffer_select_wait(pty->out, waiter);
 	return 0;
 }
 
-static int wait_pty_slave(fs_node_t * node, void * process) {
+static int wait_pty_slave(fs_node_t * node, fs_waiter_t * waiter) {
 	pty_t * pty = (pty_t *)node->device;
-	ring_buffer_select_wait(pty->in, process);
+	ring_buffer_select_wait(pty->in, waiter);
 	return 0;
 }
 
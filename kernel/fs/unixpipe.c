@@ -11,6 +11,7 @@
 #include <kernel/ringbuffer.h>
 
 #include <sys/ioctl.h>
+#include <poll.h>
 
 #define UNIX_PIPE_BUFFER 512
 
@@ -36,11 +37,16 @@ static uint32_t read_unixpipe(fs_node_t * node, uint32_t offset, uint32_t size,
 		if (self->write_closed && !ring_buffer_unread(self->buffer)) {
 			return read;
 		}
-		size_t r = ring_buffer_read(self->buffer, 1, buffer+read);
-		if (r && *((char *)(buffer + read)) == '\n') {
-			return read+r;
+		size_t r = ring_buffer_read_line(self->buffer, size - read, buffer+read);
+		if (!r && current_process->syscall_restart) {
+			/* Interrupted by a signal; only start over if nothing was read */
+			if (read) current_process->syscall_restart = 0;
+			return read;
 		}
 		read += r;
+		if (r && buffer[read - 1] == '\n') {
+			return read;
+		}
 	}
 
 	return read;
@@ -57,7 +63,7 @@ static uint32_t write_unixpipe(fs_node_t * node, uint32_t offset, uint32_t size,
 
 			return written;
 		}
-		size_t w = ring_buffer_write(self->buffer, 1, buffer+written);
+		size_t w = ring_buffer_write(self->buffer, size - written, buffer+written);
 		written += w;
 	}
 
@@ -74,6 +80,7 @@ static void close_read_pipe(fs_node_t * node) {
 		debug_print(NOTICE, "Both ends now closed, should clean up.");
 	} else {
 		ring_buffer_interrupt(self->buffer);
+		ring_buffer_alert_waiters(self->buffer, POLLHUP);
 	}
 }
 
@@ -88,7 +95,7 @@ static void close_write_pipe(fs_node_t * node) {
 	} else {
 		ring_buffer_interrupt(self->buffer);
 		if (!ring_buffer_unread(self->buffer)) {
-			ring_buffer_alert_waiters(self->buffer);
+			ring_buffer_alert_waiters(self->buffer, POLLHUP);
 		}
 	}
 }
@@ -102,12 +109,23 @@ static int check_pipe(fs_node_t * node) {
 	return 1;
 }
 
-static int wait_pipe(fs_node_t * node, void * process) {
+static int wait_pipe(fs_node_t * node, fs_waiter_t * waiter) {
 	struct unix_pipe * self = node->device;
-	ring_buffer_select_wait(self->buffer, process);
+	ring_buffer_select_wait(self->buffer, waiter);
 	return 0;
 }
 
+static int poll_read_end(fs_node_t * node) {
+	struct unix_pipe * self = node->device;
+	return (ring_buffer_unread(self->buffer) ? POLLIN : 0) | (self->write_closed ? POLLHUP : 0);
+}
+
+static int poll_write_end(fs_node_t * node) {
+	struct unix_pipe * self = node->device;
+	if (self->read_closed) return POLLERR;
+	return ring_buffer_available(self->buffer) ? POLLOUT : 0;
+}
+
 
 int make_unix_pipe(fs_node_t ** pipes) {
 	size_t size = UNIX_PIPE_BUFFER;
@@ -133,9 +151,12 @@ int make_unix_pipe(fs_node_t ** pipes) {
 	pipes[0]->close = close_read_pipe;
 	pipes[1]->close = close_write_pipe;
 
-	/* Read end can wait */
+	/* Read end can wait; both ends can be polled */
 	pipes[0]->selectcheck = check_pipe;
 	pipes[0]->selectwait = wait_pipe;
+	pipes[0]->pollcheck = poll_read_end;
+	pipes[1]->selectwait = wait_pipe;
+	pipes[1]->pollcheck = poll_write_end;
 
 	struct unix_pipe * internals = malloc(sizeof(struct unix_pipe));
 	internals->read_end = pipes[0];
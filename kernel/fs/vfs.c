@@ -13,10 +13,15 @@
 #include <kernel/printf.h>
 #include <kernel/process.h>
 #include <kernel/logging.h>
+#include <kernel/pagecache.h>
 
 #include <toaru/list.h>
 #include <toaru/hashmap.h>
 
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/getdents.h>
+
 #define MAX_SYMLINK_DEPTH 8
 #define MAX_SYMLINK_SIZE 4096
 
@@ -108,18 +113,41 @@ int selectcheck_fs(fs_node_t * node) {
 }
 
 /**
- * selectwait_fs: Inform a node that it should alert the current_process.
+ * selectwait_fs: Queue a waiter to be alerted when this node changes.
  */
-int selectwait_fs(fs_node_t * node, void * process) {
+int selectwait_fs(fs_node_t * node, fs_waiter_t * waiter) {
 	if (!node) return -ENOENT;
 
 	if (node->selectwait) {
-		return node->selectwait(node, process);
+		return node->selectwait(node, waiter);
 	}
 
 	return -EINVAL;
 }
 
+/**
+ * pollcheck_fs: Which of POLLIN, POLLOUT and POLLHUP hold right now.
+ *
+ * Nodes without a pollcheck are readable when selectcheck says so and
+ * writable if they can be written at all; nodes that can't block
+ * (regular files) are always both.
+ */
+int pollcheck_fs(fs_node_t * node) {
+	if (!node) return POLLNVAL;
+
+	if (node->pollcheck) {
+		return node->pollcheck(node);
+	}
+
+	if (node->selectcheck) {
+		int result = node->selectcheck(node);
+		if (result < 0) return POLLERR;
+		return (result == 0 ? POLLIN : 0) | (node->write ? POLLOUT : 0);
+	}
+
+	return POLLIN | POLLOUT;
+}
+
 /**
  * read_fs: Read a file system node based on its underlying type.
  *
@@ -132,6 +160,10 @@ int selectwait_fs(fs_node_t * node, void * process) {
 uint32_t read_fs(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer) {
 	if (!node) return -ENOENT;
 
+	if ((node->flags & FS_FILE) && node->readpage && node->read) {
+		return pagecache_read(node, offset, size, buffer);
+	}
+
 	if (node->read) {
 		uint32_t ret = node->read(node, offset, size, buffer);
 		return ret;
@@ -154,12 +186,117 @@ uint32_t write_fs(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buff
 
 	if (node->write) {
 		uint32_t ret = node->write(node, offset, size, buffer);
+		if ((node->flags & FS_FILE) && node->readpage && (int32_t)ret > 0) {
+			/* Write-through: the filesystem has it, now bring cached pages up to date */
+			pagecache_update(node, offset, ret, buffer);
+		}
 		return ret;
 	} else {
 		return -EINVAL;
 	}
 }
 
+/* Largest buffer a vectored call on anything but a file is gathered into */
+#define IOV_BOUNCE_MAX 0x100000
+
+static uint32_t iov_total(struct iovec * iov, int count) {
+	uint32_t total = 0;
+	for (int i = 0; i < count; ++i) {
+		if (iov[i].iov_len > IOV_BOUNCE_MAX - total) return IOV_BOUNCE_MAX;
+		total += iov[i].iov_len;
+	}
+	return total;
+}
+
+/**
+ * readv_fs: Read into several buffers.
+ *
+ * Regular files are read buffer by buffer, straight into each one,
+ * until one comes up short. Other nodes may hand out a whole message
+ * per read (a packet, a line from a terminal), so they get a single
+ * read that is then spread over the buffers.
+ *
+ * @param node    Node to read
+ * @param offset  Offset into the node data to read from
+ * @param iov     Buffers to fill, in order
+ * @param count   Number of buffers
+ * @returns Bytes read
+ */
+uint32_t readv_fs(fs_node_t *node, uint32_t offset, struct iovec * iov, int count) {
+	if (!node) return -ENOENT;
+	if (!node->read) return -EINVAL;
+
+	if (!(node->flags & FS_FILE)) {
+		uint32_t total = iov_total(iov, count);
+		if (!total) return 0;
+		uint8_t * buf = malloc(total);
+		uint32_t ret = read_fs(node, offset, total, buf);
+		if ((int32_t)ret > 0) {
+			uint32_t done = 0;
+			for (int i = 0; i < count && done < ret; ++i) {
+				uint32_t n = MIN(iov[i].iov_len, ret - done);
+				memcpy(iov[i].iov_base, buf + done, n);
+				done += n;
+			}
+		}
+		free(buf);
+		return ret;
+	}
+
+	uint32_t done = 0;
+	for (int i = 0; i < count; ++i) {
+		if (!iov[i].iov_len) continue;
+		uint32_t ret = read_fs(node, offset + done, iov[i].iov_len, iov[i].iov_base);
+		if ((int32_t)ret < 0) return done ? done : ret;
+		done += ret;
+		if (ret < iov[i].iov_len) break;
+	}
+	return done;
+}
+
+/**
+ * writev_fs: Write from several buffers.
+ *
+ * The counterpart of readv_fs: regular files are written buffer by
+ * buffer, anything else gets the buffers gathered into one write so
+ * that it still arrives as a single message.
+ *
+ * @param node    Node to write to
+ * @param offset  Offset into the node data to write to
+ * @param iov     Buffers to write, in order
+ * @param count   Number of buffers
+ * @returns Bytes written
+ */
+uint32_t writev_fs(fs_node_t *node, uint32_t offset, struct iovec * iov, int count) {
+	if (!node) return -ENOENT;
+	if (!node->write) return -EINVAL;
+
+	if (!(node->flags & FS_FILE)) {
+		uint32_t total = iov_total(iov, count);
+		if (!total) return 0;
+		uint8_t * buf = malloc(total);
+		uint32_t done = 0;
+		for (int i = 0; i < count && done < total; ++i) {
+			uint32_t n = MIN(iov[i].iov_len, total - done);
+			memcpy(buf + done, iov[i].iov_base, n);
+			done += n;
+		}
+		uint32_t ret = write_fs(node, offset, total, buf);
+		free(buf);
+		return ret;
+	}
+
+	uint32_t done = 0;
+	for (int i = 0; i < count; ++i) {
+		if (!iov[i].iov_len) continue;
+		uint32_t ret = write_fs(node, offset + done, iov[i].iov_len, iov[i].iov_base);
+		if ((int32_t)ret < 0) return done ? done : ret;
+		done += ret;
+		if (ret < iov[i].iov_len) break;
+	}
+	return done;
+}
+
 //volatile uint8_t tmp_refcount_lock = 0;
 static spin_lock_t tmp_refcount_lock = { 0 };
 
@@ -188,6 +325,10 @@ void open_fs(fs_node_t *node, unsigned int flags) {
 	if (node->open) {
 		node->open(node, flags);
 	}
+
+	if ((flags & O_TRUNC) && node->readpage) {
+		pagecache_invalidate(node);
+	}
 }
 
 /**
@@ -207,7 +348,11 @@ void close_fs(fs_node_t *node) {
 
 	spin_lock(tmp_refcount_lock);
 	node->refcount--;
-	if (node->refcount == 0) {
+	int last = (node->refcount == 0);
+	spin_unlock(tmp_refcount_lock);
+
+	/* Nobody else can reach the node now; close() may close others (pollsets) */
+	if (last) {
 		debug_print(NOTICE, "Node refcount [%s] is now 0: %d", node->name, node->refcount);
 
 		if (node->close) {
@@ -216,7 +361,6 @@ void close_fs(fs_node_t *node) {
 
 		free(node);
 	}
-	spin_unlock(tmp_refcount_lock);
 }
 
 /**
@@ -257,6 +401,37 @@ struct dirent *readdir_fs(fs_node_t *node, uint32_t index) {
 	}
 }
 
+/**
+ * getdents_fs: List a directory in batches
+ *
+ * Filesystems with a getdents() walk their own directory structures;
+ * for the rest, *position is a readdir() index and the types are
+ * unknown.
+ *
+ * @param node     Directory to read
+ * @param position Where to start; advanced past each entry taken
+ * @param fill     Called for each entry; non-zero means stop before it
+ * @param context  Passed to fill
+ * @returns 1 if fill() stopped the listing, 0 at the end of the directory
+ */
+int getdents_fs(fs_node_t *node, uint32_t *position, getdents_fill_t fill, void * context) {
+	if (!node) return -ENOENT;
+	if (!(node->flags & FS_DIRECTORY)) return -ENOTDIR;
+
+	if (node->getdents) {
+		return node->getdents(node, position, fill, context);
+	}
+
+	while (1) {
+		struct dirent * ent = readdir_fs(node, *position);
+		if (!ent) return 0;
+		int stop = fill(context, ent->ino, DT_UNKNOWN, ent->name);
+		free(ent);
+		if (stop) return 1;
+		(*position)++;
+	}
+}
+
 /**
  * finddir_fs: Find the requested file in the directory and return an fs_node for it
  *
@@ -390,6 +565,9 @@ int unlink_fs(char * name) {
 		return -EACCES;
 	}
 
+	/* The inode may be reused, so anything cached for it has to go */
+	fs_node_t * victim = kopen(path, O_NOFOLLOW);
+
 	int ret = 0;
 	if (parent->unlink) {
 		ret = parent->unlink(parent, f_path);
@@ -397,6 +575,13 @@ int unlink_fs(char * name) {
 		ret = -EINVAL;
 	}
 
+	if (victim) {
+		if (!ret && victim->readpage) {
+			pagecache_invalidate(victim);
+		}
+		close_fs(victim);
+	}
+
 	free(path);
 	free(parent);
 	return ret;
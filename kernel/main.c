@@ -49,6 +49,7 @@
 #include <kernel/args.h>
 #include <kernel/module.h>
 #include <kernel/pci.h>
+#include <kernel/ringbuffer.h>
 
 uintptr_t initial_esp = 0;
 
@@ -168,12 +169,14 @@ int kmain(struct multiboot *mboot, uint32_t mboot_mag, uintptr_t esp) {
 		args_parse(cmdline);
 	}
 
+	vdso_install();     /* Time page and system call entry */
 	vfs_install();
 	tasking_install();  /* Multi-tasking */
 	timer_install();    /* PIC driver */
 	fpu_install();      /* FPU/SSE magic */
 	syscalls_install(); /* Install the system calls */
 	shm_install();      /* Install shared memory */
+	smp_install();      /* Application processors */
 	modules_install();  /* Modules! */
 	pci_remap();
 
@@ -219,6 +222,10 @@ int kmain(struct multiboot *mboot, uint32_t mboot_mag, uintptr_t esp) {
 		}
 	}
 
+	if (args_present("ringbuffer_test")) {
+		ring_buffer_selftest();
+	}
+
 	/* Map /dev to a device mapper */
 	map_vfs_directory("/dev");
 
@@ -13,11 +13,15 @@
 #include <kernel/logging.h>
 #include <kernel/signal.h>
 #include <kernel/module.h>
+#include <kernel/trace.h>
+#include <kernel/mmap.h>
+#include <kernel/pagecache.h>
+#include <sys/vdso.h>
 
 #include <toaru/hashmap.h>
 
 #define KERNEL_HEAP_INIT 0x00800000
-#define KERNEL_HEAP_END  0x20000000
+#define KERNEL_HEAP_END  VDSO_ADDRESS
 
 extern void *end;
 uintptr_t placement_pointer = (uintptr_t)&end;
@@ -135,6 +139,7 @@ kvmalloc_p(
 
 uint32_t *frames;
 uint32_t nframes;
+static uint32_t frames_used = 0;
 
 #define INDEX_FROM_BIT(b) (b / 0x20)
 #define OFFSET_FROM_BIT(b) (b % 0x20)
@@ -147,6 +152,7 @@ set_frame(
 		uint32_t frame  = frame_addr / 0x1000;
 		uint32_t index  = INDEX_FROM_BIT(frame);
 		uint32_t offset = OFFSET_FROM_BIT(frame);
+		if (!(frames[index] & ((uint32_t)0x1 << offset))) frames_used++;
 		frames[index] |= ((uint32_t)0x1 << offset);
 	}
 }
@@ -158,6 +164,7 @@ clear_frame(
 	uint32_t frame  = frame_addr / 0x1000;
 	uint32_t index  = INDEX_FROM_BIT(frame);
 	uint32_t offset = OFFSET_FROM_BIT(frame);
+	if (frames[index] & ((uint32_t)0x1 << offset)) frames_used--;
 	frames[index] &= ~((uint32_t)0x1 << offset);
 }
 
@@ -234,6 +241,19 @@ alloc_frame(
 	}
 }
 
+/*
+ * Back a user page in a process address space, counting it
+ * against the directory if it wasn't already backed.
+ */
+void alloc_user_frame(uintptr_t address, page_directory_t * dir) {
+	page_t * page = get_page(address, 1, dir);
+	if (!page->frame) {
+		pagecache_pressure();
+		dir->user_pages++;
+	}
+	alloc_frame(page, 0, 1);
+}
+
 void
 dma_frame(
 		page_t *page,
@@ -265,17 +285,7 @@ free_frame(
 }
 
 uintptr_t memory_use(void ) {
-	uintptr_t ret = 0;
-	uint32_t i, j;
-	for (i = 0; i < INDEX_FROM_BIT(nframes); ++i) {
-		for (j = 0; j < 32; ++j) {
-			uint32_t testFrame = (uint32_t)0x1 << j;
-			if (frames[i] & testFrame) {
-				ret++;
-			}
-		}
-	}
-	return ret * 4;
+	return frames_used * 4;
 }
 
 uintptr_t memory_total(){
@@ -343,8 +353,8 @@ void paging_finalize(void) {
 	for (uintptr_t i = placement_pointer + 0x3000; i < tmp_heap_start; i += 0x1000) {
 		alloc_frame(get_page(i, 1, kernel_directory), 1, 0);
 	}
-	/* And preallocate the page entries for all the rest of the kernel heap as well */
-	for (uintptr_t i = tmp_heap_start; i < KERNEL_HEAP_END; i += 0x1000) {
+	/* And preallocate the page entries for all the rest of the kernel heap, and the page cache after it, as well */
+	for (uintptr_t i = tmp_heap_start; i < PAGE_CACHE_END; i += 0x1000) {
 		get_page(i, 1, kernel_directory);
 	}
 
@@ -368,27 +378,27 @@ uintptr_t map_to_physical(uintptr_t virtual) {
 }
 
 void debug_print_directory(page_directory_t * arg) {
-	page_directory_t * current_directory = arg;
-	debug_print(INSANE, " ---- [k:0x%x u:0x%x]", kernel_directory, current_directory);
+	page_directory_t * dir = arg;
+	debug_print(INSANE, " ---- [k:0x%x u:0x%x]", kernel_directory, dir);
 	for (uintptr_t i = 0; i < 1024; ++i) {
-		if (!current_directory->tables[i] || (uintptr_t)current_directory->tables[i] == (uintptr_t)0xFFFFFFFF) {
+		if (!dir->tables[i] || (uintptr_t)dir->tables[i] == (uintptr_t)0xFFFFFFFF) {
 			continue;
 		}
-		if (kernel_directory->tables[i] == current_directory->tables[i]) {
-			debug_print(INSANE, "  0x%x - kern [0x%x/0x%x] 0x%x", current_directory->tables[i], &current_directory->tables[i], &kernel_directory->tables[i], i * 0x1000 * 1024);
+		if (kernel_directory->tables[i] == dir->tables[i]) {
+			debug_print(INSANE, "  0x%x - kern [0x%x/0x%x] 0x%x", dir->tables[i], &dir->tables[i], &kernel_directory->tables[i], i * 0x1000 * 1024);
 			for (uint16_t j = 0; j < 1024; ++j) {
 #if 1
-				page_t *  p= &current_directory->tables[i]->pages[j];
+				page_t *  p= &dir->tables[i]->pages[j];
 				if (p->frame) {
 					debug_print(INSANE, " k  0x%x 0x%x %s", (i * 1024 + j) * 0x1000, p->frame * 0x1000, p->present ? "[present]" : "");
 				}
 #endif
 			}
 		} else {
-			debug_print(INSANE, "  0x%x - user [0x%x] 0x%x [0x%x]", current_directory->tables[i], &current_directory->tables[i], i * 0x1000 * 1024, kernel_directory->tables[i]);
+			debug_print(INSANE, "  0x%x - user [0x%x] 0x%x [0x%x]", dir->tables[i], &dir->tables[i], i * 0x1000 * 1024, kernel_directory->tables[i]);
 			for (uint16_t j = 0; j < 1024; ++j) {
 #if 1
-				page_t *  p= &current_directory->tables[i]->pages[j];
+				page_t *  p= &dir->tables[i]->pages[j];
 				if (p->frame) {
 					debug_print(INSANE, "    0x%x 0x%x %s", (i * 1024 + j) * 0x1000, p->frame * 0x1000, p->present ? "[present]" : "");
 				}
@@ -456,13 +466,19 @@ page_fault(
 	uint32_t faulting_address;
 	asm volatile("mov %%cr2, %0" : "=r"(faulting_address));
 
-	if (r->eip == SIGNAL_RETURN) {
-		return_from_signal_handler();
-	} else if (r->eip == THREAD_RETURN) {
+	trace_event(TRACE_PAGE_FAULT, faulting_address, r->eip, 0);
+
+	if (r->eip == THREAD_RETURN) {
 		debug_print(INFO, "Returned from thread.");
 		kexit(0);
 	}
 
+	current_process->stats.page_faults++;
+
+	if (faulting_address < USER_STACK_BOTTOM && mmap_fault(faulting_address, r->err_code)) {
+		return;
+	}
+
 #if 1
 	int present  = !(r->err_code & 0x1) ? 1 : 0;
 	int rw       = r->err_code & 0x2    ? 1 : 0;
@@ -475,33 +491,13 @@ page_fault(
 
 	if (r->eip < heap_end) {
 		/* find closest symbol */
-		char * closest  = NULL;
-		size_t distance = 0xFFFFFFFF;
 		uintptr_t  addr = 0;
+		char * closest  = symbol_lookup(r->eip, &addr);
 
 		if (modules_get_symbols()) {
-			list_t * hash_keys = hashmap_keys(modules_get_symbols());
-			foreach(_key, hash_keys) {
-				char * key = (char *)_key->value;
-				uintptr_t a = (uintptr_t)hashmap_get(modules_get_symbols(), key);
-
-				if (!a) continue;
-
-				size_t d;
-				if (a <= r->eip) {
-					d = r->eip - a;
-					if (d < distance) {
-						closest = key;
-						distance = d;
-						addr = a;
-					}
-				}
-			}
-			free(hash_keys);
-
 			debug_print(ERROR, "\033[1;31mClosest symbol to faulting address:\033[0m %s [0x%x]", closest, addr);
 
-			hash_keys = hashmap_keys(modules_get_list());
+			list_t * hash_keys = hashmap_keys(modules_get_list());
 			foreach(_key, hash_keys) {
 				char * key = (char *)_key->value;
 				module_data_t * m = (module_data_t *)hashmap_get(modules_get_list(), key);
@@ -522,6 +518,11 @@ page_fault(
 
 #endif
 
+	if (!(r->err_code & 0x4)) {
+		/* The kernel faulted on the process' behalf; a handler can't fix that */
+		kexit(((128 + SIGSEGV) << 8) | SIGSEGV);
+	}
+
 	send_signal(current_process->id, SIGSEGV, 1);
 }
 
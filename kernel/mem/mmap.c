@@ -0,0 +1,534 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Memory Mappings
+ *
+ * Each page directory keeps the regions mmap() has handed out in a
+ * list sorted by address. Nothing is backed when a region is created;
+ * the page fault handler finds the region and fills in the page, with
+ * zeros or from the file. MAP_PRIVATE pages belong to the directory
+ * like any other user page (and are copied by fork()), while MAP_SHARED
+ * pages belong to a vm_object_t shared by every mapping of the file and
+ * are only linked into the page tables. Files in the page cache are
+ * read through it: shared mappings map the cached pages themselves,
+ * private ones start from a copy of them.
+ */
+#include <kernel/system.h>
+#include <kernel/process.h>
+#include <kernel/logging.h>
+#include <kernel/mem.h>
+#include <kernel/mmap.h>
+#include <kernel/pagecache.h>
+
+#include <sys/mman.h>
+
+#define PAGE_SIZE 0x1000
+
+/* Objects for MAP_SHARED files, so that every mapping of a file finds the same pages */
+static list_t * shared_files = NULL;
+
+/* Objects and Frames */
+
+static uintptr_t frame_alloc(void) {
+	page_t tmp = {0};
+	alloc_frame(&tmp, 0, 0);
+	return tmp.frame;
+}
+
+static vm_object_t * object_create(fs_node_t * file) {
+	vm_object_t * object = malloc(sizeof(vm_object_t));
+	object->refcount = 1;
+	object->file = file ? clone_fs(file) : NULL;
+	object->pages = hashmap_create_int(16);
+	object->cached = (file && file->readpage) ? hashmap_create_int(16) : NULL;
+	return object;
+}
+
+static vm_object_t * object_for_file(fs_node_t * file) {
+	if (!shared_files) {
+		shared_files = list_create();
+	}
+
+	foreach(node, shared_files) {
+		vm_object_t * object = node->value;
+		if (object->file->device == file->device && object->file->inode == file->inode) {
+			object->refcount++;
+			return object;
+		}
+	}
+
+	vm_object_t * object = object_create(file);
+	list_insert(shared_files, object);
+	return object;
+}
+
+static void object_release(vm_object_t * object) {
+	object->refcount--;
+	if (object->refcount > 0) return;
+
+	if (object->file) {
+		node_t * node = list_find(shared_files, object);
+		if (node) {
+			list_delete(shared_files, node);
+			free(node);
+		}
+	}
+
+	if (object->cached) {
+		/* Dirty pages were marked as mappings went away; write them back and let the cache have them */
+		list_t * pages = hashmap_values(object->cached);
+		foreach(node, pages) {
+			pagecache_writeback(object->file, node->value);
+			pagecache_put(node->value);
+		}
+		list_free(pages);
+		free(pages);
+		hashmap_free(object->cached);
+		free(object->cached);
+	}
+
+	if (object->file) {
+		close_fs(object->file);
+	}
+
+	list_t * frames = hashmap_values(object->pages);
+	foreach(node, frames) {
+		clear_frame((uintptr_t)node->value * PAGE_SIZE);
+	}
+	list_free(frames);
+	free(frames);
+
+	hashmap_free(object->pages);
+	free(object->pages);
+	free(object);
+}
+
+/* Frame behind a page of an object, if it has been filled in */
+static uintptr_t object_frame(vm_object_t * object, uint32_t index) {
+	if (object->cached) {
+		cached_page_t * page = hashmap_get(object->cached, (void *)index);
+		if (page) return pagecache_frame(page);
+	}
+	return (uintptr_t)hashmap_get(object->pages, (void *)index);
+}
+
+/*
+ * Files outside the page cache are read and written through a page of
+ * kernel heap, which is mapped in every directory, so this works
+ * whichever directory the frame belongs to.
+ */
+static void * file_page_read(fs_node_t * file, uint32_t offset) {
+	uint8_t * data = valloc(PAGE_SIZE);
+	memset(data, 0, PAGE_SIZE);
+	if (offset < file->length) {
+		uint32_t size = file->length - offset;
+		if (size > PAGE_SIZE) size = PAGE_SIZE;
+		read_fs(file, offset, size, data);
+	}
+	return data;
+}
+
+static void file_page_write(fs_node_t * file, uint32_t offset, uintptr_t frame) {
+	/* Pages past the end of the file stay in memory; mappings don't grow files */
+	if (offset >= file->length) return;
+	uint32_t size = file->length - offset;
+	if (size > PAGE_SIZE) size = PAGE_SIZE;
+
+	uint8_t * data = valloc(PAGE_SIZE);
+	copy_page_physical(frame * PAGE_SIZE, map_to_physical((uintptr_t)data));
+	write_fs(file, offset, size, data);
+	free(data);
+}
+
+/* Areas */
+
+static vm_area_t * area_copy(vm_area_t * area) {
+	vm_area_t * copy = malloc(sizeof(vm_area_t));
+	memcpy(copy, area, sizeof(vm_area_t));
+	if (copy->file) clone_fs(copy->file);
+	if (copy->object) copy->object->refcount++;
+	return copy;
+}
+
+static void area_free(vm_area_t * area) {
+	if (area->object) object_release(area->object);
+	if (area->file) close_fs(area->file);
+	free(area);
+}
+
+static vm_area_t * area_find(page_directory_t * dir, uintptr_t address) {
+	if (!dir->mappings) return NULL;
+	foreach(node, dir->mappings) {
+		vm_area_t * area = node->value;
+		if (address < area->start) return NULL;
+		if (address < area->end) return area;
+	}
+	return NULL;
+}
+
+static void area_insert(page_directory_t * dir, vm_area_t * area) {
+	if (!dir->mappings) {
+		dir->mappings = list_create();
+	}
+	foreach(node, dir->mappings) {
+		vm_area_t * other = node->value;
+		if (other->start >= area->end) {
+			list_insert_before(dir->mappings, node, area);
+			return;
+		}
+	}
+	list_insert(dir->mappings, area);
+}
+
+/* Cut an area in two at a page boundary inside it; the second half goes in a new node after it */
+static void area_split(list_t * list, node_t * node, uintptr_t at) {
+	vm_area_t * area = node->value;
+	vm_area_t * tail = area_copy(area);
+	tail->offset += at - area->start;
+	tail->start = at;
+	area->end = at;
+	list_insert_after(list, node, tail);
+}
+
+static int in_user_range(uintptr_t addr, size_t length) {
+	return addr >= USER_MAP_START && addr < USER_STACK_BOTTOM && length <= USER_STACK_BOTTOM - addr;
+}
+
+/* Whether nothing at all is mapped in [start, end), by us or otherwise */
+static int range_free(page_directory_t * dir, uintptr_t start, uintptr_t end) {
+	if (dir->mappings) {
+		foreach(node, dir->mappings) {
+			vm_area_t * area = node->value;
+			if (area->start >= end) break;
+			if (area->end > start) return 0;
+		}
+	}
+	for (uintptr_t address = start; address < end; address += PAGE_SIZE) {
+		page_t * page = get_page(address, 0, dir);
+		if (page && page->frame) return 0;
+	}
+	return 1;
+}
+
+/* Highest gap of the given size in the mmap window, or 0 */
+static uintptr_t find_space(page_directory_t * dir, size_t length) {
+	if (length > MMAP_TOP - MMAP_BOTTOM) return 0;
+
+	uintptr_t top = MMAP_TOP;
+	if (dir->mappings) {
+		foreachr(node, dir->mappings) {
+			vm_area_t * area = node->value;
+			if (area->start >= top) continue;
+			if (area->end < top && top - area->end >= length && top - length >= MMAP_BOTTOM) {
+				return top - length;
+			}
+			top = area->start;
+			if (top < MMAP_BOTTOM + length) return 0;
+		}
+	}
+	if (top < MMAP_BOTTOM + length) return 0;
+	return top - length;
+}
+
+/*
+ * Take pages out of the page tables. Private frames are freed; shared
+ * ones belong to the area's object, and are written back to the file
+ * first if they were written to through this mapping.
+ */
+static void release_pages(page_directory_t * dir, vm_area_t * area, uintptr_t start, uintptr_t end) {
+	for (uintptr_t address = start; address < end; address += PAGE_SIZE) {
+		page_t * page = get_page(address, 0, dir);
+		if (!page || !page->frame) continue;
+		if (page->shared) {
+			if (area && area->object && area->file && page->dirty) {
+				uint32_t offset = area->offset + (address - area->start);
+				cached_page_t * cached = area->object->cached ? hashmap_get(area->object->cached, (void *)(offset / PAGE_SIZE)) : NULL;
+				if (cached) {
+					/* Written back when the object goes */
+					pagecache_set_dirty(cached);
+				} else {
+					file_page_write(area->file, offset, page->frame);
+				}
+			}
+		} else {
+			clear_frame(page->frame * PAGE_SIZE);
+			dir->user_pages--;
+		}
+		memset(page, 0, sizeof(page_t));
+		if (dir == current_directory) {
+			invalidate_tables_at(address);
+		}
+	}
+}
+
+static void unmap_range(page_directory_t * dir, uintptr_t start, uintptr_t end) {
+	if (!dir->mappings) return;
+
+	node_t * node = dir->mappings->head;
+	while (node) {
+		node_t * next = node->next;
+		vm_area_t * area = node->value;
+		if (area->start >= end) break;
+		if (area->end > start) {
+			uintptr_t from = start > area->start ? start : area->start;
+			uintptr_t to   = end < area->end ? end : area->end;
+			release_pages(dir, area, from, to);
+
+			if (from > area->start && to < area->end) {
+				/* A hole in the middle; the rest becomes an area of its own */
+				area_split(dir->mappings, node, to);
+				area->end = from;
+				break;
+			} else if (from > area->start) {
+				area->end = from;
+			} else if (to < area->end) {
+				area->offset += to - area->start;
+				area->start = to;
+			} else {
+				list_delete(dir->mappings, node);
+				free(node);
+				area_free(area);
+			}
+		}
+		node = next;
+	}
+}
+
+static void protect_pages(page_directory_t * dir, uintptr_t start, uintptr_t end, int prot) {
+	for (uintptr_t address = start; address < end; address += PAGE_SIZE) {
+		page_t * page = get_page(address, 0, dir);
+		if (!page || !page->frame) continue;
+		page->present = (prot != PROT_NONE);
+		page->rw      = (prot & PROT_WRITE) ? 1 : 0;
+		invalidate_tables_at(address);
+	}
+}
+
+static int file_writable(fs_node_t * file) {
+	return (file->open_flags & (O_WRONLY | O_RDWR)) != 0;
+}
+
+/* System Calls */
+
+uintptr_t mmap_map(uintptr_t addr, size_t length, int prot, int flags, fs_node_t * file, uint32_t offset) {
+	page_directory_t * dir = current_directory;
+	int type = flags & (MAP_SHARED | MAP_PRIVATE);
+
+	if (!length || (type != MAP_SHARED && type != MAP_PRIVATE)) return -EINVAL;
+	if (offset & 0xFFF) return -EINVAL;
+	if (length > USER_STACK_BOTTOM - USER_MAP_START) return -ENOMEM;
+	if (type == MAP_SHARED && file && (prot & PROT_WRITE) && !file_writable(file)) return -EACCES;
+
+	length = (length + 0xFFF) & ~0xFFF;
+
+	uintptr_t start;
+	if (flags & MAP_FIXED) {
+		if ((addr & 0xFFF) || !in_user_range(addr, length)) return -EINVAL;
+		start = addr;
+		/* Whatever was there goes, mapped by us or not */
+		unmap_range(dir, start, start + length);
+		release_pages(dir, NULL, start, start + length);
+		tlb_shootdown(dir);
+	} else if (addr && !(addr & 0xFFF) && in_user_range(addr, length) && range_free(dir, addr, addr + length)) {
+		start = addr;
+	} else {
+		start = find_space(dir, length);
+		if (!start) return -ENOMEM;
+	}
+
+	vm_area_t * area = malloc(sizeof(vm_area_t));
+	area->start  = start;
+	area->end    = start + length;
+	area->prot   = prot;
+	area->flags  = flags;
+	area->file   = file ? clone_fs(file) : NULL;
+	area->offset = file ? offset : 0;
+	area->object = NULL;
+	if (type == MAP_SHARED) {
+		area->object = file ? object_for_file(file) : object_create(NULL);
+	}
+	area_insert(dir, area);
+
+	return start;
+}
+
+int mmap_unmap(uintptr_t addr, size_t length) {
+	if ((addr & 0xFFF) || !length) return -EINVAL;
+	length = (length + 0xFFF) & ~0xFFF;
+	if (!in_user_range(addr, length)) return -EINVAL;
+
+	unmap_range(current_directory, addr, addr + length);
+	tlb_shootdown(current_directory);
+	return 0;
+}
+
+int mmap_protect(uintptr_t addr, size_t length, int prot) {
+	page_directory_t * dir = current_directory;
+	if ((addr & 0xFFF) || !length) return -EINVAL;
+	length = (length + 0xFFF) & ~0xFFF;
+	if (!in_user_range(addr, length)) return -EINVAL;
+	uintptr_t end = addr + length;
+
+	if (!dir->mappings) return -ENOMEM;
+
+	/* All of the range has to be mapped, and writable if asked */
+	uintptr_t covered = addr;
+	foreach(node, dir->mappings) {
+		vm_area_t * area = node->value;
+		if (area->end <= addr) continue;
+		if (area->start >= end) break;
+		if (area->start > covered) return -ENOMEM;
+		if (area->object && area->file && (prot & PROT_WRITE) && !file_writable(area->file)) return -EACCES;
+		covered = area->end;
+	}
+	if (covered < end) return -ENOMEM;
+
+	node_t * node = dir->mappings->head;
+	while (node) {
+		vm_area_t * area = node->value;
+		if (area->start >= end) break;
+		if (area->end > addr) {
+			if (area->start < addr) {
+				/* Leave the front alone and carry on with the rest */
+				area_split(dir->mappings, node, addr);
+				node = node->next;
+				continue;
+			}
+			if (area->end > end) {
+				area_split(dir->mappings, node, end);
+			}
+			area->prot = prot;
+			protect_pages(dir, area->start, area->end, prot);
+		}
+		node = node->next;
+	}
+
+	tlb_shootdown(dir);
+	return 0;
+}
+
+/* Page Faults */
+
+/*
+ * Called for every page fault; returns 1 if the address was in a
+ * mapping and the page has been filled in, 0 if the fault stands.
+ * May sleep while reading the file.
+ */
+int mmap_fault(uintptr_t address, uint32_t err_code) {
+	page_directory_t * dir = current_directory;
+	uintptr_t page_address = address & ~0xFFF;
+
+	vm_area_t * area = area_find(dir, page_address);
+	if (!area) return 0;
+	if (area->prot == PROT_NONE) return 0;
+	if ((err_code & 0x2) && !(area->prot & PROT_WRITE)) return 0;
+	if (err_code & 0x1) return 0; /* The page was there; this was a protection fault */
+
+	page_t * page = get_page(page_address, 1, dir);
+	if (page->frame) {
+		/* Another thread filled it while we were on our way here */
+		return 1;
+	}
+
+	uint32_t offset = area->offset + (page_address - area->start);
+	uint32_t index  = offset / PAGE_SIZE;
+	uintptr_t frame = 0;
+	if (area->object) {
+		frame = object_frame(area->object, index);
+	}
+
+	cached_page_t * cached = NULL;
+	void * data = NULL;
+	if (!frame && area->file) {
+		if (area->file->readpage) {
+			cached = pagecache_get(area->file, index);
+		}
+		if (!cached) {
+			data = file_page_read(area->file, offset);
+		}
+
+		/* The read can sleep, and the mapping may have changed meanwhile */
+		area = area_find(dir, page_address);
+		page = get_page(page_address, 1, dir);
+		if (!area || page->frame || area->offset + (page_address - area->start) != offset) {
+			/* Start over (or fail) with whatever is there now */
+			if (cached) pagecache_put(cached);
+			free(data);
+			return area != NULL;
+		}
+		if (area->object) {
+			frame = object_frame(area->object, index);
+		}
+	}
+
+	int zero = !frame && !data && !cached;
+	if (!frame) {
+		if (cached && area->object && area->object->cached) {
+			/* Map the cached page itself; the object keeps it pinned */
+			hashmap_set(area->object->cached, (void *)index, cached);
+			frame = pagecache_frame(cached);
+			cached = NULL;
+		} else {
+			frame = frame_alloc();
+			if (cached) {
+				copy_page_physical(pagecache_frame(cached) * PAGE_SIZE, frame * PAGE_SIZE);
+			} else if (data) {
+				copy_page_physical(map_to_physical((uintptr_t)data), frame * PAGE_SIZE);
+			}
+			if (area->object) {
+				hashmap_set(area->object->pages, (void *)index, (void *)frame);
+			}
+		}
+	}
+	if (cached) pagecache_put(cached);
+	free(data);
+
+	page->frame   = frame;
+	page->shared  = area->object ? 1 : 0;
+	page->user    = 1;
+	page->present = 1;
+	if (!area->object) {
+		dir->user_pages++;
+	}
+
+	if (zero) {
+		/* New anonymous memory: map it writable long enough to clear it */
+		page->rw = 1;
+		invalidate_tables_at(page_address);
+		memset((void *)page_address, 0, PAGE_SIZE);
+	}
+
+	page->rw = (area->prot & PROT_WRITE) ? 1 : 0;
+	invalidate_tables_at(page_address);
+	return 1;
+}
+
+/* Directories */
+
+/*
+ * fork(): the child gets its own copy of every area. Private pages
+ * that were already filled in are copied along with the page tables;
+ * shared ones are linked to the same frames.
+ */
+void mmap_clone(page_directory_t * dst, page_directory_t * src) {
+	if (!src->mappings) return;
+	dst->mappings = list_create();
+	foreach(node, src->mappings) {
+		list_insert(dst->mappings, area_copy(node->value));
+	}
+}
+
+/* exec() and exit(): drop every area, writing shared pages back */
+void mmap_release(page_directory_t * dir) {
+	if (!dir->mappings) return;
+	foreach(node, dir->mappings) {
+		vm_area_t * area = node->value;
+		release_pages(dir, area, area->start, area->end);
+		area_free(area);
+	}
+	list_free(dir->mappings);
+	free(dir->mappings);
+	dir->mappings = NULL;
+}
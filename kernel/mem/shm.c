@@ -126,13 +126,16 @@ static int release_chunk (shm_chunk_t * chunk) {
 			debug_print(INFO, "Freeing chunk with name %s", chunk->parent->name);
 #endif
 
-			/* First, free the frames used by this chunk */
-			for (uint32_t i = 0; i < chunk->num_frames; i++) {
-				clear_frame(chunk->frames[i] * 0x1000);
+			/* Kernel-owned chunks have no parent; their owner frees the memory */
+			if (chunk->parent) {
+				/* First, free the frames used by this chunk */
+				for (uint32_t i = 0; i < chunk->num_frames; i++) {
+					clear_frame(chunk->frames[i] * 0x1000);
+				}
+				chunk->parent->chunk = NULL;
 			}
 
 			/* Then, get rid of the damn thing */
-			chunk->parent->chunk = NULL;
 			free(chunk->frames);
 			free(chunk);
 		}
@@ -169,6 +172,7 @@ static void * map_in (shm_chunk_t * chunk, process_t * proc) {
 	mapping->chunk = chunk;
 	mapping->num_vaddrs = chunk->num_frames;
 	mapping->vaddrs = malloc(sizeof(uintptr_t) * mapping->num_vaddrs);
+	proc->thread.page_directory->shm_pages += mapping->num_vaddrs;
 
 	debug_print(INFO, "want %d bytes, running through mappings...", mapping->num_vaddrs * 0x1000);
 	uintptr_t last_address = SHM_START;
@@ -196,7 +200,7 @@ static void * map_in (shm_chunk_t * chunk, process_t * proc) {
 			}
 		}
 		last_address = m->vaddrs[0] + m->num_vaddrs * 0x1000;
-		debug_print(INFO, "[0x%x:0x%x] %s", m->vaddrs[0], last_address, m->chunk->parent->name);
+		debug_print(INFO, "[0x%x:0x%x] %s", m->vaddrs[0], last_address, m->chunk->parent ? m->chunk->parent->name : "(kernel)");
 	}
 	if (proc->image.shm_heap > last_address) {
 		size_t gap = proc->image.shm_heap - last_address;
@@ -334,7 +338,9 @@ int shm_release (char * path) {
 
 		memset(page, 0, sizeof(page_t));
 	}
+	proc->thread.page_directory->shm_pages -= mapping->num_vaddrs;
 	invalidate_page_tables();
+	tlb_shootdown(proc->thread.page_directory);
 
 	/* Clean up */
 	release_chunk(chunk);
@@ -354,6 +360,14 @@ void shm_release_all (process_t * proc) {
 	node_t * node;
 	while ((node = list_pop(proc->shm_mappings)) != NULL) {
 		shm_mapping_t * mapping = node->value;
+		/* Don't leave the frames reachable (eg. across exec) once our reference is gone */
+		for (uint32_t i = 0; i < mapping->num_vaddrs; i++) {
+			page_t * page = get_page(mapping->vaddrs[i], 0, proc->thread.page_directory);
+			if (page) {
+				memset(page, 0, sizeof(page_t));
+			}
+		}
+		proc->thread.page_directory->shm_pages -= mapping->num_vaddrs;
 		release_chunk(mapping->chunk);
 		free(mapping);
 		free(node);
@@ -365,6 +379,99 @@ void shm_release_all (process_t * proc) {
 	proc->shm_mappings->length = 0;
 
 	spin_unlock(bsl);
+	if (proc == current_process) {
+		invalidate_page_tables();
+	}
+	tlb_shootdown(proc->thread.page_directory);
+}
+
+/* Kernel-owned chunks */
+
+/*
+ * Wrap a page-aligned kernel allocation in a chunk so it can be
+ * mapped into processes. The caller holds the initial reference
+ * and remains responsible for freeing the memory itself, after
+ * releasing that reference with shm_release_chunk.
+ */
+shm_chunk_t * shm_chunk_from_kernel(void * address, size_t size) {
+	assert(!((uintptr_t)address & 0xFFF) && "Kernel chunk is not page-aligned");
+
+	shm_chunk_t * chunk = malloc(sizeof(shm_chunk_t));
+	chunk->parent = NULL;
+	chunk->lock = 0;
+	chunk->ref_count = 1;
+
+	chunk->num_frames = (size / 0x1000) + ((size % 0x1000) ? 1 : 0);
+	chunk->frames = malloc(sizeof(uintptr_t) * chunk->num_frames);
+
+	for (uint32_t i = 0; i < chunk->num_frames; i++) {
+		page_t * page = get_page((uintptr_t)address + i * 0x1000, 0, kernel_directory);
+		assert(page && page->frame && "Kernel chunk is not backed");
+		chunk->frames[i] = page->frame;
+	}
+
+	return chunk;
+}
+
+void * shm_map_chunk(shm_chunk_t * chunk, process_t * proc) {
+	spin_lock(bsl);
+
+	if (proc->group != 0) {
+		proc = process_from_pid(proc->group);
+	}
+
+	chunk->ref_count++;
+	void * vshm_start = map_in(chunk, proc);
+
+	spin_unlock(bsl);
+	invalidate_page_tables();
+
+	return vshm_start;
 }
 
+int shm_unmap_chunk(shm_chunk_t * chunk, process_t * proc) {
+	spin_lock(bsl);
+
+	if (proc->group != 0) {
+		proc = process_from_pid(proc->group);
+	}
+
+	node_t * node = NULL;
+	if (proc) {
+		foreach (n, proc->shm_mappings) {
+			shm_mapping_t * m = (shm_mapping_t *)n->value;
+			if (m->chunk == chunk) {
+				node = n;
+				break;
+			}
+		}
+	}
+	if (node == NULL) {
+		spin_unlock(bsl);
+		return 1;
+	}
+
+	shm_mapping_t * mapping = (shm_mapping_t *)node->value;
+	for (uint32_t i = 0; i < mapping->num_vaddrs; i++) {
+		page_t * page = get_page(mapping->vaddrs[i], 0, proc->thread.page_directory);
+		assert(page && "Shared memory mapping was invalid!");
+		memset(page, 0, sizeof(page_t));
+	}
+	proc->thread.page_directory->shm_pages -= mapping->num_vaddrs;
+	invalidate_page_tables();
+	tlb_shootdown(proc->thread.page_directory);
+
+	release_chunk(chunk);
+	list_delete(proc->shm_mappings, node);
+	free(node);
+	free(mapping);
 
+	spin_unlock(bsl);
+	return 0;
+}
+
+void shm_release_chunk(shm_chunk_t * chunk) {
+	spin_lock(bsl);
+	release_chunk(chunk);
+	spin_unlock(bsl);
+}
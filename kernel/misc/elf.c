@@ -80,8 +80,14 @@ int exec_elf(char * path, fs_node_t * file, int argc, char ** argv, char ** env,
 	current_process->image.entry = base_addr;
 	current_process->image.size  = end_addr - base_addr;
 
-	release_directory_for_exec(current_directory);
+	if (current_process->vfork_parent) {
+		/* The parent still needs that memory; load into a directory of our own */
+		vfork_exec();
+	} else {
+		release_directory_for_exec(current_directory);
+	}
 	invalidate_page_tables();
+	tlb_shootdown(current_directory);
 
 
 	for (uintptr_t x = 0; x < (uint32_t)header.e_phentsize * header.e_phnum; x += header.e_phentsize) {
@@ -93,7 +99,7 @@ int exec_elf(char * path, fs_node_t * file, int argc, char ** argv, char ** env,
 			/* TODO Upper bounds */
 			for (uintptr_t i = phdr.p_vaddr; i < phdr.p_vaddr + phdr.p_memsz; i += 0x1000) {
 				/* This doesn't care if we already allocated this page */
-				alloc_frame(get_page(i, 1, current_directory), 0, 1);
+				alloc_user_frame(i, current_directory);
 				invalidate_tables_at(i);
 			}
 			IRQ_RES;
@@ -110,7 +116,7 @@ int exec_elf(char * path, fs_node_t * file, int argc, char ** argv, char ** env,
 	close_fs(file);
 
 	for (uintptr_t stack_pointer = USER_STACK_BOTTOM; stack_pointer < USER_STACK_TOP; stack_pointer += 0x1000) {
-		alloc_frame(get_page(stack_pointer, 1, current_directory), 0, 1);
+		alloc_user_frame(stack_pointer, current_directory);
 		invalidate_tables_at(stack_pointer);
 	}
 
@@ -129,7 +135,7 @@ int exec_elf(char * path, fs_node_t * file, int argc, char ** argv, char ** env,
 
 	uintptr_t heap = current_process->image.entry + current_process->image.size;
 	while (heap & 0xFFF) heap++;
-	alloc_frame(get_page(heap, 1, current_directory), 0, 1);
+	alloc_user_frame(heap, current_directory);
 	invalidate_tables_at(heap);
 	char ** argv_ = (char **)heap;
 	heap += sizeof(char *) * (argc + 1);
@@ -141,7 +147,7 @@ int exec_elf(char * path, fs_node_t * file, int argc, char ** argv, char ** env,
 	for (int i = 0; i < argc; ++i) {
 		size_t size = strlen(argv[i]) * sizeof(char) + 1;
 		for (uintptr_t x = heap; x < heap + size + 0x1000; x += 0x1000) {
-			alloc_frame(get_page(x, 1, current_directory), 0, 1);
+			alloc_user_frame(x, current_directory);
 		}
 		invalidate_tables_at(heap);
 		argv_[i] = (char *)heap;
@@ -154,7 +160,7 @@ int exec_elf(char * path, fs_node_t * file, int argc, char ** argv, char ** env,
 	for (int i = 0; i < envc; ++i) {
 		size_t size = strlen(env[i]) * sizeof(char) + 1;
 		for (uintptr_t x = heap; x < heap + size + 0x1000; x += 0x1000) {
-			alloc_frame(get_page(x, 1, current_directory), 0, 1);
+			alloc_user_frame(x, current_directory);
 		}
 		invalidate_tables_at(heap);
 		env_[i] = (char *)heap;
@@ -167,7 +173,7 @@ int exec_elf(char * path, fs_node_t * file, int argc, char ** argv, char ** env,
 
 	current_process->image.heap        = heap; /* heap end */
 	current_process->image.heap_actual = heap + (0x1000 - heap % 0x1000);
-	alloc_frame(get_page(current_process->image.heap_actual, 1, current_directory), 0, 1);
+	alloc_user_frame(current_process->image.heap_actual, current_directory);
 	invalidate_tables_at(current_process->image.heap_actual);
 	current_process->image.user_stack  = USER_STACK_TOP;
 
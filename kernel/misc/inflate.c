@@ -0,0 +1,345 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * DEFLATE decompressor
+ *
+ * One-shot decoding of a whole stream into a caller-provided
+ * buffer, as used for compressed filesystem blocks. Huffman codes
+ * are decoded through a table indexed by the next few input bits,
+ * with a bit-at-a-time walk of the canonical code for the rare
+ * longer codes.
+ */
+#include <kernel/system.h>
+#include <kernel/inflate.h>
+
+#define MAX_BITS  15
+#define MAX_LCODES 286
+#define MAX_DCODES 30
+#define FIXED_LCODES 288
+#define FAST_BITS 9
+
+struct huffman {
+	uint16_t count[MAX_BITS + 1];
+	uint16_t symbol[FIXED_LCODES];
+	uint16_t fast[1 << FAST_BITS]; /* (length << 12) | symbol, or 0 for longer codes */
+};
+
+typedef struct {
+	const uint8_t * in;
+	size_t in_len;
+	size_t in_pos;
+	uint32_t bitbuf;
+	int bitcnt;
+	int error;
+
+	uint8_t * out;
+	size_t out_len;
+	size_t out_pos;
+
+	struct huffman lencode;
+	struct huffman distcode;
+} inflate_t;
+
+static const uint16_t length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577};
+static const uint8_t dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static struct huffman fixed_lencode;
+static struct huffman fixed_distcode;
+static int fixed_ready = 0;
+
+static void refill(inflate_t * s) {
+	while (s->bitcnt <= 24 && s->in_pos < s->in_len) {
+		s->bitbuf |= (uint32_t)s->in[s->in_pos++] << s->bitcnt;
+		s->bitcnt += 8;
+	}
+}
+
+/* Running out of input sets the error flag; callers check it per symbol */
+static uint32_t bits(inflate_t * s, int need) {
+	if (s->bitcnt < need) {
+		refill(s);
+		if (s->bitcnt < need) {
+			s->error = 1;
+			return 0;
+		}
+	}
+	uint32_t val = s->bitbuf & ((1U << need) - 1);
+	s->bitbuf >>= need;
+	s->bitcnt -= need;
+	return val;
+}
+
+/*
+ * Build the decoding tables for a canonical code from its lengths.
+ * Returns 0 for a complete code, a positive value for an incomplete
+ * one and a negative value if the lengths are over-subscribed.
+ */
+static int construct(struct huffman * h, const uint8_t * length, int n) {
+	uint16_t offs[MAX_BITS + 1];
+
+	memset(h->count, 0, sizeof(h->count));
+	for (int sym = 0; sym < n; ++sym) {
+		h->count[length[sym]]++;
+	}
+
+	memset(h->fast, 0, sizeof(h->fast));
+	if (h->count[0] == n) return 0;
+
+	int left = 1;
+	for (int len = 1; len <= MAX_BITS; ++len) {
+		left <<= 1;
+		left -= h->count[len];
+		if (left < 0) return left;
+	}
+
+	offs[1] = 0;
+	for (int len = 1; len < MAX_BITS; ++len) {
+		offs[len + 1] = offs[len] + h->count[len];
+	}
+	for (int sym = 0; sym < n; ++sym) {
+		if (length[sym]) h->symbol[offs[length[sym]]++] = sym;
+	}
+
+	/* Codes are sent starting from their most significant bit, so index the table by the reversed code */
+	int code = 0, index = 0;
+	for (int len = 1; len <= FAST_BITS; ++len) {
+		for (int i = 0; i < h->count[len]; ++i, ++code, ++index) {
+			int rev = 0;
+			for (int b = 0; b < len; ++b) {
+				if (code & (1 << b)) rev |= 1 << (len - 1 - b);
+			}
+			for (int r = rev; r < (1 << FAST_BITS); r += 1 << len) {
+				h->fast[r] = (len << 12) | h->symbol[index];
+			}
+		}
+		code <<= 1;
+	}
+
+	return left;
+}
+
+static int decode(inflate_t * s, struct huffman * h) {
+	refill(s);
+	uint16_t entry = h->fast[s->bitbuf & ((1 << FAST_BITS) - 1)];
+	if (entry) {
+		int len = entry >> 12;
+		if (len > s->bitcnt) {
+			s->error = 1;
+			return -1;
+		}
+		s->bitbuf >>= len;
+		s->bitcnt -= len;
+		return entry & 0xFFF;
+	}
+
+	int code = 0, first = 0, index = 0;
+	for (int len = 1; len <= MAX_BITS; ++len) {
+		code |= bits(s, 1);
+		int count = h->count[len];
+		if (code - count < first) {
+			return h->symbol[index + (code - first)];
+		}
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+
+	s->error = 1;
+	return -1;
+}
+
+static int stored(inflate_t * s) {
+	/* Discard the rest of the current byte; anything else buffered is whole bytes */
+	bits(s, s->bitcnt & 7);
+
+	uint8_t header[4];
+	for (int i = 0; i < 4; ++i) {
+		header[i] = bits(s, 8);
+	}
+	if (s->error) return -1;
+
+	uint32_t len  = header[0] | (header[1] << 8);
+	uint32_t nlen = header[2] | (header[3] << 8);
+	if (len != (~nlen & 0xFFFF)) return -1;
+	if (s->out_pos + len > s->out_len) return -1;
+
+	/* Drain bytes still sitting in the bit buffer, then copy directly */
+	while (len && s->bitcnt) {
+		s->out[s->out_pos++] = bits(s, 8);
+		len--;
+	}
+	if (s->in_pos + len > s->in_len) return -1;
+	memcpy(s->out + s->out_pos, s->in + s->in_pos, len);
+	s->in_pos  += len;
+	s->out_pos += len;
+	return 0;
+}
+
+static int codes(inflate_t * s, struct huffman * lencode, struct huffman * distcode) {
+	while (1) {
+		int symbol = decode(s, lencode);
+		if (s->error || symbol < 0) return -1;
+
+		if (symbol < 256) {
+			if (s->out_pos == s->out_len) return -1;
+			s->out[s->out_pos++] = symbol;
+			continue;
+		}
+
+		if (symbol == 256) return 0;
+
+		symbol -= 257;
+		if (symbol >= 29) return -1;
+		uint32_t len = length_base[symbol] + bits(s, length_extra[symbol]);
+
+		symbol = decode(s, distcode);
+		if (s->error || symbol < 0 || symbol >= 30) return -1;
+		uint32_t dist = dist_base[symbol] + bits(s, dist_extra[symbol]);
+		if (s->error) return -1;
+
+		if (dist > s->out_pos) return -1;
+		if (s->out_pos + len > s->out_len) return -1;
+
+		uint8_t * to = s->out + s->out_pos;
+		uint8_t * from = to - dist;
+		s->out_pos += len;
+		/* Byte at a time; matches may overlap their own output */
+		while (len--) {
+			*to++ = *from++;
+		}
+	}
+}
+
+static void build_fixed(void) {
+	uint8_t lengths[FIXED_LCODES];
+	int sym = 0;
+
+	for (; sym < 144; ++sym) lengths[sym] = 8;
+	for (; sym < 256; ++sym) lengths[sym] = 9;
+	for (; sym < 280; ++sym) lengths[sym] = 7;
+	for (; sym < FIXED_LCODES; ++sym) lengths[sym] = 8;
+	construct(&fixed_lencode, lengths, FIXED_LCODES);
+
+	for (sym = 0; sym < MAX_DCODES; ++sym) lengths[sym] = 5;
+	construct(&fixed_distcode, lengths, MAX_DCODES);
+
+	fixed_ready = 1;
+}
+
+static int dynamic(inflate_t * s) {
+	static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+	uint8_t lengths[MAX_LCODES + MAX_DCODES];
+
+	int nlen  = bits(s, 5) + 257;
+	int ndist = bits(s, 5) + 1;
+	int ncode = bits(s, 4) + 4;
+	if (s->error || nlen > MAX_LCODES || ndist > MAX_DCODES) return -1;
+
+	int index;
+	for (index = 0; index < ncode; ++index) {
+		lengths[order[index]] = bits(s, 3);
+	}
+	for (; index < 19; ++index) {
+		lengths[order[index]] = 0;
+	}
+	if (s->error) return -1;
+
+	/* The code length code must be complete */
+	if (construct(&s->lencode, lengths, 19) != 0) return -1;
+
+	index = 0;
+	while (index < nlen + ndist) {
+		int symbol = decode(s, &s->lencode);
+		if (s->error || symbol < 0) return -1;
+
+		if (symbol < 16) {
+			lengths[index++] = symbol;
+			continue;
+		}
+
+		int len = 0;
+		int repeat;
+		if (symbol == 16) {
+			if (index == 0) return -1;
+			len = lengths[index - 1];
+			repeat = 3 + bits(s, 2);
+		} else if (symbol == 17) {
+			repeat = 3 + bits(s, 3);
+		} else {
+			repeat = 11 + bits(s, 7);
+		}
+		if (s->error || index + repeat > nlen + ndist) return -1;
+		while (repeat--) {
+			lengths[index++] = len;
+		}
+	}
+
+	/* A block without an end-of-block code can't be decoded */
+	if (lengths[256] == 0) return -1;
+
+	/* Incomplete codes are only allowed if they have a single length */
+	int err = construct(&s->lencode, lengths, nlen);
+	if (err < 0 || (err > 0 && nlen - s->lencode.count[0] != 1)) return -1;
+
+	err = construct(&s->distcode, lengths + nlen, ndist);
+	if (err < 0 || (err > 0 && ndist - s->distcode.count[0] != 1)) return -1;
+
+	return codes(s, &s->lencode, &s->distcode);
+}
+
+int inflate_raw(const uint8_t * in, size_t in_len, uint8_t * out, size_t out_len, size_t * written) {
+	if (!fixed_ready) build_fixed();
+
+	inflate_t * s = malloc(sizeof(inflate_t));
+	s->in      = in;
+	s->in_len  = in_len;
+	s->in_pos  = 0;
+	s->bitbuf  = 0;
+	s->bitcnt  = 0;
+	s->error   = 0;
+	s->out     = out;
+	s->out_len = out_len;
+	s->out_pos = 0;
+
+	int last, err;
+	do {
+		last = bits(s, 1);
+		int type = bits(s, 2);
+		if (s->error) {
+			err = -1;
+			break;
+		}
+		switch (type) {
+			case 0:
+				err = stored(s);
+				break;
+			case 1:
+				err = codes(s, &fixed_lencode, &fixed_distcode);
+				break;
+			case 2:
+				err = dynamic(s);
+				break;
+			default:
+				err = -1;
+				break;
+		}
+	} while (!last && !err);
+
+	if (written) *written = s->out_pos;
+	free(s);
+	return err;
+}
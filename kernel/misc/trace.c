@@ -0,0 +1,115 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Kernel Trace Buffer
+ *
+ * A fixed ring of event records filled by the static tracepoints
+ * (syscalls, context switches, page faults, IRQs, block I/O) and
+ * by the timer, which samples the interrupted EIP. Tracing is off
+ * until enabled with a system function; /proc/trace exposes the
+ * ring to userspace, oldest record first.
+ */
+#include <kernel/system.h>
+#include <kernel/process.h>
+#include <kernel/trace.h>
+
+#define TRACE_RECORDS 4096 /* must be a power of two */
+
+volatile uint32_t trace_mask = 0;
+volatile uint32_t trace_switches = 0;
+
+static trace_record_t trace_buffer[TRACE_RECORDS];
+static uint32_t trace_head = 0; /* records written since the last reset */
+static uint64_t trace_start_tsc = 0;
+static unsigned long trace_start_ms = 0;
+
+static unsigned long trace_now_ms(void) {
+	return timer_ticks * 1000 + timer_subticks;
+}
+
+/*
+ * Tracepoints can fire from interrupt handlers, so a record is
+ * filled with interrupts held off rather than under a lock.
+ */
+void trace_record(uint16_t type, uint32_t arg, uint32_t arg2, uint32_t duration) {
+	uint32_t flags;
+	asm volatile ("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+
+	trace_record_t * rec = &trace_buffer[trace_head & (TRACE_RECORDS - 1)];
+	trace_head++;
+
+	rec->tsc      = trace_tsc();
+	rec->type     = type;
+	rec->pid      = current_process ? current_process->id : 0;
+	rec->arg      = arg;
+	rec->arg2     = arg2;
+	rec->duration = duration;
+
+	asm volatile ("push %0\n\tpopf" : : "r"(flags) : "memory", "cc");
+}
+
+uint32_t trace_control(uint32_t mask, int reset) {
+	uint32_t old = trace_mask;
+
+	if (reset || !trace_start_tsc) {
+		trace_mask = 0;
+		trace_head = 0;
+		trace_start_tsc = trace_tsc();
+		trace_start_ms  = trace_now_ms();
+	}
+
+	trace_mask = mask & TRACE_MASK_ALL;
+	return old;
+}
+
+/*
+ * Copy a window of the header-plus-records view of the ring.
+ * The view is only stable while tracing is stopped; kprof stops
+ * tracing before it reads.
+ */
+uint32_t trace_snapshot(uint32_t offset, uint32_t size, uint8_t * buffer) {
+	uint32_t head  = trace_head;
+	uint32_t count = head < TRACE_RECORDS ? head : TRACE_RECORDS;
+	uint32_t first = head - count;
+
+	trace_header_t header = {
+		.magic       = TRACE_MAGIC,
+		.record_size = sizeof(trace_record_t),
+		.count       = count,
+		.dropped     = first,
+		.mask        = trace_mask,
+		.tsc_per_ms  = 0,
+	};
+
+	unsigned long ms = trace_now_ms() - trace_start_ms;
+	if (trace_start_tsc && ms) {
+		header.tsc_per_ms = (uint32_t)((trace_tsc() - trace_start_tsc) / ms);
+	}
+
+	uint32_t total = sizeof(trace_header_t) + count * sizeof(trace_record_t);
+	if (offset >= total) return 0;
+	if (size > total - offset) size = total - offset;
+
+	uint32_t written = 0;
+	if (offset < sizeof(trace_header_t)) {
+		uint32_t n = sizeof(trace_header_t) - offset;
+		if (n > size) n = size;
+		memcpy(buffer, (uint8_t *)&header + offset, n);
+		written += n;
+	}
+
+	while (written < size) {
+		uint32_t pos = offset + written - sizeof(trace_header_t);
+		uint32_t index = pos / sizeof(trace_record_t);
+		uint32_t skip = pos % sizeof(trace_record_t);
+		uint32_t n = sizeof(trace_record_t) - skip;
+		if (n > size - written) n = size - written;
+		trace_record_t * rec = &trace_buffer[(first + index) & (TRACE_RECORDS - 1)];
+		memcpy(buffer + written, (uint8_t *)rec + skip, n);
+		written += n;
+	}
+
+	return written;
+}
@@ -3,7 +3,8 @@
  * of the NCSA / University of Illinois License - see LICENSE.md
  * Copyright (C) 2015 Dale Weiler
  *
- * Spin locks with waiters
+ * Spin locks with waiters, and non-yielding locks with
+ * interrupts disabled
  *
  */
 #include <kernel/system.h>
@@ -55,3 +56,31 @@ void spin_unlock(spin_lock_t lock) {
 			switch_task(1);
 	}
 }
+
+/*
+ * Locks that never yield, for code that can't be rescheduled: the
+ * kernel lock itself and anything taken outside of it. Interrupts
+ * stay disabled while the lock is held; the previous interrupt flag
+ * is handed back to spin_unlock_irqrestore.
+ */
+void spin_lock_irqsave(spin_lock_t lock, uint32_t * flags) {
+	uint32_t eflags;
+	asm volatile ("pushf\n\t"
+	              "pop %0\n\t"
+	              "cli"
+	              : "=r"(eflags) : : "memory");
+	*flags = eflags;
+
+	while (arch_atomic_swap(lock, 1)) {
+		while (lock[0]) {
+			smp_relax();
+		}
+	}
+}
+
+void spin_unlock_irqrestore(spin_lock_t lock, uint32_t flags) {
+	arch_atomic_store(lock, 0);
+	if (flags & (1 << 9)) {
+		asm volatile ("sti");
+	}
+}
@@ -0,0 +1,148 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Timing wheel
+ *
+ * Timers due in the next 256 milliseconds sit in the root wheel, one
+ * slot per millisecond. Later ones go in one of four coarser wheels
+ * of 64 slots, each slot covering 64 times as much as one in the
+ * wheel below it; when the root wheel wraps, the next slot of the
+ * first coarse wheel is spread back out over the finer wheels, and so
+ * on up (a "cascade"). Four levels cover the whole 32-bit millisecond
+ * clock, so nothing ever needs an overflow list.
+ *
+ * Arming a timer is a list append and cancelling one a list delete,
+ * and the timer interrupt only ever looks at one root slot, so the
+ * time spent with interrupts off no longer grows with the number of
+ * sleeping processes.
+ */
+#include <kernel/system.h>
+#include <kernel/ktimer.h>
+
+#define ROOT_BITS  8
+#define LEVEL_BITS 6
+#define LEVELS     4
+
+#define ROOT_SIZE  (1 << ROOT_BITS)
+#define LEVEL_SIZE (1 << LEVEL_BITS)
+#define ROOT_MASK  (ROOT_SIZE - 1)
+#define LEVEL_MASK (LEVEL_SIZE - 1)
+
+#define LEVEL_SHIFT(n)      (ROOT_BITS + (n) * LEVEL_BITS)
+#define LEVEL_INDEX(n, t)   (((t) >> LEVEL_SHIFT(n)) & LEVEL_MASK)
+
+/*
+ * Deadlines at least this far out are rounded up so that timers armed
+ * around the same time land in the same slot and fire on the same
+ * tick. The rounding is a power of two no larger than 1/64th of the
+ * wait, so a one second sleep may run up to 8ms long.
+ */
+#define COALESCE_MIN ROOT_SIZE
+
+static list_t root[ROOT_SIZE];
+static list_t levels[LEVELS][LEVEL_SIZE];
+static unsigned long wheel_clock = 0; /* The next millisecond to run */
+
+static spin_lock_t timer_lock = { 0 };
+
+static unsigned long coalesce(unsigned long expires) {
+	unsigned long delta = expires - wheel_clock;
+	if ((long)delta < COALESCE_MIN) return expires;
+
+	unsigned long slack = 1;
+	while (slack * 2 <= delta / 64) {
+		slack *= 2;
+	}
+	return (expires + slack - 1) & ~(slack - 1);
+}
+
+/* Called with timer_lock held */
+static void wheel_insert(ktimer_t * timer) {
+	unsigned long expires = timer->expires;
+	unsigned long delta = expires - wheel_clock;
+	list_t * slot;
+
+	if ((long)delta < 0) {
+		/* Already due; the next slot to run */
+		slot = &root[wheel_clock & ROOT_MASK];
+	} else if (delta < ROOT_SIZE) {
+		slot = &root[expires & ROOT_MASK];
+	} else {
+		int n = 0;
+		while (n < LEVELS - 1 && (delta >> LEVEL_SHIFT(n + 1))) {
+			n++;
+		}
+		slot = &levels[n][LEVEL_INDEX(n, expires)];
+	}
+
+	list_append(slot, &timer->link);
+}
+
+/* Spread a coarse slot over the wheels below it; returns its index */
+static int cascade(int n, int index) {
+	list_t * slot = &levels[n][index];
+	node_t * node;
+	while ((node = list_dequeue(slot))) {
+		wheel_insert(node->value);
+	}
+	return index;
+}
+
+void ktimer_add(ktimer_t * timer, unsigned long expires) {
+	uint32_t flags;
+	spin_lock_irqsave(timer_lock, &flags);
+	if (timer->link.owner) {
+		list_delete(timer->link.owner, &timer->link);
+	}
+	timer->link.value = timer;
+	timer->expires = coalesce(expires);
+	wheel_insert(timer);
+	spin_unlock_irqrestore(timer_lock, flags);
+}
+
+int ktimer_cancel(ktimer_t * timer) {
+	int armed = 0;
+	uint32_t flags;
+	spin_lock_irqsave(timer_lock, &flags);
+	if (timer->link.owner) {
+		list_delete(timer->link.owner, &timer->link);
+		armed = 1;
+	}
+	spin_unlock_irqrestore(timer_lock, flags);
+	return armed;
+}
+
+/*
+ * Run every millisecond up to and including `now`; usually just the
+ * one, but the clock occasionally steps by two to catch up with the
+ * RTC. Timers fire without the lock held, so they may arm or cancel
+ * timers themselves.
+ */
+void ktimer_run(unsigned long now) {
+	uint32_t flags;
+	spin_lock_irqsave(timer_lock, &flags);
+
+	while ((long)(now - wheel_clock) >= 0) {
+		int index = wheel_clock & ROOT_MASK;
+		if (!index) {
+			for (int n = 0; n < LEVELS; ++n) {
+				if (cascade(n, LEVEL_INDEX(n, wheel_clock))) break;
+			}
+		}
+
+		list_t * slot = &root[index];
+		wheel_clock++;
+
+		node_t * node;
+		while ((node = list_dequeue(slot))) {
+			ktimer_t * timer = node->value;
+			spin_unlock_irqrestore(timer_lock, flags);
+			timer->fire(timer);
+			spin_lock_irqsave(timer_lock, &flags);
+		}
+	}
+
+	spin_unlock_irqrestore(timer_lock, flags);
+}
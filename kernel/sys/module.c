@@ -25,6 +25,10 @@ typedef struct {
 	char name[];
 } kernel_symbol_t;
 
+/* Kernel and module symbols sorted by address, for symbolizing addresses */
+static symbol_entry_t * sorted_symbols = NULL;
+static size_t sorted_count = 0;
+
 /* Cannot use symboltable here because symbol_find is used during initialization
  * of IRQs and ISRs.
  */
@@ -69,6 +73,86 @@ _maybe_pack:
 	return 0;
 }
 
+static void symbols_sort(symbol_entry_t * list, size_t count) {
+	/* Shell sort; this only runs at boot and on module load */
+	static const size_t gaps[] = {1750, 701, 301, 132, 57, 23, 10, 4, 1};
+	for (size_t g = 0; g < sizeof(gaps) / sizeof(*gaps); ++g) {
+		size_t gap = gaps[g];
+		for (size_t i = gap; i < count; ++i) {
+			symbol_entry_t tmp = list[i];
+			size_t j = i;
+			while (j >= gap && list[j - gap].addr > tmp.addr) {
+				list[j] = list[j - gap];
+				j -= gap;
+			}
+			list[j] = tmp;
+		}
+	}
+}
+
+/*
+ * Merge a module's symbols into the sorted table. The names
+ * belong to the module's symbol hashmap, which is never freed.
+ */
+static void symbols_add(hashmap_t * symbols) {
+	list_t * hash_keys = hashmap_keys(symbols);
+	symbol_entry_t * added = malloc(sizeof(symbol_entry_t) * (hash_keys->length + 1));
+	size_t count = 0;
+	foreach(_key, hash_keys) {
+		char * key = (char *)_key->value;
+		uintptr_t addr = (uintptr_t)hashmap_get(symbols, key);
+		if (!addr) continue;
+		added[count].addr = addr;
+		added[count].name = key;
+		count++;
+	}
+	list_free(hash_keys);
+	free(hash_keys);
+
+	symbols_sort(added, count);
+
+	symbol_entry_t * merged = malloc(sizeof(symbol_entry_t) * (sorted_count + count));
+	size_t i = 0, j = 0, k = 0;
+	while (i < sorted_count && j < count) {
+		merged[k++] = (sorted_symbols[i].addr <= added[j].addr) ? sorted_symbols[i++] : added[j++];
+	}
+	while (i < sorted_count) merged[k++] = sorted_symbols[i++];
+	while (j < count) merged[k++] = added[j++];
+	free(added);
+
+	symbol_entry_t * old = sorted_symbols;
+	IRQ_OFF;
+	sorted_symbols = merged;
+	sorted_count = k;
+	IRQ_RES;
+	free(old);
+}
+
+/**
+ * Find the closest symbol at or below an address.
+ */
+char * symbol_lookup(uintptr_t addr, uintptr_t * base) {
+	if (!sorted_count || addr < sorted_symbols[0].addr) return NULL;
+
+	size_t lo = 0, hi = sorted_count;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (sorted_symbols[mid].addr <= addr) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (base) *base = sorted_symbols[lo].addr;
+	return sorted_symbols[lo].name;
+}
+
+symbol_entry_t * symbols_sorted(size_t * count) {
+	*count = sorted_count;
+	return sorted_symbols;
+}
+
 void * module_load_direct(void * blob, size_t length) {
 	Elf32_Header * target = (Elf32_Header *)blob;
 
@@ -294,6 +378,8 @@ void * module_load_direct(void * blob, size_t length) {
 		goto mod_load_error;
 	}
 
+	symbols_add(local_symbols);
+
 	mod_info->initialize();
 
 	debug_print(NOTICE, "Finished loading module %s", mod_info->name);
@@ -367,11 +453,24 @@ void modules_install(void) {
 
 	/* Load all of the kernel symbols into the symboltable */
 	kernel_symbol_t * k = (kernel_symbol_t *)&kernel_symbols_start;
+	size_t count = 0;
 
 	while ((uintptr_t)k < (uintptr_t)&kernel_symbols_end) {
 		hashmap_set(symboltable, k->name, (void *)k->addr);
 		k = (kernel_symbol_t *)((uintptr_t)k + sizeof(kernel_symbol_t) + strlen(k->name) + 1);
+		count++;
+	}
+
+	/* And into the sorted table, pointing at the names in the symbol blob */
+	sorted_symbols = malloc(sizeof(symbol_entry_t) * count);
+	k = (kernel_symbol_t *)&kernel_symbols_start;
+	while ((uintptr_t)k < (uintptr_t)&kernel_symbols_end) {
+		sorted_symbols[sorted_count].addr = k->addr;
+		sorted_symbols[sorted_count].name = k->name;
+		sorted_count++;
+		k = (kernel_symbol_t *)((uintptr_t)k + sizeof(kernel_symbol_t) + strlen(k->name) + 1);
 	}
+	symbols_sort(sorted_symbols, sorted_count);
 
 	/* Also add the kernel_symbol_start and kernel_symbol_end (these were excluded from the generator) */
 	hashmap_set(symboltable, "kernel_symbols_start", &kernel_symbols_start);
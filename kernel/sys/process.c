@@ -19,18 +19,24 @@
 
 #include <toaru/list.h>
 #include <toaru/tree.h>
+#include <toaru/hashmap.h>
+
+#include <poll.h>
 
 tree_t * process_tree;  /* Parent->Children tree */
 list_t * process_list;  /* Flat storage */
-list_t * process_queue; /* Ready queue */
-list_t * sleep_queue;
-volatile process_t * current_process = NULL;
-process_t * kernel_idle_task = NULL;
+static hashmap_t * process_table; /* pid -> process, for process_from_pid() */
+/* Ready queues are per-processor, see <kernel/smp.h> */
+/* Owner of sleep_node while in sleep_until(); the deadline is sleep_timer */
+static list_t timed_sleep;
 
 static spin_lock_t tree_lock = { 0 };
 static spin_lock_t process_queue_lock = { 0 };
 static spin_lock_t wait_lock_tmp = { 0 };
-static spin_lock_t sleep_lock = { 0 };
+
+/* awoken_index while process_wait_nodes() is still waiting, or timed out */
+#define FSWAIT_PENDING (-3)
+#define FSWAIT_TIMEOUT (-4)
 
 static bitset_t pid_set;
 
@@ -38,13 +44,7 @@ static bitset_t pid_set;
 char * default_name = "[unnamed]";
 
 int is_valid_process(process_t * process) {
-	foreach(lnode, process_list) {
-		if (lnode->value == process) {
-			return 1;
-		}
-	}
-
-	return 0;
+	return process && process_from_pid(process->id) == process;
 }
 
 /*
@@ -53,14 +53,20 @@ int is_valid_process(process_t * process) {
  */
 #define MAX_PID 32768
 
+/* Buckets in process_table; pids hash to themselves, so these are allocated in order */
+#define PROCESS_TABLE_SIZE 1024
+
 /*
  * Initialize the process tree and ready queue.
  */
 void initialize_process_tree(void) {
 	process_tree = tree_create();
 	process_list = list_create();
-	process_queue = list_create();
-	sleep_queue = list_create();
+	process_table = hashmap_create_int(PROCESS_TABLE_SIZE);
+
+	/* The bootstrap processor; the others are brought up by smp_install() */
+	cpus[0].ready_queue = list_create();
+	cpus[0].online = 1;
 
 	/* Start off with enough bits for 64 processes */
 	bitset_init(&pid_set, MAX_PID / 8);
@@ -112,29 +118,78 @@ void debug_print_process_tree(void) {
 	debug_print_process_tree_node(process_tree->root, 0);
 }
 
+/*
+ * Find the longest ready queue, for an idle processor to take work from.
+ */
+static list_t * busiest_queue(void) {
+	list_t * busiest = NULL;
+	for (int i = 0; i < cpu_count; ++i) {
+		if (!cpus[i].online) continue;
+		list_t * queue = cpus[i].ready_queue;
+		if (queue->length && (!busiest || queue->length > busiest->length)) {
+			busiest = queue;
+		}
+	}
+	return busiest;
+}
+
 /*
  * Retreive the next ready process.
  * XXX: POPs from the ready queue!
  *
+ * Takes from this processor's queue first, then from whichever
+ * processor has the most waiting.
+ *
  * @return A pointer to the next process in the queue.
  */
 process_t * next_ready_process(void) {
-	if (!process_available()) {
-		return kernel_idle_task;
+	list_t * queue = this_cpu()->ready_queue;
+	if (!queue->head) {
+		queue = busiest_queue();
+		if (!queue) {
+			return kernel_idle_task;
+		}
 	}
-	if (process_queue->head->owner != process_queue) {
-		debug_print(ERROR, "Erroneous process located in process queue: node 0x%x has owner 0x%x, but process_queue is 0x%x", process_queue->head, process_queue->head->owner, process_queue);
+	if (queue->head->owner != queue) {
+		debug_print(ERROR, "Erroneous process located in process queue: node 0x%x has owner 0x%x, but ready queue is 0x%x", queue->head, queue->head->owner, queue);
 
-		process_t * proc = process_queue->head->value;
+		process_t * proc = queue->head->value;
 
 		debug_print(ERROR, "PID associated with this node is %d", proc->id);
 	}
-	node_t * np = list_dequeue(process_queue);
+	node_t * np = list_dequeue(queue);
 	assert(np && "Ready queue is empty.");
 	process_t * next = np->value;
 	return next;
 }
 
+/*
+ * Pick a ready queue for a process. A preempted process stays where
+ * it is; a woken one goes to the processor it last ran on if that is
+ * idle, then to any idle processor, then to its last processor anyway
+ * so it finds its cache warm. Idle processors steal from busy ones in
+ * next_ready_process(), which evens things out.
+ */
+static cpu_t * choose_cpu(process_t * proc) {
+	if (proc == current_process) {
+		return this_cpu();
+	}
+	cpu_t * last = &cpus[proc->cpu];
+	if (!last->online) {
+		last = this_cpu();
+	}
+	if (last->process == last->idle_task && !last->ready_queue->length) {
+		return last;
+	}
+	for (int i = 0; i < cpu_count; ++i) {
+		cpu_t * cpu = &cpus[i];
+		if (cpu->online && cpu->process == cpu->idle_task && !cpu->ready_queue->length) {
+			return cpu;
+		}
+	}
+	return last;
+}
+
 /*
  * Reinsert a process into the ready queue.
  *
@@ -142,18 +197,9 @@ process_t * next_ready_process(void) {
  */
 void make_process_ready(process_t * proc) {
 	if (proc->sleep_node.owner != NULL) {
-		if (proc->sleep_node.owner == sleep_queue) {
-			/* XXX can't wake from timed sleep */
-			if (proc->timed_sleep_node) {
-				IRQ_OFF;
-				spin_lock(sleep_lock);
-				list_delete(sleep_queue, proc->timed_sleep_node);
-				spin_unlock(sleep_lock);
-				IRQ_RES;
-				proc->sleep_node.owner = NULL;
-				free(proc->timed_sleep_node->value);
-			}
-			/* Else: I have no idea what happened. */
+		if (proc->sleep_node.owner == &timed_sleep) {
+			ktimer_cancel(&proc->sleep_timer);
+			proc->sleep_node.owner = NULL;
 		} else {
 			proc->sleep_interrupted = 1;
 			spin_lock(wait_lock_tmp);
@@ -163,12 +209,21 @@ void make_process_ready(process_t * proc) {
 	}
 	if (proc->sched_node.owner) {
 		debug_print(WARNING, "Can't make process ready without removing from owner list: %d", proc->id);
-		debug_print(WARNING, "  (This is a bug) Current owner list is 0x%x (ready queue is 0x%x)", proc->sched_node.owner, process_queue);
+		debug_print(WARNING, "  (This is a bug) Current owner list is 0x%x (ready queue is 0x%x)", proc->sched_node.owner, this_cpu()->ready_queue);
 		return;
 	}
+	if (proc->running && proc != current_process) {
+		/* Already on another processor; have it reschedule so it notices new signals */
+		smp_reschedule(&cpus[proc->cpu]);
+		return;
+	}
+	cpu_t * cpu = choose_cpu(proc);
 	spin_lock(process_queue_lock);
-	list_append(process_queue, &proc->sched_node);
+	list_append(cpu->ready_queue, &proc->sched_node);
 	spin_unlock(process_queue_lock);
+	if (cpu != this_cpu() && cpu->process == cpu->idle_task) {
+		smp_reschedule(cpu);
+	}
 }
 
 
@@ -193,16 +248,26 @@ void delete_process(process_t * proc) {
 		return;
 	}
 
+	process_t * init = process_tree->root->value;
+
 	/* Remove the entry. */
 	spin_lock(tree_lock);
-	/* Reparent everyone below me to init */
+	/* Reparent everyone below me to init, along with any that already finished */
 	int has_children = entry->children->length;
 	tree_remove_reparent_root(process_tree, entry);
-	list_delete(process_list, list_find(process_list, proc));
+	node_t * zombie;
+	while ((zombie = list_dequeue(&proc->zombies))) {
+		list_append(&init->zombies, zombie);
+	}
+	if (proc->zombie_node.owner) {
+		list_delete(proc->zombie_node.owner, &proc->zombie_node);
+	}
+	list_delete(process_list, proc->list_entry);
+	free(proc->list_entry);
+	hashmap_remove(process_table, (void *)proc->id);
 	spin_unlock(tree_lock);
 
 	if (has_children) {
-		process_t * init = process_tree->root->value;
 		wakeup_queue(init->wait_queue);
 	}
 
@@ -214,6 +279,8 @@ void delete_process(process_t * proc) {
 
 static void _kidle(void) {
 	while (1) {
+		/* Let other processors into the kernel while we wait */
+		kernel_lock_release();
 		IRQ_ON;
 		PAUSE;
 	}
@@ -233,12 +300,12 @@ process_t * spawn_kidle(void) {
 	idle->thread.eip  = (uintptr_t)&_kidle;
 	idle->thread.esp  = idle->image.stack;
 	idle->thread.ebp  = idle->image.stack;
+	idle->thread.fpu_cpu = -1;
 
 	idle->started = 1;
 	idle->running = 1;
 	idle->wait_queue = list_create();
 	idle->shm_mappings = list_create();
-	idle->signal_queue = list_create();
 
 	gettimeofday(&idle->start, NULL);
 
@@ -270,6 +337,9 @@ process_t * spawn_init(void) {
 	init->mask    = 022;     /* umask */
 	init->group   = 0;       /* Task group 0 */
 	init->status  = 0;       /* Run status */
+	memset(&init->stats, 0x00, sizeof(init->stats));
+	init->thread.fpu_enabled = 0;
+	init->thread.fpu_cpu = -1;
 	init->fds = malloc(sizeof(fd_table_t));
 	init->fds->refs = 1;
 	init->fds->length   = 0;  /* Initialize the file descriptors */
@@ -297,8 +367,9 @@ process_t * spawn_init(void) {
 	init->running = 1;
 	init->wait_queue = list_create();
 	init->shm_mappings = list_create();
-	init->signal_queue = list_create();
-	init->signal_kstack = NULL; /* None yet initialized */
+	init->signals_pending = 0;
+	init->signals_blocked = 0;
+	init->syscall_restart = 0;
 
 	init->sched_node.prev = NULL;
 	init->sched_node.next = NULL;
@@ -308,7 +379,10 @@ process_t * spawn_init(void) {
 	init->sleep_node.next = NULL;
 	init->sleep_node.value = init;
 
-	init->timed_sleep_node = NULL;
+	memset(&init->sleep_timer, 0, sizeof(ktimer_t));
+	memset(&init->zombies, 0, sizeof(list_t));
+	memset(&init->zombie_node, 0, sizeof(node_t));
+	init->zombie_node.value = init;
 
 	init->is_tasklet = 0;
 
@@ -316,7 +390,8 @@ process_t * spawn_init(void) {
 
 	/* What the hey, let's also set the description on this one */
 	init->description = strdup("[init]");
-	list_insert(process_list, (void *)init);
+	init->list_entry = list_insert(process_list, (void *)init);
+	hashmap_set(process_table, (void *)init->id, init);
 
 	return init;
 }
@@ -359,6 +434,11 @@ void process_disown(process_t * proc) {
 	tree_break_off(process_tree, entry);
 	/* And insert it back elsewhere */
 	tree_node_insert_child_node(process_tree, process_tree->root, entry);
+	if (proc->zombie_node.owner) {
+		process_t * init = process_tree->root->value;
+		list_delete(proc->zombie_node.owner, &proc->zombie_node);
+		list_append(&init->zombies, &proc->zombie_node);
+	}
 	spin_unlock(tree_lock);
 }
 
@@ -392,8 +472,7 @@ process_t * spawn_process(volatile process_t * parent, int reuse_fds) {
 	proc->thread.esp = 0;
 	proc->thread.ebp = 0;
 	proc->thread.eip = 0;
-	proc->thread.fpu_enabled = 0;
-	memcpy((void*)proc->thread.fp_regs, (void*)parent->thread.fp_regs, 512);
+	fpu_fork(proc, (process_t *)parent);
 
 	/* Set the process image information from the parent */
 	proc->image.entry       = parent->image.entry;
@@ -441,8 +520,8 @@ process_t * spawn_process(volatile process_t * parent, int reuse_fds) {
 	memset(proc->signals.functions, 0x00, sizeof(uintptr_t) * NUMSIGNALS);
 	proc->wait_queue = list_create();
 	proc->shm_mappings = list_create();
-	proc->signal_queue = list_create();
-	proc->signal_kstack = NULL; /* None yet initialized */
+	proc->signals_pending = 0;
+	proc->signals_blocked = parent->signals_blocked;
 
 	proc->sched_node.prev = NULL;
 	proc->sched_node.next = NULL;
@@ -452,7 +531,8 @@ process_t * spawn_process(volatile process_t * parent, int reuse_fds) {
 	proc->sleep_node.next = NULL;
 	proc->sleep_node.value = proc;
 
-	proc->timed_sleep_node = NULL;
+	memset(&proc->sleep_timer, 0, sizeof(ktimer_t));
+	proc->zombie_node.value = proc;
 
 	proc->is_tasklet = 0;
 
@@ -465,30 +545,40 @@ process_t * spawn_process(volatile process_t * parent, int reuse_fds) {
 	proc->tree_entry = entry;
 	spin_lock(tree_lock);
 	tree_node_insert_child_node(process_tree, parent->tree_entry, entry);
-	list_insert(process_list, (void *)proc);
+	proc->list_entry = list_insert(process_list, (void *)proc);
+	hashmap_set(process_table, (void *)proc->id, proc);
 	spin_unlock(tree_lock);
 
 	/* Return the new process */
 	return proc;
 }
 
-uint8_t process_compare(void * proc_v, void * pid_v) {
-	pid_t pid = (*(pid_t *)pid_v);
-	process_t * proc = (process_t *)proc_v;
-
-	return (uint8_t)(proc->id == pid);
-}
-
 process_t * process_from_pid(pid_t pid) {
 	if (pid < 0) return NULL;
 
 	spin_lock(tree_lock);
-	tree_node_t * entry = tree_find(process_tree,&pid,process_compare);
+	process_t * proc = hashmap_get(process_table, (void *)pid);
 	spin_unlock(tree_lock);
-	if (entry) {
-		return (process_t *)entry->value;
+	return proc;
+}
+
+/*
+ * Queue a process that has just finished for its parent to reap, and
+ * return the parent so it can be woken.
+ */
+process_t * process_make_zombie(process_t * process) {
+	process_t * result = NULL;
+	spin_lock(tree_lock);
+
+	tree_node_t * entry = process->tree_entry;
+
+	if (entry->parent) {
+		result = entry->parent->value;
+		list_append(&result->zombies, &process->zombie_node);
 	}
-	return NULL;
+
+	spin_unlock(tree_lock);
+	return result;
 }
 
 process_t * process_get_parent(process_t * process) {
@@ -560,7 +650,7 @@ void set_process_environment(process_t * proc, page_directory_t * directory) {
  * @return 1 if there are processes available, 0 otherwise
  */
 uint8_t process_available(void) {
-	return (process_queue->head != NULL);
+	return (this_cpu()->ready_queue->head != NULL || busiest_queue() != NULL);
 }
 
 /*
@@ -657,40 +747,37 @@ int sleep_on(list_t * queue) {
 	return current_process->sleep_interrupted;
 }
 
+/*
+ * Sleep on a queue after checking the wait condition under `release`,
+ * taken with spin_lock_irqsave. The lock is only dropped once we are on
+ * the queue, so a wakeup that comes in after the check isn't lost.
+ */
+int sleep_on_unlocking(list_t * queue, spin_lock_t release, uint32_t flags) {
+	if (current_process->sleep_node.owner) {
+		spin_unlock_irqrestore(release, flags);
+		switch_task(0);
+		return 0;
+	}
+	current_process->sleep_interrupted = 0;
+	spin_lock(wait_lock_tmp);
+	list_append(queue, (node_t *)&current_process->sleep_node);
+	spin_unlock(wait_lock_tmp);
+	spin_unlock_irqrestore(release, flags);
+	switch_task(0);
+	return current_process->sleep_interrupted;
+}
+
 int process_is_ready(process_t * proc) {
 	return (proc->sched_node.owner != NULL);
 }
 
 
-void wakeup_sleepers(unsigned long seconds, unsigned long subseconds) {
-	IRQ_OFF;
-	spin_lock(sleep_lock);
-	if (sleep_queue->length) {
-		sleeper_t * proc = ((sleeper_t *)sleep_queue->head->value);
-		while (proc && (proc->end_tick < seconds || (proc->end_tick == seconds && proc->end_subtick <= subseconds))) {
-
-			if (proc->is_fswait) {
-				proc->is_fswait = -1;
-				process_alert_node(proc->process,proc);
-			} else {
-				process_t * process = proc->process;
-				process->sleep_node.owner = NULL;
-				process->timed_sleep_node = NULL;
-				if (!process_is_ready(process)) {
-					make_process_ready(process);
-				}
-			}
-			free(proc);
-			free(list_dequeue(sleep_queue));
-			if (sleep_queue->length) {
-				proc = ((sleeper_t *)sleep_queue->head->value);
-			} else {
-				break;
-			}
-		}
+static void sleep_timer_fire(ktimer_t * timer) {
+	process_t * process = timer->data;
+	process->sleep_node.owner = NULL;
+	if (!process_is_ready(process)) {
+		make_process_ready(process);
 	}
-	spin_unlock(sleep_lock);
-	IRQ_RES;
 }
 
 void sleep_until(process_t * process, unsigned long seconds, unsigned long subseconds) {
@@ -698,51 +785,28 @@ void sleep_until(process_t * process, unsigned long seconds, unsigned long subse
 		/* Can't sleep, sleeping already */
 		return;
 	}
-	process->sleep_node.owner = sleep_queue;
+	process->sleep_node.owner = &timed_sleep;
 
-	IRQ_OFF;
-	spin_lock(sleep_lock);
-	node_t * before = NULL;
-	foreach(node, sleep_queue) {
-		sleeper_t * candidate = ((sleeper_t *)node->value);
-		if (candidate->end_tick > seconds || (candidate->end_tick == seconds && candidate->end_subtick > subseconds)) {
-			break;
-		}
-		before = node;
-	}
-	sleeper_t * proc = malloc(sizeof(sleeper_t));
-	proc->process     = process;
-	proc->end_tick    = seconds;
-	proc->end_subtick = subseconds;
-	proc->is_fswait = 0;
-	process->timed_sleep_node = list_insert_after(sleep_queue, before, proc);
-	spin_unlock(sleep_lock);
-	IRQ_RES;
+	process->sleep_timer.fire = sleep_timer_fire;
+	process->sleep_timer.data = process;
+	ktimer_add(&process->sleep_timer, seconds * 1000 + subseconds);
 }
 
 void cleanup_process(process_t * proc, int retval) {
 	proc->status   = retval;
 	proc->finished = 1;
 
+	ktimer_cancel(&proc->sleep_timer);
+
 	list_free(proc->wait_queue);
 	free(proc->wait_queue);
-	list_free(proc->signal_queue);
-	free(proc->signal_queue);
 	free(proc->wd_name);
 
 
-	if (proc->node_waits) {
-		list_free(proc->node_waits);
-		free(proc->node_waits);
-		proc->node_waits = NULL;
-	}
 	debug_print(INFO, "Releasing shared memory for %d", proc->id);
 	shm_release_all(proc);
 	free(proc->shm_mappings);
 	debug_print(INFO, "Freeing more mems %d", proc->id);
-	if (proc->signal_kstack) {
-		free(proc->signal_kstack);
-	}
 
 	release_directory(proc->thread.page_directory);
 
@@ -796,6 +860,29 @@ static int wait_candidate(process_t * parent, int pid, int options, process_t *
 	return 0;
 }
 
+/*
+ * Whether `parent` has any children waitpid(pid) could return, finished
+ * or not. Only waiting on a process group needs to look at each child.
+ */
+static int has_wait_candidates(process_t * parent, int pid, int options) {
+	if (pid > 0) {
+		process_t * child = process_from_pid(pid);
+		return child && child->tree_entry && child->tree_entry->parent == parent->tree_entry &&
+			wait_candidate(parent, pid, options, child);
+	}
+
+	foreach(node, parent->tree_entry->children) {
+		if (!node->value) {
+			continue;
+		}
+		process_t * child = ((tree_node_t *)node->value)->value;
+		if (wait_candidate(parent, pid, options, child)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
 int waitpid(int pid, int * status, int options) {
 	process_t * proc = (process_t *)current_process;
 	if (proc->group) {
@@ -806,25 +893,17 @@ int waitpid(int pid, int * status, int options) {
 
 	do {
 		process_t * candidate = NULL;
-		int has_children = 0;
-
-		/* First, find out if there is anyone to reap */
-		foreach(node, proc->tree_entry->children) {
-			if (!node->value) {
-				continue;
-			}
-			process_t * child = ((tree_node_t *)node->value)->value;
 
+		/* First, find out if there is anyone to reap; only finished children are on this list */
+		foreach(node, &proc->zombies) {
+			process_t * child = node->value;
 			if (wait_candidate(proc, pid, options, child)) {
-				has_children = 1;
-				if (child->finished) {
-					candidate = child;
-					break;
-				}
+				candidate = child;
+				break;
 			}
 		}
 
-		if (!has_children) {
+		if (!candidate && !has_wait_candidates(proc, pid, options)) {
 			/* No valid children matching this description */
 			debug_print(INFO, "No children matching description.");
 			return -ECHILD;
@@ -852,116 +931,111 @@ int waitpid(int pid, int * status, int options) {
 	} while (1);
 }
 
+static int first_ready_node(fs_node_t * nodes[]) {
+	for (int index = 0; nodes[index]; ++index) {
+		int result = selectcheck_fs(nodes[index]);
+		if (result < 0) {
+			debug_print(NOTICE, "An invalid descriptor was specified: %d (0x%x) (pid=%d)", index, nodes[index], current_process->id);
+			return -1;
+		}
+		if (result == 0) {
+			return index;
+		}
+	}
+	return -2;
+}
+
+static void fswait_alert(fs_waiter_t * waiter, int events) {
+	process_awaken_from_fswait(waiter->owner, waiter->index);
+}
+
+static void fswait_timeout_fire(ktimer_t * timer) {
+	process_awaken_from_fswait(timer->data, FSWAIT_TIMEOUT);
+}
+
+/*
+ * Wait until one of a NULL-terminated list of nodes is readable.
+ * Returns its index, the number of nodes if the timeout passed, -2 if
+ * nothing was ready and the timeout was 0, or -1 for a bad node or
+ * a signal.
+ */
 int process_wait_nodes(process_t * process,fs_node_t * nodes[], int timeout) {
 	assert(!process->node_waits && "Tried to wait on nodes while already waiting on nodes.");
 
-	fs_node_t ** n = nodes;
-	int index = 0;
-	if (*n) {
-		do {
-			int result = selectcheck_fs(*n);
-			if (result < 0) {
-				debug_print(NOTICE, "An invalid descriptor was specified: %d (0x%x) (pid=%d)", index, *n, current_process->id);
-				return -1;
-			}
-			if (result == 0) {
-				return index;
-			}
-			n++;
-			index++;
-		} while (*n);
-	}
-
-	if (timeout == 0) {
-		return -2;
+	int result = first_ready_node(nodes);
+	if (result != -2 || timeout == 0) {
+		return result;
 	}
 
-	n = nodes;
+	int count = 0;
+	while (nodes[count]) count++;
 
-	process->node_waits = list_create();
-	if (*n) {
-		do {
-			if (selectwait_fs(*n, process) < 0) {
-				debug_print(NOTICE, "Bad selectwait? 0x%x", *n);
-			}
-			n++;
-		} while (*n);
-	}
+	fs_waiter_t * waits = malloc(sizeof(fs_waiter_t) * count);
+	memset(waits, 0x00, sizeof(fs_waiter_t) * count);
 
-	if (timeout > 0) {
-		debug_print(INFO, "fswait with a timeout of %d (pid=%d)", timeout, current_process->id);
-		unsigned long s, ss;
-		relative_time(0, timeout, &s, &ss);
+	process->awoken_index = FSWAIT_PENDING;
+	process->node_waits = waits;
 
-		IRQ_OFF;
-		spin_lock(sleep_lock);
-		node_t * before = NULL;
-		foreach(node, sleep_queue) {
-			sleeper_t * candidate = ((sleeper_t *)node->value);
-			if (candidate->end_tick > s || (candidate->end_tick == s && candidate->end_subtick > ss)) {
-				break;
-			}
-			before = node;
+	for (int i = 0; i < count; ++i) {
+		waits[i].events = POLLIN;
+		waits[i].alert  = fswait_alert;
+		waits[i].owner  = process;
+		waits[i].index  = i;
+		clone_fs(nodes[i]);
+		if (selectwait_fs(nodes[i], &waits[i]) < 0) {
+			debug_print(NOTICE, "Bad selectwait? 0x%x", nodes[i]);
 		}
-		sleeper_t * proc = malloc(sizeof(sleeper_t));
-		proc->process     = process;
-		proc->end_tick    = s;
-		proc->end_subtick = ss;
-		proc->is_fswait = 1;
-		list_insert(((process_t *)process)->node_waits, proc);
-		process->timeout_node = list_insert_after(sleep_queue, before, proc);
-		spin_unlock(sleep_lock);
-		IRQ_RES;
-	} else {
-		process->timeout_node = NULL;
 	}
 
-	process->awoken_index = -1;
-	/* Wait. */
-	switch_task(0);
+	/* Anything that became ready before we were registered */
+	result = first_ready_node(nodes);
+	if (result == -2) {
+		if (timeout > 0) {
+			debug_print(INFO, "fswait with a timeout of %d (pid=%d)", timeout, current_process->id);
+			process->sleep_timer.fire = fswait_timeout_fire;
+			process->sleep_timer.data = process;
+			ktimer_add(&process->sleep_timer, timer_now_ms() + timeout);
+		}
 
-	return process->awoken_index;
-}
+		/* Wait. An alert that already came in has queued us, so switch regardless */
+		do {
+			switch_task(0);
+		} while (process->awoken_index == FSWAIT_PENDING);
 
-int process_awaken_from_fswait(process_t * process, int index) {
-	process->awoken_index = index;
-	list_free(process->node_waits);
-	free(process->node_waits);
-	process->node_waits = NULL;
-	if (process->timeout_node && process->timeout_node->owner == sleep_queue) {
-		sleeper_t * proc = process->timeout_node->value;
-		if (proc->is_fswait != -1) {
-			list_delete(sleep_queue, process->timeout_node);
-			free(process->timeout_node->value);
-			free(process->timeout_node);
+		result = process->awoken_index;
+		if (result == FSWAIT_TIMEOUT) {
+			result = count;
+		}
+	} else {
+		/* Stop alerts from waking us; one that already did has queued us to run */
+		IRQ_OFF;
+		int woken = (process->awoken_index != FSWAIT_PENDING);
+		process->awoken_index = result;
+		IRQ_RES;
+		if (woken) {
+			switch_task(0);
 		}
 	}
-	process->timeout_node = NULL;
-	make_process_ready(process);
-	return 0;
-}
 
-int process_alert_node(process_t * process, void * value) {
+	ktimer_cancel(&process->sleep_timer);
 
-	if (!is_valid_process(process)) {
-		debug_print(WARNING, "Invalid process in alert from fswait.");
-		return 0;
+	/* Whichever node woke us, the others still have us queued */
+	for (int i = 0; i < count; ++i) {
+		fs_wait_remove(&waits[i]);
+		close_fs(nodes[i]);
 	}
+	process->node_waits = NULL;
+	free(waits);
 
+	return result;
+}
 
-
-	if (!process->node_waits) {
-		return 0; /* Possibly already returned. Wait for another call. */
-	}
-
-	int index = 0;
-	foreach(node, process->node_waits) {
-		if (value == node->value) {
-			return process_awaken_from_fswait(process, index);
-		}
-		index++;
+int process_awaken_from_fswait(process_t * process, int index) {
+	if (!process->node_waits || process->awoken_index != FSWAIT_PENDING) {
+		return 0; /* Already woken, or not waiting */
 	}
-
-	return -1;
+	process->awoken_index = index;
+	ktimer_cancel(&process->sleep_timer);
+	make_process_ready(process);
+	return 0;
 }
-
@@ -4,40 +4,31 @@
  * Copyright (C) 2012-2018 K. Lange
  *
  * Signal Handling
+ *
+ * Sending a signal sets its bit in the receiver's pending mask.
+ * Signals whose default action ends the process take effect as
+ * soon as the receiver next runs, wherever it is; the rest wait
+ * for it to return to userspace, where deliver_signals() pushes a
+ * frame holding the interrupted registers, signal mask and FPU
+ * state onto the user stack and sends it to the handler. The
+ * handler returns into a stub in the vDSO that calls sigreturn,
+ * which puts everything back from the frame.
  */
 
 #include <kernel/system.h>
 #include <kernel/signal.h>
 #include <kernel/logging.h>
-
-void enter_signal_handler(uintptr_t location, int signum, uintptr_t stack) {
-	IRQ_OFF;
-	asm volatile(
-			"mov %2, %%esp\n"
-			"pushl %1\n"           /*          argument count   */
-			"pushl $" STRSTR(SIGNAL_RETURN) "\n"
-			"mov $0x23, %%ax\n"    /* Segment selector */
-			"mov %%ax, %%ds\n"
-			"mov %%ax, %%es\n"
-			"mov %%ax, %%fs\n"
-			"mov %%ax, %%gs\n"
-			"mov %%esp, %%eax\n"   /* Stack -> EAX */
-			"pushl $0x23\n"        /* Segment selector again */
-			"pushl %%eax\n"
-			"pushf\n"              /* Push flags */
-			"popl %%eax\n"         /* Fix the Interrupt flag */
-			"orl  $0x200, %%eax\n"
-			"pushl %%eax\n"
-			"pushl $0x1B\n"
-			"pushl %0\n"           /* Push the entry point */
-			"iret\n"
-			: : "m"(location), "m"(signum), "r"(stack) : "%ax", "%esp", "%eax");
-
-	debug_print(CRITICAL, "Failed to jump to signal handler!");
-}
-
-static spin_lock_t sig_lock;
-static spin_lock_t sig_lock_b;
+#include <sys/vdso.h>
+
+/* What deliver_signals() leaves on the user stack */
+struct signal_frame {
+	uintptr_t return_address;    /* The sigreturn stub; the handler returns here */
+	int       signum;            /* The handler's argument */
+	struct regs registers;       /* Where the process was interrupted */
+	uint64_t  blocked;           /* Signal mask to go back to */
+	uint32_t  fpu_saved;         /* Whether fpu holds anything */
+	uint8_t   fpu[512];          /* FXSAVE image */
+};
 
 char isdeadly[] = {
 	0, /* 0? */
@@ -79,108 +70,141 @@ char isdeadly[] = {
 	0, /* SIGCAT     */
 };
 
-void handle_signal(process_t * proc, signal_t * sig) {
-	uintptr_t handler = sig->handler;
-	uintptr_t signum  = sig->signum;
-	free(sig);
 
-	if (proc->finished) {
-		return;
+/* Lowest-numbered signal in a mask */
+static int first_signal(uint64_t mask) {
+	for (int i = 1; i < NUMSIGNALS; ++i) {
+		if (mask & SIGNAL_BIT(i)) return i;
 	}
+	return 0;
+}
 
-	if (signum == 0 || signum >= NUMSIGNALS) {
-		/* Ignore */
-		return;
+static void __attribute__((noreturn)) signal_kill(process_t * proc, int signum) {
+	debug_print(WARNING, "Process %d killed by unhandled signal (%d)", proc->id, signum);
+	kexit(((128 + signum) << 8) | signum);
+	__builtin_unreachable();
+}
+
+/*
+ * Are there signals that will run a handler? Blocking calls that
+ * can be restarted return early for these; see syscall_restart.
+ */
+int signal_pending(process_t * proc) {
+	uint64_t ready = proc->signals_pending & ~proc->signals_blocked;
+	for (int i = 1; ready && i < NUMSIGNALS; ++i) {
+		if ((ready & SIGNAL_BIT(i)) && proc->signals.functions[i] > 1) return 1;
 	}
+	return 0;
+}
 
-	if (!handler) {
-		char dowhat = isdeadly[signum];
+/*
+ * Take default actions that can't wait for a return to userspace:
+ * end the process for a deadly signal it has no handler for.
+ */
+void signal_default_actions(process_t * proc) {
+	uint64_t ready = proc->signals_pending & ~proc->signals_blocked;
+	for (int i = 1; ready && i < NUMSIGNALS; ++i) {
+		if (!(ready & SIGNAL_BIT(i)) || proc->signals.functions[i]) continue;
+		proc->signals_pending &= ~SIGNAL_BIT(i);
+		char dowhat = isdeadly[i];
 		if (dowhat == 1 || dowhat == 2) {
-			debug_print(WARNING, "Process %d killed by unhandled signal (%d)", proc->id, signum);
-			kexit(((128 + signum) << 8) | signum);
-			__builtin_unreachable();
-		} else {
-			debug_print(WARNING, "Ignoring signal %d by default in pid %d", signum, proc->id);
+			signal_kill(proc, i);
 		}
 		/* XXX dowhat == 2: should dump core */
 		/* XXX dowhat == 3: stop */
-		return;
 	}
+}
 
-	if (handler == 1) /* Ignore */ {
-		return;
+/* Build a signal frame on the user stack and point the process at the handler */
+static int enter_signal_handler(process_t * proc, struct regs * r, uintptr_t handler, int signum) {
+	/* The handler's argument ends up 16-byte aligned */
+	uintptr_t stack = ((r->useresp - sizeof(struct signal_frame)) & ~0xF) - sizeof(uintptr_t);
+	if (stack <= proc->image.entry) {
+		return 1;
 	}
+	struct signal_frame * frame = (struct signal_frame *)stack;
 
-	debug_print(NOTICE, "handling signal in process %d (%d) (0x%x)", proc->id, signum, handler);
+	frame->return_address = VDSO_SIGRETURN;
+	frame->signum = signum;
+	memcpy(&frame->registers, r, sizeof(struct regs));
+	frame->blocked = proc->signals_blocked;
+	frame->fpu_saved = fpu_get_state(proc, frame->fpu);
 
-	uintptr_t stack = 0xFFFF0000;
-	if (proc->syscall_registers->useresp < 0x10000100) {
-		stack = proc->image.user_stack;
-	} else {
-		stack = proc->syscall_registers->useresp;
-	}
-
-	/* Not marked as ignored, must call signal */
-	enter_signal_handler(handler, signum, stack);
+	/* The signal stays blocked while its handler runs */
+	proc->signals_blocked |= SIGNAL_BIT(signum);
 
+	r->useresp = stack;
+	r->eip = handler;
+	return 0;
 }
 
-list_t * rets_from_sig;
+/*
+ * Called on the way back to userspace, with the registers that will
+ * be restored; runs default actions and sets up at most one handler.
+ * Whatever else is pending goes after that handler's sigreturn.
+ */
+void deliver_signals(struct regs * r) {
+	process_t * proc = (process_t *)current_process;
+	if ((r->cs & 3) != 3 || !proc || proc->finished) return;
+
+	while (proc->signals_pending & ~proc->signals_blocked) {
+		int signum = first_signal(proc->signals_pending & ~proc->signals_blocked);
+		proc->signals_pending &= ~SIGNAL_BIT(signum);
+
+		uintptr_t handler = proc->signals.functions[signum];
+		if (!handler) {
+			char dowhat = isdeadly[signum];
+			if (dowhat == 1 || dowhat == 2) {
+				signal_kill(proc, signum);
+			}
+			continue;
+		}
+		if (handler == 1) /* Ignore */ {
+			continue;
+		}
 
-void return_from_signal_handler(void) {
-#if 0
-	debug_print(ERROR, "Return From Signal for process %d", current_process->id);
-#endif
+		debug_print(NOTICE, "handling signal in process %d (%d) (0x%x)", proc->id, signum, handler);
 
-	if (__builtin_expect(!rets_from_sig, 0)) {
-		rets_from_sig = list_create();
+		if (enter_signal_handler(proc, r, handler, signum)) {
+			debug_print(WARNING, "Process %d has no room on its stack for signal %d", proc->id, signum);
+			signal_kill(proc, SIGSEGV);
+		}
+		return;
 	}
-
-	spin_lock(sig_lock);
-	list_insert(rets_from_sig, (process_t *)current_process);
-	spin_unlock(sig_lock);
-
-	switch_next();
 }
 
-void fix_signal_stacks(void) {
-	uint8_t redo_me = 0;
-	if (rets_from_sig) {
-		spin_lock(sig_lock_b);
-		while (rets_from_sig->head) {
-			spin_lock(sig_lock);
-			node_t * n = list_dequeue(rets_from_sig);
-			spin_unlock(sig_lock);
-			if (!n) {
-				continue;
-			}
-			process_t * p = n->value;
-			free(n);
-			if (p == current_process) {
-				redo_me = 1;
-				continue;
-			}
-			p->thread.esp = p->signal_state.esp;
-			p->thread.eip = p->signal_state.eip;
-			p->thread.ebp = p->signal_state.ebp;
-			if (!p->signal_kstack) {
-				debug_print(ERROR, "Cannot restore signal stack for pid=%d - unset?", p->id);
-			} else {
-				debug_print(ERROR, "Restoring signal stack for pid=%d", p->id);
-				memcpy((void *)(p->image.stack - KERNEL_STACK_SIZE), p->signal_kstack, KERNEL_STACK_SIZE);
-				free(p->signal_kstack);
-				p->signal_kstack = NULL;
-			}
-			make_process_ready(p);
-		}
-		spin_unlock(sig_lock_b);
+/*
+ * sigreturn: the handler has returned into the vDSO stub, which
+ * popped the return address, so the frame starts one word down.
+ * Returns the interrupted EAX, which the system call puts back.
+ */
+int return_from_signal_handler(struct regs * r) {
+	process_t * proc = (process_t *)current_process;
+	uintptr_t stack = r->useresp - sizeof(uintptr_t);
+	if (stack <= proc->image.entry) {
+		signal_kill(proc, SIGSEGV);
 	}
-	if (redo_me) {
-		spin_lock(sig_lock);
-		list_insert(rets_from_sig, (process_t *)current_process);
-		spin_unlock(sig_lock);
-		switch_next();
+	struct signal_frame * frame = (struct signal_frame *)stack;
+	struct regs * saved = &frame->registers;
+
+	r->edi = saved->edi;
+	r->esi = saved->esi;
+	r->ebp = saved->ebp;
+	r->ebx = saved->ebx;
+	r->edx = saved->edx;
+	r->ecx = saved->ecx;
+	r->eax = saved->eax;
+	r->eip = saved->eip;
+	r->useresp = saved->useresp;
+	/* Only the arithmetic, direction and trap flags are the process' to set */
+	r->eflags = (r->eflags & ~0xDD5) | (saved->eflags & 0xDD5);
+
+	proc->signals_blocked = frame->blocked & ~SIGNAL_UNBLOCKABLE;
+	if (frame->fpu_saved) {
+		fpu_set_state(proc, frame->fpu);
 	}
+
+	return r->eax;
 }
 
 int send_signal(pid_t process, uint32_t signal, int force_root) {
@@ -196,26 +220,39 @@ int send_signal(pid_t process, uint32_t signal, int force_root) {
 		return 1;
 	}
 
-	if (signal > NUMSIGNALS) {
+	if (signal >= NUMSIGNALS) {
 		/* Invalid signal */
 		return 1;
 	}
 
+	if (signal == 0) {
+		/* Only checking the process exists */
+		return 0;
+	}
+
 	if (receiver->finished) {
 		/* Can't send signals to finished processes */
 		return 1;
 	}
 
-	if (!receiver->signals.functions[signal] && !isdeadly[signal]) {
-		/* If we're blocking a signal and it's not going to kill us, don't deliver it */
+	uintptr_t handler = receiver->signals.functions[signal];
+	if ((!handler && !isdeadly[signal]) || handler == 1) {
+		/* Ignored, by default or on request */
 		return 1;
 	}
 
-	/* Append signal to list */
-	signal_t * sig = malloc(sizeof(signal_t));
-	sig->handler = (uintptr_t)receiver->signals.functions[signal];
-	sig->signum  = signal;
-	memset(&sig->registers_before, 0x00, sizeof(regs_t));
+	receiver->signals_pending |= SIGNAL_BIT(signal);
+
+	if (receiver->signals_blocked & SIGNAL_BIT(signal)) {
+		/* Stays pending until it is unblocked */
+		return 0;
+	}
+
+	if (receiver == current_process) {
+		/* A handler runs on the way back to userspace; a deadly signal is taken now */
+		signal_default_actions(receiver);
+		return 0;
+	}
 
 	if (receiver->node_waits) {
 		process_awaken_from_fswait(receiver, -1);
@@ -224,17 +261,5 @@ int send_signal(pid_t process, uint32_t signal, int force_root) {
 		make_process_ready(receiver);
 	}
 
-	list_insert(receiver->signal_queue, sig);
-
-	if (receiver == current_process) {
-		/* Forces us to be rescheduled and enter signal handler */
-		if (receiver->signal_kstack) {
-			switch_next();
-		} else {
-			switch_task(0);
-		}
-	}
-
 	return 0;
 }
-
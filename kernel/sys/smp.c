@@ -0,0 +1,537 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Symmetric multiprocessing
+ *
+ * Processors are found through the ACPI MADT, or the older MP
+ * tables, and started with INIT and startup IPIs into the
+ * trampoline in smp.S. Each one gets an idle task, a ready queue
+ * and a local APIC timer that drives its scheduling, as the PIT
+ * does on the bootstrap processor, which keeps all device IRQs.
+ *
+ * The kernel lock: a processor holds it whenever it runs kernel
+ * code, other than the idle loop and the shootdown handler. It is
+ * taken on the way into irq_handler and fault_handler if this
+ * processor doesn't already have it, and given up when returning to
+ * user mode or going idle. Task switches happen with it held, so it
+ * follows the processor rather than the task.
+ */
+#include <kernel/system.h>
+#include <kernel/logging.h>
+#include <kernel/process.h>
+#include <kernel/args.h>
+
+#define AP_BASE 0x7000
+
+#define LAPIC_ID            0x020
+#define LAPIC_TPR           0x080
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0
+#define LAPIC_ICR_LOW       0x300
+#define LAPIC_ICR_HIGH      0x310
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_LVT_LINT0     0x350
+#define LAPIC_LVT_LINT1     0x360
+#define LAPIC_LVT_ERROR     0x370
+#define LAPIC_TIMER_INIT    0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+#define LAPIC_ENABLE        0x100
+#define LAPIC_MASKED        0x10000
+#define LAPIC_PERIODIC      0x20000
+#define LAPIC_EXTINT        0x700
+#define LAPIC_NMI           0x400
+
+#define ICR_FIXED           0x00000
+#define ICR_INIT            0x00500
+#define ICR_STARTUP         0x00600
+#define ICR_PENDING         0x01000
+#define ICR_ASSERT          0x04000
+#define ICR_LEVEL           0x08000
+
+cpu_t cpus[MAX_CPUS] = {
+	/* The bootstrap processor runs kmain with the kernel lock held */
+	[0] = { .kernel_lock_held = 1 },
+};
+int cpu_count = 1;
+
+static spin_lock_t kernel_lock = { 1, 0 };
+
+static volatile uint32_t * lapic = NULL;
+static uint32_t lapic_ticks_per_ms = 0;
+static uint64_t bsp_pat = 0;
+
+extern void _lapic_timer(void);
+extern void _lapic_resched(void);
+extern void _lapic_tlb(void);
+extern void _lapic_spurious(void);
+
+extern char ap_trampoline[];
+extern char ap_trampoline_end[];
+extern uint32_t ap_cr3;
+extern uint32_t ap_stack;
+extern uint32_t ap_entry;
+extern uint32_t ap_cpu;
+
+/* Where a trampoline variable ends up once copied to AP_BASE */
+#define TRAMPOLINE(sym) ((uint32_t *)(AP_BASE + ((uintptr_t)&(sym) - (uintptr_t)ap_trampoline)))
+
+/*
+ * Kernel lock
+ */
+int kernel_lock_enter(void) {
+	cpu_t * cpu = this_cpu();
+	if (cpu->kernel_lock_held) {
+		return 0;
+	}
+	spin_lock_irqsave(kernel_lock, &cpu->kernel_lock_flags);
+	cpu->kernel_lock_held = 1;
+	return 1;
+}
+
+void kernel_lock_leave(int took) {
+	if (took) {
+		kernel_lock_release();
+	}
+}
+
+void kernel_lock_release(void) {
+	cpu_t * cpu = this_cpu();
+	if (!cpu->kernel_lock_held) {
+		return;
+	}
+	cpu->kernel_lock_held = 0;
+	spin_unlock_irqrestore(kernel_lock, cpu->kernel_lock_flags);
+}
+
+/*
+ * Called while spinning with interrupts disabled. Shootdowns are
+ * answered here as well as from their IPI, or a processor waiting
+ * for the kernel lock would never let its holder finish one.
+ */
+void smp_relax(void) {
+	cpu_t * cpu = this_cpu();
+	if (cpu->tlb_flush) {
+		invalidate_page_tables();
+		cpu->tlb_flush = 0;
+	}
+	asm volatile ("pause");
+}
+
+/*
+ * Local APIC
+ */
+static inline uint32_t lapic_read(uint32_t reg) {
+	return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+	lapic[reg / 4] = value;
+}
+
+static void lapic_eoi(void) {
+	lapic_write(LAPIC_EOI, 0);
+}
+
+static void lapic_send_ipi(int lapic_id, uint32_t command) {
+	uint32_t flags;
+	asm volatile ("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+
+	lapic_write(LAPIC_ICR_HIGH, lapic_id << 24);
+	lapic_write(LAPIC_ICR_LOW, command);
+	while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING);
+
+	if (flags & (1 << 9)) {
+		asm volatile ("sti");
+	}
+}
+
+static void lapic_enable(int bsp) {
+	lapic_write(LAPIC_TPR, 0);
+	lapic_write(LAPIC_SVR, LAPIC_ENABLE | LAPIC_SPURIOUS);
+	if (bsp) {
+		/* Virtual wire mode: the PIC keeps delivering through LINT0 */
+		lapic_write(LAPIC_LVT_LINT0, LAPIC_EXTINT);
+		lapic_write(LAPIC_LVT_LINT1, LAPIC_NMI);
+	} else {
+		lapic_write(LAPIC_LVT_LINT0, LAPIC_MASKED);
+		lapic_write(LAPIC_LVT_LINT1, LAPIC_MASKED);
+	}
+	lapic_write(LAPIC_LVT_ERROR, LAPIC_MASKED);
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_MASKED);
+}
+
+static void lapic_timer_start(void) {
+	lapic_write(LAPIC_TIMER_DIVIDE, 0x3); /* Divide by 16 */
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_PERIODIC | LAPIC_TIMER_VECTOR);
+	lapic_write(LAPIC_TIMER_INIT, lapic_ticks_per_ms);
+}
+
+void lapic_handler(struct regs * r) {
+	switch (r->int_no) {
+		case IPI_TLB_SHOOTDOWN:
+			/* Lock-free: the sender is waiting with the kernel lock held */
+			invalidate_page_tables();
+			this_cpu()->tlb_flush = 0;
+			lapic_eoi();
+			break;
+		case LAPIC_TIMER_VECTOR:
+		case IPI_RESCHEDULE:
+			{
+				lapic_eoi();
+				int took = kernel_lock_enter();
+				if (r->int_no == LAPIC_TIMER_VECTOR) {
+					timer_account(r);
+				}
+				switch_task(1);
+				deliver_signals(r);
+				kernel_lock_leave(took);
+			}
+			break;
+	}
+}
+
+void smp_reschedule(cpu_t * cpu) {
+	if (!lapic || cpu == this_cpu() || !cpu->online) return;
+	lapic_send_ipi(cpu->lapic_id, ICR_FIXED | ICR_ASSERT | IPI_RESCHEDULE);
+}
+
+/*
+ * Flush `dir` from every other processor that has it loaded, after
+ * mappings were removed from it; NULL flushes every processor, for
+ * kernel mappings, which all directories share. Called with the
+ * kernel lock held.
+ */
+void tlb_shootdown(page_directory_t * dir) {
+	if (cpu_count < 2) return;
+
+	cpu_t * self = this_cpu();
+	for (int i = 0; i < cpu_count; ++i) {
+		cpu_t * cpu = &cpus[i];
+		if (cpu == self || !cpu->online || (dir && cpu->directory != dir)) continue;
+		cpu->tlb_flush = 1;
+		lapic_send_ipi(cpu->lapic_id, ICR_FIXED | ICR_ASSERT | IPI_TLB_SHOOTDOWN);
+	}
+	for (int i = 0; i < cpu_count; ++i) {
+		while (cpus[i].tlb_flush) {
+			asm volatile ("pause");
+		}
+	}
+}
+
+/*
+ * Timing, before the other processors have timers of their own. The
+ * PIT's channel 0 runs at 1 kHz (see devices/timer.c) and reloads
+ * when it reaches the bottom, so each reload is a millisecond.
+ */
+static uint16_t pit_read(void) {
+	outportb(0x43, 0x00); /* Latch channel 0 */
+	uint8_t low  = inportb(0x40);
+	uint8_t high = inportb(0x40);
+	return (high << 8) | low;
+}
+
+static void pit_wait(int ms) {
+	uint16_t last = pit_read();
+	while (ms) {
+		uint16_t now = pit_read();
+		if (now > last) ms--;
+		last = now;
+	}
+}
+
+static void lapic_calibrate(void) {
+	lapic_write(LAPIC_TIMER_DIVIDE, 0x3);
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_MASKED);
+	lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+	pit_wait(10);
+	uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+	lapic_write(LAPIC_TIMER_INIT, 0);
+	lapic_ticks_per_ms = elapsed / 10;
+}
+
+/*
+ * Map physical memory (firmware tables, the local APIC) into the
+ * kernel heap, whose page tables every directory shares.
+ */
+static void * map_physical(uintptr_t physical, size_t size, int uncached) {
+	uintptr_t offset = physical & 0xFFF;
+	size_t pages = (offset + size + 0xFFF) / 0x1000;
+	uintptr_t virtual = kvmalloc(pages * 0x1000);
+
+	for (size_t i = 0; i < pages; ++i) {
+		page_t * page = get_page(virtual + i * 0x1000, 0, kernel_directory);
+		free_frame(page);
+		page->frame = ((physical & 0xFFFFF000) + i * 0x1000) / 0x1000;
+		page->present = 1;
+		page->rw = 1;
+		page->user = 0;
+		page->cachedisable = uncached;
+		page->writethrough = uncached;
+		invalidate_tables_at(virtual + i * 0x1000);
+	}
+
+	return (void *)(virtual + offset);
+}
+
+static int checksum(void * data, size_t length) {
+	uint8_t sum = 0;
+	for (size_t i = 0; i < length; ++i) {
+		sum += ((uint8_t *)data)[i];
+	}
+	return sum;
+}
+
+/* Search low memory, on 16-byte boundaries, for a signed structure */
+static uintptr_t scan_for(uintptr_t start, size_t length, const char * sig, size_t sig_len, size_t sum_len) {
+	uint8_t * base = map_physical(start, length, 0);
+	for (size_t i = 0; i + sum_len <= length; i += 16) {
+		if (!memcmp(base + i, sig, sig_len) && !checksum(base + i, sum_len)) {
+			return start + i;
+		}
+	}
+	return 0;
+}
+
+static uintptr_t scan_bios_areas(const char * sig, size_t sig_len, size_t sum_len) {
+	uint16_t * bda = map_physical(0x400, 0x100, 0);
+	uintptr_t ebda = (uintptr_t)bda[0x0E / 2] << 4;
+	uintptr_t base_end = (uintptr_t)bda[0x13 / 2] * 1024;
+
+	uintptr_t found = 0;
+	if (ebda) found = scan_for(ebda, 1024, sig, sig_len, sum_len);
+	if (!found && base_end) found = scan_for(base_end - 1024, 1024, sig, sig_len, sum_len);
+	if (!found) found = scan_for(0xE0000, 0x20000, sig, sig_len, sum_len);
+	return found;
+}
+
+typedef struct {
+	char signature[8];
+	uint8_t checksum;
+	char oem[6];
+	uint8_t revision;
+	uint32_t rsdt;
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+	char signature[4];
+	uint32_t length;
+	uint8_t revision;
+	uint8_t checksum;
+	char oem[6];
+	char oem_table[8];
+	uint32_t oem_revision;
+	uint32_t creator;
+	uint32_t creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+typedef struct {
+	acpi_header_t header;
+	uint32_t lapic_address;
+	uint32_t flags;
+	uint8_t entries[];
+} __attribute__((packed)) acpi_madt_t;
+
+static int acpi_find_cpus(int * lapic_ids, uintptr_t * lapic_address) {
+	uintptr_t rsdp_addr = scan_bios_areas("RSD PTR ", 8, 20);
+	if (!rsdp_addr) return 0;
+
+	acpi_rsdp_t * rsdp = map_physical(rsdp_addr, sizeof(acpi_rsdp_t), 0);
+	acpi_header_t * rsdt = map_physical(rsdp->rsdt, sizeof(acpi_header_t), 0);
+	if (memcmp(rsdt->signature, "RSDT", 4)) return 0;
+	rsdt = map_physical(rsdp->rsdt, rsdt->length, 0);
+
+	uint32_t * tables = (uint32_t *)(rsdt + 1);
+	size_t count = (rsdt->length - sizeof(acpi_header_t)) / 4;
+	for (size_t i = 0; i < count; ++i) {
+		acpi_header_t * header = map_physical(tables[i], sizeof(acpi_header_t), 0);
+		if (memcmp(header->signature, "APIC", 4)) continue;
+
+		acpi_madt_t * madt = map_physical(tables[i], header->length, 0);
+		*lapic_address = madt->lapic_address;
+
+		int found = 0;
+		uint8_t * entry = madt->entries;
+		uint8_t * end = (uint8_t *)madt + madt->header.length;
+		while (entry + 2 <= end && entry[1] >= 2) {
+			/* Processor local APIC: type, length, processor id, APIC id, flags */
+			if (entry[0] == 0 && (*(uint32_t *)&entry[4] & 1) && found < MAX_CPUS) {
+				lapic_ids[found++] = entry[3];
+			}
+			entry += entry[1];
+		}
+		return found;
+	}
+
+	return 0;
+}
+
+typedef struct {
+	char signature[4];
+	uint32_t config;
+	uint8_t length;
+	uint8_t revision;
+	uint8_t checksum;
+	uint8_t features[5];
+} __attribute__((packed)) mp_pointer_t;
+
+typedef struct {
+	char signature[4];
+	uint16_t length;
+	uint8_t revision;
+	uint8_t checksum;
+	char oem[8];
+	char product[12];
+	uint32_t oem_table;
+	uint16_t oem_table_size;
+	uint16_t entry_count;
+	uint32_t lapic_address;
+	uint16_t extended_length;
+	uint8_t extended_checksum;
+	uint8_t reserved;
+} __attribute__((packed)) mp_config_t;
+
+static int mp_find_cpus(int * lapic_ids, uintptr_t * lapic_address) {
+	uintptr_t pointer_addr = scan_bios_areas("_MP_", 4, 16);
+	if (!pointer_addr) return 0;
+
+	mp_pointer_t * pointer = map_physical(pointer_addr, sizeof(mp_pointer_t), 0);
+	if (!pointer->config) return 0; /* A default configuration; not worth supporting */
+
+	mp_config_t * config = map_physical(pointer->config, sizeof(mp_config_t), 0);
+	if (memcmp(config->signature, "PCMP", 4)) return 0;
+	config = map_physical(pointer->config, config->length, 0);
+	*lapic_address = config->lapic_address;
+
+	int found = 0;
+	uint8_t * entry = (uint8_t *)(config + 1);
+	for (int i = 0; i < config->entry_count; ++i) {
+		if (entry[0] == 0) {
+			/* Processor: type, APIC id, version, flags, ...; 20 bytes */
+			if ((entry[3] & 1) && found < MAX_CPUS) {
+				lapic_ids[found++] = entry[1];
+			}
+			entry += 20;
+		} else {
+			entry += 8;
+		}
+	}
+	return found;
+}
+
+/*
+ * Application processors arrive here from the trampoline, on their
+ * idle task's stack, with interrupts off and no kernel lock.
+ */
+static void ap_main(cpu_t * cpu) {
+	gdt_install_cpu(cpu->id);
+	idt_load_cpu();
+
+	/* Same memory types as the bootstrap processor (see paging_install) */
+	asm volatile ("wrmsr" : : "c"(0x277), "A"(bsp_pat));
+
+	current_process = cpu->idle_task;
+	current_directory = kernel_directory;
+	set_kernel_stack(cpu->idle_task->image.stack);
+	fpu_install_ap();
+
+	lapic_enable(0);
+	lapic_timer_start();
+
+	cpu->online = 1;
+
+	/* Become the idle task */
+	asm volatile (
+			"mov %0, %%esp\n"
+			"mov %0, %%ebp\n"
+			"jmp *%1"
+			: : "r"(cpu->idle_task->thread.esp), "r"(cpu->idle_task->thread.eip));
+}
+
+static int start_ap(cpu_t * cpu) {
+	process_t * idle = spawn_kidle();
+	set_process_environment(idle, kernel_directory);
+	kernel_directory->ref_count++;
+	idle->cpu = cpu->id;
+	cpu->idle_task = idle;
+	cpu->process = idle;
+	cpu->directory = kernel_directory;
+	cpu->ready_queue = list_create();
+
+	*TRAMPOLINE(ap_cr3)   = kernel_directory->physical_address;
+	*TRAMPOLINE(ap_stack) = idle->image.stack;
+	*TRAMPOLINE(ap_entry) = (uintptr_t)&ap_main;
+	*TRAMPOLINE(ap_cpu)   = (uintptr_t)cpu;
+
+	lapic_send_ipi(cpu->lapic_id, ICR_INIT | ICR_ASSERT | ICR_LEVEL);
+	lapic_send_ipi(cpu->lapic_id, ICR_INIT | ICR_LEVEL);
+	pit_wait(10);
+
+	for (int attempt = 0; attempt < 2 && !cpu->online; ++attempt) {
+		lapic_send_ipi(cpu->lapic_id, ICR_STARTUP | (AP_BASE >> 12));
+		for (int ms = 0; ms < 100 && !cpu->online; ++ms) {
+			pit_wait(1);
+		}
+	}
+
+	return cpu->online;
+}
+
+void smp_install(void) {
+	if (args_present("nosmp")) {
+		debug_print(NOTICE, "smp: disabled by kernel argument");
+		return;
+	}
+
+	uint32_t edx;
+	asm volatile ("cpuid" : "=d"(edx) : "a"(1) : "ebx", "ecx");
+	if (!(edx & (1 << 9))) {
+		debug_print(NOTICE, "smp: no local APIC");
+		return;
+	}
+
+	int lapic_ids[MAX_CPUS];
+	uintptr_t lapic_address = 0xFEE00000;
+	int found = acpi_find_cpus(lapic_ids, &lapic_address);
+	if (!found) {
+		found = mp_find_cpus(lapic_ids, &lapic_address);
+	}
+	if (found < 2) {
+		debug_print(NOTICE, "smp: single processor");
+		return;
+	}
+
+	IRQ_OFF;
+
+	lapic = map_physical(lapic_address, 0x1000, 1);
+	cpus[0].lapic_id = lapic_read(LAPIC_ID) >> 24;
+	lapic_enable(1);
+	lapic_calibrate();
+
+	idt_set_gate(LAPIC_TIMER_VECTOR, _lapic_timer, 0x08, 0x8E);
+	idt_set_gate(IPI_RESCHEDULE, _lapic_resched, 0x08, 0x8E);
+	idt_set_gate(IPI_TLB_SHOOTDOWN, _lapic_tlb, 0x08, 0x8E);
+	idt_set_gate(LAPIC_SPURIOUS, _lapic_spurious, 0x08, 0x8E);
+
+	asm volatile ("rdmsr" : "=A"(bsp_pat) : "c"(0x277));
+	memcpy((void *)AP_BASE, ap_trampoline, ap_trampoline_end - ap_trampoline);
+
+	for (int i = 0; i < found && cpu_count < MAX_CPUS; ++i) {
+		if (lapic_ids[i] == cpus[0].lapic_id) continue;
+		cpu_t * cpu = &cpus[cpu_count];
+		cpu->id = cpu_count;
+		cpu->lapic_id = lapic_ids[i];
+		if (start_ap(cpu)) {
+			cpu_count++;
+		} else {
+			debug_print(WARNING, "smp: processor with APIC id %d did not start", lapic_ids[i]);
+		}
+	}
+
+	debug_print(NOTICE, "smp: %d processors online, APIC timer at %d ticks/ms", cpu_count, lapic_ticks_per_ms);
+
+	IRQ_RES;
+}
@@ -16,8 +16,15 @@
 #include <kernel/shm.h>
 #include <kernel/printf.h>
 #include <kernel/module.h>
+#include <kernel/trace.h>
+#include <kernel/mmap.h>
 
 #include <sys/utsname.h>
+#include <sys/pollset.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/signal.h>
+#include <sys/getdents.h>
 #include <syscall_nums.h>
 
 static char   hostname[256];
@@ -64,6 +71,7 @@ static int sys_read(int fd, char * ptr, int len) {
 		fs_node_t * node = FD_ENTRY(fd);
 		uint32_t out = read_fs(node, node->offset, len, (uint8_t *)ptr);
 		node->offset += out;
+		if ((int)out > 0) current_process->stats.read_bytes += out;
 		return (int)out;
 	}
 	return -EBADF;
@@ -92,6 +100,40 @@ static int sys_readdir(int fd, int index, struct dirent * entry) {
 	return -EBADF;
 }
 
+struct getdents_buffer {
+	char * out;
+	uint32_t size;
+	uint32_t used;
+};
+
+static int getdents_fill(void * context, uint32_t ino, uint8_t type, char * name) {
+	struct getdents_buffer * b = context;
+	size_t len = strlen(name);
+	uint32_t reclen = DIRENT_RECLEN(len);
+	if (b->used + reclen > b->size) return 1;
+
+	struct dirent_record * rec = (struct dirent_record *)(b->out + b->used);
+	rec->d_ino    = ino;
+	rec->d_reclen = reclen;
+	rec->d_type   = type;
+	memcpy(rec->d_name, name, len + 1);
+	b->used += reclen;
+	return 0;
+}
+
+static int sys_getdents(int fd, char * buf, uint32_t size) {
+	if (FD_CHECK(fd)) {
+		PTR_VALIDATE(buf);
+		fs_node_t * node = FD_ENTRY(fd);
+		struct getdents_buffer b = { buf, size, 0 };
+		int ret = getdents_fs(node, &node->offset, getdents_fill, &b);
+		if (ret < 0) return ret;
+		if (ret && !b.used) return -EINVAL; /* Not even one entry fits */
+		return b.used;
+	}
+	return -EBADF;
+}
+
 static int sys_write(int fd, char * ptr, int len) {
 	if (FD_CHECK(fd)) {
 		PTR_VALIDATE(ptr);
@@ -102,11 +144,96 @@ static int sys_write(int fd, char * ptr, int len) {
 		}
 		uint32_t out = write_fs(node, node->offset, len, (uint8_t *)ptr);
 		node->offset += out;
+		if ((int)out > 0) current_process->stats.write_bytes += out;
 		return out;
 	}
 	return -EBADF;
 }
 
+/* Copy a vector in from userspace, checking every buffer in it */
+static struct iovec * iov_copy(struct iovec * iov, int count) {
+	PTR_VALIDATE(iov);
+	struct iovec * out = malloc(sizeof(struct iovec) * count);
+	memcpy(out, iov, sizeof(struct iovec) * count);
+	for (int i = 0; i < count; ++i) {
+		PTR_VALIDATE(out[i].iov_base);
+	}
+	return out;
+}
+
+static int sys_readv(int fd, struct iovec * iov, int count) {
+	if (FD_CHECK(fd)) {
+		if (count < 0 || count > IOV_MAX || (count && !iov)) return -EINVAL;
+		if (!count) return 0;
+		struct iovec * kiov = iov_copy(iov, count);
+		fs_node_t * node = FD_ENTRY(fd);
+		uint32_t out = readv_fs(node, node->offset, kiov, count);
+		free(kiov);
+		if ((int)out > 0) {
+			node->offset += out;
+			current_process->stats.read_bytes += out;
+		}
+		return (int)out;
+	}
+	return -EBADF;
+}
+
+static int sys_writev(int fd, struct iovec * iov, int count) {
+	if (FD_CHECK(fd)) {
+		if (count < 0 || count > IOV_MAX || (count && !iov)) return -EINVAL;
+		fs_node_t * node = FD_ENTRY(fd);
+		if (!has_permission(node, 02)) {
+			debug_print(WARNING, "access denied (writev, fd=%d)", fd);
+			return -EACCES;
+		}
+		if (!count) return 0;
+		struct iovec * kiov = iov_copy(iov, count);
+		uint32_t out = writev_fs(node, node->offset, kiov, count);
+		free(kiov);
+		if ((int)out > 0) {
+			node->offset += out;
+			current_process->stats.write_bytes += out;
+		}
+		return (int)out;
+	}
+	return -EBADF;
+}
+
+/* Only files and block devices have offsets to read or write at */
+static int node_seekable(fs_node_t * node) {
+	return (node->flags & (FS_FILE | FS_BLOCKDEVICE)) != 0;
+}
+
+static int sys_pread(int fd, char * ptr, int len, int offset) {
+	if (FD_CHECK(fd)) {
+		PTR_VALIDATE(ptr);
+		fs_node_t * node = FD_ENTRY(fd);
+		if (!node_seekable(node)) return -ESPIPE;
+		if (offset < 0) return -EINVAL;
+		uint32_t out = read_fs(node, offset, len, (uint8_t *)ptr);
+		if ((int)out > 0) current_process->stats.read_bytes += out;
+		return (int)out;
+	}
+	return -EBADF;
+}
+
+static int sys_pwrite(int fd, char * ptr, int len, int offset) {
+	if (FD_CHECK(fd)) {
+		PTR_VALIDATE(ptr);
+		fs_node_t * node = FD_ENTRY(fd);
+		if (!node_seekable(node)) return -ESPIPE;
+		if (offset < 0) return -EINVAL;
+		if (!has_permission(node, 02)) {
+			debug_print(WARNING, "access denied (pwrite, fd=%d)", fd);
+			return -EACCES;
+		}
+		uint32_t out = write_fs(node, offset, len, (uint8_t *)ptr);
+		if ((int)out > 0) current_process->stats.write_bytes += out;
+		return (int)out;
+	}
+	return -EBADF;
+}
+
 static int sys_waitpid(int pid, int * status, int options) {
 	if (status && !PTR_INRANGE(status)) {
 		return -EINVAL;
@@ -188,7 +315,7 @@ static int sys_sbrk(int size) {
 	while (proc->image.heap > proc->image.heap_actual) {
 		proc->image.heap_actual += 0x1000;
 		assert(proc->image.heap_actual % 0x1000 == 0);
-		alloc_frame(get_page(proc->image.heap_actual, 1, current_directory), 0, 1);
+		alloc_user_frame(proc->image.heap_actual, current_directory);
 		invalidate_tables_at(proc->image.heap_actual);
 	}
 	spin_unlock(proc->image.lock);
@@ -431,6 +558,42 @@ static int sys_signal(uint32_t signum, uintptr_t handler) {
 	return (int)old;
 }
 
+static int sys_sigprocmask(int how, uint64_t * set, uint64_t * oldset) {
+	PTR_VALIDATE(set);
+	PTR_VALIDATE(oldset);
+	if (oldset) {
+		*oldset = current_process->signals_blocked;
+	}
+	if (!set) return 0;
+	switch (how) {
+		case SIG_BLOCK:
+			current_process->signals_blocked |= *set;
+			break;
+		case SIG_UNBLOCK:
+			current_process->signals_blocked &= ~*set;
+			break;
+		case SIG_SETMASK:
+			current_process->signals_blocked = *set;
+			break;
+		default:
+			return -EINVAL;
+	}
+	/* Anything this unblocked is delivered on the way out */
+	current_process->signals_blocked &= ~SIGNAL_UNBLOCKABLE;
+	return 0;
+}
+
+static int sys_sigpending(uint64_t * set) {
+	PTR_VALIDATE(set);
+	if (!set) return -EFAULT;
+	*set = current_process->signals_pending & current_process->signals_blocked;
+	return 0;
+}
+
+static int sys_sigreturn(void) {
+	return return_from_signal_handler(current_process->syscall_registers);
+}
+
 /*
 static void inspect_memory (uintptr_t vaddr) {
 	// Please use this scary hack of a function as infrequently as possible.
@@ -593,6 +756,10 @@ static int sys_sysfunc(int fn, char ** args) {
 				} else {
 					return -EINVAL;
 				}
+			case TRACE_SYSFUNC:
+				/* Set the trace mask in arg0, optionally resetting the buffer */
+				PTR_VALIDATE(args);
+				return trace_control((uint32_t)args[0], (int)args[1]);
 			case 8:
 				debug_print(NOTICE, "Loading module %s.", args[0]);
 				{
@@ -624,11 +791,11 @@ static int sys_sysfunc(int fn, char ** args) {
 				proc->image.heap = (uintptr_t)args[0];
 				proc->image.heap_actual = proc->image.heap & 0xFFFFF000;
 				assert(proc->image.heap_actual % 0x1000 == 0);
-				alloc_frame(get_page(proc->image.heap_actual, 1, current_directory), 0, 1);
+				alloc_user_frame(proc->image.heap_actual, current_directory);
 				invalidate_tables_at(proc->image.heap_actual);
 				while (proc->image.heap > proc->image.heap_actual) {
 					proc->image.heap_actual += 0x1000;
-					alloc_frame(get_page(proc->image.heap_actual, 1, current_directory), 0, 1);
+					alloc_user_frame(proc->image.heap_actual, current_directory);
 					invalidate_tables_at(proc->image.heap_actual);
 				}
 				spin_unlock(proc->image.lock);
@@ -656,7 +823,7 @@ static int sys_sysfunc(int fn, char ** args) {
 
 				spin_lock(proc->image.lock);
 				for (size_t x = 0; x < size; x += 0x1000) {
-					alloc_frame(get_page(address + x, 1, current_directory), 0, 1);
+					alloc_user_frame(address + x, current_directory);
 					invalidate_tables_at(address + x);
 				}
 				spin_unlock(proc->image.lock);
@@ -762,6 +929,36 @@ static int sys_clone(uintptr_t new_stack, uintptr_t thread_func, uintptr_t arg)
 	return (int)clone(new_stack, thread_func, arg);
 }
 
+static int sys_vfork(uintptr_t new_stack, uintptr_t thread_func, uintptr_t arg) {
+	if (!new_stack || !PTR_INRANGE(new_stack)) return -EINVAL;
+	if (!thread_func || !PTR_INRANGE(thread_func)) return -EINVAL;
+	return (int)vfork(new_stack, thread_func, arg);
+}
+
+static int sys_mmap(struct mmap_args * args) {
+	PTR_VALIDATE(args);
+	if (!args) return -EFAULT;
+
+	fs_node_t * node = NULL;
+	if (!(args->flags & MAP_ANONYMOUS)) {
+		if (!FD_CHECK(args->fd)) return -EBADF;
+		node = FD_ENTRY(args->fd);
+		if (!(node->flags & FS_FILE)) return -ENODEV;
+		if ((node->open_flags & (O_WRONLY | O_RDWR)) == O_WRONLY) return -EACCES;
+	}
+	if (args->offset < 0) return -EINVAL;
+
+	return (int)mmap_map((uintptr_t)args->addr, args->length, args->prot, args->flags, node, args->offset);
+}
+
+static int sys_munmap(void * addr, size_t length) {
+	return mmap_unmap((uintptr_t)addr, length);
+}
+
+static int sys_mprotect(void * addr, size_t length, int prot) {
+	return mmap_protect((uintptr_t)addr, length, prot);
+}
+
 static int sys_shm_obtain(char * path, size_t * size) {
 	PTR_VALIDATE(path);
 	PTR_VALIDATE(size);
@@ -904,6 +1101,71 @@ static int sys_fswait_timeout(int c, int fds[], int timeout) {
 	return result;
 }
 
+static int sys_pollset_create(void) {
+	fs_node_t * node = make_pollset();
+	open_fs(node, 0);
+	return process_append_fd((process_t *)current_process, node);
+}
+
+static int sys_pollset_ctl(int set, int op, int fd, struct pollset_event * event) {
+	PTR_VALIDATE(event);
+	if (!FD_CHECK(set) || !FD_CHECK(fd)) return -EBADF;
+	if (op != POLLSET_DEL && !event) return -EFAULT;
+	return pollset_ctl_fs(FD_ENTRY(set), op, fd, FD_ENTRY(fd),
+		event ? event->events : 0, event ? event->data : NULL);
+}
+
+static int sys_pollset_wait(int set, struct pollset_event * events, int max, int timeout) {
+	PTR_VALIDATE(events);
+	if (!FD_CHECK(set)) return -EBADF;
+	if (max <= 0 || !events) return -EINVAL;
+	/* max is only bounded by the caller's array, which can't wrap */
+	if ((size_t)max > (UINTPTR_MAX - (uintptr_t)events) / sizeof(struct pollset_event)) return -EFAULT;
+	PTR_VALIDATE(&events[max - 1]);
+	return pollset_wait_fs(FD_ENTRY(set), events, max, timeout);
+}
+
+/*
+ * poll() builds a pollset for the length of the call, keyed by index
+ * into fds so that the same descriptor can appear more than once.
+ */
+static int sys_poll(struct pollfd * fds, unsigned int count, int timeout) {
+	if (count > POLL_MAX) return -EINVAL;
+	PTR_VALIDATE(fds);
+	if (count && !fds) return -EFAULT;
+	if (count) {
+		if ((uintptr_t)(fds + count) < (uintptr_t)fds) return -EFAULT;
+		PTR_VALIDATE(&fds[count - 1]);
+	}
+
+	fs_node_t * set = make_pollset();
+	open_fs(set, 0);
+
+	int result = 0;
+	for (unsigned int i = 0; i < count; ++i) {
+		fds[i].revents = 0;
+		if (fds[i].fd < 0) continue;
+		if (!FD_CHECK(fds[i].fd)) {
+			fds[i].revents = POLLNVAL;
+			result++;
+			continue;
+		}
+		pollset_ctl_fs(set, POLLSET_ADD, i, FD_ENTRY(fds[i].fd), fds[i].events & ~POLLET, NULL);
+	}
+
+	if (!result) {
+		struct pollset_event * ready = malloc(sizeof(struct pollset_event) * (count ? count : 1));
+		result = pollset_wait_fs(set, ready, count ? count : 1, timeout);
+		for (int i = 0; i < result; ++i) {
+			fds[ready[i].fd].revents = ready[i].revents;
+		}
+		free(ready);
+	}
+
+	close_fs(set);
+	return result;
+}
+
 /*
  * System Call Internals
  */
@@ -959,6 +1221,22 @@ static int (*syscalls[])() = {
 	[SYS_FSWAIT]       = sys_fswait,
 	[SYS_FSWAIT2]      = sys_fswait_timeout,
 	[SYS_CHOWN]        = sys_chown,
+	[SYS_POLLSET_CREATE] = sys_pollset_create,
+	[SYS_POLLSET_CTL]  = sys_pollset_ctl,
+	[SYS_POLLSET_WAIT] = sys_pollset_wait,
+	[SYS_POLL]         = sys_poll,
+	[SYS_VFORK]        = sys_vfork,
+	[SYS_MMAP]         = sys_mmap,
+	[SYS_MUNMAP]       = sys_munmap,
+	[SYS_MPROTECT]     = sys_mprotect,
+	[SYS_READV]        = sys_readv,
+	[SYS_WRITEV]       = sys_writev,
+	[SYS_PREAD]        = sys_pread,
+	[SYS_PWRITE]       = sys_pwrite,
+	[SYS_SIGRETURN]    = sys_sigreturn,
+	[SYS_SIGPROCMASK]  = sys_sigprocmask,
+	[SYS_SIGPENDING]   = sys_sigpending,
+	[SYS_GETDENTS]     = sys_getdents,
 };
 
 uint32_t num_syscalls = sizeof(syscalls) / sizeof(*syscalls);
@@ -979,15 +1257,37 @@ void syscall_handler(struct regs * r) {
 
 	/* Update the syscall registers for this process */
 	current_process->syscall_registers = r;
+	current_process->stats.syscalls++;
 
 	if (trace_pid && current_process->id == trace_pid) {
 		debug_print(WARNING, "[syscall trace] %d (0x%x) 0x%x 0x%x 0x%x 0x%x 0x%x", r->eax, location, r->ebx, r->ecx, r->edx, r->esi, r->edi);
 	}
 
+	uint32_t num = r->eax;
+	uint64_t start = trace_enabled(TRACE_SYSCALL) ? trace_tsc() : 0;
+
 	/* Call the syscall function */
+	current_process->syscall_restart = 0;
 	scall_func func = (scall_func)location;
 	uint32_t ret = func(r->ebx, r->ecx, r->edx, r->esi, r->edi);
 
+	/* Duration includes any time spent blocked */
+	if (start && trace_enabled(TRACE_SYSCALL)) {
+		trace_record(TRACE_SYSCALL, num, ret, (uint32_t)(trace_tsc() - start));
+	}
+
+	if (current_process->syscall_restart) {
+		/*
+		 * Woken by a signal before doing anything: back up over the
+		 * int $0x7F or sysenter (both two bytes) so the call is made
+		 * again once the handler returns.
+		 */
+		current_process->syscall_restart = 0;
+		r->eax = num;
+		r->eip -= 2;
+		return;
+	}
+
 	if ((current_process->syscall_registers == r) ||
 			(location != (uintptr_t)&fork && location != (uintptr_t)&clone)) {
 		r->eax = ret;
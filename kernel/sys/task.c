@@ -12,6 +12,8 @@
 #include <kernel/logging.h>
 #include <kernel/shm.h>
 #include <kernel/mem.h>
+#include <kernel/mmap.h>
+#include <kernel/trace.h>
 
 #define TASK_MAGIC 0xDEADBEEF
 
@@ -21,7 +23,6 @@ uint32_t next_pid = 0;
 							*((type *) stack) = item
 
 page_directory_t *kernel_directory;
-page_directory_t *current_directory;
 
 /*
  * Clone a page directory and its contents.
@@ -62,6 +63,10 @@ clone_directory(
 			}
 		}
 	}
+	/* Every user frame below SHM_START was copied; shared memory was not */
+	dir->user_pages = src->user_pages;
+	dir->shm_pages  = 0;
+	mmap_clone(dir, src);
 	return dir;
 }
 
@@ -72,6 +77,7 @@ void release_directory(page_directory_t * dir) {
 	dir->ref_count--;
 
 	if (dir->ref_count < 1) {
+		mmap_release(dir);
 		uint32_t i;
 		for (i = 0; i < 1024; ++i) {
 			if (!dir->tables[i] || (uintptr_t)dir->tables[i] == (uintptr_t)0xFFFFFFFF) {
@@ -80,7 +86,7 @@ void release_directory(page_directory_t * dir) {
 			if (kernel_directory->tables[i] != dir->tables[i]) {
 				if (i * 0x1000 * 1024 < SHM_START) {
 					for (uint32_t j = 0; j < 1024; ++j) {
-						if (dir->tables[i]->pages[j].frame) {
+						if (dir->tables[i]->pages[j].frame && !dir->tables[i]->pages[j].shared) {
 							free_frame(&(dir->tables[i]->pages[j]));
 						}
 					}
@@ -94,6 +100,7 @@ void release_directory(page_directory_t * dir) {
 
 void release_directory_for_exec(page_directory_t * dir) {
 	uint32_t i;
+	mmap_release(dir);
 	/* This better be the only owner of this directory... */
 	for (i = 0; i < 1024; ++i) {
 		if (!dir->tables[i] || (uintptr_t)dir->tables[i] == (uintptr_t)0xFFFFFFFF) {
@@ -102,8 +109,9 @@ void release_directory_for_exec(page_directory_t * dir) {
 		if (kernel_directory->tables[i] != dir->tables[i]) {
 			if (i * 0x1000 * 1024 < USER_STACK_BOTTOM) {
 				for (uint32_t j = 0; j < 1024; ++j) {
-					if (dir->tables[i]->pages[j].frame) {
+					if (dir->tables[i]->pages[j].frame && !dir->tables[i]->pages[j].shared) {
 						free_frame(&(dir->tables[i]->pages[j]));
+						dir->user_pages--;
 					}
 				}
 				dir->physical_tables[i] = 0;
@@ -137,10 +145,15 @@ clone_table(
 		if (!src->pages[i].frame) {
 			continue;
 		}
+		if (src->pages[i].shared) {
+			/* Frames of shared mappings aren't ours to copy */
+			table->pages[i] = src->pages[i];
+			continue;
+		}
 		/* Allocate a new frame */
 		alloc_frame(&table->pages[i], 0, 0);
 		/* Set the correct access bit */
-		if (src->pages[i].present)	table->pages[i].present = 1;
+		table->pages[i].present = src->pages[i].present;
 		if (src->pages[i].rw)		table->pages[i].rw = 1;
 		if (src->pages[i].user)		table->pages[i].user = 1;
 		if (src->pages[i].writethrough)	table->pages[i].writethrough = 1;
@@ -353,6 +366,104 @@ clone(uintptr_t new_stack, uintptr_t thread_func, uintptr_t arg) {
 	return new_proc->id;
 }
 
+/*
+ * Start a new process that shares our memory instead of copying it,
+ * for a caller that is only going to exec. Like clone(), the child
+ * runs thread_func(arg) on new_stack, so it never touches our stack
+ * frames; unlike clone(), it gets its own descriptor table and is a
+ * process of its own rather than a thread of ours. We don't return
+ * until it has called exec or exited, so it has the memory to itself.
+ */
+uint32_t
+vfork(uintptr_t new_stack, uintptr_t thread_func, uintptr_t arg) {
+	uintptr_t esp, ebp;
+
+	IRQ_OFF;
+
+	current_process->syscall_registers->eax = 0;
+
+	process_t * parent = (process_t *)current_process;
+	assert(parent && "vforked from nothing??");
+	page_directory_t * directory = current_directory;
+	/* Spawn a new process from this one, with copies of our descriptors */
+	process_t * new_proc = spawn_process(current_process, 0);
+	assert(new_proc && "Could not allocate a new process!");
+	/* Borrow our directory */
+	set_process_environment(new_proc, directory);
+	directory->ref_count++;
+
+	struct regs r;
+	memcpy(&r, current_process->syscall_registers, sizeof(struct regs));
+	new_proc->syscall_registers = &r;
+
+	esp = new_proc->image.stack;
+	ebp = esp;
+
+	new_proc->syscall_registers->ebp = new_stack;
+	new_proc->syscall_registers->eip = thread_func;
+
+	/* Push arg, bogus return address onto the child's stack */
+	PUSH(new_stack, uintptr_t, arg);
+	PUSH(new_stack, uintptr_t, THREAD_RETURN);
+
+	new_proc->syscall_registers->esp = new_stack;
+	new_proc->syscall_registers->useresp = new_stack;
+
+	PUSH(esp, struct regs, r);
+
+	new_proc->thread.esp = esp;
+	new_proc->thread.ebp = ebp;
+
+	new_proc->is_tasklet = parent->is_tasklet;
+
+	new_proc->thread.eip = (uintptr_t)&return_to_userspace;
+
+	new_proc->vfork_parent = parent;
+	parent->vfork_child = new_proc;
+
+	pid_t pid = new_proc->id;
+
+	make_process_ready(new_proc);
+
+	IRQ_RES;
+
+	/* Signals can wake us, but we can't go back to userspace until it's done */
+	while (parent->vfork_child == new_proc) {
+		sleep_on(parent->wait_queue);
+	}
+
+	return pid;
+}
+
+/*
+ * A vfork() child is done with its parent's memory, by exec or exit;
+ * let the parent carry on.
+ */
+void vfork_release(process_t * proc) {
+	process_t * parent = proc->vfork_parent;
+	if (!parent) return;
+
+	proc->vfork_parent = NULL;
+	parent->vfork_child = NULL;
+	wakeup_queue(parent->wait_queue);
+}
+
+/*
+ * exec() in a vfork() child: rather than emptying the directory it
+ * shares with its parent, move to a new one with only the kernel
+ * mapped, and let the parent go.
+ */
+void vfork_exec(void) {
+	page_directory_t * shared = current_directory;
+	page_directory_t * directory = clone_directory(kernel_directory);
+
+	set_process_environment((process_t *)current_process, directory);
+	switch_page_directory(directory);
+	release_directory(shared);
+
+	vfork_release((process_t *)current_process);
+}
+
 /*
  * Get the process ID of the current process.
  *
@@ -386,16 +497,10 @@ void switch_task(uint8_t reschedule) {
 	if (eip == 0x10000) {
 		/* Returned from EIP after task switch, we have
 		 * finished switching. */
-		fix_signal_stacks();
-
-		/* XXX: Signals */
-		if (!current_process->finished) {
-			if (current_process->signal_queue->length > 0) {
-				node_t * node = list_dequeue(current_process->signal_queue);
-				signal_t * sig = node->value;
-				free(node);
-				handle_signal((process_t *)current_process, sig);
-			}
+
+		/* Deadly signals take effect now; handlers run on the way back to userspace */
+		if (!current_process->finished && current_process->signals_pending) {
+			signal_default_actions((process_t *)current_process);
 		}
 
 		return;
@@ -407,6 +512,12 @@ void switch_task(uint8_t reschedule) {
 	current_process->thread.ebp = ebp;
 	current_process->running = 0;
 
+	if (reschedule) {
+		current_process->stats.nivcsw++;
+	} else {
+		current_process->stats.nvcsw++;
+	}
+
 	/* Save floating point state */
 	switch_fpu();
 
@@ -426,8 +537,11 @@ void switch_task(uint8_t reschedule) {
  */
 void switch_next(void) {
 	uintptr_t esp, ebp, eip;
+	pid_t prev = current_process ? current_process->id : 0;
 	/* Get the next available process */
 	current_process = next_ready_process();
+	trace_switches++;
+	trace_event(TRACE_SWITCH, prev, 0, 0);
 	/* Retreive the ESP/EBP/EIP */
 	eip = current_process->thread.eip;
 	esp = current_process->thread.esp;
@@ -445,23 +559,15 @@ void switch_next(void) {
 		switch_next();
 	}
 
+	current_process->cpu = this_cpu()->id;
+
 	/* Set the page directory */
 	current_directory = current_process->thread.page_directory;
 	switch_page_directory(current_directory);
 	/* Set the kernel stack in the TSS */
 	set_kernel_stack(current_process->image.stack);
 
-	if (current_process->started) {
-		if (!current_process->signal_kstack) {
-			if (current_process->signal_queue->length > 0) {
-				current_process->signal_kstack  = malloc(KERNEL_STACK_SIZE);
-				current_process->signal_state.esp = current_process->thread.esp;
-				current_process->signal_state.eip = current_process->thread.eip;
-				current_process->signal_state.ebp = current_process->thread.ebp;
-				memcpy(current_process->signal_kstack, (void *)(current_process->image.stack - KERNEL_STACK_SIZE), KERNEL_STACK_SIZE);
-			}
-		}
-	} else {
+	if (!current_process->started) {
 		current_process->started = 1;
 	}
 
@@ -496,6 +602,7 @@ enter_user_jmp(uintptr_t location, int argc, char ** argv, uintptr_t stack) {
 
 	PUSH(stack, uintptr_t, (uintptr_t)argv);
 	PUSH(stack, int, argc);
+	kernel_lock_release();
 	enter_userspace(location, stack);
 }
 
@@ -513,12 +620,14 @@ void task_exit(int retval) {
 	}
 	cleanup_process((process_t *)current_process, retval);
 
-	process_t * parent = process_get_parent((process_t *)current_process);
+	process_t * parent = process_make_zombie((process_t *)current_process);
 
 	if (parent && !parent->finished) {
 		wakeup_queue(parent->wait_queue);
 	}
 
+	vfork_release((process_t *)current_process);
+
 	switch_next();
 }
 
@@ -0,0 +1,73 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * vDSO
+ *
+ * Two pages mapped read-only for userspace at VDSO_ADDRESS, just
+ * below the page cache. That part of the address space uses page
+ * tables shared by every directory, so mapping the pages once in
+ * the kernel directory puts them in every process. The kernel
+ * writes to them through its own heap mapping.
+ *
+ * The first page holds the time, updated every timer tick; the
+ * second holds the system call stub libc calls (see syscall.h)
+ * and the one signal handlers return to.
+ */
+#include <kernel/system.h>
+#include <kernel/logging.h>
+#include <kernel/args.h>
+#include <kernel/mem.h>
+#include <sys/vdso.h>
+
+extern char vdso_sysenter_start[], vdso_sysenter_exit[], vdso_sysenter_end[];
+extern char vdso_int_start[], vdso_int_end[];
+extern char vdso_sigreturn_start[], vdso_sigreturn_end[];
+extern uintptr_t sysenter_return;
+
+static struct vdso_data * vdso_data = NULL;
+
+void vdso_install(void) {
+	uint8_t * pages = valloc(VDSO_SIZE);
+	memset(pages, 0, VDSO_SIZE);
+
+	for (uintptr_t i = 0; i < VDSO_SIZE; i += 0x1000) {
+		uintptr_t phys = map_to_physical((uintptr_t)pages + i) & ~0xFFF;
+		dma_frame(get_page(VDSO_ADDRESS + i, 1, kernel_directory), 0, 0, phys);
+		invalidate_tables_at(VDSO_ADDRESS + i);
+	}
+
+	vdso_data = (struct vdso_data *)pages;
+	uint8_t * code = pages + 0x1000;
+
+	if (sysenter_available && !args_present("nosysenter")) {
+		memcpy(code, vdso_sysenter_start, vdso_sysenter_end - vdso_sysenter_start);
+		sysenter_return = VDSO_ADDRESS + 0x1000 + (vdso_sysenter_exit - vdso_sysenter_start);
+		vdso_data->features |= VDSO_SYSENTER;
+		debug_print(NOTICE, "vdso: system calls use sysenter");
+	} else {
+		memcpy(code, vdso_int_start, vdso_int_end - vdso_int_start);
+		debug_print(NOTICE, "vdso: system calls use int 0x7F");
+	}
+	vdso_data->syscall = VDSO_ADDRESS + 0x1000;
+
+	memcpy(pages + (VDSO_SIGRETURN - VDSO_ADDRESS), vdso_sigreturn_start, vdso_sigreturn_end - vdso_sigreturn_start);
+
+	vdso_update();
+}
+
+/*
+ * Publish the time. Called from the timer on the bootstrap processor,
+ * which is the only writer; readers retry while the sequence is odd
+ * or changes under them.
+ */
+void vdso_update(void) {
+	if (!vdso_data) return;
+	vdso_data->sequence++;
+	asm volatile ("" ::: "memory");
+	vdso_data->seconds  = boot_time + timer_ticks + timer_drift;
+	vdso_data->useconds = timer_subticks * 1000;
+	asm volatile ("" ::: "memory");
+	vdso_data->sequence++;
+}
@@ -10,6 +10,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#include <stdlib.h>
 #include <fcntl.h>
 
 #include <sys/ioctl.h>
@@ -20,6 +21,7 @@
 #include <kernel/video.h>
 
 #include <toaru/graphics.h>
+#include <toaru/inflate.h>
 
 static inline int32_t min(int32_t a, int32_t b) {
 	return (a < b) ? a : b;
@@ -255,186 +257,697 @@ uint32_t premultiply(uint32_t color) {
 	return rgba(r,g,b,a);
 }
 
-static int clamp(int a, int l, int h) {
-	return a < l ? l : (a > h ? h : a);
+/*
+ * Box blur
+ *
+ * Each pass slides a window of 2 * half + 1 pixels along a row, keeping
+ * a running sum of all four channels in one SSE register, so the cost
+ * doesn't depend on the radius. Near the edges the window is cut short
+ * and the average is over the pixels that are left. Columns are
+ * blurred by transposing the image in small blocks, running the same
+ * row passes over the transposed rows, and transposing back, which
+ * keeps every pass reading memory in order.
+ */
+
+#define BLUR_BLOCK 32
+
+static inline __m128i blur_unpack(uint32_t pixel) {
+	__m128i zero = _mm_setzero_si128();
+	return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel), zero), zero);
 }
 
-static void _box_blur_horizontal(gfx_context_t * _src, int radius) {
-	uint32_t * p = (uint32_t *)_src->backbuffer;
-	int w = _src->width;
-	int h = _src->height;
-	int half_radius = radius / 2;
-	int index = 0;
-	uint32_t * out_color = calloc(sizeof(uint32_t), w);
-
-	for (int y = 0; y < h; y++) {
-		int hits = 0;
-		int r = 0;
-		int g = 0;
-		int b = 0;
-		int a = 0;
-		for (int x = -half_radius; x < w; x++) {
-			int old_p = x - half_radius - 1;
-			if (old_p >= 0)
-			{
-				uint32_t col = p[clamp(index + old_p, 0, w*h-1)];
-				if (col) {
-					r -= _RED(col);
-					g -= _GRE(col);
-					b -= _BLU(col);
-					a -= _ALP(col);
-				}
-				hits--;
-			}
+static inline uint32_t blur_pack(__m128i sum, __m128 scale) {
+	__m128 avg = _mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(sum), _mm_set1_ps(0.5f)), scale);
+	__m128i v = _mm_cvttps_epi32(avg);
+	v = _mm_packs_epi32(v, v);
+	return _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+}
 
-			int newPixel = x + half_radius;
-			if (newPixel < w) {
-				int col = p[clamp(index + newPixel, 0, w*h-1)];
-				if (col != 0) {
-					r += _RED(col);
-					g += _GRE(col);
-					b += _BLU(col);
-					a += _ALP(col);
-				}
-				hits++;
-			}
+/*
+ * One pass over a row of n pixels. The +0.5 makes the float division
+ * truncate the same way integer division would. Away from the edges
+ * the window is always full, so that stretch gets its own loop.
+ */
+__attribute__((__force_align_arg_pointer__))
+static void box_blur_row(uint32_t * out, const uint32_t * in, int n, int half, const float * recip) {
+	__m128i sum = _mm_setzero_si128();
 
-			if (x >= 0) {
-				out_color[x] = rgba(r / hits, g / hits, b / hits, a / hits);
-			}
-		}
+	for (int x = 0; x < half && x < n; ++x) {
+		sum = _mm_add_epi32(sum, blur_unpack(in[x]));
+	}
+
+	int x = 0;
+	int full_from = half + 1 < n ? half + 1 : n;
+	int full_to   = n - half;
 
-		for (int x = 0; x < w; x++) {
-			p[index + x] = out_color[x];
+	for (; x < full_from; ++x) {
+		if (x + half < n) {
+			sum = _mm_add_epi32(sum, blur_unpack(in[x + half]));
 		}
+		int last = x + half >= n ? n - 1 : x + half;
+		out[x] = blur_pack(sum, _mm_set1_ps(recip[last + 1]));
+	}
 
-		index += w;
+	__m128 scale = _mm_set1_ps(recip[2 * half + 1 < n ? 2 * half + 1 : n]);
+	for (; x < full_to; ++x) {
+		sum = _mm_add_epi32(sum, blur_unpack(in[x + half]));
+		sum = _mm_sub_epi32(sum, blur_unpack(in[x - half - 1]));
+		out[x] = blur_pack(sum, scale);
 	}
 
-	free(out_color);
+	for (; x < n; ++x) {
+		sum = _mm_sub_epi32(sum, blur_unpack(in[x - half - 1]));
+		out[x] = blur_pack(sum, _mm_set1_ps(recip[n - (x - half)]));
+	}
 }
 
-static void _box_blur_vertical(gfx_context_t * _src, int radius) {
-	uint32_t * p = (uint32_t *)_src->backbuffer;
-	int w = _src->width;
-	int h = _src->height;
-	int half_radius = radius / 2;
-
-	uint32_t * out_color = calloc(sizeof(uint32_t), h);
-	int old_offset = -(half_radius + 1) * w;
-	int new_offset = (half_radius) * w;
-
-	for (int x = 0; x < w; x++) {
-		int hits = 0;
-		int r = 0;
-		int g = 0;
-		int b = 0;
-		int a = 0;
-		int index = -half_radius * w + x;
-		for (int y = -half_radius; y < h; y++) {
-			int old_p = y - half_radius - 1;
-			if (old_p >= 0) {
-				uint32_t col = p[clamp(index + old_offset, 0, w*h-1)];
-				if (col != 0) {
-					r -= _RED(col);
-					g -= _GRE(col);
-					b -= _BLU(col);
-					a -= _ALP(col);
+/* Write the w x h pixels at src into dst as h x w; strides are in pixels */
+__attribute__((__force_align_arg_pointer__))
+static void blur_transpose(uint32_t * dst, int dst_stride, const uint32_t * src, int src_stride, int w, int h) {
+	for (int by = 0; by < h; by += BLUR_BLOCK) {
+		int ey = by + BLUR_BLOCK < h ? by + BLUR_BLOCK : h;
+		for (int bx = 0; bx < w; bx += BLUR_BLOCK) {
+			int ex = bx + BLUR_BLOCK < w ? bx + BLUR_BLOCK : w;
+			int y = by;
+			for (; y + 4 <= ey; y += 4) {
+				int x = bx;
+				for (; x + 4 <= ex; x += 4) {
+					/* 4x4 tile */
+					__m128i r0 = _mm_loadu_si128((const __m128i *)&src[(y + 0) * src_stride + x]);
+					__m128i r1 = _mm_loadu_si128((const __m128i *)&src[(y + 1) * src_stride + x]);
+					__m128i r2 = _mm_loadu_si128((const __m128i *)&src[(y + 2) * src_stride + x]);
+					__m128i r3 = _mm_loadu_si128((const __m128i *)&src[(y + 3) * src_stride + x]);
+					__m128i t0 = _mm_unpacklo_epi32(r0, r1);
+					__m128i t1 = _mm_unpacklo_epi32(r2, r3);
+					__m128i t2 = _mm_unpackhi_epi32(r0, r1);
+					__m128i t3 = _mm_unpackhi_epi32(r2, r3);
+					_mm_storeu_si128((__m128i *)&dst[(x + 0) * dst_stride + y], _mm_unpacklo_epi64(t0, t1));
+					_mm_storeu_si128((__m128i *)&dst[(x + 1) * dst_stride + y], _mm_unpackhi_epi64(t0, t1));
+					_mm_storeu_si128((__m128i *)&dst[(x + 2) * dst_stride + y], _mm_unpacklo_epi64(t2, t3));
+					_mm_storeu_si128((__m128i *)&dst[(x + 3) * dst_stride + y], _mm_unpackhi_epi64(t2, t3));
 				}
-				hits--;
-			}
-
-			int newPixel = y + half_radius;
-			if (newPixel < h) {
-				uint32_t col = p[clamp(index + new_offset, 0, w*h-1)];
-				if (col != 0)
-				{
-					r += _RED(col);
-					g += _GRE(col);
-					b += _BLU(col);
-					a += _ALP(col);
+				for (; x < ex; ++x) {
+					for (int i = 0; i < 4; ++i) {
+						dst[x * dst_stride + y + i] = src[(y + i) * src_stride + x];
+					}
 				}
-				hits++;
 			}
-
-			if (y >= 0) {
-				out_color[y] = rgba(r / hits, g / hits, b / hits, a / hits);
+			for (; y < ey; ++y) {
+				for (int x = bx; x < ex; ++x) {
+					dst[x * dst_stride + y] = src[y * src_stride + x];
+				}
 			}
-
-			index += w;
 		}
+	}
+}
 
-		for (int y = 0; y < h; y++) {
-			p[y * w + x] = out_color[y];
+/* Run each pass in turn over every row, in place */
+static void blur_rows(uint32_t * p, int stride, int w, int h, const int * halves, int passes, uint32_t * tmp[2], float * recip) {
+	for (int y = 0; y < h; ++y) {
+		uint32_t * row = &p[y * stride];
+		const uint32_t * in = row;
+		for (int i = 0; i < passes; ++i) {
+			box_blur_row(tmp[i % 2], in, w, halves[i], recip);
+			in = tmp[i % 2];
 		}
+		memcpy(row, in, w * sizeof(uint32_t));
 	}
+}
 
-	free(out_color);
+static void blur_context_passes(gfx_context_t * _src, const int * halves, int passes) {
+	int w = _src->width;
+	int h = _src->height;
+	int stride = _src->stride / sizeof(uint32_t);
+	uint32_t * p = (uint32_t *)_src->backbuffer;
+
+	int widest = 0;
+	for (int i = 0; i < passes; ++i) {
+		if (halves[i] > widest) widest = halves[i];
+	}
+	if (!widest || !w || !h) return;
+
+	/* 1/n for every window size that can come up */
+	int longest = w > h ? w : h;
+	int windows = 2 * widest + 1 < longest ? 2 * widest + 1 : longest;
+	float * recip = malloc(sizeof(float) * (windows + 1));
+	for (int i = 1; i <= windows; ++i) {
+		recip[i] = 1.0f / (float)i;
+	}
+
+	uint32_t * tmp[2] = { malloc(sizeof(uint32_t) * longest), malloc(sizeof(uint32_t) * longest) };
+	uint32_t * transposed = malloc(sizeof(uint32_t) * w * h);
+
+	blur_rows(p, stride, w, h, halves, passes, tmp, recip);
+	blur_transpose(transposed, h, p, stride, w, h);
+	blur_rows(transposed, h, h, w, halves, passes, tmp, recip);
+	blur_transpose(p, stride, transposed, h, h, w);
+
+	free(transposed);
+	free(tmp[0]);
+	free(tmp[1]);
+	free(recip);
 }
 
 void blur_context_box(gfx_context_t * _src, int radius) {
-	_box_blur_horizontal(_src,radius);
-	_box_blur_vertical(_src,radius);
-}
-
-void load_sprite(sprite_t * sprite, char * filename) {
-	/* Open the requested binary */
-	FILE * image = fopen(filename, "r");
-	size_t image_size= 0;
-
-	fseek(image, 0, SEEK_END);
-	image_size = ftell(image);
-	fseek(image, 0, SEEK_SET);
-
-	/* Alright, we have the length */
-	char * bufferb = malloc(image_size);
-	fread(bufferb, image_size, 1, image);
-	uint16_t x = 0; /* -> 212 */
-	uint16_t y = 0; /* -> 68 */
-	/* Get the width / height of the image */
-	signed int *bufferi = (signed int *)((uintptr_t)bufferb + 2);
-	uint32_t width  = bufferi[4];
-	uint32_t height = bufferi[5];
-	uint16_t bpp    = bufferi[6] / 0x10000;
-	uint32_t row_width = (bpp * width + 31) / 32 * 4;
-	/* Skip right to the important part */
-	size_t i = bufferi[2];
+	int half = radius / 2;
+	blur_context_passes(_src, &half, 1);
+}
+
+/*
+ * Three box blurs sized so their combined variance is sigma^2 look
+ * just about like a Gaussian blur, at the cost of three box passes.
+ */
+#define GAUSSIAN_PASSES 3
+
+void blur_context_gaussian(gfx_context_t * _src, double sigma) {
+	if (sigma <= 0.0) return;
+
+	/* The widest odd box that isn't too wide, and the next one up */
+	int lower = (int)sqrt(12.0 * sigma * sigma / GAUSSIAN_PASSES + 1.0);
+	if (lower % 2 == 0) lower--;
+	int upper = lower + 2;
+
+	/* How many of the passes use the smaller box */
+	int small = (int)((12.0 * sigma * sigma - GAUSSIAN_PASSES * lower * lower - 4.0 * GAUSSIAN_PASSES * lower - 3.0 * GAUSSIAN_PASSES) / (-4.0 * lower - 4.0) + 0.5);
 
-	sprite->width = width;
+	int halves[GAUSSIAN_PASSES];
+	for (int i = 0; i < GAUSSIAN_PASSES; ++i) {
+		halves[i] = ((i < small ? lower : upper) - 1) / 2;
+	}
+	blur_context_passes(_src, halves, GAUSSIAN_PASSES);
+}
+
+/*
+ * Image loading
+ *
+ * Images are decoded a row at a time straight from the file into the
+ * sprite, so nothing else as big as the image is ever allocated, and
+ * rows are converted to premultiplied ARGB four pixels at a time with
+ * SSE2. Bitmaps (24- and 32-bit, and 8-bit as grey) and
+ * non-interlaced PNGs are supported; anything else fails to load and
+ * leaves an empty sprite.
+ */
+
+/* Scratch rows get some slack so the vector loops can read past the end */
+#define ROW_SLACK 16
+
+static void sprite_reset(sprite_t * sprite) {
+	sprite->width  = 0;
+	sprite->height = 0;
+	sprite->bitmap = NULL;
+	sprite->masks  = NULL;
+}
+
+static int sprite_alloc(sprite_t * sprite, uint32_t width, uint32_t height, int progressive) {
+	if (!width || !height || width > 0xFFFF || height > 0xFFFF) return -1;
+	/*
+	 * Every row and clearing loop after this indexes the bitmap with
+	 * width * height, so make sure the byte size can't wrap.
+	 */
+	if (width * height > SIZE_MAX / sizeof(uint32_t)) return -1;
+	sprite->width  = width;
 	sprite->height = height;
-	sprite->bitmap = malloc(sizeof(uint32_t) * width * height);
+	/* Shown before it's complete, so it has to start out transparent */
+	sprite->bitmap = progressive ? calloc(width * height, sizeof(uint32_t)) : malloc(width * height * sizeof(uint32_t));
+	return sprite->bitmap ? 0 : -1;
+}
+
+static inline uint32_t premultiply_fast(uint32_t color) {
+	uint32_t a = _ALP(color);
+	if (a == 0xFF) return color;
+	if (a == 0) return 0;
+	return premultiply(color);
+}
+
+/*
+ * Multiply the colour channels of four ARGB pixels by their alpha.
+ * (x + 1 + (x >> 8)) >> 8 is exactly x / 255 for any product of two
+ * bytes, so this matches premultiply().
+ */
+static inline __m128i premultiply_sse(__m128i pixels) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one  = _mm_set1_epi16(1);
+	const __m128i keep_alpha = _mm_set_epi16(0xFF, 0, 0, 0, 0xFF, 0, 0, 0);
+	const __m128i no_alpha   = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+
+	__m128i lo = _mm_unpacklo_epi8(pixels, zero);
+	__m128i hi = _mm_unpackhi_epi8(pixels, zero);
+
+	/* Each pixel's alpha in its colour lanes, and 255 in its alpha lane */
+	__m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xFF), 0xFF);
+	__m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xFF), 0xFF);
+	alo = _mm_or_si128(_mm_and_si128(alo, no_alpha), keep_alpha);
+	ahi = _mm_or_si128(_mm_and_si128(ahi, no_alpha), keep_alpha);
+
+	lo = _mm_mullo_epi16(lo, alo);
+	hi = _mm_mullo_epi16(hi, ahi);
+	lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, one), _mm_srli_epi16(lo, 8)), 8);
+	hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, one), _mm_srli_epi16(hi, 8)), 8);
+
+	return _mm_packus_epi16(lo, hi);
+}
+
+/* Four three-byte pixels starting at `in`, one per lane (reads 16 bytes) */
+static inline __m128i gather_24(const uint8_t * in) {
+	__m128i v = _mm_loadu_si128((const __m128i *)in);
+	__m128i a = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+	__m128i b = _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9));
+	return _mm_unpacklo_epi64(a, b);
+}
+
+/* Swap the bytes that end up as red and blue */
+static inline __m128i swap_rb(__m128i v) {
+	const __m128i ga = _mm_set1_epi32(0xFF00FF00);
+	const __m128i b  = _mm_set1_epi32(0x000000FF);
+	__m128i rb = _mm_andnot_si128(ga, v);
+	return _mm_or_si128(_mm_and_si128(v, ga),
+		_mm_or_si128(_mm_srli_epi32(rb, 16), _mm_slli_epi32(_mm_and_si128(rb, b), 16)));
+}
+
+/* B, G, R (24-bit bitmaps) */
+__attribute__((__force_align_arg_pointer__))
+static void convert_bgr(uint32_t * out, const uint8_t * in, int width) {
+	const __m128i opaque = _mm_set1_epi32(0xFF000000);
+	int x = 0;
+	for (; x + 4 <= width; x += 4) {
+		_mm_storeu_si128((__m128i *)(out + x), _mm_or_si128(gather_24(in + 3 * x), opaque));
+	}
+	for (; x < width; ++x) {
+		out[x] = 0xFF000000 | (in[3 * x + 2] << 16) | (in[3 * x + 1] << 8) | in[3 * x];
+	}
+}
+
+/* R, G, B (PNG truecolour) */
+__attribute__((__force_align_arg_pointer__))
+static void convert_rgb(uint32_t * out, const uint8_t * in, int width) {
+	const __m128i opaque = _mm_set1_epi32(0xFF000000);
+	int x = 0;
+	for (; x + 4 <= width; x += 4) {
+		_mm_storeu_si128((__m128i *)(out + x), _mm_or_si128(swap_rb(gather_24(in + 3 * x)), opaque));
+	}
+	for (; x < width; ++x) {
+		out[x] = 0xFF000000 | (in[3 * x] << 16) | (in[3 * x + 1] << 8) | in[3 * x + 2];
+	}
+}
+
+/* A, B, G, R (32-bit bitmaps, as this loader has always read them) */
+__attribute__((__force_align_arg_pointer__))
+static void convert_abgr(uint32_t * out, const uint8_t * in, int width) {
+	int x = 0;
+	for (; x + 4 <= width; x += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + 4 * x));
+		v = _mm_or_si128(_mm_srli_epi32(v, 8), _mm_slli_epi32(v, 24));
+		_mm_storeu_si128((__m128i *)(out + x), premultiply_sse(v));
+	}
+	for (; x < width; ++x) {
+		const uint8_t * p = in + 4 * x;
+		out[x] = premultiply_fast((p[0] << 24) | (p[3] << 16) | (p[2] << 8) | p[1]);
+	}
+}
+
+/* R, G, B, A (PNG truecolour with alpha) */
+__attribute__((__force_align_arg_pointer__))
+static void convert_rgba(uint32_t * out, const uint8_t * in, int width) {
+	int x = 0;
+	for (; x + 4 <= width; x += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + 4 * x));
+		_mm_storeu_si128((__m128i *)(out + x), premultiply_sse(swap_rb(v)));
+	}
+	for (; x < width; ++x) {
+		const uint8_t * p = in + 4 * x;
+		out[x] = premultiply_fast((p[3] << 24) | (p[0] << 16) | (p[1] << 8) | p[2]);
+	}
+}
+
+static void convert_grey(uint32_t * out, const uint8_t * in, int width) {
+	for (int x = 0; x < width; ++x) {
+		out[x] = rgb(in[x], in[x], in[x]);
+	}
+}
+
+static uint32_t read_le32(const uint8_t * p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+}
+
+static int load_bmp(FILE * file, sprite_t * sprite, sprite_progress_t progress, void * data) {
+	uint8_t header[54];
+	if (fread(header, sizeof(header), 1, file) != 1) return -1;
+
+	uint32_t offset = read_le32(&header[10]);
+	int32_t  width  = read_le32(&header[18]);
+	int32_t  height = read_le32(&header[22]);
+	uint16_t bpp    = header[28] | (header[29] << 8);
+
+	void (*convert)(uint32_t *, const uint8_t *, int);
+	switch (bpp) {
+		case 24: convert = convert_bgr;  break;
+		case 32: convert = convert_abgr; break;
+		case 8:  convert = convert_grey; break;
+		default: return -1;
+	}
 
+	/* Rows are stored bottom to top, unless the height is negative */
+	int top_down = height < 0;
+	if (top_down) height = -height;
+	if (width <= 0 || sprite_alloc(sprite, width, height, !!progress)) return -1;
+	if (progress) progress(sprite, 0, 0, data);
+
+	uint32_t row_width = (bpp * width + 31) / 32 * 4;
+	uint8_t * row = malloc(row_width + ROW_SLACK);
+	if (!row || fseek(file, offset, SEEK_SET) < 0) {
+		free(row);
+		return -1;
+	}
+
+	int y;
 	for (y = 0; y < height; ++y) {
-		for (x = 0; x < width; ++x) {
-			if (i > image_size) goto _cleanup_sprite;
-			/* Extract the color */
-			uint32_t color;
-			if (bpp == 24) {
-				color =	(bufferb[i   + 3 * x] & 0xFF) +
-						(bufferb[i+1 + 3 * x] & 0xFF) * 0x100 +
-						(bufferb[i+2 + 3 * x] & 0xFF) * 0x10000 + 0xFF000000;
-			} else if (bpp == 32) {
-				if (bufferb[i + 4 * x] == 0) {
-					color = 0x000000;
-				} else {
-					color =	(bufferb[i   + 4 * x] & 0xFF) * 0x1000000 +
-							(bufferb[i+1 + 4 * x] & 0xFF) * 0x1 +
-							(bufferb[i+2 + 4 * x] & 0xFF) * 0x100 +
-							(bufferb[i+3 + 4 * x] & 0xFF) * 0x10000;
-					color = premultiply(color);
-				}
+		if (fread(row, row_width, 1, file) != 1) break;
+		int out = top_down ? y : height - y - 1;
+		convert(&sprite->bitmap[out * width], row, width);
+		if (progress) progress(sprite, out, 1, data);
+	}
+
+	free(row);
+	if (y < height) {
+		/* Truncated; clear whatever wasn't read */
+		if (!progress) {
+			if (top_down) {
+				memset(&sprite->bitmap[y * width], 0, (height - y) * width * sizeof(uint32_t));
+			} else {
+				memset(sprite->bitmap, 0, (height - y) * width * sizeof(uint32_t));
+			}
+		}
+		return -1;
+	}
+	return 0;
+}
+
+/* PNG */
+
+#define PNG_GREY       0
+#define PNG_TRUECOLOR  2
+#define PNG_INDEXED    3
+#define PNG_GREY_ALPHA 4
+#define PNG_TRUECOLOR_ALPHA 6
+
+struct png_loader {
+	FILE * file;
+	sprite_t * sprite;
+	sprite_progress_t progress;
+	void * data;
+
+	uint32_t chunk_left;  /* Of the current IDAT */
+	int done;             /* No more IDAT chunks */
+
+	int color_type;
+	int depth;
+	int channels;
+	uint32_t stride;      /* Bytes in a row, without the filter byte */
+	uint32_t pixel;       /* Bytes per pixel for filtering, at least 1 */
+	uint8_t * row;        /* Filter byte, then the row being assembled */
+	uint8_t * prev;       /* The previous row, unfiltered */
+	uint8_t * samples;    /* 16-bit rows cut down to 8 */
+	uint32_t row_fill;
+	uint32_t y;
+
+	uint32_t palette[256];
+};
+
+static uint32_t read_be32(const uint8_t * p) {
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static int png_chunk_header(FILE * file, uint32_t * length, char type[4]) {
+	uint8_t header[8];
+	if (fread(header, sizeof(header), 1, file) != 1) return -1;
+	*length = read_be32(header);
+	memcpy(type, header + 4, 4);
+	return 0;
+}
+
+/* Compressed data is the IDAT chunks back to back, read as needed */
+static size_t png_read(inflate_stream_t * stream, uint8_t * buf, size_t size) {
+	struct png_loader * png = stream->data;
+	while (!png->chunk_left) {
+		if (png->done) return 0;
+		char type[4];
+		/* Skip the CRC of the last chunk */
+		if (fseek(png->file, 4, SEEK_CUR) < 0 || png_chunk_header(png->file, &png->chunk_left, type) || memcmp(type, "IDAT", 4)) {
+			png->done = 1;
+			return 0;
+		}
+	}
+	if (size > png->chunk_left) size = png->chunk_left;
+	size_t r = fread(buf, 1, size, png->file);
+	if (!r) png->done = 1;
+	png->chunk_left -= r;
+	return r;
+}
+
+static uint8_t paeth(int a, int b, int c) {
+	int p  = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+	if (pa <= pb && pa <= pc) return a;
+	if (pb <= pc) return b;
+	return c;
+}
+
+__attribute__((__force_align_arg_pointer__))
+static int png_unfilter(struct png_loader * png) {
+	uint8_t * cur  = png->row + 1;
+	uint8_t * prev = png->prev;
+	uint32_t n = png->stride;
+	uint32_t bpp = png->pixel;
+
+	switch (png->row[0]) {
+		case 0:
+			break;
+		case 1: /* Sub */
+			for (uint32_t i = bpp; i < n; ++i) cur[i] += cur[i - bpp];
+			break;
+		case 2: { /* Up */
+			uint32_t i = 0;
+			for (; i + 16 <= n; i += 16) {
+				__m128i c = _mm_loadu_si128((__m128i *)(cur + i));
+				__m128i p = _mm_loadu_si128((__m128i *)(prev + i));
+				_mm_storeu_si128((__m128i *)(cur + i), _mm_add_epi8(c, p));
+			}
+			for (; i < n; ++i) cur[i] += prev[i];
+			break;
+		}
+		case 3: /* Average */
+			for (uint32_t i = 0; i < n; ++i) {
+				int left = i >= bpp ? cur[i - bpp] : 0;
+				cur[i] += (left + prev[i]) >> 1;
+			}
+			break;
+		case 4: /* Paeth */
+			for (uint32_t i = 0; i < n; ++i) {
+				int left = i >= bpp ? cur[i - bpp] : 0;
+				int upleft = i >= bpp ? prev[i - bpp] : 0;
+				cur[i] += paeth(left, prev[i], upleft);
+			}
+			break;
+		default:
+			return -1;
+	}
+	return 0;
+}
+
+static void png_convert(struct png_loader * png, uint32_t * out) {
+	const uint8_t * in = png->row + 1;
+	int width = png->sprite->width;
+
+	if (png->depth == 16) {
+		/* Keep the high byte of each sample */
+		uint32_t samples = width * png->channels;
+		for (uint32_t i = 0; i < samples; ++i) {
+			png->samples[i] = in[i * 2];
+		}
+		in = png->samples;
+	}
+
+	if (png->depth < 8) {
+		/* Packed grey or palette indices, most significant bits first */
+		int per_byte = 8 / png->depth;
+		int mask = (1 << png->depth) - 1;
+		for (int x = 0; x < width; ++x) {
+			int shift = 8 - png->depth * (x % per_byte + 1);
+			int v = (in[x / per_byte] >> shift) & mask;
+			if (png->color_type == PNG_INDEXED) {
+				out[x] = png->palette[v];
 			} else {
-				color = rgb(bufferb[i + x],bufferb[i + x],bufferb[i + x]); /* Unsupported */
+				int g = v * 255 / mask;
+				out[x] = rgb(g, g, g);
+			}
+		}
+		return;
+	}
+
+	switch (png->color_type) {
+		case PNG_GREY:
+			convert_grey(out, in, width);
+			break;
+		case PNG_TRUECOLOR:
+			convert_rgb(out, in, width);
+			break;
+		case PNG_INDEXED:
+			for (int x = 0; x < width; ++x) out[x] = png->palette[in[x]];
+			break;
+		case PNG_GREY_ALPHA:
+			for (int x = 0; x < width; ++x) {
+				out[x] = premultiply_fast(rgba(in[2 * x], in[2 * x], in[2 * x], in[2 * x + 1]));
+			}
+			break;
+		case PNG_TRUECOLOR_ALPHA:
+			convert_rgba(out, in, width);
+			break;
+	}
+}
+
+/* Decompressed data is filtered rows; each one is finished as soon as it's complete */
+static int png_write(inflate_stream_t * stream, const uint8_t * buf, size_t size) {
+	struct png_loader * png = stream->data;
+	sprite_t * sprite = png->sprite;
+
+	while (size) {
+		uint32_t n = png->stride + 1 - png->row_fill;
+		if (n > size) n = size;
+		memcpy(png->row + png->row_fill, buf, n);
+		png->row_fill += n;
+		buf += n;
+		size -= n;
+
+		if (png->row_fill < png->stride + 1) break;
+
+		if (png_unfilter(png)) return 1;
+		png_convert(png, &sprite->bitmap[png->y * sprite->width]);
+		if (png->progress) png->progress(sprite, png->y, 1, png->data);
+
+		memcpy(png->prev, png->row + 1, png->stride);
+		png->row_fill = 0;
+		if (++png->y == sprite->height) return 1;
+	}
+	return 0;
+}
+
+static int load_png(FILE * file, sprite_t * sprite, sprite_progress_t progress, void * data) {
+	static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	uint8_t buf[13];
+	if (fread(buf, 8, 1, file) != 1 || memcmp(buf, signature, 8)) return -1;
+
+	uint32_t length;
+	char type[4];
+	if (png_chunk_header(file, &length, type) || memcmp(type, "IHDR", 4) || length != 13) return -1;
+	if (fread(buf, 13, 1, file) != 1) return -1;
+
+	struct png_loader * png = calloc(1, sizeof(struct png_loader));
+	png->file       = file;
+	png->sprite     = sprite;
+	png->progress   = progress;
+	png->data       = data;
+	png->depth      = buf[8];
+	png->color_type = buf[9];
+
+	uint32_t width  = read_be32(buf);
+	uint32_t height = read_be32(buf + 4);
+	int ok_depth;
+	switch (png->color_type) {
+		case PNG_GREY:            png->channels = 1; ok_depth = png->depth <= 8 || png->depth == 16; break;
+		case PNG_TRUECOLOR:       png->channels = 3; ok_depth = png->depth == 8 || png->depth == 16; break;
+		case PNG_INDEXED:         png->channels = 1; ok_depth = png->depth <= 8; break;
+		case PNG_GREY_ALPHA:      png->channels = 2; ok_depth = png->depth == 8 || png->depth == 16; break;
+		case PNG_TRUECOLOR_ALPHA: png->channels = 4; ok_depth = png->depth == 8 || png->depth == 16; break;
+		default:                  ok_depth = 0; break;
+	}
+	/* Bit depths are powers of two; interlaced images aren't supported */
+	if (!ok_depth || (png->depth & (png->depth - 1)) || buf[10] || buf[11] || buf[12]) {
+		free(png);
+		return -1;
+	}
+
+	uint32_t bits = png->channels * png->depth;
+	png->stride = (width * bits + 7) / 8;
+	png->pixel  = bits < 8 ? 1 : bits / 8;
+
+	/* Everything up to the first IDAT: the palette and its transparency */
+	int err = -1;
+	while (1) {
+		if (fseek(file, 4, SEEK_CUR) < 0 || png_chunk_header(file, &length, type)) goto _done;
+		if (!memcmp(type, "IDAT", 4)) break;
+		if (!memcmp(type, "PLTE", 4) && length <= 768 && length % 3 == 0) {
+			uint8_t rgbs[768];
+			if (fread(rgbs, length, 1, file) != 1) goto _done;
+			for (uint32_t i = 0; i < length / 3; ++i) {
+				png->palette[i] = rgb(rgbs[3 * i], rgbs[3 * i + 1], rgbs[3 * i + 2]);
+			}
+		} else if (!memcmp(type, "tRNS", 4) && png->color_type == PNG_INDEXED && length <= 256) {
+			uint8_t alpha[256];
+			if (fread(alpha, length, 1, file) != 1) goto _done;
+			for (uint32_t i = 0; i < length; ++i) {
+				png->palette[i] = premultiply((png->palette[i] & 0xFFFFFF) | (alpha[i] << 24));
 			}
-			/* Set our point */
-			sprite->bitmap[(height - y - 1) * width + x] = color;
+		} else if (!memcmp(type, "IEND", 4)) {
+			goto _done;
+		} else if (fseek(file, length, SEEK_CUR) < 0) {
+			goto _done;
 		}
-		i += row_width;
 	}
+	png->chunk_left = length;
+
+	if (sprite_alloc(sprite, width, height, !!progress)) goto _done;
+	if (progress) progress(sprite, 0, 0, data);
+
+	png->row     = malloc(png->stride + 1 + ROW_SLACK);
+	png->prev    = calloc(png->stride + ROW_SLACK, 1);
+	png->samples = malloc(width * png->channels + ROW_SLACK);
+
+	inflate_stream_t stream = { png_read, png_write, png };
+	inflate_zlib(&stream);
+
+	if (png->y < height) {
+		/* Truncated or corrupt; clear whatever wasn't decoded */
+		memset(&sprite->bitmap[png->y * width], 0, (height - png->y) * width * sizeof(uint32_t));
+	} else {
+		err = 0;
+	}
+
+	free(png->row);
+	free(png->prev);
+	free(png->samples);
+_done:
+	free(png);
+	return err;
+}
+
+int load_sprite_progressive(sprite_t * sprite, char * filename, sprite_progress_t progress, void * data) {
+	sprite_reset(sprite);
+
+	FILE * file = fopen(filename, "r");
+	if (!file) return -1;
+
+	uint8_t magic[2];
+	int err = -1;
+	if (fread(magic, 2, 1, file) == 1) {
+		rewind(file);
+		if (magic[0] == 'B' && magic[1] == 'M') {
+			err = load_bmp(file, sprite, progress, data);
+		} else if (magic[0] == 0x89 && magic[1] == 'P') {
+			err = load_png(file, sprite, progress, data);
+		}
+	}
+	fclose(file);
+
+	if (err && !sprite->bitmap) {
+		sprite_reset(sprite);
+	}
+	return err;
+}
 
-_cleanup_sprite:
-	fclose(image);
-	free(bufferb);
+int load_sprite(sprite_t * sprite, char * filename) {
+	return load_sprite_progressive(sprite, filename, NULL, NULL);
 }
 
 static __m128i mask00ff;
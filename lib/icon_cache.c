@@ -7,53 +7,129 @@
  *
  * Used be a few different applications.
  * Probably needs scaling?
+ *
+ * Icons come from the shared icon atlas when they're in it, and
+ * from their bitmaps otherwise.
  */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <toaru/graphics.h>
 #include <toaru/hashmap.h>
+#include <toaru/icon_cache.h>
+
+#define ICON_DIR "/usr/share/icons"
 
 static hashmap_t * icon_cache_16;
 static hashmap_t * icon_cache_48;
 
+/* Search paths, under ICON_DIR */
 static char * icon_directories_16[] = {
-	"/usr/share/icons/16",
-	"/usr/share/icons/24",
-	"/usr/share/icons/48",
-	"/usr/share/icons",
-	"/usr/share/icons/external",
+	"16/",
+	"24/",
+	"48/",
+	"",
+	"external/",
 	NULL
 };
 
 static char * icon_directories_48[] = {
-	"/usr/share/icons/48",
-	"/usr/share/icons/24",
-	"/usr/share/icons/16",
-	"/usr/share/icons",
-	"/usr/share/icons/external",
+	"48/",
+	"24/",
+	"16/",
+	"",
+	"external/",
 	NULL
 };
 
+static struct icon_atlas_header * atlas = NULL;
+static struct icon_atlas_entry * atlas_index = NULL;
+
+static void open_atlas(void) {
+	int fd = open(ICON_ATLAS_PATH, O_RDONLY);
+	if (fd < 0) return;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct icon_atlas_header)) {
+		close(fd);
+		return;
+	}
+
+	/* Shared, so every process maps the same pages */
+	struct icon_atlas_header * header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED) return;
+
+	if (header->magic != ICON_ATLAS_MAGIC ||
+		header->version != ICON_ATLAS_VERSION ||
+		header->size != (uint32_t)st.st_size ||
+		header->count > (header->size - sizeof(struct icon_atlas_header)) / sizeof(struct icon_atlas_entry)) {
+		munmap(header, st.st_size);
+		return;
+	}
+
+	/* Names are compared with strcmp, so they have to end within the entry */
+	struct icon_atlas_entry * index = (struct icon_atlas_entry *)(header + 1);
+	for (uint32_t i = 0; i < header->count; ++i) {
+		if (!memchr(index[i].name, '\0', sizeof(index[i].name))) {
+			munmap(header, st.st_size);
+			return;
+		}
+	}
+
+	atlas = header;
+	atlas_index = index;
+}
+
+static int atlas_compare(const void * key, const void * entry) {
+	return strcmp(key, ((const struct icon_atlas_entry *)entry)->name);
+}
+
+/*
+ * Load an icon from a path under ICON_DIR, without the .bmp. Icons
+ * from the atlas point straight at its pixels.
+ */
+static sprite_t * icon_load(const char * path) {
+	if (atlas) {
+		struct icon_atlas_entry * entry = bsearch(path, atlas_index, atlas->count,
+			sizeof(struct icon_atlas_entry), atlas_compare);
+		if (entry && entry->offset <= atlas->size &&
+			(uint64_t)entry->width * entry->height * sizeof(uint32_t) <= atlas->size - entry->offset) {
+			sprite_t * icon = calloc(1, sizeof(sprite_t));
+			icon->width  = entry->width;
+			icon->height = entry->height;
+			icon->bitmap = (uint32_t *)((uintptr_t)atlas + entry->offset);
+			icon->alpha  = ALPHA_EMBEDDED;
+			return icon;
+		}
+	}
+
+	char file[100];
+	snprintf(file, sizeof(file), ICON_DIR "/%s.bmp", path);
+	if (access(file, R_OK) != 0) return NULL;
+
+	sprite_t * icon = malloc(sizeof(sprite_t));
+	load_sprite(icon, file);
+	icon->alpha = ALPHA_EMBEDDED;
+	return icon;
+}
+
 __attribute__((constructor))
 static void _init_caches(void) {
+	open_atlas();
+
 	icon_cache_16 = hashmap_create(10);
-	{ /* Generic fallback icon */
-		sprite_t * app_icon = malloc(sizeof(sprite_t));
-		load_sprite(app_icon, "/usr/share/icons/16/applications-generic.bmp");
-		app_icon->alpha = ALPHA_EMBEDDED;
-		hashmap_set(icon_cache_16, "generic", app_icon);
-	}
+	/* Generic fallback icon */
+	hashmap_set(icon_cache_16, "generic", icon_load("16/applications-generic"));
 
 	icon_cache_48 = hashmap_create(10);
-	{ /* Generic fallback icon */
-		sprite_t * app_icon = malloc(sizeof(sprite_t));
-		load_sprite(app_icon, "/usr/share/icons/48/applications-generic.bmp");
-		app_icon->alpha = ALPHA_EMBEDDED;
-		hashmap_set(icon_cache_48, "generic", app_icon);
-	}
+	/* Generic fallback icon */
+	hashmap_set(icon_cache_48, "generic", icon_load("48/applications-generic"));
 }
 
 
@@ -73,12 +149,10 @@ static sprite_t * icon_get_int(const char * name, hashmap_t * icon_cache, char *
 		char path[100];
 		while (icon_directories[i]) {
 			/* Check each path... */
-			sprintf(path, "%s/%s.bmp", icon_directories[i], name);
-			if (access(path, R_OK) == 0) {
+			snprintf(path, sizeof(path), "%s%s", icon_directories[i], name);
+			icon = icon_load(path);
+			if (icon) {
 				/* And if we find one, cache it */
-				icon = malloc(sizeof(sprite_t));
-				load_sprite(icon, path);
-				icon->alpha = ALPHA_EMBEDDED;
 				hashmap_set(icon_cache, (void*)name, icon);
 				return icon;
 			}
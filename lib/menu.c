@@ -21,11 +21,13 @@
 #include <toaru/hashmap.h>
 #include <toaru/list.h>
 #include <toaru/icon_cache.h>
+#include <toaru/widget.h>
 
 #include <toaru/menu.h>
 
 #define MENU_ENTRY_HEIGHT 20
 #define MENU_BACKGROUND rgb(239,238,232)
+#define MENU_BORDER rgb(109,111,112)
 #define MENU_ICON_SIZE 16
 
 #define HILIGHT_BORDER_TOP rgb(54,128,205)
@@ -156,6 +158,7 @@ struct MenuEntry * menu_create_normal(const char * icon, const char * action, co
 	struct MenuEntry_Normal * out = malloc(sizeof(struct MenuEntry_Normal));
 
 	out->_type = MenuEntry_Normal;
+	out->_widget = NULL;
 	out->height = MENU_ENTRY_HEIGHT;
 	out->hilight = 0;
 	out->renderer = _menu_draw_MenuEntry_Normal;
@@ -222,6 +225,7 @@ struct MenuEntry * menu_create_submenu(const char * icon, const char * action, c
 	struct MenuEntry_Submenu * out = malloc(sizeof(struct MenuEntry_Submenu));
 
 	out->_type = MenuEntry_Submenu;
+	out->_widget = NULL;
 	out->height = MENU_ENTRY_HEIGHT;
 	out->hilight = 0;
 	out->renderer = _menu_draw_MenuEntry_Submenu;
@@ -259,6 +263,7 @@ struct MenuEntry * menu_create_separator(void) {
 	struct MenuEntry_Separator * out = malloc(sizeof(struct MenuEntry_Separator));
 
 	out->_type = MenuEntry_Separator;
+	out->_widget = NULL;
 	out->height = 6;
 	out->hilight = 0;
 	out->renderer = _menu_draw_MenuEntry_Separator;
@@ -286,6 +291,10 @@ void menu_update_title(struct MenuEntry * self, char * new_title) {
 		_self->title = strdup(new_title);
 		_self->rwidth = 50 + string_width(_self->title);
 	}
+
+	if (self->_widget) {
+		widget_invalidate(self->_widget);
+	}
 }
 
 static int _close_enough(struct yutani_msg_window_mouse_event * me) {
@@ -372,6 +381,7 @@ struct MenuList * menu_create(void) {
 	p->_bar = NULL;
 	p->parent = NULL;
 	p->closed = 1;
+	p->widgets = NULL;
 	return p;
 }
 
@@ -428,6 +438,7 @@ struct MenuSet * menu_set_from_description(const char * path, void (*callback)(s
 			p->_bar = NULL;
 			p->parent = NULL;
 			p->closed = 1;
+			p->widgets = NULL;
 			hashmap_set(out, line+1, p);
 			current_menu = p;
 		} else if (*line == '#') {
@@ -495,33 +506,50 @@ failure:
 	return NULL;
 }
 
-static void _menu_redraw(yutani_window_t * menu_window, yutani_t * yctx, struct MenuList * menu) {
+/* Window background and border, for any part of the window */
+static void _menu_background(widget_tree_t * tree, gfx_context_t * ctx, widget_rect_t * rect) {
+	for (int y = rect->y; y < rect->y + rect->height; ++y) {
+		for (int x = rect->x; x < rect->x + rect->width; ++x) {
+			int edge = x == 0 || y == 0 || x == ctx->width - 1 || y == ctx->height - 1;
+			GFX(ctx, x, y) = edge ? MENU_BORDER : MENU_BACKGROUND;
+		}
+	}
+}
 
-	gfx_context_t * ctx = menu->ctx;
-	list_t * entries = menu->entries;
-	/* Window background */
-	draw_fill(ctx, MENU_BACKGROUND);
+/* What an entry looks like; it's redrawn when this changes */
+static int _menu_entry_state(struct MenuEntry * entry) {
+	int state = entry->hilight;
+	if (entry->_type == MenuEntry_Submenu) {
+		struct MenuEntry_Submenu * _entry = (struct MenuEntry_Submenu *)entry;
+		if (_entry->_owner && _entry->_my_child && _entry->_owner->child == _entry->_my_child) {
+			state |= 2;
+		}
+	}
+	return state;
+}
 
-	/* Window border */
-	draw_line(ctx, 0, ctx->width-1, 0, 0, rgb(109,111,112));
-	draw_line(ctx, 0, 0, 0, ctx->height-1, rgb(109,111,112));
-	draw_line(ctx, ctx->width-1, ctx->width-1, 0, ctx->height-1, rgb(109,111,112));
-	draw_line(ctx, 0, ctx->width-1, ctx->height-1, ctx->height-1, rgb(109,111,112));
+static void _menu_draw_entry(widget_t * self, gfx_context_t * ctx) {
+	struct MenuEntry * entry = self->data;
+	entry->_drawn = _menu_entry_state(entry);
+	if (entry->renderer) {
+		entry->renderer(ctx, entry, 0);
+	}
+	/* Renderers draw relative to the entry, but submenus are placed by its window offset */
+	entry->offset = self->bounds.y;
+}
 
-	/* Draw menu entries */
-	int offset = 4;
-	foreach(node, entries) {
+/* Redraw the entries whose appearance changed since they were last drawn */
+static void _menu_redraw(yutani_window_t * menu_window, yutani_t * yctx, struct MenuList * menu) {
+	if (!menu->widgets) return;
+
+	foreach(node, menu->entries) {
 		struct MenuEntry * entry = node->value;
-		if (entry->renderer) {
-			entry->renderer(ctx, entry, offset);
+		if (entry->_widget && entry->_drawn != _menu_entry_state(entry)) {
+			widget_invalidate(entry->_widget);
 		}
-
-		offset += entry->height;
 	}
 
-	/* Expose menu */
-	flip(ctx);
-	yutani_flip(yctx, menu_window);
+	widget_render(menu->widgets);
 }
 
 void menu_show(struct MenuList * menu, yutani_t * yctx) {
@@ -544,6 +572,18 @@ void menu_show(struct MenuList * menu, yutani_t * yctx) {
 	menu_window->user_data = menu;
 	menu->window = menu_window;
 
+	/* One widget per entry, so hilighting one only redraws that one */
+	if (menu->widgets) {
+		widget_tree_free(menu->widgets);
+	}
+	menu->widgets = widget_tree_create(yctx, menu_window, menu->ctx, _menu_background, menu);
+	int offset = 4;
+	foreach(node, menu->entries) {
+		struct MenuEntry * entry = node->value;
+		entry->_widget = widget_create(menu->widgets->root, 0, offset, width, entry->height, _menu_draw_entry, entry);
+		offset += entry->height;
+	}
+
 	_menu_redraw(menu_window, yctx, menu);
 
 	hashmap_set(menu_windows, (void*)menu_window->wid, menu_window);
@@ -582,6 +622,11 @@ int menu_definitely_close(struct MenuList * menu) {
 	foreach(node, menu->entries) {
 		struct MenuEntry * entry = node->value;
 		entry->hilight = 0;
+		entry->_widget = NULL;
+	}
+	if (menu->widgets) {
+		widget_tree_free(menu->widgets);
+		menu->widgets = NULL;
 	}
 	menu->closed = 1;
 	yutani_wid_t wid = menu->window->wid;
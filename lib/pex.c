@@ -16,17 +16,20 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 
 #include <toaru/pex.h>
 
 size_t pex_send(FILE * sock, unsigned int rcpt, size_t size, char * blob) {
 	assert(size <= MAX_PACKET_SIZE);
-	pex_header_t * broadcast = malloc(sizeof(pex_header_t) + size);
-	broadcast->target = rcpt;
-	memcpy(broadcast->data, blob, size);
-	size_t out = write(fileno(sock), broadcast, sizeof(pex_header_t) + size);
-	free(broadcast);
-	return out;
+	pex_header_t header;
+	header.target = rcpt;
+	/* The kernel gathers the two into a single packet */
+	struct iovec iov[2] = {
+		{ &header, sizeof(pex_header_t) },
+		{ blob, size },
+	};
+	return writev(fileno(sock), iov, 2);
 }
 
 size_t pex_broadcast(FILE * sock, size_t size, char * blob) {
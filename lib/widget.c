@@ -0,0 +1,280 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * widget - Retained widget trees with damage tracking.
+ *
+ * Keeps a list of damaged rectangles for a window. Rendering grows
+ * each one until every widget it touches is entirely inside it (a
+ * widget is always drawn whole), merges the ones that then overlap,
+ * and repaints and flips each of them separately.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <toaru/yutani.h>
+#include <toaru/graphics.h>
+#include <toaru/list.h>
+#include <toaru/widget.h>
+
+static int rect_empty(widget_rect_t * r) {
+	return r->width <= 0 || r->height <= 0;
+}
+
+static int rect_intersects(widget_rect_t * a, widget_rect_t * b) {
+	return a->x < b->x + b->width && b->x < a->x + a->width &&
+		a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+static int rect_contains(widget_rect_t * outer, widget_rect_t * inner) {
+	return inner->x >= outer->x && inner->y >= outer->y &&
+		inner->x + inner->width <= outer->x + outer->width &&
+		inner->y + inner->height <= outer->y + outer->height;
+}
+
+static void rect_union(widget_rect_t * a, widget_rect_t * b) {
+	int right  = a->x + a->width  > b->x + b->width  ? a->x + a->width  : b->x + b->width;
+	int bottom = a->y + a->height > b->y + b->height ? a->y + a->height : b->y + b->height;
+	a->x = a->x < b->x ? a->x : b->x;
+	a->y = a->y < b->y ? a->y : b->y;
+	a->width  = right - a->x;
+	a->height = bottom - a->y;
+}
+
+/* Clip to the window; widgets and damage outside it are ignored */
+static void rect_clip(widget_tree_t * tree, widget_rect_t * r) {
+	int right  = r->x + r->width;
+	int bottom = r->y + r->height;
+	if (r->x < 0) r->x = 0;
+	if (r->y < 0) r->y = 0;
+	if (right > tree->ctx->width) right = tree->ctx->width;
+	if (bottom > tree->ctx->height) bottom = tree->ctx->height;
+	r->width  = right - r->x;
+	r->height = bottom - r->y;
+}
+
+static void add_damage(widget_tree_t * tree, widget_rect_t rect) {
+	rect_clip(tree, &rect);
+	if (rect_empty(&rect)) return;
+
+	for (int i = 0; i < tree->damage_count; ++i) {
+		if (rect_intersects(&tree->damage[i], &rect)) {
+			rect_union(&tree->damage[i], &rect);
+			return;
+		}
+	}
+
+	if (tree->damage_count == WIDGET_MAX_DAMAGE) {
+		/* Out of room; this one goes in with the last */
+		rect_union(&tree->damage[WIDGET_MAX_DAMAGE - 1], &rect);
+		return;
+	}
+
+	tree->damage[tree->damage_count++] = rect;
+}
+
+/* Merge damage that overlaps; returns 1 if anything changed */
+static int merge_damage(widget_tree_t * tree) {
+	int changed = 0;
+	for (int i = 0; i < tree->damage_count; ++i) {
+		for (int j = i + 1; j < tree->damage_count; ++j) {
+			if (rect_intersects(&tree->damage[i], &tree->damage[j])) {
+				rect_union(&tree->damage[i], &tree->damage[j]);
+				tree->damage[j] = tree->damage[--tree->damage_count];
+				changed = 1;
+				j = i;
+			}
+		}
+	}
+	return changed;
+}
+
+widget_tree_t * widget_tree_create(yutani_t * yctx, yutani_window_t * window, gfx_context_t * ctx,
+		void (*background)(widget_tree_t *, gfx_context_t *, widget_rect_t *), void * data) {
+	widget_tree_t * tree = malloc(sizeof(widget_tree_t));
+	tree->yctx = yctx;
+	tree->window = window;
+	tree->ctx = ctx;
+	tree->background = background;
+	tree->data = data;
+	tree->damage_count = 0;
+
+	tree->root = calloc(1, sizeof(widget_t));
+	tree->root->tree = tree;
+	tree->root->children = list_create();
+	widget_tree_resize(tree);
+
+	return tree;
+}
+
+void widget_tree_free(widget_tree_t * tree) {
+	widget_free(tree->root);
+	free(tree);
+}
+
+void widget_tree_resize(widget_tree_t * tree) {
+	tree->root->bounds.x = 0;
+	tree->root->bounds.y = 0;
+	tree->root->bounds.width  = tree->ctx->width;
+	tree->root->bounds.height = tree->ctx->height;
+	tree->damage_count = 0;
+	add_damage(tree, tree->root->bounds);
+}
+
+widget_t * widget_create(widget_t * parent, int x, int y, int width, int height,
+		void (*draw)(widget_t *, gfx_context_t *), void * data) {
+	widget_t * widget = calloc(1, sizeof(widget_t));
+	widget->bounds.x = x;
+	widget->bounds.y = y;
+	widget->bounds.width  = width;
+	widget->bounds.height = height;
+	widget->dirty = 1;
+	widget->draw = draw;
+	widget->data = data;
+	widget->parent = parent;
+	widget->tree = parent->tree;
+	widget->children = list_create();
+	list_insert(parent->children, widget);
+	return widget;
+}
+
+void widget_free(widget_t * widget) {
+	while (widget->children->head) {
+		widget_free(widget->children->head->value);
+	}
+	list_free(widget->children);
+	free(widget->children);
+
+	if (widget->parent) {
+		node_t * node = list_find(widget->parent->children, widget);
+		if (node) {
+			list_delete(widget->parent->children, node);
+			free(node);
+		}
+		if (!widget->hidden) {
+			add_damage(widget->tree, widget->bounds);
+		}
+	}
+	free(widget);
+}
+
+void widget_move(widget_t * widget, int x, int y, int width, int height) {
+	if (widget->bounds.x == x && widget->bounds.y == y &&
+			widget->bounds.width == width && widget->bounds.height == height) return;
+
+	/* Whatever was under the old position has to be repainted */
+	if (!widget->hidden) {
+		add_damage(widget->tree, widget->bounds);
+	}
+	widget->bounds.x = x;
+	widget->bounds.y = y;
+	widget->bounds.width  = width;
+	widget->bounds.height = height;
+	widget->dirty = 1;
+}
+
+void widget_set_hidden(widget_t * widget, int hidden) {
+	if (widget->hidden == hidden) return;
+	widget->hidden = hidden;
+	if (hidden) {
+		add_damage(widget->tree, widget->bounds);
+	} else {
+		widget->dirty = 1;
+	}
+}
+
+void widget_invalidate(widget_t * widget) {
+	widget->dirty = 1;
+}
+
+void widget_damage(widget_tree_t * tree, int x, int y, int width, int height) {
+	widget_rect_t rect = {x, y, width, height};
+	add_damage(tree, rect);
+}
+
+static void collect_dirty(widget_t * widget) {
+	if (widget->hidden) return;
+	if (widget->dirty) {
+		add_damage(widget->tree, widget->bounds);
+	}
+	foreach(node, widget->children) {
+		collect_dirty(node->value);
+	}
+}
+
+/* Grow damage that covers part of a widget to cover all of it; returns 1 if anything grew */
+static int grow_damage(widget_t * widget) {
+	if (widget->hidden) return 0;
+	int changed = 0;
+	if (widget->draw) {
+		widget_rect_t bounds = widget->bounds;
+		rect_clip(widget->tree, &bounds);
+		widget_tree_t * tree = widget->tree;
+		for (int i = 0; i < tree->damage_count; ++i) {
+			if (rect_intersects(&tree->damage[i], &bounds) && !rect_contains(&tree->damage[i], &bounds)) {
+				rect_union(&tree->damage[i], &bounds);
+				changed = 1;
+			}
+		}
+	}
+	foreach(node, widget->children) {
+		changed |= grow_damage(node->value);
+	}
+	return changed;
+}
+
+static void draw_widgets(widget_t * widget, widget_rect_t * rect) {
+	if (widget->hidden) return;
+	widget->dirty = 0;
+
+	widget_rect_t bounds = widget->bounds;
+	rect_clip(widget->tree, &bounds);
+
+	if (widget->draw && !rect_empty(&bounds) && rect_intersects(rect, &bounds)) {
+		/* A view of the window's backbuffer that covers just this widget */
+		gfx_context_t * ctx = widget->tree->ctx;
+		gfx_context_t sub = *ctx;
+		size_t offset = bounds.y * GFX_S(ctx) + bounds.x * GFX_B(ctx);
+		sub.width  = bounds.width;
+		sub.height = bounds.height;
+		sub.size   = bounds.height * GFX_S(ctx);
+		sub.buffer = ctx->buffer + offset;
+		sub.backbuffer = ctx->backbuffer + offset;
+		sub.clips = NULL;
+		sub.clips_size = 0;
+		widget->draw(widget, &sub);
+	}
+
+	foreach(node, widget->children) {
+		draw_widgets(node->value, rect);
+	}
+}
+
+int widget_render(widget_tree_t * tree) {
+	collect_dirty(tree->root);
+	do {
+		merge_damage(tree);
+	} while (grow_damage(tree->root) || merge_damage(tree));
+
+	gfx_context_t * ctx = tree->ctx;
+	int count = tree->damage_count;
+
+	for (int i = 0; i < count; ++i) {
+		widget_rect_t * rect = &tree->damage[i];
+		if (tree->background) {
+			tree->background(tree, ctx, rect);
+		}
+		draw_widgets(tree->root, rect);
+
+		if (ctx->buffer != ctx->backbuffer) {
+			for (int y = rect->y; y < rect->y + rect->height; ++y) {
+				memcpy(&GFXR(ctx, rect->x, y), &GFX(ctx, rect->x, y), rect->width * GFX_B(ctx));
+			}
+		}
+		yutani_flip_region(tree->yctx, tree->window, rect->x, rect->y, rect->width, rect->height);
+	}
+
+	tree->damage_count = 0;
+	return count;
+}
@@ -1,10 +1,18 @@
+#include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <syscall.h>
+#include <syscall_nums.h>
 #include <errno.h>
 #include <bits/dirent.h>
 
+DEFN_SYSCALL3(getdents, SYS_GETDENTS, int, void *, unsigned int);
+
+int getdents(int fd, void * buf, unsigned int size) {
+	__sets_errno(syscall_getdents(fd, buf, size));
+}
+
 DIR * opendir (const char * dirname) {
 	int fd = open(dirname, O_RDONLY);
 	if (fd < 0) {
@@ -15,32 +23,52 @@ DIR * opendir (const char * dirname) {
 	DIR * dir = (DIR *)malloc(sizeof(DIR));
 	dir->fd = fd;
 	dir->cur_entry = -1;
+	dir->buf_pos = 0;
+	dir->buf_len = 0;
 	return dir;
 }
 
 int closedir (DIR * dir) {
 	if (dir && (dir->fd != -1)) {
-		return close(dir->fd);
+		int ret = close(dir->fd);
+		free(dir);
+		return ret;
 	} else {
 		return -EBADF;
 	}
 }
 
+void rewinddir (DIR * dirp) {
+	lseek(dirp->fd, 0, SEEK_SET);
+	dirp->cur_entry = -1;
+	dirp->buf_pos = 0;
+	dirp->buf_len = 0;
+}
+
 struct dirent * readdir (DIR * dirp) {
 	static struct dirent ent;
 
-	int ret = syscall_readdir(dirp->fd, ++dirp->cur_entry, &ent);
-	if (ret < 0) {
-		errno = -ret;
-		memset(&ent, 0, sizeof(struct dirent));
-		return NULL;
+	if (dirp->buf_pos >= dirp->buf_len) {
+		/* Refill with as many entries as fit */
+		int ret = syscall_getdents(dirp->fd, dirp->buf, sizeof(dirp->buf));
+		if (ret <= 0) {
+			/* error, or end of directory */
+			if (ret < 0) errno = -ret;
+			memset(&ent, 0, sizeof(struct dirent));
+			return NULL;
+		}
+		dirp->buf_pos = 0;
+		dirp->buf_len = ret;
 	}
 
-	if (ret == 0) {
-		/* end of directory */
-		memset(&ent, 0, sizeof(struct dirent));
-		return NULL;
-	}
+	struct dirent_record * rec = (struct dirent_record *)(dirp->buf + dirp->buf_pos);
+	dirp->buf_pos += rec->d_reclen;
+	dirp->cur_entry++;
+
+	ent.d_ino  = rec->d_ino;
+	ent.d_type = rec->d_type;
+	strncpy(ent.d_name, rec->d_name, sizeof(ent.d_name) - 1);
+	ent.d_name[sizeof(ent.d_name) - 1] = '\0';
 
 	return &ent;
 }
@@ -0,0 +1,58 @@
+#include <poll.h>
+#include <errno.h>
+#include <sys/select.h>
+
+/* select() is poll() with the descriptors given as bitmaps */
+int select(int nfds, fd_set * readfds, fd_set * writefds, fd_set * exceptfds, struct timeval * timeout) {
+	if (nfds < 0 || nfds > FD_SETSIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct pollfd fds[FD_SETSIZE];
+	int count = 0;
+
+	for (int fd = 0; fd < nfds; ++fd) {
+		short events = 0;
+		if (readfds && FD_ISSET(fd, readfds)) events |= POLLIN;
+		if (writefds && FD_ISSET(fd, writefds)) events |= POLLOUT;
+		if (exceptfds && FD_ISSET(fd, exceptfds)) events |= POLLPRI;
+		if (!events) continue;
+		fds[count].fd = fd;
+		fds[count].events = events;
+		count++;
+	}
+
+	int ms = timeout ? (timeout->tv_sec * 1000 + timeout->tv_usec / 1000) : -1;
+	int ret = poll(fds, count, ms);
+	if (ret < 0) return ret;
+
+	if (readfds) FD_ZERO(readfds);
+	if (writefds) FD_ZERO(writefds);
+	if (exceptfds) FD_ZERO(exceptfds);
+
+	ret = 0;
+	for (int i = 0; i < count; ++i) {
+		short revents = fds[i].revents;
+		if (revents & POLLNVAL) {
+			errno = EBADF;
+			return -1;
+		}
+		int fd = fds[i].fd;
+		/* Hang-ups and errors show up as readable, as read() won't block */
+		if (readfds && (fds[i].events & POLLIN) && (revents & (POLLIN | POLLHUP | POLLERR))) {
+			FD_SET(fd, readfds);
+			ret++;
+		}
+		if (writefds && (fds[i].events & POLLOUT) && (revents & (POLLOUT | POLLERR))) {
+			FD_SET(fd, writefds);
+			ret++;
+		}
+		if (exceptfds && (fds[i].events & POLLPRI) && (revents & POLLPRI)) {
+			FD_SET(fd, exceptfds);
+			ret++;
+		}
+	}
+
+	return ret;
+}
@@ -0,0 +1,15 @@
+#include <signal.h>
+#include <syscall.h>
+#include <syscall_nums.h>
+#include <errno.h>
+
+DEFN_SYSCALL3(sigprocmask, SYS_SIGPROCMASK, int, const void *, void *);
+DEFN_SYSCALL1(sigpending, SYS_SIGPENDING, void *);
+
+int sigprocmask(int how, const sigset_t * set, sigset_t * oldset) {
+	__sets_errno(syscall_sigprocmask(how, set, oldset));
+}
+
+int sigpending(sigset_t * set) {
+	__sets_errno(syscall_sigpending(set));
+}
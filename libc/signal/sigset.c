@@ -0,0 +1,38 @@
+#include <signal.h>
+#include <errno.h>
+
+int sigemptyset(sigset_t * set) {
+	*set = 0;
+	return 0;
+}
+
+int sigfillset(sigset_t * set) {
+	*set = ~0ULL;
+	return 0;
+}
+
+int sigaddset(sigset_t * set, int signum) {
+	if (signum <= 0 || signum >= NUMSIGNALS) {
+		errno = EINVAL;
+		return -1;
+	}
+	*set |= 1ULL << signum;
+	return 0;
+}
+
+int sigdelset(sigset_t * set, int signum) {
+	if (signum <= 0 || signum >= NUMSIGNALS) {
+		errno = EINVAL;
+		return -1;
+	}
+	*set &= ~(1ULL << signum);
+	return 0;
+}
+
+int sigismember(const sigset_t * set, int signum) {
+	if (signum <= 0 || signum >= NUMSIGNALS) {
+		errno = EINVAL;
+		return -1;
+	}
+	return (*set >> signum) & 1;
+}
@@ -0,0 +1,199 @@
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syscall.h>
+#include <syscall_nums.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+DEFN_SYSCALL3(vfork, SYS_VFORK, uintptr_t, uintptr_t, void *);
+
+#define SPAWN_OPEN  1
+#define SPAWN_CLOSE 2
+#define SPAWN_DUP2  3
+
+/* The child runs on this much of our stack; it only applies file actions and execs */
+#define SPAWN_STACK_SIZE 0x4000
+
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+struct spawn_args {
+	const char * path;
+	const posix_spawn_file_actions_t * file_actions;
+	char * const * argv;
+	char * const * envp;
+	int error; /* Written by the child; we're stopped until it execs or exits */
+};
+
+static int spawn_action(struct __spawn_action * action) {
+	switch (action->type) {
+		case SPAWN_OPEN: {
+			int fd = open(action->path, action->oflag, action->mode);
+			if (fd < 0) return errno;
+			if (fd != action->fd) {
+				int r = dup2(fd, action->fd);
+				close(fd);
+				if (r < 0) return EBADF;
+			}
+			return 0;
+		}
+		case SPAWN_CLOSE:
+			close(action->fd);
+			return 0;
+		case SPAWN_DUP2:
+			if (dup2(action->fd, action->newfd) < 0) return EBADF;
+			return 0;
+	}
+	return EINVAL;
+}
+
+/*
+ * Runs in the child, in our memory: nothing here may allocate or
+ * touch stdio, and it has to leave with exec or syscall_exit() so our
+ * atexit handlers and buffers are left alone.
+ */
+static void spawn_child(struct spawn_args * args) {
+	if (args->file_actions) {
+		for (int i = 0; i < args->file_actions->count; ++i) {
+			int error = spawn_action(&args->file_actions->actions[i]);
+			if (error) {
+				args->error = error;
+				syscall_exit(127);
+			}
+		}
+	}
+
+	int r = syscall_execve((char *)args->path, (char **)args->argv, (char **)args->envp);
+	args->error = r < 0 ? -r : ENOEXEC;
+	syscall_exit(127);
+}
+
+int posix_spawn(pid_t * pid, const char * path, const posix_spawn_file_actions_t * file_actions,
+		const posix_spawnattr_t * attrp, char * const argv[], char * const envp[]) {
+	if (attrp && attrp->flags) return EINVAL;
+
+	char stack[SPAWN_STACK_SIZE] __attribute__((aligned(16)));
+	struct spawn_args args = { path, file_actions, argv, envp ? envp : environ, 0 };
+
+	int saved_errno = errno;
+	int child = syscall_vfork((uintptr_t)stack + SPAWN_STACK_SIZE, (uintptr_t)spawn_child, &args);
+	errno = saved_errno;
+
+	if (child < 0) return -child;
+
+	if (args.error) {
+		/* It never got to run anything; collect it so the caller doesn't have to */
+		waitpid(child, NULL, 0);
+		errno = saved_errno;
+		return args.error;
+	}
+
+	if (pid) *pid = child;
+	return 0;
+}
+
+int posix_spawnp(pid_t * pid, const char * file, const posix_spawn_file_actions_t * file_actions,
+		const posix_spawnattr_t * attrp, char * const argv[], char * const envp[]) {
+	if (!file || strchr(file, '/')) {
+		return posix_spawn(pid, file, file_actions, attrp, argv, envp);
+	}
+
+	/* Search the path here, since the child can't allocate */
+	char * path = getenv("PATH");
+	if (!path) path = DEFAULT_PATH;
+
+	char * xpath = strdup(path);
+	char * p, * last;
+	int error = ENOENT;
+	for ((p = strtok_r(xpath, ":", &last)); p; p = strtok_r(NULL, ":", &last)) {
+		char exe[strlen(p) + strlen(file) + 2];
+		struct stat stat_buf;
+		sprintf(exe, "%s/%s", p, file);
+		if (stat(exe, &stat_buf) != 0) continue;
+		if (!(stat_buf.st_mode & 0111)) continue;
+		error = posix_spawn(pid, exe, file_actions, attrp, argv, envp);
+		break;
+	}
+	free(xpath);
+	return error;
+}
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t * file_actions) {
+	file_actions->count = 0;
+	file_actions->capacity = 0;
+	file_actions->actions = NULL;
+	return 0;
+}
+
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t * file_actions) {
+	for (int i = 0; i < file_actions->count; ++i) {
+		free(file_actions->actions[i].path);
+	}
+	free(file_actions->actions);
+	file_actions->count = 0;
+	file_actions->capacity = 0;
+	file_actions->actions = NULL;
+	return 0;
+}
+
+static struct __spawn_action * spawn_action_add(posix_spawn_file_actions_t * file_actions, int type, int fd) {
+	if (fd < 0) return NULL;
+	if (file_actions->count == file_actions->capacity) {
+		int capacity = file_actions->capacity ? file_actions->capacity * 2 : 4;
+		struct __spawn_action * actions = realloc(file_actions->actions, sizeof(struct __spawn_action) * capacity);
+		if (!actions) return NULL;
+		file_actions->actions = actions;
+		file_actions->capacity = capacity;
+	}
+	struct __spawn_action * action = &file_actions->actions[file_actions->count++];
+	memset(action, 0, sizeof(struct __spawn_action));
+	action->type = type;
+	action->fd = fd;
+	return action;
+}
+
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t * file_actions, int fd, const char * path, int oflag, mode_t mode) {
+	struct __spawn_action * action = spawn_action_add(file_actions, SPAWN_OPEN, fd);
+	if (!action) return fd < 0 ? EBADF : ENOMEM;
+	action->path = strdup(path);
+	action->oflag = oflag;
+	action->mode = mode;
+	return 0;
+}
+
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t * file_actions, int fd) {
+	if (!spawn_action_add(file_actions, SPAWN_CLOSE, fd)) return fd < 0 ? EBADF : ENOMEM;
+	return 0;
+}
+
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t * file_actions, int fd, int newfd) {
+	if (newfd < 0) return EBADF;
+	struct __spawn_action * action = spawn_action_add(file_actions, SPAWN_DUP2, fd);
+	if (!action) return fd < 0 ? EBADF : ENOMEM;
+	action->newfd = newfd;
+	return 0;
+}
+
+int posix_spawnattr_init(posix_spawnattr_t * attr) {
+	attr->flags = 0;
+	return 0;
+}
+
+int posix_spawnattr_destroy(posix_spawnattr_t * attr) {
+	return 0;
+}
+
+int posix_spawnattr_getflags(const posix_spawnattr_t * attr, short * flags) {
+	*flags = attr->flags;
+	return 0;
+}
+
+int posix_spawnattr_setflags(posix_spawnattr_t * attr, short flags) {
+	if (flags) return EINVAL;
+	attr->flags = flags;
+	return 0;
+}
@@ -1,9 +1,14 @@
 #include <stdio.h>
 #include <string.h>
+#include <sys/uio.h>
 
 int puts(const char *s) {
+	/* One write, so the line doesn't get split up by other writers */
+	struct iovec iov[2] = {
+		{ (void *)s, strlen(s) },
+		{ "\n", 1 },
+	};
 	/* eof? */
-	fwrite(s, 1, strlen(s), stdout);
-	fwrite("\n", 1, 1, stdout);
+	writev(fileno(stdout), iov, 2);
 	return 0;
 }
@@ -2,6 +2,7 @@
 #include <syscall.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -107,25 +108,33 @@ static size_t read_bytes(FILE * f, char * out, size_t len) {
 		}
 
 		if (f->available == 0) {
-			if (f->offset == f->bufsiz) {
-				f->offset = 0;
-			}
-			ssize_t r = read(fileno(f), &f->read_buf[f->offset], f->bufsiz - f->offset);
+			/*
+			 * Read straight into the caller's buffer and refill ours
+			 * with whatever comes after it, in one call.
+			 */
+			struct iovec iov[2] = {
+				{ out, len },
+				{ f->read_buf, f->bufsiz },
+			};
+			ssize_t r = readv(fileno(f), iov, 2);
 			if (r < 0) {
 				//fprintf(stderr, "error condition\n");
 				return r_out;
-			} else {
-				f->read_from = f->offset;
-				f->available = r;
-				f->offset += f->available;
 			}
-		}
-
-		if (f->available == 0) {
-			/* EOF condition */
-			//fprintf(stderr, "%s: no bytes available, returning read value of %d\n", _argv_0, r_out);
-			f->eof = 1;
-			return r_out;
+			if (r == 0) {
+				/* EOF condition */
+				//fprintf(stderr, "%s: no bytes available, returning read value of %d\n", _argv_0, r_out);
+				f->eof = 1;
+				return r_out;
+			}
+			size_t direct = (size_t)r < len ? (size_t)r : len;
+			out   += direct;
+			len   -= direct;
+			r_out += direct;
+			f->read_from = 0;
+			f->offset    = r - direct;
+			f->available = r - direct;
+			continue;
 		}
 
 		//fprintf(stderr, "%s: reading until %d reaches %d or %d reaches 0\n", _argv_0, f->read_from, f->offset, len);
@@ -0,0 +1,18 @@
+#include <stdlib.h>
+#include <stddef.h>
+
+void * bsearch(const void * key, const void * base, size_t nmemb, size_t size, int (*compar)(const void *, const void *)) {
+	size_t low = 0, high = nmemb;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		const void * elem = (const char *)base + size * mid;
+		int cmp = compar(key, elem);
+		if (cmp == 0) return (void *)elem;
+		if (cmp < 0) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+	return NULL;
+}
@@ -107,6 +107,7 @@
 #include <stdint.h>
 #include <limits.h>
 #include <string.h>
+#include <sys/mman.h>
 /* }}} */
 /* Definitions {{{ */
 
@@ -127,6 +128,9 @@
 #define SKIP_MAX_LEVEL 6							/* We have a maximum of 6 levels in our skip lists. */
 
 #define BIN_MAGIC 0xDEFAD00D
+#define MAPPED_MAGIC 0xDEFAD00E						/* A big bin with pages of its own from mmap() */
+
+#define MMAP_THRESHOLD 0x20000						/* Allocations this big or bigger go to mmap() */
 
 /* }}} */
 
@@ -644,6 +648,21 @@ static void * __attribute__ ((malloc)) klmalloc(uintptr_t size) {
 			klmalloc_list_decouple(&(klmalloc_bin_head[bucket_id]),bin_header);
 		}
 		return item;
+	} else if (size >= MMAP_THRESHOLD) {
+		/*
+		 * Huge allocations get pages of their own, which go straight
+		 * back to the system when they are freed instead of sitting
+		 * in the big bins forever.
+		 */
+		uintptr_t pages = (size + sizeof(klmalloc_big_bin_header) + PAGE_MASK) / PAGE_SIZE;
+		klmalloc_big_bin_header * bin_header = mmap(NULL, pages * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (bin_header == MAP_FAILED) {
+			return NULL;
+		}
+		bin_header->bin_magic = MAPPED_MAGIC;
+		bin_header->size = pages * PAGE_SIZE - sizeof(klmalloc_big_bin_header);
+		bin_header->head = NULL;
+		return (void*)((uintptr_t)bin_header + sizeof(klmalloc_big_bin_header));
 	} else {
 		/*
 		 * Big bins.
@@ -760,6 +779,14 @@ static void klfree(void *ptr) {
 	klmalloc_bin_header * header = (klmalloc_bin_header *)((uintptr_t)ptr & (uintptr_t)~PAGE_MASK);
 	assert((uintptr_t)header % PAGE_SIZE == 0);
 
+	if (header->bin_magic == MAPPED_MAGIC) {
+		/*
+		 * Mapped blocks are unmapped whole.
+		 */
+		munmap(header, header->size + sizeof(klmalloc_big_bin_header));
+		return;
+	}
+
 	if (header->bin_magic != BIN_MAGIC)
 		return;
 
@@ -911,7 +938,7 @@ static void * __attribute__ ((malloc)) klrealloc(void *ptr, uintptr_t size) {
 	 * by aligning it to a page.
 	 */
 	klmalloc_bin_header * header_old = (void *)((uintptr_t)ptr & (uintptr_t)~PAGE_MASK);
-	if (header_old->bin_magic != BIN_MAGIC) {
+	if (header_old->bin_magic != BIN_MAGIC && header_old->bin_magic != MAPPED_MAGIC) {
 		assert(0 && "Bad magic on realloc.");
 		return NULL;
 	}
@@ -977,8 +1004,14 @@ static void * __attribute__ ((malloc)) klcalloc(uintptr_t nmemb, uintptr_t size)
 	 */
 
 	void *ptr = klmalloc(nmemb * size);
-	if (__builtin_expect(ptr != NULL, 1))
-		memset(ptr,0x00,nmemb * size);
+	if (__builtin_expect(ptr != NULL, 1)) {
+		/*
+		 * Freshly mapped pages are already zero.
+		 */
+		klmalloc_bin_header * header = (void *)((uintptr_t)ptr & (uintptr_t)~PAGE_MASK);
+		if (header->bin_magic != MAPPED_MAGIC)
+			memset(ptr,0x00,nmemb * size);
+	}
 	return ptr;
 }
 /* }}} */
@@ -0,0 +1,27 @@
+#include <syscall.h>
+#include <syscall_nums.h>
+#include <sys/mman.h>
+#include <errno.h>
+
+DEFN_SYSCALL1(mmap, SYS_MMAP, void *);
+DEFN_SYSCALL2(munmap, SYS_MUNMAP, void *, size_t);
+DEFN_SYSCALL3(mprotect, SYS_MPROTECT, void *, size_t, int);
+
+void * mmap(void * addr, size_t length, int prot, int flags, int fd, off_t offset) {
+	struct mmap_args args = { addr, length, prot, flags, fd, offset };
+	/* Mappings can be above 2GB, so only the top few values are errors */
+	unsigned int result = (unsigned int)syscall_mmap(&args);
+	if (result > (unsigned int)-4096) {
+		errno = -(int)result;
+		return MAP_FAILED;
+	}
+	return (void *)result;
+}
+
+int munmap(void * addr, size_t length) {
+	__sets_errno(syscall_munmap(addr, length));
+}
+
+int mprotect(void * addr, size_t length, int prot) {
+	__sets_errno(syscall_mprotect(addr, length, prot));
+}
@@ -0,0 +1,20 @@
+#include <syscall.h>
+#include <syscall_nums.h>
+#include <sys/pollset.h>
+#include <errno.h>
+
+DEFN_SYSCALL0(pollset_create, SYS_POLLSET_CREATE);
+DEFN_SYSCALL4(pollset_ctl, SYS_POLLSET_CTL, int, int, int, void *);
+DEFN_SYSCALL4(pollset_wait, SYS_POLLSET_WAIT, int, void *, int, int);
+
+int pollset_create(void) {
+	__sets_errno(syscall_pollset_create());
+}
+
+int pollset_ctl(int set, int op, int fd, struct pollset_event * event) {
+	__sets_errno(syscall_pollset_ctl(set, op, fd, event));
+}
+
+int pollset_wait(int set, struct pollset_event * events, int max, int timeout) {
+	__sets_errno(syscall_pollset_wait(set, events, max, timeout));
+}
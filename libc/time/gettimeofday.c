@@ -1,7 +1,21 @@
 #include <sys/time.h>
+#include <sys/vdso.h>
 #include <syscall.h>
 
 int gettimeofday(struct timeval *p, void *z){
-	return syscall_gettimeofday(p,z);
-}
+	if (!p) return syscall_gettimeofday(p,z);
+
+	/* Read the time the kernel publishes in the vDSO; retry if it was mid-update */
+	uint32_t seq, sec, usec;
+	do {
+		seq = VDSO_DATA->sequence;
+		__asm__ __volatile__("" ::: "memory");
+		sec = VDSO_DATA->seconds;
+		usec = VDSO_DATA->useconds;
+		__asm__ __volatile__("" ::: "memory");
+	} while ((seq & 1) || seq != VDSO_DATA->sequence);
 
+	p->tv_sec = sec;
+	p->tv_usec = usec;
+	return 0;
+}
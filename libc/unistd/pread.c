@@ -0,0 +1,10 @@
+#include <unistd.h>
+#include <syscall.h>
+#include <syscall_nums.h>
+#include <errno.h>
+
+DEFN_SYSCALL4(pread, SYS_PREAD, int, void *, size_t, long);
+
+ssize_t pread(int fd, void * buf, size_t count, off_t offset) {
+	__sets_errno(syscall_pread(fd, buf, count, offset));
+}
@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include <syscall.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 
 #include <kernel/elf.h>
@@ -231,8 +232,13 @@ static elf_t * open_object(const char * path) {
 	return object;
 }
 
-/* Calculate the size of an object file by examining its phdrs */
-static size_t object_calculate_size(elf_t * object) {
+/* Read part of an object's file: one pread() rather than a seek and a read */
+static void object_read(elf_t * object, off_t offset, void * buf, size_t size) {
+	pread(fileno(object->file), buf, size, offset);
+}
+
+/* Find the range of addresses an object loads into by examining its phdrs */
+static int object_extent(elf_t * object, uintptr_t * base_out, uintptr_t * end_out) {
 
 	uintptr_t base_addr = 0xFFFFFFFF;
 	uintptr_t end_addr  = 0x0;
@@ -241,8 +247,7 @@ static size_t object_calculate_size(elf_t * object) {
 		Elf32_Phdr phdr;
 
 		/* Read the phdr */
-		fseek(object->file, object->header.e_phoff + object->header.e_phentsize * headers, SEEK_SET);
-		fread(&phdr, object->header.e_phentsize, 1, object->file);
+		object_read(object, object->header.e_phoff + object->header.e_phentsize * headers, &phdr, object->header.e_phentsize);
 
 		switch (phdr.p_type) {
 			case PT_LOAD:
@@ -268,6 +273,15 @@ static size_t object_calculate_size(elf_t * object) {
 
 	/* If base_addr is still -1, then no valid phdrs were found, and the object has no loaded size. */
 	if (base_addr == 0xFFFFFFFF) return 0;
+	*base_out = base_addr;
+	*end_out = end_addr;
+	return 1;
+}
+
+/* Calculate the size of an object file by examining its phdrs */
+static size_t object_calculate_size(elf_t * object) {
+	uintptr_t base_addr, end_addr;
+	if (!object_extent(object, &base_addr, &end_addr)) return 0;
 	return end_addr - base_addr;
 }
 
@@ -278,24 +292,39 @@ static uintptr_t object_load(elf_t * object, uintptr_t base) {
 
 	object->base = base;
 
+	/*
+	 * Map all of the object's memory at once; segments can share a
+	 * page, so mapping them one at a time would clear what the one
+	 * before had loaded. If that fails (the range is outside the mmap
+	 * area, or collides with something), fall back to asking for each
+	 * segment's memory directly.
+	 */
+	int mapped = 0;
+	uintptr_t low, high;
+	if (object_extent(object, &low, &high)) {
+		low  = (base + low) & ~0xFFF;
+		high = (base + high + 0xFFF) & ~0xFFF;
+		mapped = mmap((void *)low, high - low, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED;
+	}
+
 	size_t headers = 0;
 	while (headers < object->header.e_phnum) {
 		Elf32_Phdr phdr;
 
 		/* Read the phdr */
-		fseek(object->file, object->header.e_phoff + object->header.e_phentsize * headers, SEEK_SET);
-		fread(&phdr, object->header.e_phentsize, 1, object->file);
+		object_read(object, object->header.e_phoff + object->header.e_phentsize * headers, &phdr, object->header.e_phentsize);
 
 		switch (phdr.p_type) {
 			case PT_LOAD:
 				{
-					/* Request memory to load this PHDR into */
-					char * args[] = {(char *)(base + phdr.p_vaddr), (char *)phdr.p_memsz};
-					syscall_system_function(10, args);
+					if (!mapped) {
+						/* Request memory to load this PHDR into */
+						char * args[] = {(char *)(base + phdr.p_vaddr), (char *)phdr.p_memsz};
+						syscall_system_function(10, args);
+					}
 
 					/* Copy the code into memory */
-					fseek(object->file, phdr.p_offset, SEEK_SET);
-					fread((void *)(base + phdr.p_vaddr), phdr.p_filesz, 1, object->file);
+					object_read(object, phdr.p_offset, (void *)(base + phdr.p_vaddr), phdr.p_filesz);
 
 					/* Zero the remaining area */
 					size_t r = phdr.p_filesz;
@@ -332,11 +361,9 @@ static int object_postload(elf_t * object) {
 	/* Load section string table */
 	{
 		Elf32_Shdr shdr;
-		fseek(object->file, object->header.e_shoff + object->header.e_shentsize * object->header.e_shstrndx, SEEK_SET);
-		fread(&shdr, object->header.e_shentsize, 1, object->file);
+		object_read(object, object->header.e_shoff + object->header.e_shentsize * object->header.e_shstrndx, &shdr, object->header.e_shentsize);
 		object->string_table = malloc(shdr.sh_size);
-		fseek(object->file, shdr.sh_offset, SEEK_SET);
-		fread(object->string_table, shdr.sh_size, 1, object->file);
+		object_read(object, shdr.sh_offset, object->string_table, shdr.sh_size);
 	}
 
 	/* If there is a dynamic table, parse it. */
@@ -388,8 +415,7 @@ static int object_postload(elf_t * object) {
 	for (uintptr_t x = 0; x < object->header.e_shentsize * object->header.e_shnum; x += object->header.e_shentsize) {
 		Elf32_Shdr shdr;
 		/* Read section header */
-		fseek(object->file, object->header.e_shoff + x, SEEK_SET);
-		fread(&shdr, object->header.e_shentsize, 1, object->file);
+		object_read(object, object->header.e_shoff + x, &shdr, object->header.e_shentsize);
 
 		/* ctors */
 		if (!strcmp((char *)((uintptr_t)object->string_table + shdr.sh_name), ".ctors")) {
@@ -449,8 +475,7 @@ static int object_relocate(elf_t * object) {
 	for (uintptr_t x = 0; x < object->header.e_shentsize * object->header.e_shnum; x += object->header.e_shentsize) {
 		Elf32_Shdr shdr;
 		/* Load section header */
-		fseek(object->file, object->header.e_shoff + x, SEEK_SET);
-		fread(&shdr, object->header.e_shentsize, 1, object->file);
+		object_read(object, object->header.e_shoff + x, &shdr, object->header.e_shentsize);
 
 		/* Relocation table found */
 		if (shdr.sh_type == 9) {
@@ -517,8 +542,7 @@ static void object_find_copy_relocations(elf_t * object) {
 
 	for (uintptr_t x = 0; x < object->header.e_shentsize * object->header.e_shnum; x += object->header.e_shentsize) {
 		Elf32_Shdr shdr;
-		fseek(object->file, object->header.e_shoff + x, SEEK_SET);
-		fread(&shdr, object->header.e_shentsize, 1, object->file);
+		object_read(object, object->header.e_shoff + x, &shdr, object->header.e_shentsize);
 
 		/* Relocation table found */
 		if (shdr.sh_type == 9) {
@@ -576,11 +600,16 @@ static void * do_actual_load(const char * filename, elf_t * lib, int flags) {
 	}
 
 	/*
-	 * Allocate space to load the library
-	 * This is where we should really be loading things into COW
-	 * but we don't have the functionality available.
+	 * Find space to load the library, away from the heap.
+	 * This is where we should really be mapping the file itself,
+	 * but relocations write all over it.
 	 */
-	uintptr_t load_addr = (uintptr_t)malloc(lib_size);
+	void * load_space = mmap(NULL, lib_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (load_space == MAP_FAILED) {
+		last_error = "could not find space to load library";
+		return NULL;
+	}
+	uintptr_t load_addr = (uintptr_t)load_space;
 	object_load(lib, load_addr);
 
 	/* Perform cleanup steps */
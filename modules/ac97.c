@@ -132,17 +132,14 @@ static void find_ac97(uint32_t device, uint16_t vendorid, uint16_t deviceid, voi
 
 }
 
-#define DIVISION 0x1000
 static int irq_handler(struct regs * regs) {
 	uint16_t sr = inports(_device.nabmbar + AC97_PO_SR);
 	if (!sr) return 0;
 
 	if (sr & AC97_X_SR_BCIS) {
+		/* The mixer fills this buffer outside of the interrupt, two periods ahead of playback */
 		size_t f = (_device.lvi + 2) % AC97_BDL_LEN;
-		for (size_t i = 0; i < AC97_BDL_BUFFER_LEN * sizeof(*_device.bufs[0]); i += DIVISION) {
-			snd_request_buf(&_snd, DIVISION, (uint8_t *)_device.bufs[f] + i);
-			//switch_task(1);
-		}
+		snd_schedule_buf(&_snd, AC97_BDL_BUFFER_LEN * sizeof(*_device.bufs[0]), (uint8_t *)_device.bufs[f]);
 		_device.lvi = (_device.lvi + 1) % AC97_BDL_LEN;
 		outportb(_device.nabmbar + AC97_PO_LVI, _device.lvi);
 	} else if (sr & AC97_X_SR_LVBCI) {
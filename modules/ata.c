@@ -14,6 +14,7 @@
 #include <kernel/fs.h>
 #include <kernel/printf.h>
 #include <kernel/pci.h>
+#include <kernel/trace.h>
 
 /* TODO: Move this to mod/ata.h */
 #include <kernel/ata.h>
@@ -104,6 +105,7 @@ static uint32_t read_ata(fs_node_t *node, uint32_t offset, uint32_t size, uint8_
 	unsigned int end_block = (offset + size - 1) / ATA_SECTOR_SIZE;
 
 	unsigned int x_offset = 0;
+	uint64_t start = trace_enabled(TRACE_BLOCK) ? trace_tsc() : 0;
 
 	if (offset > ata_max_offset(dev)) {
 		return 0;
@@ -145,6 +147,10 @@ static uint32_t read_ata(fs_node_t *node, uint32_t offset, uint32_t size, uint8_
 		start_block++;
 	}
 
+	if (start) {
+		trace_record(TRACE_BLOCK, offset / ATA_SECTOR_SIZE, size, (uint32_t)(trace_tsc() - start));
+	}
+
 	return size;
 }
 
@@ -208,6 +214,7 @@ static uint32_t write_ata(fs_node_t *node, uint32_t offset, uint32_t size, uint8
 	unsigned int end_block = (offset + size - 1) / ATA_SECTOR_SIZE;
 
 	unsigned int x_offset = 0;
+	uint64_t start = trace_enabled(TRACE_BLOCK) ? trace_tsc() : 0;
 
 	if (offset > ata_max_offset(dev)) {
 		return 0;
@@ -256,6 +263,10 @@ static uint32_t write_ata(fs_node_t *node, uint32_t offset, uint32_t size, uint8
 		start_block++;
 	}
 
+	if (start) {
+		trace_record(TRACE_BLOCK, offset / ATA_SECTOR_SIZE, size | TRACE_BLOCK_WRITE, (uint32_t)(trace_tsc() - start));
+	}
+
 	return size;
 }
 
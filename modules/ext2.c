@@ -13,6 +13,8 @@
 #include <kernel/printf.h>
 #include <kernel/tokenize.h>
 
+#include <sys/getdents.h>
+
 #define EXT2_BGD_BLOCK 2
 
 #define E_SUCCESS   0
@@ -65,6 +67,9 @@ typedef struct {
 #define RN   (this->root_node)
 #define DC   (this->disk_cache)
 
+/* Whether directory entries carry a file_type */
+#define HAS_FILETYPE (SB->rev_level >= 1 && (SB->feature_incompat & EXT2_FEATURE_INCOMPAT_FILETYPE))
+
 /*
  * These macros deal with the block group descriptor bitmap
  */
@@ -610,7 +615,7 @@ static unsigned int inode_write_block(ext2_fs_t * this, ext2_inodetable_t * inod
  *
  * @returns Error code or E_SUCCESS
  */
-static int create_entry(fs_node_t * parent, char * name, uint32_t inode) {
+static int create_entry(fs_node_t * parent, char * name, uint32_t inode, uint8_t file_type) {
 	ext2_fs_t * this = (ext2_fs_t *)parent->device;
 
 	ext2_inodetable_t * pinode = read_inode(this,parent->inode);
@@ -632,7 +637,7 @@ static int create_entry(fs_node_t * parent, char * name, uint32_t inode) {
 	debug_print(WARNING, "  inode     = %d", inode);
 	debug_print(WARNING, "  rec_len   = %d", rec_len);
 	debug_print(WARNING, "  name_len  = %d", strlen(name));
-	debug_print(WARNING, "  file_type = %d", 0);
+	debug_print(WARNING, "  file_type = %d", file_type);
 	debug_print(WARNING, "  name      = %s", name);
 
 	debug_print(WARNING, "The inode size is marked as: %d", pinode->size);
@@ -718,7 +723,7 @@ static int create_entry(fs_node_t * parent, char * name, uint32_t inode) {
 	d_ent->inode     = inode;
 	d_ent->rec_len   = this->block_size - dir_offset;
 	d_ent->name_len  = strlen(name);
-	d_ent->file_type = 0; /* This is unused */
+	d_ent->file_type = HAS_FILETYPE ? file_type : 0;
 	memcpy(d_ent->name, name, strlen(name));
 
 	inode_write_block(this, pinode, parent->inode, block_nr, block);
@@ -821,7 +826,7 @@ static int mkdir_ext2(fs_node_t * parent, char * name, uint16_t permission) {
 	write_inode(this, inode, inode_no);
 
 	/* Now append the entry to the parent */
-	create_entry(parent, name, inode_no);
+	create_entry(parent, name, inode_no, EXT2_FT_DIR);
 
 	inode->size = this->block_size;
 	write_inode(this, inode, inode_no);
@@ -832,6 +837,7 @@ static int mkdir_ext2(fs_node_t * parent, char * name, uint16_t permission) {
 	t->rec_len = 12;
 	t->name_len = 1;
 	t->name[0] = '.';
+	t->file_type = HAS_FILETYPE ? EXT2_FT_DIR : 0;
 	memcpy(&tmp[0], t, 12);
 	t->inode = parent->inode;
 	t->name_len = 2;
@@ -916,7 +922,7 @@ static int create_ext2(fs_node_t * parent, char * name, uint16_t permission) {
 	write_inode(this, inode, inode_no);
 
 	/* Now append the entry to the parent */
-	create_entry(parent, name, inode_no);
+	create_entry(parent, name, inode_no, EXT2_FT_REG_FILE);
 
 	free(inode);
 
@@ -1227,6 +1233,25 @@ static uint32_t write_ext2(fs_node_t *node, uint32_t offset, uint32_t size, uint
 	return rv;
 }
 
+/**
+ * readpage_ext2: Fill a page cache page from a file.
+ */
+static uint32_t readpage_ext2(fs_node_t *node, uint32_t index, uint8_t *page) {
+	ext2_fs_t * this = (ext2_fs_t *)node->device;
+	ext2_inodetable_t * inode = read_inode(this, node->inode);
+	uint32_t size = inode->size;
+	free(inode);
+
+	uint32_t offset = index * 0x1000;
+	if (offset >= size) return 0;
+	if (size - offset > 0x1000) size = offset + 0x1000;
+	return read_ext2(node, offset, size - offset, page);
+}
+
+static uint32_t writepage_ext2(fs_node_t *node, uint32_t index, uint32_t size, uint8_t *page) {
+	return write_ext2(node, index * 0x1000, size, page);
+}
+
 static void open_ext2(fs_node_t *node, unsigned int flags) {
 	ext2_fs_t * this = node->device;
 
@@ -1266,6 +1291,69 @@ static struct dirent * readdir_ext2(fs_node_t *node, uint32_t index) {
 	return dirent;
 }
 
+static uint8_t ext2_dtype(ext2_fs_t * this, ext2_dir_t * d_ent) {
+	if (!HAS_FILETYPE) return DT_UNKNOWN;
+	switch (d_ent->file_type) {
+		case EXT2_FT_REG_FILE: return DT_REG;
+		case EXT2_FT_DIR:      return DT_DIR;
+		case EXT2_FT_CHRDEV:   return DT_CHR;
+		case EXT2_FT_BLKDEV:   return DT_BLK;
+		case EXT2_FT_FIFO:     return DT_FIFO;
+		case EXT2_FT_SOCK:     return DT_SOCK;
+		case EXT2_FT_SYMLINK:  return DT_LNK;
+		default:               return DT_UNKNOWN;
+	}
+}
+
+/**
+ * getdents_ext2
+ *
+ * Walks the directory blocks once, from a byte offset into the
+ * directory, instead of rescanning from the start for every entry
+ * like readdir_ext2 has to.
+ */
+static int getdents_ext2(fs_node_t *node, uint32_t * position, getdents_fill_t fill, void * context) {
+
+	ext2_fs_t * this = (ext2_fs_t *)node->device;
+
+	ext2_inodetable_t *inode = read_inode(this, node->inode);
+	assert(inode->mode & EXT2_S_IFDIR);
+
+	uint8_t * block = malloc(this->block_size);
+	uint32_t block_nr = (uint32_t)-1;
+	char name[256];
+	int ret = 0;
+
+	while (*position < inode->size) {
+		if (*position / this->block_size != block_nr) {
+			block_nr = *position / this->block_size;
+			inode_read_block(this, inode, block_nr, block);
+		}
+
+		uint32_t dir_offset = *position % this->block_size;
+		ext2_dir_t * d_ent = (ext2_dir_t *)((uintptr_t)block + dir_offset);
+		if (d_ent->rec_len < sizeof(ext2_dir_t) || dir_offset + d_ent->rec_len > this->block_size) {
+			debug_print(WARNING, "ext2: bad directory entry in inode %d at offset %d", node->inode, *position);
+			break;
+		}
+
+		if (d_ent->inode) {
+			memcpy(name, d_ent->name, d_ent->name_len);
+			name[d_ent->name_len] = '\0';
+			if (fill(context, d_ent->inode, ext2_dtype(this, d_ent), name)) {
+				ret = 1;
+				break;
+			}
+		}
+
+		*position += d_ent->rec_len;
+	}
+
+	free(block);
+	free(inode);
+	return ret;
+}
+
 static int symlink_ext2(fs_node_t * parent, char * target, char * name) {
 	if (!name) return -EINVAL;
 
@@ -1326,7 +1414,7 @@ static int symlink_ext2(fs_node_t * parent, char * target, char * name) {
 	write_inode(this, inode, inode_no);
 
 	/* Now append the entry to the parent */
-	create_entry(parent, name, inode_no);
+	create_entry(parent, name, inode_no, EXT2_FT_SYMLINK);
 
 
 	/* If we didn't embed it in the inode just use write_inode_buffer to finish the job */
@@ -1383,6 +1471,8 @@ static uint32_t node_from_file(ext2_fs_t * this, ext2_inodetable_t *inode, ext2_
 		fnode->flags   |= FS_FILE;
 		fnode->read     = read_ext2;
 		fnode->write    = write_ext2;
+		fnode->readpage = readpage_ext2;
+		fnode->writepage = writepage_ext2;
 		fnode->create   = NULL;
 		fnode->mkdir    = NULL;
 		fnode->readdir  = NULL;
@@ -1395,6 +1485,7 @@ static uint32_t node_from_file(ext2_fs_t * this, ext2_inodetable_t *inode, ext2_
 		fnode->create   = create_ext2;
 		fnode->mkdir    = mkdir_ext2;
 		fnode->readdir  = readdir_ext2;
+		fnode->getdents = getdents_ext2;
 		fnode->finddir  = finddir_ext2;
 		fnode->unlink   = unlink_ext2;
 		fnode->write    = NULL;
@@ -1414,6 +1505,8 @@ static uint32_t node_from_file(ext2_fs_t * this, ext2_inodetable_t *inode, ext2_
 		fnode->flags   |= FS_SYMLINK;
 		fnode->read     = NULL;
 		fnode->write    = NULL;
+		fnode->readpage = NULL;
+		fnode->writepage = NULL;
 		fnode->create   = NULL;
 		fnode->mkdir    = NULL;
 		fnode->readdir  = NULL;
@@ -1489,10 +1582,13 @@ static uint32_t ext2_root(ext2_fs_t * this, ext2_inodetable_t *inode, fs_node_t
 	fnode->flags |= FS_DIRECTORY;
 	fnode->read    = NULL;
 	fnode->write   = NULL;
+	fnode->readpage  = NULL;
+	fnode->writepage = NULL;
 	fnode->chmod   = chmod_ext2;
 	fnode->open    = open_ext2;
 	fnode->close   = close_ext2;
 	fnode->readdir = readdir_ext2;
+	fnode->getdents = getdents_ext2;
 	fnode->finddir = finddir_ext2;
 	fnode->ioctl   = NULL;
 	fnode->create  = create_ext2;
@@ -290,6 +290,13 @@ static uint32_t read_iso(fs_node_t * node, uint32_t offset, uint32_t size, uint8
 	return size_to_read;
 }
 
+static uint32_t readpage_iso(fs_node_t * node, uint32_t index, uint8_t * page) {
+	uint32_t offset = index * 0x1000;
+	if (offset >= node->length) return 0;
+	uint32_t size = node->length - offset;
+	return read_iso(node, offset, size > 0x1000 ? 0x1000 : size, page);
+}
+
 static fs_node_t * finddir_iso(fs_node_t *node, char *name) {
 	iso_9660_fs_t * this = node->device;
 	char * buffer = malloc(this->block_size);
@@ -383,6 +390,8 @@ static void file_from_dir_entry(iso_9660_fs_t * this, size_t sector, iso_9660_di
 	fs->length = dir->extent_length_LSB;
 	fs->mask = 0444;
 	fs->nlink = 0; /* Unsupported */
+	fs->readpage  = NULL;
+	fs->writepage = NULL;
 	if (dir->flags & FLAG_DIRECTORY) {
 		fs->flags = FS_DIRECTORY;
 		fs->readdir = readdir_iso;
@@ -390,6 +399,7 @@ static void file_from_dir_entry(iso_9660_fs_t * this, size_t sector, iso_9660_di
 	} else {
 		fs->flags = FS_FILE;
 		fs->read = read_iso;
+		fs->readpage = readpage_iso;
 	}
 	/* Other things not supported */
 	/* TODO actually get these from the CD into Unix time */
@@ -14,6 +14,8 @@
 #include <toaru/list.h>
 #include <toaru/hashmap.h>
 
+#include <poll.h>
+
 static hashmap_t * dns_cache;
 static list_t * dns_waiters = NULL;
 static uint32_t _dns_server;
@@ -387,15 +389,8 @@ static char * fgets(char * buf, int size, struct socket * stream) {
 	return buf;
 }
 
-static void socket_alert_waiters(struct socket * sock) {
-	if (sock->alert_waiters) {
-		while (sock->alert_waiters->head) {
-			node_t * node = list_dequeue(sock->alert_waiters);
-			process_t * p = node->value;
-			process_alert_node(p, sock);
-			free(node);
-		}
-	}
+static void socket_alert_waiters(struct socket * sock, int events) {
+	fs_wait_alert(sock->alert_waiters, events);
 }
 
 
@@ -413,14 +408,9 @@ static int socket_check(fs_node_t * node) {
 	return 1;
 }
 
-static int socket_wait(fs_node_t * node, void * process) {
+static int socket_wait(fs_node_t * node, fs_waiter_t * waiter) {
 	struct socket * sock = node->device;
-
-	if (!list_find(sock->alert_waiters, process)) {
-		list_insert(sock->alert_waiters, process);
-	}
-
-	list_insert(((process_t *)process)->node_waits, sock);
+	fs_wait_add(&sock->alert_waiters, waiter);
 	return 0;
 }
 
@@ -760,7 +750,7 @@ int net_close(struct socket* socket) {
 	// socket->is_connected;
 	socket->status = 1; /* Disconnected */
 	wakeup_queue(socket->packet_wait);
-	socket_alert_waiters(socket);
+	socket_alert_waiters(socket, POLLHUP);
 	return 1;
 }
 
@@ -906,7 +896,7 @@ static void net_handle_tcp(struct tcp_header * tcp, size_t length) {
 			net_send_tcp(socket, TCP_FLAGS_ACK, NULL, 0);
 
 			wakeup_queue(socket->packet_wait);
-			socket_alert_waiters(socket);
+			socket_alert_waiters(socket, POLLIN);
 
 			if (htons(tcp->flags) & TCP_FLAGS_FIN) {
 				/* We should make sure we finish sending before closing. */
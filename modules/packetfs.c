@@ -239,18 +239,18 @@ static void close_client(fs_node_t * node) {
 	free(c);
 }
 
-static int wait_server(fs_node_t * node, void * process) {
+static int wait_server(fs_node_t * node, fs_waiter_t * waiter) {
 	pex_ex_t * p = (pex_ex_t *)node->device;
-	return selectwait_fs(p->server_pipe, process);
+	return selectwait_fs(p->server_pipe, waiter);
 }
 static int check_server(fs_node_t * node) {
 	pex_ex_t * p = (pex_ex_t *)node->device;
 	return selectcheck_fs(p->server_pipe);
 }
 
-static int wait_client(fs_node_t * node, void * process) {
+static int wait_client(fs_node_t * node, fs_waiter_t * waiter) {
 	pex_client_t * c = (pex_client_t *)node->inode;
-	return selectwait_fs(c->pipe, process);
+	return selectwait_fs(c->pipe, waiter);
 }
 static int check_client(fs_node_t * node) {
 	pex_client_t * c = (pex_client_t *)node->inode;
@@ -12,6 +12,9 @@
 #include <kernel/module.h>
 #include <kernel/multiboot.h>
 #include <kernel/pci.h>
+#include <kernel/trace.h>
+#include <kernel/procsnap.h>
+#include <kernel/pagecache.h>
 #include <kernel/mod/procfs.h>
 
 #define PROCFS_STANDARD_ENTRIES (sizeof(std_entries) / sizeof(struct procfs_entry))
@@ -81,51 +84,40 @@ static uint32_t proc_cmdline_func(fs_node_t *node, uint32_t offset, uint32_t siz
 	return size;
 }
 
-static size_t calculate_memory_usage(page_directory_t * src) {
-	size_t pages = 0;
-	for (uint32_t i = 0; i < 1024; ++i) {
-		if (!src->tables[i] || (uintptr_t)src->tables[i] == (uintptr_t)0xFFFFFFFF) {
-			continue;
-		}
-		if (kernel_directory->tables[i] == src->tables[i]) {
-			continue;
-		}
-		/* For each table */
-		if (i * 0x1000 * 1024 < SHM_START) {
-			/* Ignore shared memory for now */
-			for (int j = 0; j < 1024; ++j) {
-				/* For each frame in the table... */
-				if (!src->tables[i]->pages[j].frame) {
-					continue;
-				}
-				pages++;
-			}
+static char * proc_basename(process_t * proc) {
+	char * name = proc->name + strlen(proc->name) - 1;
+
+	while (1) {
+		if (*name == '/') {
+			name++;
+			break;
 		}
+		if (name == proc->name) break;
+		name--;
 	}
-	return pages;
+
+	return name;
 }
 
-static size_t calculate_shm_resident(page_directory_t * src) {
-	size_t pages = 0;
-	for (uint32_t i = 0; i < 1024; ++i) {
-		if (!src->tables[i] || (uintptr_t)src->tables[i] == (uintptr_t)0xFFFFFFFF) {
-			continue;
-		}
-		if (kernel_directory->tables[i] == src->tables[i]) {
-			continue;
-		}
-		if (i * 0x1000 * 1024 < SHM_START) {
-			continue;
-		}
-		for (int j = 0; j < 1024; ++j) {
-			/* For each frame in the table... */
-			if (!src->tables[i]->pages[j].frame) {
-				continue;
-			}
-			pages++;
-		}
-	}
-	return pages;
+/* Our sprintf has no 64-bit conversions */
+static char * format_u64(char * out, uint64_t value) {
+	char tmp[21];
+	int i = 0;
+	do {
+		uint32_t hi = value >> 32;
+		uint32_t lo = value;
+		/* Divide by ten in 16-bit steps to stay within 32-bit arithmetic */
+		uint32_t qhi = hi / 10;
+		uint32_t mid = ((hi % 10) << 16) | (lo >> 16);
+		uint32_t qmid = mid / 10;
+		uint32_t low = ((mid % 10) << 16) | (lo & 0xFFFF);
+		tmp[i++] = '0' + (low % 10);
+		value = ((uint64_t)qhi << 32) | (qmid << 16) | (low / 10);
+	} while (value);
+	char * o = out;
+	while (i) *o++ = tmp[--i];
+	*o = '\0';
+	return out;
 }
 
 static uint32_t proc_status_func(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer) {
@@ -139,20 +131,11 @@ static uint32_t proc_status_func(fs_node_t *node, uint32_t offset, uint32_t size
 	}
 
 	char state = proc->finished ? 'Z' : (process_is_ready(proc) ? 'R' : 'S');
-	char * name = proc->name + strlen(proc->name) - 1;
-
-	while (1) {
-		if (*name == '/') {
-			name++;
-			break;
-		}
-		if (name == proc->name) break;
-		name--;
-	}
+	char * name = proc_basename(proc);
 
-	/* Calculate process memory usage */
-	int mem_usage = calculate_memory_usage(proc->thread.page_directory) * 4;
-	int shm_usage = calculate_shm_resident(proc->thread.page_directory) * 4;
+	/* Process memory usage is maintained by the page allocator */
+	int mem_usage = proc->thread.page_directory->user_pages * 4;
+	int shm_usage = proc->thread.page_directory->shm_pages * 4;
 	int mem_permille = 1000 * (mem_usage + shm_usage) / memory_total();
 
 	sprintf(buf,
@@ -201,9 +184,55 @@ static uint32_t proc_status_func(fs_node_t *node, uint32_t offset, uint32_t size
 	return size;
 }
 
+/**
+ * Single-line summary for tools that poll every process (ps, top).
+ * Fields, in order: pid (name) state ppid tgid uid utime stime nvcsw
+ * nivcsw syscalls faults rbytes wbytes vsz_kb shm_kb start_sec.
+ * Times are in timer ticks (milliseconds).
+ */
+static uint32_t proc_stat_func(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer) {
+	char buf[512];
+	char rbytes[21], wbytes[21];
+	process_t * proc = process_from_pid(node->inode);
+
+	if (!proc) {
+		return 0;
+	}
+
+	process_t * parent = process_get_parent(proc);
+	char state = proc->finished ? 'Z' : (process_is_ready(proc) ? 'R' : 'S');
+
+	sprintf(buf, "%d (%s) %c %d %d %d %d %d %d %d %d %d %s %s %d %d %d\n",
+			proc->id,
+			proc_basename(proc),
+			state,
+			parent ? parent->id : 0,
+			proc->group ? proc->group : proc->id,
+			proc->user,
+			proc->stats.utime,
+			proc->stats.stime,
+			proc->stats.nvcsw,
+			proc->stats.nivcsw,
+			proc->stats.syscalls,
+			proc->stats.page_faults,
+			format_u64(rbytes, proc->stats.read_bytes),
+			format_u64(wbytes, proc->stats.write_bytes),
+			proc->thread.page_directory->user_pages * 4,
+			proc->thread.page_directory->shm_pages * 4,
+			proc->start.tv_sec);
+
+	size_t _bsize = strlen(buf);
+	if (offset > _bsize) return 0;
+	if (size > _bsize - offset) size = _bsize - offset;
+
+	memcpy(buffer, buf + offset, size);
+	return size;
+}
+
 static struct procfs_entry procdir_entries[] = {
 	{1, "cmdline", proc_cmdline_func},
 	{2, "status",  proc_status_func},
+	{3, "stat",    proc_stat_func},
 };
 
 static struct dirent * readdir_procfs_procdir(fs_node_t *node, uint32_t index) {
@@ -300,7 +329,13 @@ static uint32_t cpuinfo_func(fs_node_t *node, uint32_t offset, uint32_t size, ui
 		"Manufacturer: %s\n"
 		"Family: %d\n"
 		"Model: %d\n"
-		, _manu, _family, _model);
+		"Processors: %d\n"
+		"FPUSaves: %d\n"
+		"FPUSavesAvoided: %d\n"
+		"FPURestores: %d\n"
+		"FPURestoresAvoided: %d\n"
+		, _manu, _family, _model, cpu_count,
+		fpu_saves, fpu_saves_avoided, fpu_restores, fpu_restores_avoided);
 
 	size_t _bsize = strlen(buf);
 	if (offset > _bsize) return 0;
@@ -318,14 +353,24 @@ static uint32_t meminfo_func(fs_node_t *node, uint32_t offset, uint32_t size, ui
 	unsigned int total = memory_total();
 	unsigned int free  = total - memory_use();
 	unsigned int kheap = (heap_end - kernel_heap_alloc_point) / 1024;
-
-
+	struct pagecache_stats cache;
+	pagecache_get_stats(&cache);
 
 	sprintf(buf,
 		"MemTotal: %d kB\n"
 		"MemFree: %d kB\n"
 		"KHeapUse: %d kB\n"
-		, total, free, kheap);
+		"Cached: %d kB\n"
+		"CacheLimit: %d kB\n"
+		"CachePinned: %d kB\n"
+		"CacheDirty: %d kB\n"
+		"CacheHits: %d\n"
+		"CacheMisses: %d\n"
+		"CacheReclaimed: %d\n"
+		"CacheWritten: %d\n"
+		, total, free, kheap,
+		cache.pages * 4, cache.limit * 4, cache.pinned * 4, cache.dirty * 4,
+		cache.hits, cache.misses, cache.reclaimed, cache.written);
 
 	size_t _bsize = strlen(buf);
 	if (offset > _bsize) return 0;
@@ -675,6 +720,114 @@ static uint32_t pci_func(fs_node_t *node, uint32_t offset, uint32_t size, uint8_
 	return size;
 }
 
+static uint32_t trace_func(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer) {
+	return trace_snapshot(offset, size, buffer);
+}
+
+/**
+ * Sorted kernel and module symbols, one "address name" per line.
+ * Lines are fixed-width up to the name, so we can skip straight
+ * to the requested offset without formatting everything before it.
+ */
+static uint32_t ksyms_func(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer) {
+	size_t count;
+	symbol_entry_t * syms = symbols_sorted(&count);
+	char line[512];
+
+	uint32_t pos = 0;
+	uint32_t written = 0;
+	for (size_t i = 0; i < count && written < size; ++i) {
+		size_t len = 10 + strlen(syms[i].name);
+		if (len > sizeof(line) - 1) continue;
+		if (pos + len <= offset) {
+			pos += len;
+			continue;
+		}
+		sprintf(line, "%x %s\n", syms[i].addr, syms[i].name);
+		uint32_t skip = offset > pos ? offset - pos : 0;
+		uint32_t n = len - skip;
+		if (n > size - written) n = size - written;
+		memcpy(buffer + written, line + skip, n);
+		written += n;
+		pos += len;
+	}
+
+	return written;
+}
+
+extern unsigned long irq_counts[]; /* from kernel/cpu/irq.c */
+
+/**
+ * Binary snapshot of every process plus global counters, for
+ * monitors that refresh continuously. Only reads at offset 0
+ * return data; the snapshot is taken with interrupts off, so it
+ * is consistent and no process can exit while we look at it.
+ */
+static uint32_t snapshot_func(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer) {
+	if (offset != 0 || size < sizeof(procsnap_header_t)) return 0;
+
+	procsnap_header_t * header = (procsnap_header_t *)buffer;
+	procsnap_record_t * records = (procsnap_record_t *)(buffer + sizeof(procsnap_header_t));
+	uint32_t space = (size - sizeof(procsnap_header_t)) / sizeof(procsnap_record_t);
+
+	IRQ_OFF;
+
+	header->magic       = PROCSNAP_MAGIC;
+	header->header_size = sizeof(procsnap_header_t);
+	header->record_size = sizeof(procsnap_record_t);
+	header->total       = process_list->length;
+	header->uptime      = timer_ticks * 1000 + timer_subticks;
+	header->cpu_user    = timer_user_ticks;
+	header->cpu_system  = timer_system_ticks;
+	header->cpu_idle    = timer_idle_ticks;
+	header->mem_total   = memory_total();
+	header->mem_used    = memory_use();
+	header->kheap_used  = (heap_end - kernel_heap_alloc_point) / 1024;
+	header->context_switches = trace_switches;
+	for (int i = 0; i < PROCSNAP_IRQS; ++i) {
+		header->irqs[i] = irq_counts[i];
+	}
+
+	uint32_t count = 0;
+	foreach(lnode, process_list) {
+		if (count == space) break;
+		process_t * proc = (process_t *)lnode->value;
+		procsnap_record_t * r = &records[count++];
+		tree_node_t * parent = proc->tree_entry ? proc->tree_entry->parent : NULL;
+
+		r->pid   = proc->id;
+		r->tgid  = proc->group ? proc->group : proc->id;
+		r->ppid  = parent ? ((process_t *)parent->value)->id : 0;
+		r->uid   = proc->user;
+		r->state = proc->finished ? 'Z' : (process_is_ready(proc) ? 'R' : 'S');
+		r->flags = (proc->is_tasklet ? PROCSNAP_FLAG_TASKLET : 0) |
+		           (r->tgid != r->pid ? PROCSNAP_FLAG_THREAD : 0);
+		r->reserved = 0;
+		char * name = proc_basename(proc);
+		size_t len = strlen(name);
+		if (len > sizeof(r->name) - 1) len = sizeof(r->name) - 1;
+		memcpy(r->name, name, len);
+		r->name[len] = '\0';
+
+		r->utime       = proc->stats.utime;
+		r->stime       = proc->stats.stime;
+		r->nvcsw       = proc->stats.nvcsw;
+		r->nivcsw      = proc->stats.nivcsw;
+		r->syscalls    = proc->stats.syscalls;
+		r->page_faults = proc->stats.page_faults;
+		r->read_bytes  = proc->stats.read_bytes;
+		r->write_bytes = proc->stats.write_bytes;
+		r->vsz   = proc->thread.page_directory->user_pages * 4;
+		r->shm   = proc->thread.page_directory->shm_pages * 4;
+		r->start = proc->start.tv_sec;
+	}
+	header->count = count;
+
+	IRQ_RES;
+
+	return sizeof(procsnap_header_t) + count * sizeof(procsnap_record_t);
+}
+
 static struct procfs_entry std_entries[] = {
 	{-1, "cpuinfo",  cpuinfo_func},
 	{-2, "meminfo",  meminfo_func},
@@ -689,6 +842,9 @@ static struct procfs_entry std_entries[] = {
 	{-11,"irq",      irq_func},
 	{-12,"pat",      pat_func},
 	{-13,"pci",      pci_func},
+	{-14,"trace",    trace_func},
+	{-15,"ksyms",    ksyms_func},
+	{-16,"snapshot", snapshot_func},
 };
 
 static list_t * extended_entries = NULL;
@@ -764,8 +920,6 @@ static struct dirent * readdir_procfs_root(fs_node_t *node, uint32_t index) {
 
 	int i = index + 1;
 
-	debug_print(WARNING, "%d %d %d", i, index, PROCFS_STANDARD_ENTRIES);
-
 	pid_t pid = 0;
 
 	foreach(lnode, process_list) {
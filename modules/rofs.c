@@ -0,0 +1,336 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Compressed read-only filesystem
+ *
+ * Mounts images built by util/mkrofs.py, normally the boot
+ * ramdisk. Metadata is loaded once at mount time; file data is
+ * decompressed a block at a time into a small LRU cache, or
+ * straight into the caller's buffer when a read covers a whole
+ * block. See <kernel/mod/rofs.h> for the image layout.
+ */
+#include <kernel/system.h>
+#include <kernel/types.h>
+#include <kernel/fs.h>
+#include <kernel/logging.h>
+#include <kernel/module.h>
+#include <kernel/printf.h>
+#include <kernel/tokenize.h>
+#include <kernel/inflate.h>
+#include <kernel/mod/rofs.h>
+
+#define ROFS_CACHE_BLOCKS 32
+
+struct rofs_cache_entry {
+	uint32_t block;    /* index in the block table, or -1 if unused */
+	uint32_t length;   /* decompressed bytes */
+	uint32_t last_use;
+	uint8_t * data;
+};
+
+typedef struct {
+	fs_node_t * device;
+	rofs_super_t super;
+
+	rofs_inode_t * inodes;
+	rofs_dirent_t * dirents;
+	char * names;
+	rofs_block_t * blocks;
+
+	spin_lock_t cache_lock;
+	uint32_t cache_clock;
+	struct rofs_cache_entry cache[ROFS_CACHE_BLOCKS];
+	uint8_t * compressed; /* one compressed block; protected by cache_lock */
+} rofs_t;
+
+static void node_from_inode(rofs_t * this, uint32_t ino, char * name, fs_node_t * fnode);
+
+/*
+ * Decompress one block into `out`, which has room for block_size
+ * bytes. Called with the cache lock held.
+ */
+static int rofs_load_block(rofs_t * this, uint32_t block, uint8_t * out, uint32_t * length) {
+	if (block >= this->super.block_count) return 1;
+
+	rofs_block_t * b = &this->blocks[block];
+	uint32_t size = b->size & ~ROFS_BLOCK_STORED;
+	if (size > this->super.block_size) return 1;
+
+	if (b->size & ROFS_BLOCK_STORED) {
+		*length = read_fs(this->device, b->offset, size, out);
+		return 0;
+	}
+
+	if (read_fs(this->device, b->offset, size, this->compressed) != size) return 1;
+
+	size_t written;
+	if (inflate_raw(this->compressed, size, out, this->super.block_size, &written)) {
+		debug_print(ERROR, "rofs: block %d is corrupt", block);
+		return 1;
+	}
+	*length = written;
+	return 0;
+}
+
+static struct rofs_cache_entry * rofs_cached_block(rofs_t * this, uint32_t block) {
+	for (int i = 0; i < ROFS_CACHE_BLOCKS; ++i) {
+		if (this->cache[i].block == block) {
+			this->cache[i].last_use = ++this->cache_clock;
+			return &this->cache[i];
+		}
+	}
+	return NULL;
+}
+
+static struct rofs_cache_entry * rofs_get_block(rofs_t * this, uint32_t block) {
+	struct rofs_cache_entry * entry = rofs_cached_block(this, block);
+	if (entry) return entry;
+
+	entry = &this->cache[0];
+	for (int i = 1; i < ROFS_CACHE_BLOCKS; ++i) {
+		if (this->cache[i].last_use < entry->last_use) {
+			entry = &this->cache[i];
+		}
+	}
+
+	if (rofs_load_block(this, block, entry->data, &entry->length)) {
+		entry->block = (uint32_t)-1;
+		entry->last_use = 0;
+		return NULL;
+	}
+
+	entry->block = block;
+	entry->last_use = ++this->cache_clock;
+	return entry;
+}
+
+static uint32_t read_rofs(fs_node_t * node, uint32_t offset, uint32_t size, uint8_t * buffer) {
+	rofs_t * this = (rofs_t *)node->device;
+	rofs_inode_t * inode = &this->inodes[node->inode];
+	uint32_t block_size = this->super.block_size;
+
+	if (offset >= inode->size) return 0;
+	if (size > inode->size - offset) size = inode->size - offset;
+
+	uint32_t done = 0;
+	spin_lock(this->cache_lock);
+	while (done < size) {
+		uint32_t pos   = offset + done;
+		uint32_t index = pos / block_size;
+		uint32_t skip  = pos % block_size;
+		uint32_t block = inode->start + index;
+
+		/* Whole blocks that aren't cached skip the cache entirely */
+		uint32_t full = inode->size - index * block_size;
+		if (full > block_size) full = block_size;
+		if (!skip && size - done >= full && !rofs_cached_block(this, block)) {
+			uint32_t length;
+			if (rofs_load_block(this, block, buffer + done, &length) || length != full) break;
+			done += full;
+			continue;
+		}
+
+		struct rofs_cache_entry * entry = rofs_get_block(this, block);
+		if (!entry || skip >= entry->length) break;
+
+		uint32_t n = entry->length - skip;
+		if (n > size - done) n = size - done;
+		memcpy(buffer + done, entry->data + skip, n);
+		done += n;
+	}
+	spin_unlock(this->cache_lock);
+
+	return done;
+}
+
+static struct dirent * readdir_rofs(fs_node_t * node, uint32_t index) {
+	rofs_t * this = (rofs_t *)node->device;
+	rofs_inode_t * inode = &this->inodes[node->inode];
+
+	struct dirent * out;
+	if (index < 2) {
+		out = malloc(sizeof(struct dirent));
+		memset(out, 0x00, sizeof(struct dirent));
+		out->ino = node->inode;
+		strcpy(out->name, index ? ".." : ".");
+		return out;
+	}
+
+	index -= 2;
+	if (index >= inode->size) return NULL;
+
+	rofs_dirent_t * d = &this->dirents[inode->start + index];
+	out = malloc(sizeof(struct dirent));
+	memset(out, 0x00, sizeof(struct dirent));
+	out->ino = d->inode;
+	strcpy(out->name, this->names + d->name);
+	return out;
+}
+
+/* Entries in a directory are sorted by name, so this is a bisection */
+static fs_node_t * finddir_rofs(fs_node_t * node, char * name) {
+	rofs_t * this = (rofs_t *)node->device;
+	rofs_inode_t * inode = &this->inodes[node->inode];
+
+	rofs_dirent_t * entries = &this->dirents[inode->start];
+	uint32_t low = 0, high = inode->size;
+
+	while (low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		int cmp = strcmp(name, this->names + entries[mid].name);
+		if (cmp == 0) {
+			fs_node_t * out = malloc(sizeof(fs_node_t));
+			node_from_inode(this, entries[mid].inode, name, out);
+			return out;
+		} else if (cmp < 0) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+
+	return NULL;
+}
+
+static int readlink_rofs(fs_node_t * node, char * buf, size_t size) {
+	rofs_t * this = (rofs_t *)node->device;
+	char * target = this->names + this->inodes[node->inode].start;
+
+	size_t read_size = strlen(target);
+	if (read_size > size) read_size = size;
+	memcpy(buf, target, read_size);
+
+	/* As with ext2, the length doesn't include the nul */
+	if (read_size < size) {
+		buf[read_size] = '\0';
+	}
+	return read_size;
+}
+
+static void node_from_inode(rofs_t * this, uint32_t ino, char * name, fs_node_t * fnode) {
+	rofs_inode_t * inode = &this->inodes[ino];
+
+	memset(fnode, 0x00, sizeof(fs_node_t));
+	size_t name_len = strlen(name);
+	if (name_len > sizeof(fnode->name) - 1) name_len = sizeof(fnode->name) - 1;
+	memcpy(fnode->name, name, name_len);
+	fnode->device = this;
+	fnode->inode  = ino;
+	fnode->mask   = inode->mode & 07777;
+	fnode->uid    = inode->uid;
+	fnode->gid    = inode->gid;
+	fnode->nlink  = inode->nlink;
+	fnode->length = inode->size;
+	fnode->atime  = inode->mtime;
+	fnode->mtime  = inode->mtime;
+	fnode->ctime  = inode->mtime;
+
+	switch (inode->mode & _IFMT) {
+		case _IFDIR:
+			fnode->flags   = FS_DIRECTORY;
+			fnode->length  = 0;
+			fnode->readdir = readdir_rofs;
+			fnode->finddir = finddir_rofs;
+			break;
+		case _IFLNK:
+			fnode->flags    = FS_SYMLINK;
+			fnode->length   = strlen(this->names + inode->start);
+			fnode->readlink = readlink_rofs;
+			break;
+		default:
+			fnode->flags = FS_FILE;
+			fnode->read  = read_rofs;
+			break;
+	}
+}
+
+/* Read a metadata table, checking that it lies inside the image */
+static void * rofs_read_table(rofs_t * this, uint32_t offset, uint32_t count, uint32_t size) {
+	if (!count) return malloc(1);
+	if (count > this->super.image_size / size) return NULL;
+	uint32_t length = count * size;
+	if (offset > this->super.image_size || length > this->super.image_size - offset) return NULL;
+
+	void * table = malloc(length);
+	if (read_fs(this->device, offset, length, table) != length) {
+		free(table);
+		return NULL;
+	}
+	return table;
+}
+
+static fs_node_t * mount_rofs(fs_node_t * dev) {
+	rofs_t * this = malloc(sizeof(rofs_t));
+	memset(this, 0x00, sizeof(rofs_t));
+	this->device = dev;
+
+	read_fs(dev, 0, sizeof(rofs_super_t), (uint8_t *)&this->super);
+	if (this->super.magic != ROFS_MAGIC || this->super.version != ROFS_VERSION) {
+		debug_print(ERROR, "rofs: bad magic or version");
+		free(this);
+		return NULL;
+	}
+	if (!this->super.inode_count || this->super.image_size > dev->length ||
+			this->super.block_size < 512 || this->super.block_size > 0x100000) {
+		debug_print(ERROR, "rofs: bad superblock");
+		free(this);
+		return NULL;
+	}
+
+	this->inodes  = rofs_read_table(this, this->super.inode_offset,  this->super.inode_count,  sizeof(rofs_inode_t));
+	this->dirents = rofs_read_table(this, this->super.dirent_offset, this->super.dirent_count, sizeof(rofs_dirent_t));
+	this->names   = rofs_read_table(this, this->super.names_offset,  this->super.names_size,   1);
+	this->blocks  = rofs_read_table(this, this->super.block_offset,  this->super.block_count,  sizeof(rofs_block_t));
+	if (!this->inodes || !this->dirents || !this->names || !this->blocks) {
+		debug_print(ERROR, "rofs: metadata tables are outside the image");
+		return NULL;
+	}
+
+	this->compressed = malloc(this->super.block_size);
+	for (int i = 0; i < ROFS_CACHE_BLOCKS; ++i) {
+		this->cache[i].block = (uint32_t)-1;
+		this->cache[i].data  = malloc(this->super.block_size);
+	}
+
+	debug_print(NOTICE, "rofs: %d inodes, %d blocks of %d bytes, image is %d bytes",
+			this->super.inode_count, this->super.block_count, this->super.block_size, this->super.image_size);
+
+	fs_node_t * root = malloc(sizeof(fs_node_t));
+	node_from_inode(this, 0, "/", root);
+	return root;
+}
+
+static fs_node_t * rofs_fs_mount(char * device, char * mount_path) {
+	char * arg = strdup(device);
+	char * argv[10];
+	int argc = tokenize(arg, ",", argv);
+
+	fs_node_t * dev = kopen(argv[0], 0);
+	if (!dev) {
+		debug_print(ERROR, "failed to open %s", device);
+		free(arg);
+		return NULL;
+	}
+
+	for (int i = 1; i < argc; ++i) {
+		debug_print(WARNING, "Unrecognized option to rofs driver: %s", argv[i]);
+	}
+
+	fs_node_t * fs = mount_rofs(dev);
+
+	free(arg);
+	return fs;
+}
+
+static int init(void) {
+	vfs_register("rofs", rofs_fs_mount);
+	return 0;
+}
+
+static int fini(void) {
+	return 0;
+}
+
+MODULE_DEF(rofs, init, fini);
@@ -142,8 +142,8 @@ static void close_serial(fs_node_t * node) {
 	return;
 }
 
-static int wait_serial(fs_node_t * node, void * process) {
-	return selectwait_fs(*pipe_for_port((int)node->device), process);
+static int wait_serial(fs_node_t * node, fs_waiter_t * waiter) {
+	return selectwait_fs(*pipe_for_port((int)node->device), waiter);
 }
 static int check_serial(fs_node_t * node) {
 	return selectcheck_fs(*pipe_for_port((int)node->device));
@@ -5,30 +5,52 @@
  *
  * Sound subsystem.
  *
- * Currently has the ability to mix several sound sources together. Could use
- * a /dev/mixer device to allow changing of audio settings. Also could use
- * the ability to change frequency and format for audio samples. Also doesn't
+ * Mixes several sound sources together. Each /dev/dsp stream has its own
+ * sample rate (resampled to the device rate), gain and buffer size, set
+ * through ioctls. Mixing is done by a tasklet rather than in the device's
+ * interrupt handler, using saturating SSE2 arithmetic. Streams can also be
+ * switched to a ring shared with the client (SND_DSP_MMAP), which the mixer
+ * reads directly, skipping the copy through write(). Still doesn't
  * really support multiple devices despite the interface suggesting it might...
  */
 
 #include <kernel/module.h>
 #include <kernel/ringbuffer.h>
 #include <kernel/system.h>
+#include <kernel/shm.h>
 #include <kernel/mod/snd.h>
 
 #include <toaru/list.h>
 #include <errno.h>
+#include <poll.h>
 
 /* Utility macros */
 #define N_ELEMENTS(arr) (sizeof(arr) / sizeof((arr)[0]))
 
 #define SND_BUF_SIZE 0x4000
 
+/* Frames are always 16-bit signed stereo */
+#define SND_FRAME_SIZE 4
+#define SND_MIN_LATENCY 64
+#define SND_MAX_LATENCY 0x4000
+
+/* Output frames mixed per pass */
+#define SND_MIX_CHUNK 256
+/* Stream gain is Q15; unity is handled separately as pmulhw is signed */
+#define SND_GAIN_UNITY 0x8000
+
+/* Maximum number of buffers a device can have waiting on the mixer */
+#define SND_PENDING 8
+
 static uint32_t snd_dsp_write(fs_node_t * node, uint32_t offset, uint32_t size, uint8_t *buffer);
 static int snd_dsp_ioctl(fs_node_t * node, int request, void * argp);
 static void snd_dsp_open(fs_node_t * node, unsigned int flags);
 static void snd_dsp_close(fs_node_t * node);
 
+static int snd_dsp_check(fs_node_t * node);
+static int snd_dsp_wait(fs_node_t * node, fs_waiter_t * waiter);
+static int snd_dsp_poll(fs_node_t * node);
+
 static int snd_mixer_ioctl(fs_node_t * node, int request, void * argp);
 static void snd_mixer_open(fs_node_t * node, unsigned int flags);
 static void snd_mixer_close(fs_node_t * node);
@@ -45,6 +67,9 @@ static fs_node_t _dsp_fnode = {
 	.write  = snd_dsp_write,
 	.open   = snd_dsp_open,
 	.close  = snd_dsp_close,
+	.selectcheck = snd_dsp_check,
+	.selectwait  = snd_dsp_wait,
+	.pollcheck   = snd_dsp_poll,
 };
 static fs_node_t _mixer_fnode = {
 	.name  = "mixer",
@@ -59,12 +84,51 @@ static list_t _buffers;
 static uint32_t _next_device_id = SND_DEVICE_MAIN;
 
 struct dsp_node {
+	spin_lock_t lock;   /* Guards rb and map against writers */
+	int writers;        /* Threads inside write() using rb */
 	ring_buffer_t * rb;
 	size_t samples;
 	size_t written;
 	int realtime;
+
+	uint32_t rate;      /* Sample rate of the stream; 0 means the device rate */
+	uint32_t gain;      /* Q15 gain */
+	uint32_t latency;   /* Size of rb in frames */
+	uint32_t phase;     /* 16.16 resampler position, relative to history[0] */
+	int16_t history[4]; /* Last two input frames, for interpolation */
+	int running;        /* Stream filled the last period */
+	uint32_t underruns;
+	uint32_t period;    /* Free frames needed for fswait to report ready */
+	list_t * alert_waiters;
+
+	/* Shared ring, if the client asked for one */
+	snd_dsp_mmap_t * map;
+	shm_chunk_t * map_chunk;
+	pid_t map_pid;
+	uint32_t map_frames;  /* Kernel copies of the header fields the */
+	uint32_t map_read;    /* client could otherwise scribble over */
+	uint32_t * map_ring;
+};
+
+struct snd_pending {
+	snd_device_t * device;
+	uint8_t * buffer;
+	uint32_t size;
 };
 
+static struct snd_pending _pending[SND_PENDING];
+static volatile unsigned int _pending_head = 0;
+static volatile unsigned int _pending_tail = 0;
+static spin_lock_t _pending_lock;
+static list_t * _mixer_wait;
+
+static struct {
+	uint32_t periods;
+	uint32_t late;
+	uint32_t mix_time;
+	uint32_t mix_time_max;
+} _mix_stats;
+
 int snd_register(snd_device_t * device) {
 	int rv = 0;
 
@@ -107,27 +171,150 @@ static uint32_t snd_dsp_write(fs_node_t * node, uint32_t offset, uint32_t size,
 
 	struct dsp_node * dsp = node->device;
 
-	size_t s = ring_buffer_available(dsp->rb);
+	/*
+	 * The buffer can't be swapped out from under us while we hold a
+	 * writer count; we can't hold the lock itself as the write may block.
+	 */
+	spin_lock(dsp->lock);
+	if (dsp->map) {
+		/* Mapped streams are fed through the ring */
+		spin_unlock(dsp->lock);
+		return -1;
+	}
+	ring_buffer_t * rb = dsp->rb;
+	dsp->writers++;
+	spin_unlock(dsp->lock);
+
+	size_t s = ring_buffer_available(rb);
 	size_t out;
 	if (size > s && dsp->realtime) {
-		out = ring_buffer_write(dsp->rb, s & ~0x3, buffer);
+		out = ring_buffer_write(rb, s & ~0x3, buffer);
 	} else {
-		out = ring_buffer_write(dsp->rb, size, buffer);
+		out = ring_buffer_write(rb, size, buffer);
 	}
 	dsp->written += out / 4;
 
+	spin_lock(dsp->lock);
+	dsp->writers--;
+	spin_unlock(dsp->lock);
+
 	return out;
 }
 
+static snd_device_t * snd_main_device();
+
 static int snd_dsp_ioctl(fs_node_t * node, int request, void * argp) {
-	/* Potentially use this to set sample rates in the future */
 	struct dsp_node * dsp = node->device;
-	if (request == 4) {
-		dsp->realtime = 1;
-	} else if (request == 5) {
-		return dsp->samples;
+	switch (request) {
+		case SND_DSP_SET_REALTIME:
+			dsp->realtime = 1;
+			return 0;
+		case SND_DSP_GET_SAMPLES:
+			return dsp->samples;
+		case SND_DSP_SET_RATE: {
+			validate(argp);
+			snd_device_t * device = snd_main_device();
+			uint32_t rate = *(uint32_t *)argp;
+			if (!device) return -ENODEV;
+			/* The resampler reads at most two input frames per output frame */
+			if (rate < device->playback_speed / 8 || rate > device->playback_speed * 2) {
+				return -EINVAL;
+			}
+			spin_lock(_buffers_lock);
+			dsp->rate = (rate == device->playback_speed) ? 0 : rate;
+			spin_unlock(_buffers_lock);
+			return 0;
+		}
+		case SND_DSP_SET_VOLUME: {
+			validate(argp);
+			uint32_t val = *(uint32_t *)argp;
+			if (val == SND_KNOB_MAX_VALUE) {
+				dsp->gain = SND_GAIN_UNITY;
+			} else {
+				dsp->gain = (val >> 16) * (SND_GAIN_UNITY - 1) / 0xFFFF;
+			}
+			return 0;
+		}
+		case SND_DSP_SET_LATENCY: {
+			validate(argp);
+			uint32_t frames = *(uint32_t *)argp;
+			if (frames < SND_MIN_LATENCY || frames > SND_MAX_LATENCY) {
+				return -EINVAL;
+			}
+			/*
+			 * Replacing the buffer is only safe when nothing is queued in it
+			 * and no other thread is in the middle of writing to it.
+			 */
+			spin_lock(dsp->lock);
+			spin_lock(_buffers_lock);
+			if (dsp->writers || ring_buffer_unread(dsp->rb)) {
+				spin_unlock(_buffers_lock);
+				spin_unlock(dsp->lock);
+				return -EBUSY;
+			}
+			ring_buffer_t * old = dsp->rb;
+			/* One byte of a ring buffer is always left unused */
+			dsp->rb = ring_buffer_create(frames * SND_FRAME_SIZE + 1);
+			dsp->rb->lockless = 1;
+			dsp->latency = frames;
+			spin_unlock(_buffers_lock);
+			spin_unlock(dsp->lock);
+			ring_buffer_destroy(old);
+			free(old);
+			return 0;
+		}
+		case SND_DSP_GET_STATS: {
+			validate(argp);
+			snd_dsp_stats_t * stats = argp;
+			snd_device_t * device = snd_main_device();
+			stats->rate = dsp->rate ? dsp->rate : (device ? device->playback_speed : 0);
+			stats->latency = dsp->latency;
+			stats->samples = dsp->samples;
+			stats->underruns = dsp->underruns;
+			stats->periods = _mix_stats.periods;
+			stats->late = _mix_stats.late;
+			stats->mix_time = _mix_stats.mix_time;
+			stats->mix_time_max = _mix_stats.mix_time_max;
+			return 0;
+		}
+		case SND_DSP_MMAP: {
+			validate(argp);
+			snd_dsp_mmap_request_t * req = argp;
+			if (req->frames < SND_MIN_LATENCY || req->frames > SND_MAX_LATENCY ||
+				(req->frames & (req->frames - 1)) || !req->period || req->period > req->frames) {
+				return -EINVAL;
+			}
+			spin_lock(dsp->lock);
+			spin_lock(_buffers_lock);
+			if (dsp->map || dsp->writers || ring_buffer_unread(dsp->rb)) {
+				spin_unlock(_buffers_lock);
+				spin_unlock(dsp->lock);
+				return -EBUSY;
+			}
+			size_t size = 0x1000 + ((req->frames * SND_FRAME_SIZE + 0xFFF) & ~0xFFF);
+			snd_dsp_mmap_t * map = valloc(size);
+			memset(map, 0, size);
+			map->frames = req->frames;
+			map->period = req->period;
+			map->data_offset = 0x1000;
+
+			dsp->map_chunk = shm_chunk_from_kernel(map, size);
+			dsp->map_pid = current_process->id;
+			dsp->map_frames = req->frames;
+			dsp->map_read = 0;
+			dsp->map_ring = (uint32_t *)((uintptr_t)map + 0x1000);
+			dsp->period = req->period;
+			dsp->latency = req->frames;
+			dsp->map = map;
+			spin_unlock(_buffers_lock);
+			spin_unlock(dsp->lock);
+
+			req->map = shm_map_chunk(dsp->map_chunk, (process_t *)current_process);
+			return 0;
+		}
+		default:
+			return -EINVAL;
 	}
-	return -1;
 }
 
 static void snd_dsp_open(fs_node_t * node, unsigned int flags) {
@@ -138,10 +325,23 @@ static void snd_dsp_open(fs_node_t * node, unsigned int flags) {
 	/* Allocate a buffer for the node and keep a reference for ourselves */
 
 	struct dsp_node * dsp = malloc(sizeof(struct dsp_node));
+	spin_init(dsp->lock);
+	dsp->writers = 0;
 	dsp->rb = ring_buffer_create(SND_BUF_SIZE);
+	dsp->rb->lockless = 1; /* Only ever written by the client and read by the mixer */
 	dsp->samples = 0;
 	dsp->written = 0;
 	dsp->realtime = 0;
+	dsp->rate = 0;
+	dsp->gain = SND_GAIN_UNITY;
+	dsp->latency = SND_BUF_SIZE / SND_FRAME_SIZE;
+	dsp->phase = 0;
+	memset(dsp->history, 0, sizeof(dsp->history));
+	dsp->running = 0;
+	dsp->underruns = 0;
+	dsp->period = SND_MIX_CHUNK;
+	dsp->alert_waiters = NULL;
+	dsp->map = NULL;
 	node->device = dsp;
 	spin_lock(_buffers_lock);
 	list_insert(&_buffers, node->device);
@@ -154,11 +354,84 @@ static void snd_dsp_close(fs_node_t * node) {
 	list_delete(&_buffers, list_find(&_buffers, dsp));
 	spin_unlock(_buffers_lock);
 
+	if (dsp->map) {
+		/* Make sure the ring isn't reachable from userspace before freeing it */
+		process_t * proc = process_from_pid(dsp->map_pid);
+		if (proc) {
+			shm_unmap_chunk(dsp->map_chunk, proc);
+		}
+		shm_release_chunk(dsp->map_chunk);
+		free(dsp->map);
+	}
+
+	if (dsp->alert_waiters) {
+		list_free(dsp->alert_waiters);
+		free(dsp->alert_waiters);
+	}
+
 	ring_buffer_destroy(dsp->rb);
 	free(dsp->rb);
 	free(dsp);
 }
 
+/* Frames waiting to be mixed */
+static size_t snd_stream_unread(struct dsp_node * dsp) {
+	if (dsp->map) {
+		/* Don't trust the client to keep its pointer in range */
+		return MIN(dsp->map->write_ptr - dsp->map_read, dsp->map_frames);
+	}
+	return ring_buffer_unread(dsp->rb) / SND_FRAME_SIZE;
+}
+
+/* Frames the client can queue without blocking */
+static size_t snd_stream_space(struct dsp_node * dsp) {
+	if (dsp->map) {
+		return dsp->map_frames - snd_stream_unread(dsp);
+	}
+	return ring_buffer_available(dsp->rb) / SND_FRAME_SIZE;
+}
+
+/* Consume frames; the caller has checked there are enough */
+static void snd_stream_take(struct dsp_node * dsp, size_t frames, int16_t * out) {
+	if (dsp->map) {
+		/* At most two segments, as the ring may wrap */
+		uint32_t start = dsp->map_read & (dsp->map_frames - 1);
+		size_t first = MIN(frames, dsp->map_frames - start);
+		memcpy(out, &dsp->map_ring[start], first * SND_FRAME_SIZE);
+		memcpy(out + first * 2, dsp->map_ring, (frames - first) * SND_FRAME_SIZE);
+		dsp->map_read += frames;
+		dsp->map->read_ptr = dsp->map_read;
+		return;
+	}
+	ring_buffer_read(dsp->rb, frames * SND_FRAME_SIZE, (uint8_t *)out);
+}
+
+static int snd_dsp_check(fs_node_t * node) {
+	struct dsp_node * dsp = node->device;
+	return snd_stream_space(dsp) >= dsp->period ? 0 : 1;
+}
+
+static int snd_dsp_wait(fs_node_t * node, fs_waiter_t * waiter) {
+	struct dsp_node * dsp = node->device;
+	fs_wait_add(&dsp->alert_waiters, waiter);
+	return 0;
+}
+
+static int snd_dsp_poll(fs_node_t * node) {
+	struct dsp_node * dsp = node->device;
+	return snd_stream_space(dsp) >= dsp->period ? POLLOUT : 0;
+}
+
+/*
+ * Called by the mixer after consuming from a stream. fswait treats a
+ * free period as "ready", so this alerts readers as well as writers.
+ */
+static void snd_stream_alert(struct dsp_node * dsp) {
+	if (!dsp->alert_waiters || !dsp->alert_waiters->length) return;
+	if (snd_stream_space(dsp) < dsp->period) return;
+	fs_wait_alert(dsp->alert_waiters, POLLIN | POLLOUT);
+}
+
 static snd_device_t * snd_device_by_id(uint32_t device_id) {
 	spin_lock(_devices_lock);
 	snd_device_t * out = NULL;
@@ -233,42 +506,203 @@ static void snd_mixer_close(fs_node_t * node) {
 	return;
 }
 
+/*
+ * Add `count` samples from `in` to `out` with saturation, scaling the input
+ * by a Q15 gain. Eight samples are handled at a time with SSE2; this only
+ * ever runs in the mixer tasklet, whose SSE state is saved like any other
+ * thread's, so it must never be called from an interrupt handler.
+ */
+__attribute__((target("sse2")))
+static void snd_mix_samples(int16_t * out, int16_t * in, size_t count, uint32_t gain) {
+	size_t blocks = count / 8;
+
+	if (blocks && gain == SND_GAIN_UNITY) {
+		asm volatile (
+			"1:\n"
+			"movdqu (%1), %%xmm1\n"
+			"movdqu (%0), %%xmm0\n"
+			"paddsw %%xmm1, %%xmm0\n"
+			"movdqu %%xmm0, (%0)\n"
+			"add $16, %0\n"
+			"add $16, %1\n"
+			"dec %2\n"
+			"jnz 1b\n"
+			: "+r"(out), "+r"(in), "+r"(blocks)
+			:
+			: "memory", "cc", "xmm0", "xmm1");
+	} else if (blocks) {
+		uint32_t g = gain | (gain << 16);
+		asm volatile (
+			"movd %3, %%xmm2\n"
+			"pshufd $0, %%xmm2, %%xmm2\n"
+			"1:\n"
+			"movdqu (%1), %%xmm1\n"
+			"pmulhw %%xmm2, %%xmm1\n"  /* (s * g) >> 16 ... */
+			"paddsw %%xmm1, %%xmm1\n"  /* ... << 1 makes it Q15 */
+			"movdqu (%0), %%xmm0\n"
+			"paddsw %%xmm1, %%xmm0\n"
+			"movdqu %%xmm0, (%0)\n"
+			"add $16, %0\n"
+			"add $16, %1\n"
+			"dec %2\n"
+			"jnz 1b\n"
+			: "+r"(out), "+r"(in), "+r"(blocks)
+			: "r"(g)
+			: "memory", "cc", "xmm0", "xmm1", "xmm2");
+	}
+
+	for (size_t i = 0; i < count % 8; ++i) {
+		int32_t s = (gain == SND_GAIN_UNITY) ? in[i] : ((int32_t)in[i] * (int32_t)gain) >> 15;
+		s += out[i];
+		if (s > INT16_MAX) s = INT16_MAX;
+		if (s < INT16_MIN) s = INT16_MIN;
+		out[i] = s;
+	}
+}
+
+/*
+ * Pull up to `frames` frames at the device rate out of a stream into `out`.
+ * Streams at other rates are linearly interpolated; the last two input frames
+ * are kept between calls so periods join up without clicks.
+ */
+static size_t snd_stream_read(struct dsp_node * dsp, uint32_t out_rate, size_t frames, int16_t * out) {
+	static int16_t in[(SND_MIX_CHUNK * 2 + 8) * 2];
+
+	if (!dsp->rate) {
+		size_t got = MIN(snd_stream_unread(dsp), frames);
+		if (got) {
+			snd_stream_take(dsp, got, out);
+		}
+		return got;
+	}
+
+	/* 16.16 input frames per output frame, without overflowing 32 bits */
+	uint32_t step = ((dsp->rate / out_rate) << 16) | (((dsp->rate % out_rate) << 16) / out_rate);
+
+	/* in[0] and in[1] are the history frames; new input starts at in[2] */
+	size_t needed = (dsp->phase + (frames - 1) * step) >> 16;
+	size_t got    = MIN(needed, snd_stream_unread(dsp));
+
+	memcpy(in, dsp->history, sizeof(dsp->history));
+	if (got) {
+		snd_stream_take(dsp, got, &in[4]);
+	}
+
+	size_t produced = 0;
+	uint32_t phase = dsp->phase;
+	while (produced < frames && (phase >> 16) <= got) {
+		size_t k = phase >> 16;
+		int32_t frac = (phase & 0xFFFF) >> 1;
+		for (int c = 0; c < 2; ++c) {
+			int32_t a = in[k * 2 + c];
+			int32_t b = in[(k + 1) * 2 + c];
+			out[produced * 2 + c] = a + (((b - a) * frac) >> 15);
+		}
+		produced++;
+		phase += step;
+	}
+
+	memcpy(dsp->history, &in[got * 2], sizeof(dsp->history));
+	dsp->phase = phase - (got << 16);
+
+	return produced;
+}
+
 int snd_request_buf(snd_device_t * device, uint32_t size, uint8_t *buffer) {
-	static int16_t tmp_buf[0x100];
+	static int16_t tmp_buf[SND_MIX_CHUNK * 2];
 
 	memset(buffer, 0, size);
 
 	spin_lock(_buffers_lock);
 	foreach(buf_node, &_buffers) {
 		struct dsp_node * dsp = buf_node->value;
-		ring_buffer_t * buf = dsp->rb;
-		/* ~0x3 is to ensure we don't read partial samples or just a single channel */
-		size_t bytes_left = MIN(ring_buffer_unread(buf) & ~0x3, size);
+		size_t frames_left = size / SND_FRAME_SIZE;
 		int16_t * adding_ptr = (int16_t *) buffer;
-		while (bytes_left) {
-			size_t this_read_size = MIN(bytes_left, sizeof(tmp_buf));
-			ring_buffer_read(buf, this_read_size, (uint8_t *)tmp_buf);
-			dsp->samples += this_read_size / 4; /* 16 bits, 2 channels */
-			/*
-			 * Reduce the sample by a half so that multiple sources won't immediately
-			 * cause awful clipping. This is kind of a hack since it would probably be
-			 * better to just use some kind of compressor.
-			 */
-			for (size_t i = 0; i < N_ELEMENTS(tmp_buf); i++) {
-				tmp_buf[i] /= 2;
+		int short_read = 0;
+		while (frames_left) {
+			size_t this_read = MIN(frames_left, SND_MIX_CHUNK);
+			size_t got = snd_stream_read(dsp, device->playback_speed, this_read, tmp_buf);
+			if (!got) {
+				short_read = 1;
+				break;
+			}
+			dsp->samples += got;
+			snd_mix_samples(adding_ptr, tmp_buf, got * 2, dsp->gain);
+			adding_ptr += got * 2;
+			frames_left -= got;
+			if (got < this_read) {
+				short_read = 1;
+				break;
 			}
-			for (size_t i = 0; i < this_read_size / sizeof(*adding_ptr); i++) {
-				adding_ptr[i] += tmp_buf[i];
+		}
+		/* Only count underruns for streams that were actually playing */
+		if (short_read && dsp->running) {
+			dsp->underruns++;
+			if (dsp->map) {
+				dsp->map->underruns = dsp->underruns;
 			}
-			adding_ptr += this_read_size / sizeof(*adding_ptr);
-			bytes_left -= this_read_size;
 		}
+		dsp->running = !short_read;
+		snd_stream_alert(dsp);
 	}
 	spin_unlock(_buffers_lock);
 
 	return size;
 }
 
+int snd_schedule_buf(snd_device_t * device, uint32_t size, uint8_t *buffer) {
+	uint32_t flags;
+	spin_lock_irqsave(_pending_lock, &flags);
+	unsigned int next = (_pending_head + 1) % SND_PENDING;
+	if (next == _pending_tail) {
+		spin_unlock_irqrestore(_pending_lock, flags);
+		/* Mixer is hopelessly behind; the device will replay stale audio */
+		_mix_stats.late++;
+		return -1;
+	}
+	_pending[_pending_head].device = device;
+	_pending[_pending_head].buffer = buffer;
+	_pending[_pending_head].size   = size;
+	_pending_head = next;
+	spin_unlock_irqrestore(_pending_lock, flags);
+	wakeup_queue(_mixer_wait);
+	return 0;
+}
+
+static void snd_mixer_tasklet(void * data, char * name) {
+	while (1) {
+		/*
+		 * Check for work and get on the wait queue without letting the
+		 * interrupt handler in between, or its wakeup would be lost.
+		 */
+		uint32_t flags;
+		spin_lock_irqsave(_pending_lock, &flags);
+		while (_pending_head == _pending_tail) {
+			sleep_on_unlocking(_mixer_wait, _pending_lock, flags);
+			spin_lock_irqsave(_pending_lock, &flags);
+		}
+		spin_unlock_irqrestore(_pending_lock, flags);
+
+		if ((_pending_head + SND_PENDING - _pending_tail) % SND_PENDING > 1) {
+			/* More than one period was waiting for us */
+			_mix_stats.late++;
+		}
+
+		struct snd_pending * p = &_pending[_pending_tail];
+		uint64_t before, after;
+		asm volatile ("rdtsc" : "=A" (before));
+		snd_request_buf(p->device, p->size, p->buffer);
+		asm volatile ("rdtsc" : "=A" (after));
+		_pending_tail = (_pending_tail + 1) % SND_PENDING;
+
+		_mix_stats.periods++;
+		_mix_stats.mix_time = (uint32_t)(after - before);
+		if (_mix_stats.mix_time > _mix_stats.mix_time_max) {
+			_mix_stats.mix_time_max = _mix_stats.mix_time;
+		}
+	}
+}
+
 static snd_device_t * snd_main_device() {
 	spin_lock(_devices_lock);
 	foreach(node, &_devices) {
@@ -302,6 +736,10 @@ DEFINE_SHELL_FUNCTION(snd_off, "[debug] turn snd master to lowest volume") {
 #endif
 
 static int init(void) {
+	_mixer_wait = list_create();
+	spin_init(_pending_lock);
+	create_kernel_tasklet(snd_mixer_tasklet, "[snd]", NULL);
+
 	vfs_mount("/dev/dsp", &_dsp_fnode);
 	vfs_mount("/dev/mixer", &_mixer_fnode);
 
@@ -2,6 +2,13 @@
  * This file is part of ToaruOS and is released under the terms
  * of the NCSA / University of Illinois License - see LICENSE.md
  * Copyright (C) 2014-2018 K. Lange
+ *
+ * In-memory temporary filesystem.
+ *
+ * Also provides "overlay" mounts, which start out as a writable
+ * view of a read-only lower directory: a directory's entries are
+ * created the first time it is looked at, and file contents are
+ * read from the lower filesystem until a file is first written.
  */
 #include <kernel/system.h>
 #include <kernel/logging.h>
@@ -12,6 +19,9 @@
 #include <kernel/module.h>
 #include <kernel/mod/tmpfs.h>
 
+#include <sys/ioctl.h>
+#include <sys/getdents.h>
+
 /* 4KB */
 #define BLOCKSIZE 0x1000
 
@@ -23,6 +33,7 @@ static char * buf_space = NULL;
 
 static spin_lock_t tmpfs_lock = { 0 };
 static spin_lock_t tmpfs_page_lock = { 0 };
+static spin_lock_t tmpfs_overlay_lock = { 0 };
 
 struct tmpfs_dir * tmpfs_root = NULL;
 
@@ -48,13 +59,19 @@ static struct tmpfs_file * tmpfs_file_new(char * name) {
 	for (size_t i = 0; i < t->pointers; ++i) {
 		t->blocks[i] = NULL;
 	}
+	t->target = NULL;
+	t->lower = NULL;
+	t->copied = 0;
 
 	spin_unlock(tmpfs_lock);
 	return t;
 }
 
+static void tmpfs_dir_populate(struct tmpfs_dir * d);
+
 static int symlink_tmpfs(fs_node_t * parent, char * target, char * name) {
 	struct tmpfs_dir * d = (struct tmpfs_dir *)parent->device;
+	tmpfs_dir_populate(d);
 	debug_print(NOTICE, "Creating TMPFS file (symlink) %s in %s", name, d->name);
 
 	spin_lock(tmpfs_lock);
@@ -117,12 +134,22 @@ static struct tmpfs_dir * tmpfs_dir_new(char * name, struct tmpfs_dir * parent)
 	d->mtime = d->atime;
 	d->ctime = d->atime;
 	d->files = list_create();
+	d->parent = parent;
+	d->lower = NULL;
 
 	spin_unlock(tmpfs_lock);
 	return d;
 }
 
 static void tmpfs_file_free(struct tmpfs_file * t) {
+	if (t->type == TMPFS_TYPE_DIR) {
+		struct tmpfs_dir * d = (struct tmpfs_dir *)t;
+		if (d->lower) close_fs(d->lower);
+		return;
+	}
+	if (t->lower) {
+		close_fs(t->lower);
+	}
 	if (t->type == TMPFS_TYPE_LINK) {
 		debug_print(ERROR, "uh, what");
 		free(t->target);
@@ -174,12 +201,109 @@ static char * tmpfs_file_getset_block(struct tmpfs_file * t, size_t blockid, int
 	return (char *)buf_space;
 }
 
+/*
+ * Overlay: create the entries of a directory from its lower
+ * directory. Subdirectories and file contents stay with the lower
+ * filesystem until they are needed.
+ */
+static void tmpfs_dir_populate(struct tmpfs_dir * d) {
+	if (!d->lower) return;
+
+	spin_lock(tmpfs_overlay_lock);
+	fs_node_t * lower = d->lower;
+	if (!lower) {
+		spin_unlock(tmpfs_overlay_lock);
+		return;
+	}
+
+	list_t * entries = list_create();
+	struct dirent * ent;
+	for (uint32_t index = 0; (ent = readdir_fs(lower, index)) != NULL; ++index) {
+		if (!strcmp(ent->name, ".") || !strcmp(ent->name, "..")) {
+			free(ent);
+			continue;
+		}
+		fs_node_t * node = finddir_fs(lower, ent->name);
+		free(ent);
+		if (!node) continue;
+
+		struct tmpfs_file * t;
+		if (node->flags & FS_SYMLINK) {
+			char target[1024];
+			int len = readlink_fs(node, target, sizeof(target) - 1);
+			target[len < 0 ? 0 : len] = '\0';
+			t = tmpfs_file_new(node->name);
+			t->type = TMPFS_TYPE_LINK;
+			t->target = strdup(target);
+			free(node);
+		} else if (node->flags & FS_DIRECTORY) {
+			struct tmpfs_dir * dir = tmpfs_dir_new(node->name, d);
+			dir->lower = node;
+			open_fs(node, O_RDONLY);
+			t = (struct tmpfs_file *)dir;
+		} else {
+			t = tmpfs_file_new(node->name);
+			t->length = node->length;
+			t->lower = node;
+			open_fs(node, O_RDONLY);
+		}
+		t->mask  = node->mask;
+		t->uid   = node->uid;
+		t->gid   = node->gid;
+		t->atime = node->atime;
+		t->mtime = node->mtime;
+		t->ctime = node->ctime;
+		list_insert(entries, t);
+	}
+
+	spin_lock(tmpfs_lock);
+	foreach(node, entries) {
+		list_insert(d->files, node->value);
+	}
+	d->lower = NULL;
+	spin_unlock(tmpfs_lock);
+
+	list_free(entries);
+	free(entries);
+	close_fs(lower);
+	spin_unlock(tmpfs_overlay_lock);
+}
+
+/*
+ * Overlay: bring a file's contents into memory, before it is
+ * modified or when asked to with IOCTL_PRELOAD. The lower node is
+ * kept until the file is unlinked, as readers may still be in it.
+ */
+static void tmpfs_file_copy_up(struct tmpfs_file * t) {
+	if (!t->lower || t->copied) return;
+
+	spin_lock(tmpfs_overlay_lock);
+	if (!t->copied) {
+		uint8_t * tmp = malloc(BLOCKSIZE);
+		for (uint32_t offset = 0; offset < t->length; offset += BLOCKSIZE) {
+			uint32_t size = t->length - offset < BLOCKSIZE ? t->length - offset : BLOCKSIZE;
+			read_fs(t->lower, offset, size, tmp);
+			char * buf = tmpfs_file_getset_block(t, offset / BLOCKSIZE, 1);
+			memcpy(buf, tmp, size);
+			spin_unlock(tmpfs_page_lock);
+		}
+		free(tmp);
+		t->copied = 1;
+	}
+	spin_unlock(tmpfs_overlay_lock);
+}
 
 static uint32_t read_tmpfs(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer) {
 	struct tmpfs_file * t = (struct tmpfs_file *)(node->device);
 
 	t->atime = now();
 
+	if (t->lower && !t->copied) {
+		if (offset >= t->length) return 0;
+		if (size > t->length - offset) size = t->length - offset;
+		return read_fs(t->lower, offset, size, buffer);
+	}
+
 	uint32_t end;
 	if (offset + size > t->length) {
 		end = t->length;
@@ -223,6 +347,8 @@ static uint32_t read_tmpfs(fs_node_t *node, uint32_t offset, uint32_t size, uint
 static uint32_t write_tmpfs(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer) {
 	struct tmpfs_file * t = (struct tmpfs_file *)(node->device);
 
+	tmpfs_file_copy_up(t);
+
 	t->atime = now();
 	t->mtime = t->atime;
 
@@ -290,6 +416,9 @@ static void open_tmpfs(fs_node_t * node, unsigned int flags) {
 
 	if (flags & O_TRUNC) {
 		debug_print(INFO, "Truncating file %s", t->name);
+		if (t->lower) {
+			t->copied = 1;
+		}
 		for (size_t i = 0; i < t->block_count; ++i) {
 			clear_frame((uintptr_t)t->blocks[i] * 0x1000);
 			t->blocks[i] = 0;
@@ -301,6 +430,18 @@ static void open_tmpfs(fs_node_t * node, unsigned int flags) {
 	return;
 }
 
+static int ioctl_tmpfs(fs_node_t * node, int request, void * argp) {
+	struct tmpfs_file * t = (struct tmpfs_file *)(node->device);
+
+	switch (request) {
+		case IOCTL_PRELOAD:
+			tmpfs_file_copy_up(t);
+			return 0;
+		default:
+			return -EINVAL;
+	}
+}
+
 static fs_node_t * tmpfs_from_file(struct tmpfs_file * t) {
 	fs_node_t * fnode = malloc(sizeof(fs_node_t));
 	memset(fnode, 0x00, sizeof(fs_node_t));
@@ -322,6 +463,7 @@ static fs_node_t * tmpfs_from_file(struct tmpfs_file * t) {
 	fnode->finddir = NULL;
 	fnode->chmod   = chmod_tmpfs;
 	fnode->chown   = chown_tmpfs;
+	fnode->ioctl   = ioctl_tmpfs;
 	fnode->length  = t->length;
 	fnode->nlink   = 1;
 	return fnode;
@@ -344,6 +486,8 @@ static struct dirent * readdir_tmpfs(fs_node_t *node, uint32_t index) {
 	struct tmpfs_dir * d = (struct tmpfs_dir *)node->device;
 	uint32_t i = 0;
 
+	tmpfs_dir_populate(d);
+
 	debug_print(NOTICE, "tmpfs - readdir id=%d", index);
 
 	if (index == 0) {
@@ -381,10 +525,43 @@ static struct dirent * readdir_tmpfs(fs_node_t *node, uint32_t index) {
 	return NULL;
 }
 
+static int getdents_tmpfs(fs_node_t * node, uint32_t * position, getdents_fill_t fill, void * context) {
+	struct tmpfs_dir * d = (struct tmpfs_dir *)node->device;
+	uint32_t i = 2;
+
+	tmpfs_dir_populate(d);
+
+	/* Same positions as readdir_tmpfs: ".", "..", then the file list */
+	if (*position == 0) {
+		if (fill(context, 0, DT_DIR, ".")) return 1;
+		(*position)++;
+	}
+
+	if (*position == 1) {
+		if (fill(context, 0, DT_DIR, "..")) return 1;
+		(*position)++;
+	}
+
+	foreach(f, d->files) {
+		if (i++ < *position) continue;
+		struct tmpfs_file * t = (struct tmpfs_file *)f->value;
+		uint8_t type = DT_UNKNOWN;
+		switch (t->type) {
+			case TMPFS_TYPE_FILE: type = DT_REG; break;
+			case TMPFS_TYPE_DIR:  type = DT_DIR; break;
+			case TMPFS_TYPE_LINK: type = DT_LNK; break;
+		}
+		if (fill(context, (uint32_t)t, type, t->name)) return 1;
+		(*position)++;
+	}
+	return 0;
+}
+
 static fs_node_t * finddir_tmpfs(fs_node_t * node, char * name) {
 	if (!name) return NULL;
 
 	struct tmpfs_dir * d = (struct tmpfs_dir *)node->device;
+	tmpfs_dir_populate(d);
 
 	spin_lock(tmpfs_lock);
 
@@ -412,6 +589,7 @@ static fs_node_t * finddir_tmpfs(fs_node_t * node, char * name) {
 static int unlink_tmpfs(fs_node_t * node, char * name) {
 	struct tmpfs_dir * d = (struct tmpfs_dir *)node->device;
 	int i = -1, j = 0;
+	tmpfs_dir_populate(d);
 	spin_lock(tmpfs_lock);
 
 	foreach(f, d->files) {
@@ -441,6 +619,7 @@ static int create_tmpfs(fs_node_t *parent, char *name, uint16_t permission) {
 
 	struct tmpfs_dir * d = (struct tmpfs_dir *)parent->device;
 	debug_print(NOTICE, "Creating TMPFS file %s in %s", name, d->name);
+	tmpfs_dir_populate(d);
 
 	spin_lock(tmpfs_lock);
 	foreach(f, d->files) {
@@ -471,6 +650,7 @@ static int mkdir_tmpfs(fs_node_t * parent, char * name, uint16_t permission) {
 
 	struct tmpfs_dir * d = (struct tmpfs_dir *)parent->device;
 	debug_print(NOTICE, "Creating TMPFS directory %s (in %s)", name, d->name);
+	tmpfs_dir_populate(d);
 
 	spin_lock(tmpfs_lock);
 	foreach(f, d->files) {
@@ -514,6 +694,7 @@ static fs_node_t * tmpfs_from_dir(struct tmpfs_dir * d) {
 	fnode->open    = NULL;
 	fnode->close   = NULL;
 	fnode->readdir = readdir_tmpfs;
+	fnode->getdents = getdents_tmpfs;
 	fnode->finddir = finddir_tmpfs;
 	fnode->create  = create_tmpfs;
 	fnode->unlink  = unlink_tmpfs;
@@ -541,6 +722,33 @@ fs_node_t * tmpfs_mount(char * device, char * mount_path) {
 	return fs;
 }
 
+/*
+ * mount overlay /lower /path: a writable tmpfs that starts with
+ * the contents of /lower. Mounting over the directory being used
+ * as the lower layer (e.g. "/" on "/") is fine, as the lower root
+ * is opened before the new mount replaces it.
+ */
+fs_node_t * tmpfs_overlay_mount(char * device, char * mount_path) {
+	fs_node_t * lower = kopen(device, 0);
+	if (!lower) {
+		debug_print(ERROR, "overlay: failed to open %s", device);
+		return NULL;
+	}
+	if (!(lower->flags & FS_DIRECTORY)) {
+		debug_print(ERROR, "overlay: %s is not a directory", device);
+		close_fs(lower);
+		return NULL;
+	}
+
+	fs_node_t * fs = tmpfs_create(device);
+	struct tmpfs_dir * root = (struct tmpfs_dir *)fs->device;
+	root->lower = lower;
+	root->mask  = fs->mask = lower->mask;
+	root->uid   = fs->uid  = lower->uid;
+	root->gid   = fs->gid  = lower->gid;
+	return fs;
+}
+
 static int tmpfs_initialize(void) {
 
 	buf_space = (void*)kvmalloc(BLOCKSIZE);
@@ -549,6 +757,7 @@ static int tmpfs_initialize(void) {
 	vfs_mount("/var", tmpfs_create("var"));
 
 	vfs_register("tmpfs", tmpfs_mount);
+	vfs_register("overlay", tmpfs_overlay_mount);
 
 	return 0;
 }
@@ -1,9 +0,0 @@
-#!/bin/bash
-
-DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
-
-SPACE_REQ=$(du -sb "$DIR/../base" | cut -f 1)
-
-let "SIZE = ($SPACE_REQ / 3500)"
-echo $SIZE
-
@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""
+Pack icons into an atlas (see base/usr/include/toaru/icon_cache.h for
+the layout).
+
+usage: mkiconatlas.py icon_dir output
+
+Takes the bitmaps directly in icon_dir and in each of its
+subdirectories (not symlinks), named by their path under icon_dir, and
+converts them the same way load_sprite() does. Bitmaps it can't
+convert are left out, and are loaded from the file at run time.
+"""
+import os
+import struct
+import sys
+
+ATLAS_MAGIC   = 0x534E4349
+ATLAS_VERSION = 1
+
+HEADER_FORMAT = '<4I'
+ENTRY_FORMAT  = '<56s2HI'
+NAME_MAX      = 55
+PIXEL_ALIGN   = 16
+
+def premultiply(a, r, g, b):
+    return (a << 24) | ((r * a // 255) << 16) | ((g * a // 255) << 8) | (b * a // 255)
+
+def load_bmp(path):
+    """Pixels as load_sprite() would produce them, or None."""
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) < 30 or data[:2] != b'BM':
+        return None
+    offset, = struct.unpack_from('<I', data, 10)
+    width, height = struct.unpack_from('<ii', data, 18)
+    bpp, = struct.unpack_from('<H', data, 28)
+    if width <= 0 or height <= 0 or bpp not in (24, 32):
+        return None
+    row_width = (bpp * width + 31) // 32 * 4
+    if offset + row_width * height > len(data):
+        return None
+
+    pixels = [0] * (width * height)
+    for y in range(height):
+        row = offset + y * row_width
+        out = (height - y - 1) * width
+        for x in range(width):
+            if bpp == 24:
+                b, g, r = data[row + 3 * x:row + 3 * x + 3]
+                pixels[out + x] = 0xFF000000 | (r << 16) | (g << 8) | b
+            else:
+                a, b, g, r = data[row + 4 * x:row + 4 * x + 4]
+                pixels[out + x] = premultiply(a, r, g, b) if a else 0
+    return width, height, pixels
+
+def find_icons(icon_dir):
+    for sub in [''] + sorted(os.listdir(icon_dir)):
+        path = os.path.join(icon_dir, sub)
+        if os.path.islink(path) or not os.path.isdir(path):
+            continue
+        for name in sorted(os.listdir(path)):
+            full = os.path.join(path, name)
+            if not name.endswith('.bmp') or os.path.islink(full) or not os.path.isfile(full):
+                continue
+            yield (sub + '/' if sub else '') + name[:-4], full
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__.strip(), file=sys.stderr)
+        return 1
+    icon_dir, output = sys.argv[1:]
+
+    icons = []
+    for name, path in find_icons(icon_dir):
+        encoded = name.encode('utf-8')
+        if len(encoded) > NAME_MAX:
+            print('%s: name too long, skipping' % path, file=sys.stderr)
+            continue
+        icon = load_bmp(path)
+        if not icon:
+            print('%s: unsupported bitmap, skipping' % path, file=sys.stderr)
+            continue
+        icons.append((encoded,) + icon)
+    icons.sort(key=lambda icon: icon[0])
+
+    index_end = struct.calcsize(HEADER_FORMAT) + struct.calcsize(ENTRY_FORMAT) * len(icons)
+    offset = (index_end + PIXEL_ALIGN - 1) // PIXEL_ALIGN * PIXEL_ALIGN
+    index = bytearray()
+    pixels = bytearray(offset - index_end)
+    for name, width, height, data in icons:
+        index += struct.pack(ENTRY_FORMAT, name, width, height, offset)
+        chunk = struct.pack('<%dI' % len(data), *data)
+        chunk += bytes(-len(chunk) % PIXEL_ALIGN)
+        pixels += chunk
+        offset += len(chunk)
+
+    with open(output, 'wb') as f:
+        f.write(struct.pack(HEADER_FORMAT, ATLAS_MAGIC, ATLAS_VERSION, len(icons), offset))
+        f.write(index)
+        f.write(pixels)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
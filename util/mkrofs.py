@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+"""
+Build a compressed read-only filesystem image (see
+base/usr/include/kernel/mod/rofs.h for the layout).
+
+usage: mkrofs.py [-b block_size] [-D devtable] source output
+
+Ownership is squashed to root, as with `genext2fs -U`; entries in
+the devtable (path type mode uid gid ...) override mode and owner.
+"""
+import argparse
+import collections
+import hashlib
+import os
+import stat
+import struct
+import zlib
+
+ROFS_MAGIC = 0x53464F52
+ROFS_VERSION = 1
+ROFS_BLOCK_STORED = 0x80000000
+
+SUPER_FORMAT  = '<12I'
+INODE_FORMAT  = '<4H3I'
+DIRENT_FORMAT = '<2I'
+BLOCK_FORMAT  = '<2I'
+
+def read_devtable(path):
+    overrides = {}
+    if not path:
+        return overrides
+    with open(path) as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) < 5 or fields[0].startswith('#'):
+                continue
+            overrides[fields[0]] = (int(fields[2], 8), int(fields[3]), int(fields[4]))
+    return overrides
+
+class Image(object):
+
+    def __init__(self, block_size):
+        self.block_size = block_size
+        self.data = bytearray(struct.calcsize(SUPER_FORMAT))
+        self.inodes = []
+        self.dirents = []
+        self.names = bytearray()
+        self.name_offsets = {}
+        self.blocks = []
+        self.seen_blocks = {}
+        self.bytes_in = 0
+
+    def name(self, name):
+        if name not in self.name_offsets:
+            self.name_offsets[name] = len(self.names)
+            self.names += name + b'\0'
+        return self.name_offsets[name]
+
+    def add_block(self, chunk):
+        digest = hashlib.sha1(chunk).digest()
+        if digest in self.seen_blocks:
+            self.blocks.append(self.seen_blocks[digest])
+            return
+        compressor = zlib.compressobj(9, zlib.DEFLATED, -15)
+        packed = compressor.compress(chunk) + compressor.flush()
+        if len(packed) >= len(chunk):
+            entry = (len(self.data), len(chunk) | ROFS_BLOCK_STORED)
+            self.data += chunk
+        else:
+            entry = (len(self.data), len(packed))
+            self.data += packed
+        self.seen_blocks[digest] = entry
+        self.blocks.append(entry)
+
+    def add_file(self, path):
+        first = len(self.blocks)
+        with open(path, 'rb') as f:
+            contents = f.read()
+        self.bytes_in += len(contents)
+        for offset in range(0, len(contents), self.block_size):
+            self.add_block(contents[offset:offset + self.block_size])
+        return first, len(contents)
+
+    def build(self, source, overrides):
+        # Inodes are numbered breadth-first so that every directory's
+        # entries can be written as one contiguous, sorted run.
+        self.inodes.append(None)
+        queue = collections.deque([(0, '', source)])
+        while queue:
+            number, relative, path = queue.popleft()
+            self.inodes[number] = self.make_inode(relative, path, overrides, queue)
+
+    def make_inode(self, relative, path, overrides, queue):
+        st = os.lstat(path)
+        mode = st.st_mode
+        uid, gid = 0, 0
+        if (relative or '/') in overrides:
+            perms, uid, gid = overrides[relative or '/']
+            mode = stat.S_IFMT(mode) | perms
+        nlink = 1
+
+        if stat.S_ISDIR(mode):
+            names = sorted(os.fsencode(n) for n in os.listdir(path))
+            start = len(self.dirents)
+            for name in names:
+                if len(name) > 255:
+                    raise ValueError('name too long: ' + os.path.join(path, os.fsdecode(name)))
+                child = os.path.join(path, os.fsdecode(name))
+                self.dirents.append((len(self.inodes), self.name(name)))
+                queue.append((len(self.inodes), relative + '/' + os.fsdecode(name), child))
+                self.inodes.append(None)
+                if os.path.isdir(child) and not os.path.islink(child):
+                    nlink += 1
+            size = len(names)
+            nlink += 1
+        elif stat.S_ISLNK(mode):
+            start = self.name(os.fsencode(os.readlink(path)))
+            size = 0
+        elif stat.S_ISREG(mode):
+            start, size = self.add_file(path)
+        else:
+            raise ValueError('unsupported file type: ' + path)
+
+        return struct.pack(INODE_FORMAT, mode & 0xFFFF, uid, gid, nlink, size, int(st.st_mtime), start)
+
+    def write(self, output):
+        def table(entries):
+            while len(self.data) % 4:
+                self.data.append(0)
+            offset = len(self.data)
+            self.data += b''.join(entries)
+            return offset
+
+        inode_offset  = table(self.inodes)
+        dirent_offset = table(struct.pack(DIRENT_FORMAT, *d) for d in self.dirents)
+        names_offset  = table([bytes(self.names)])
+        block_offset  = table(struct.pack(BLOCK_FORMAT, *b) for b in self.blocks)
+
+        self.data[0:struct.calcsize(SUPER_FORMAT)] = struct.pack(SUPER_FORMAT,
+            ROFS_MAGIC, ROFS_VERSION, self.block_size, len(self.data),
+            len(self.inodes), inode_offset,
+            len(self.dirents), dirent_offset,
+            len(self.names), names_offset,
+            len(self.blocks), block_offset)
+
+        with open(output, 'wb') as f:
+            f.write(self.data)
+
+def main():
+    parser = argparse.ArgumentParser(description='Build a compressed read-only filesystem image.')
+    parser.add_argument('-b', dest='block_size', type=int, default=32768, help='block size (default 32768)')
+    parser.add_argument('-D', dest='devtable', help='devtable with mode and owner overrides')
+    parser.add_argument('source')
+    parser.add_argument('output')
+    args = parser.parse_args()
+
+    image = Image(args.block_size)
+    image.build(args.source, read_devtable(args.devtable))
+    image.write(args.output)
+
+    print('{}: {} inodes, {} bytes of file data in {} bytes ({:.1f}%)'.format(
+        args.output, len(image.inodes), image.bytes_in, len(image.data),
+        100.0 * len(image.data) / max(image.bytes_in, 1)))
+
+if __name__ == '__main__':
+    main()